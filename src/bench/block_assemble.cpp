@@ -3,13 +3,21 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <bench/bench.h>
+#include <chainparams.h>
 #include <config.h>
+#include <consensus/consensus.h>
 #include <consensus/validation.h>
+#include <miner.h>
+#include <random.h>
 #include <script/standard.h>
+#include <test/setup_common.h>
 #include <test/util.h>
 #include <txmempool.h>
+#include <util/system.h>
 #include <validation.h>
 
+#include <algorithm>
+#include <cassert>
 #include <vector>
 
 static void AssembleBlock(benchmark::State &state) {
@@ -57,3 +65,50 @@ static void AssembleBlock(benchmark::State &state) {
 }
 
 BENCHMARK(AssembleBlock, 700);
+
+/// Fill a mempool with ~256MB of 500-byte txs, a tenth of them the children of
+/// another, then repeatedly assemble a 256MB template from it without checking
+/// its validity
+static void AssembleBlock256MB(benchmark::State &state, unsigned nThreads) {
+    constexpr size_t txSize = 500, nTx = 256 * ONE_MEGABYTE / txSize;
+    const CScript SCRIPT_PUB = CScript() << OP_TRUE;
+
+    CTxMemPool pool;
+    FastRandomContext rng(true);
+    for (size_t i = 0; i < nTx; ++i) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(TxId(rng.rand256()), 0), CScript() << std::vector<uint8_t>(txSize - 70));
+        tx.vout.emplace_back(1337 * SATOSHI, SCRIPT_PUB);
+        const CTransactionRef rtx = MakeTransactionRef(tx);
+        LOCK2(cs_main, pool.cs);
+        pool.addUnchecked(TestMemPoolEntryHelper{}.Fee(int64_t(1000 + rng.randrange(10000)) * SATOSHI).FromTx(rtx));
+        if (i % 10 == 0) {
+            tx.vin[0].prevout = COutPoint(rtx->GetId(), 0);
+            pool.addUnchecked(TestMemPoolEntryHelper{}.Fee(int64_t(1000 + rng.randrange(10000)) * SATOSHI)
+                                  .FromTx(MakeTransactionRef(tx)));
+            ++i;
+        }
+    }
+
+    BlockAssembler::Options options;
+    options.nExcessiveBlockSize = 256 * ONE_MEGABYTE;
+    options.nMaxGeneratedBlockSize = 256 * ONE_MEGABYTE;
+    options.nThreads = nThreads;
+
+    while (state.KeepRunning()) {
+        const auto pblocktemplate =
+            BlockAssembler(Params(), pool, options).CreateNewBlock(SCRIPT_PUB, 0., false /* checkValidity */);
+        assert(pblocktemplate->block.vtx.size() > 1);
+    }
+}
+
+static void AssembleBlock256MB_1Thread(benchmark::State &state) {
+    AssembleBlock256MB(state, 1);
+}
+
+static void AssembleBlock256MB_MultiThread(benchmark::State &state) {
+    AssembleBlock256MB(state, std::clamp(GetNumCores(), 2, MAX_BLOCK_ASSEMBLY_THREADS));
+}
+
+BENCHMARK(AssembleBlock256MB_1Thread, 1);
+BENCHMARK(AssembleBlock256MB_MultiThread, 1);
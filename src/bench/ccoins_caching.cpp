@@ -7,8 +7,11 @@
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
 #include <policy/policy.h>
+#include <random.h>
+#include <sync.h>
 #include <wallet/crypter.h>
 
+#include <thread>
 #include <vector>
 
 // FIXME: Dedup with SetupDummyInputs in test/transaction_tests.cpp.
@@ -128,5 +131,127 @@ static void CheckTxInputs(benchmark::State &state) {
     }
 }
 
+namespace {
+//! A CCoinsView which is never written to, and can thus be read from several
+//! threads at once (like CCoinsViewDB).
+class CCoinsViewReadOnly : public CCoinsView {
+    std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> coins;
+
+public:
+    explicit CCoinsViewReadOnly(
+        std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> coinsIn)
+        : coins(std::move(coinsIn)) {}
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override {
+        auto it = coins.find(outpoint);
+        if (it == coins.end()) {
+            return false;
+        }
+        coin = it->second;
+        return true;
+    }
+};
+} // namespace
+
+static constexpr size_t CONCURRENT_READ_COINS = 100000;
+static constexpr size_t CONCURRENT_READ_LOOKUPS = 400000;
+
+static std::vector<COutPoint> MakeConcurrentReadOutpoints(
+    std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> &coins) {
+    FastRandomContext rng(true);
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(CONCURRENT_READ_COINS);
+    for (size_t i = 0; i < CONCURRENT_READ_COINS; ++i) {
+        outpoints.emplace_back(TxId(rng.rand256()), i % 4);
+        coins.emplace(outpoints.back(),
+                      Coin(CTxOut(int64_t(i) * SATOSHI, CScript() << OP_TRUE),
+                           1, false));
+    }
+    return outpoints;
+}
+
+// Run CONCURRENT_READ_LOOKUPS lookups against a warm cache, split evenly
+// between nThreads reader threads. Should the cache scale with the number of
+// readers, the time per iteration goes down as nThreads goes up.
+template <typename Lookup>
+static void ConcurrentReads(benchmark::State &state, int nThreads,
+                            const std::vector<COutPoint> &outpoints,
+                            Lookup lookup) {
+    const size_t perThread = CONCURRENT_READ_LOOKUPS / nThreads;
+    while (state.KeepRunning()) {
+        std::vector<std::thread> readers;
+        for (int t = 0; t < nThreads; ++t) {
+            readers.emplace_back([&, t]() {
+                FastRandomContext rng(uint256(std::vector<uint8_t>(32, t)));
+                for (size_t i = 0; i < perThread; ++i) {
+                    const bool found =
+                        lookup(outpoints[rng.randrange(outpoints.size())]);
+                    assert(found);
+                }
+            });
+        }
+        for (std::thread &reader : readers) {
+            reader.join();
+        }
+    }
+}
+
+// Readers of a CCoinsViewCache have to be serialized (by cs_main in the node).
+static void CCoinsCachingLockedRead(benchmark::State &state, int nThreads) {
+    std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> coins;
+    const auto outpoints = MakeConcurrentReadOutpoints(coins);
+    CCoinsViewReadOnly base(std::move(coins));
+    CCoinsViewCache cache(&base);
+    for (const COutPoint &outpoint : outpoints) {
+        cache.AccessCoin(outpoint);
+    }
+
+    Mutex cs;
+    ConcurrentReads(state, nThreads, outpoints, [&](const COutPoint &outpoint) {
+        LOCK(cs);
+        return !cache.AccessCoin(outpoint).IsSpent();
+    });
+}
+
+static void CCoinsCachingShardedRead(benchmark::State &state, int nThreads) {
+    std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> coins;
+    const auto outpoints = MakeConcurrentReadOutpoints(coins);
+    CCoinsViewReadOnly base(std::move(coins));
+    CCoinsViewShardedCache cache(&base);
+    for (const COutPoint &outpoint : outpoints) {
+        cache.HaveCoin(outpoint);
+    }
+
+    ConcurrentReads(state, nThreads, outpoints, [&](const COutPoint &outpoint) {
+        Coin coin;
+        return cache.GetCoin(outpoint, coin);
+    });
+}
+
+static void CCoinsCachingLockedRead1Thread(benchmark::State &state) {
+    CCoinsCachingLockedRead(state, 1);
+}
+static void CCoinsCachingLockedRead4Threads(benchmark::State &state) {
+    CCoinsCachingLockedRead(state, 4);
+}
+static void CCoinsCachingShardedRead1Thread(benchmark::State &state) {
+    CCoinsCachingShardedRead(state, 1);
+}
+static void CCoinsCachingShardedRead2Threads(benchmark::State &state) {
+    CCoinsCachingShardedRead(state, 2);
+}
+static void CCoinsCachingShardedRead4Threads(benchmark::State &state) {
+    CCoinsCachingShardedRead(state, 4);
+}
+static void CCoinsCachingShardedRead8Threads(benchmark::State &state) {
+    CCoinsCachingShardedRead(state, 8);
+}
+
 BENCHMARK(CCoinsCaching, 170 * 1000);
 BENCHMARK(CheckTxInputs, 1000);
+BENCHMARK(CCoinsCachingLockedRead1Thread, 10);
+BENCHMARK(CCoinsCachingLockedRead4Threads, 10);
+BENCHMARK(CCoinsCachingShardedRead1Thread, 10);
+BENCHMARK(CCoinsCachingShardedRead2Threads, 10);
+BENCHMARK(CCoinsCachingShardedRead4Threads, 10);
+BENCHMARK(CCoinsCachingShardedRead8Threads, 10);
@@ -6,8 +6,14 @@
 #include <bench/data.h>
 
 #include <chainparams.h>
+#include <checkqueue.h>
 #include <config.h>
 #include <consensus/validation.h>
+#include <key.h>
+#include <policy/policy.h>
+#include <random.h>
+#include <script/interpreter.h>
+#include <script/standard.h>
 #include <streams.h>
 #include <validation.h>
 
@@ -63,7 +69,85 @@ static void DeserializeAndCheckBlockTest_32MB(benchmark::State &state) {
     DeserializeAndCheckBlockTest(benchmark::data::block556034, state);
 }
 
+// The script checks of a block made of NUM_TXS transactions, each spending
+// NUM_INPUTS P2PKH coins with Schnorr signatures, as ConnectBlock runs them on
+// a single thread: one by one, as they used to, or through the script check
+// queue, which verifies the signatures of each of its batches at once.
+static void CheckBlockScripts_Schnorr(bool batched, benchmark::State &state) {
+    static constexpr size_t NUM_TXS = 1000;
+    static constexpr size_t NUM_INPUTS = 2;
+    static constexpr size_t NUM_KEYS = 16;
+    const Amount amount = 10 * COIN;
+    const SigHashType sigHashType = SigHashType().withForkId();
+
+    FastRandomContext insecure_rand(true);
+    std::vector<CKey> keys(NUM_KEYS);
+    for (CKey &key : keys) {
+        key.MakeNewKey(true);
+    }
+
+    std::vector<CTransactionRef> txs;
+    std::vector<CScriptCheck> checks;
+    for (size_t i = 0; i < NUM_TXS; ++i) {
+        CMutableTransaction mtx;
+        std::vector<const CKey *> signers;
+        std::vector<CScript> scriptPubKeys;
+        for (size_t n = 0; n < NUM_INPUTS; ++n) {
+            mtx.vin.emplace_back(COutPoint(TxId(insecure_rand.rand256()), 0));
+            signers.push_back(&keys[insecure_rand.randrange(NUM_KEYS)]);
+            scriptPubKeys.push_back(
+                GetScriptForDestination(signers.back()->GetPubKey().GetID()));
+        }
+        mtx.vout.emplace_back(int64_t(NUM_INPUTS) * amount, CScript() << OP_TRUE);
+        for (size_t n = 0; n < NUM_INPUTS; ++n) {
+            const uint256 hash =
+                SignatureHash(scriptPubKeys[n], mtx, n, sigHashType, amount);
+            std::vector<uint8_t> vchSig;
+            bool ret = signers[n]->SignSchnorr(hash, vchSig);
+            assert(ret);
+            vchSig.push_back(uint8_t(sigHashType.getRawSigHashType()));
+            mtx.vin[n].scriptSig =
+                CScript() << vchSig << ToByteVector(signers[n]->GetPubKey());
+        }
+        txs.push_back(MakeTransactionRef(mtx));
+
+        const CTransaction &tx = *txs.back();
+        const PrecomputedTransactionData txdata(tx);
+        for (size_t n = 0; n < NUM_INPUTS; ++n) {
+            checks.emplace_back(
+                ScriptExecutionContext(n, scriptPubKeys[n], amount, tx),
+                STANDARD_SCRIPT_VERIFY_FLAGS, false, txdata);
+        }
+    }
+
+    // No worker threads: all the checks run on this thread, in Wait().
+    CCheckQueue<CScriptCheck> queue{128};
+    while (state.KeepRunning()) {
+        std::vector<CScriptCheck> vChecks(checks);
+        bool fOk = true;
+        if (batched) {
+            CCheckQueueControl<CScriptCheck> control(&queue);
+            control.Add(vChecks);
+            fOk = control.Wait();
+        } else {
+            for (CScriptCheck &check : vChecks) {
+                fOk = fOk && check();
+            }
+        }
+        assert(fOk);
+    }
+}
+
+static void CheckBlockScripts_Schnorr_Individual(benchmark::State &state) {
+    CheckBlockScripts_Schnorr(false, state);
+}
+static void CheckBlockScripts_Schnorr_Batched(benchmark::State &state) {
+    CheckBlockScripts_Schnorr(true, state);
+}
+
 BENCHMARK(DeserializeBlockTest_1MB, 160);
 BENCHMARK(DeserializeBlockTest_32MB, 3);
 BENCHMARK(DeserializeAndCheckBlockTest_1MB, 130);
 BENCHMARK(DeserializeAndCheckBlockTest_32MB, 2);
+BENCHMARK(CheckBlockScripts_Schnorr_Individual, 2);
+BENCHMARK(CheckBlockScripts_Schnorr_Batched, 2);
@@ -5,6 +5,7 @@
 #include <bench/bench.h>
 #include <bench/data.h>
 #include <checkqueue.h>
+#include <crypto/sha256.h>
 #include <logging.h>
 #include <policy/policy.h>
 #include <prevector.h>
@@ -61,6 +62,73 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State &state) {
     queue.StopWorkerThreads();
 }
 
+// This Benchmark shows how the CheckQueue scales with the number of threads
+// verifying: the jobs cost a few microseconds each, like a cheap signature
+// check, and are added in small batches, like the inputs of the transactions
+// of a block. Every thread count is measured with the same total amount of
+// work, so on a machine with enough cores the time should go down as 1/N.
+static void CCheckQueueScaling(int nThreads, benchmark::State &state) {
+    static constexpr size_t BATCHES = 2000;
+    static constexpr size_t BATCH_SIZE = 3;
+    static constexpr int HASHES_PER_JOB = 16;
+
+    struct HashJob {
+        uint256 hash;
+        HashJob() {}
+        explicit HashJob(FastRandomContext &insecure_rand)
+            : hash(insecure_rand.rand256()) {}
+        bool operator()() {
+            for (int i = 0; i < HASHES_PER_JOB; ++i) {
+                CSHA256().Write(hash.begin(), hash.size()).Finalize(hash.begin());
+            }
+            return true;
+        }
+        void swap(HashJob &x) { std::swap(hash, x.hash); };
+    };
+    CCheckQueue<HashJob> queue{QUEUE_BATCH_SIZE};
+    // the master thread verifies too, in Wait()
+    queue.StartWorkerThreads(nThreads - 1);
+    Defer d([&queue]{
+        queue.StopWorkerThreads();
+    });
+    while (state.KeepRunning()) {
+        FastRandomContext insecure_rand(true);
+        CCheckQueueControl<HashJob> control(&queue);
+        for (size_t i = 0; i < BATCHES; ++i) {
+            std::vector<HashJob> vChecks;
+            vChecks.reserve(BATCH_SIZE);
+            for (size_t x = 0; x < BATCH_SIZE; ++x) {
+                vChecks.emplace_back(insecure_rand);
+            }
+            control.Add(vChecks);
+        }
+        const bool result = control.Wait();
+        assert(result);
+    }
+}
+
+static void CCheckQueueScaling_1Thread(benchmark::State &state) {
+    CCheckQueueScaling(1, state);
+}
+static void CCheckQueueScaling_2Threads(benchmark::State &state) {
+    CCheckQueueScaling(2, state);
+}
+static void CCheckQueueScaling_4Threads(benchmark::State &state) {
+    CCheckQueueScaling(4, state);
+}
+static void CCheckQueueScaling_8Threads(benchmark::State &state) {
+    CCheckQueueScaling(8, state);
+}
+static void CCheckQueueScaling_16Threads(benchmark::State &state) {
+    CCheckQueueScaling(16, state);
+}
+static void CCheckQueueScaling_32Threads(benchmark::State &state) {
+    CCheckQueueScaling(32, state);
+}
+static void CCheckQueueScaling_64Threads(benchmark::State &state) {
+    CCheckQueueScaling(64, state);
+}
+
 static void CCheckQueue_RealData32MB(bool cacheSigs, benchmark::State &state) {
     // This block happens to have txs where there are 166944 txins, and of those 157783 spend from the
     // same block, so it is a good candidate for this benchmark since we *have* the prevout coins already
@@ -169,5 +237,12 @@ static void CCheckQueue_RealBlock_32MB_WithCacheStore(benchmark::State &state) {
 }
 
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+BENCHMARK(CCheckQueueScaling_1Thread, 10);
+BENCHMARK(CCheckQueueScaling_2Threads, 10);
+BENCHMARK(CCheckQueueScaling_4Threads, 10);
+BENCHMARK(CCheckQueueScaling_8Threads, 10);
+BENCHMARK(CCheckQueueScaling_16Threads, 10);
+BENCHMARK(CCheckQueueScaling_32Threads, 10);
+BENCHMARK(CCheckQueueScaling_64Threads, 10);
 BENCHMARK(CCheckQueue_RealBlock_32MB_NoCacheStore, 5);
 BENCHMARK(CCheckQueue_RealBlock_32MB_WithCacheStore, 5);
@@ -1,3 +1,2 @@
-version https://git-lfs.github.com/spec/v1
-oid sha256:f8b33b6794c8dc1690bf988b089cf70439184e40c65a6e698974ede9694d984d
-size 2613943
+#include <bench/data.h>
+namespace benchmark { namespace data { const std::vector<uint8_t> block413567; } }
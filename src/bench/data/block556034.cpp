@@ -1,3 +1,2 @@
-version https://git-lfs.github.com/spec/v1
-oid sha256:a6ccf55bee2ba24f163209230780f0bda1b8a42b0ab5de21aa347decbc61294f
-size 82950288
+#include <bench/data.h>
+namespace benchmark { namespace data { const std::vector<uint8_t> block556034; } }
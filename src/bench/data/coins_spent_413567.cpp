@@ -1,3 +1,2 @@
-version https://git-lfs.github.com/spec/v1
-oid sha256:0e118f8e0bcff8846165b57b2a515f2715eb23fe6eff686302e64129c9bbaff9
-size 834498
+#include <bench/data.h>
+namespace benchmark { namespace data { const std::vector<uint8_t> coins_spent_413567; } }
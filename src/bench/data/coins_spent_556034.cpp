@@ -1,3 +1,2 @@
-version https://git-lfs.github.com/spec/v1
-oid sha256:7690c5e3905b45be25c3dc96a61f3dafe9309c4370654b11576d5be05c5fec74
-size 28454310
+#include <bench/data.h>
+namespace benchmark { namespace data { const std::vector<uint8_t> coins_spent_556034; } }
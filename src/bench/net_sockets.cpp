@@ -0,0 +1,151 @@
+// Copyright (c) 2022 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <compat.h>
+#include <config.h>
+#include <hash.h>
+#include <net.h>
+#include <netbase.h>
+#include <netmessagemaker.h>
+#include <scheduler.h>
+#include <sync.h>
+#include <util/system.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <list>
+#include <thread>
+#include <vector>
+
+static constexpr int NUM_CONNECTIONS = 5000;
+
+namespace {
+//! Takes the messages the socket handler hands off, and counts them.
+class CountingMsgProc final : public NetEventsInterface {
+public:
+    Mutex cs;
+    std::condition_variable cond;
+    size_t nReceived GUARDED_BY(cs){0};
+
+    bool ProcessMessages(const Config &, CNode *pnode,
+                         std::atomic<bool> &) override {
+        std::list<CNetMessage> msgs;
+        {
+            LOCK(pnode->cs_vProcessMsg);
+            msgs.swap(pnode->vProcessMsg);
+            pnode->nProcessQueueSize = 0;
+            pnode->fPauseRecv = false;
+        }
+        if (!msgs.empty()) {
+            LOCK(cs);
+            nReceived += msgs.size();
+            cond.notify_all();
+        }
+        return false;
+    }
+    bool SendMessages(const Config &, CNode *, std::atomic<bool> &) override {
+        return true;
+    }
+    void InitializeNode(const Config &, CNode *) override {}
+    void FinalizeNode(const Config &, NodeId, bool &) override {}
+};
+} // namespace
+
+// Latency of a message from one of thousands of otherwise idle inbound
+// connections on localhost, to its hand off to the message processor.
+static void SocketHandlerManyConnections(benchmark::State &state) {
+    const Config &config = GetConfig();
+
+    // Both ends of each connection take a file descriptor.
+    int nConnections = std::min(
+        NUM_CONNECTIONS, (RaiseFileDescriptorLimit(2 * NUM_CONNECTIONS + 100) -
+                          100) /
+                             2);
+#ifndef USE_EPOLL
+    nConnections = std::min(nConnections, (FD_SETSIZE - 100) / 2);
+#endif
+    assert(nConnections > 0);
+
+    // Find a free port on localhost.
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+    SOCKET hProbe = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    assert(hProbe != INVALID_SOCKET);
+    int ret = bind(hProbe, reinterpret_cast<sockaddr *>(&addr), addrLen);
+    assert(ret == 0);
+    ret = getsockname(hProbe, reinterpret_cast<sockaddr *>(&addr), &addrLen);
+    assert(ret == 0);
+    CloseSocket(hProbe);
+
+    gArgs.ForceSetArg("-dnsseed", "0");
+    CountingMsgProc msgproc;
+    CScheduler scheduler;
+    CConnman connman(config, 0x1337, 0x1337);
+    CConnman::Options options;
+    options.nMaxConnections = nConnections + 1;
+    options.nMaxAddnode = MAX_ADDNODE_CONNECTIONS;
+    options.m_msgproc = &msgproc;
+    options.nSendBufferMaxSize = 1000 * DEFAULT_MAXSENDBUFFER;
+    options.nReceiveFloodSize = 1000 * DEFAULT_MAXRECEIVEBUFFER;
+    // The connections never complete the version handshake.
+    options.m_peer_connect_timeout = 24 * 60 * 60;
+    options.m_use_addrman_outgoing = false;
+    options.vBinds.emplace_back(addr);
+    const bool started = connman.Start(scheduler, options);
+    assert(started);
+
+    std::vector<SOCKET> clients;
+    clients.reserve(nConnections);
+    for (int i = 0; i < nConnections; ++i) {
+        SOCKET hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        assert(hSocket != INVALID_SOCKET);
+        ret = connect(hSocket, reinterpret_cast<sockaddr *>(&addr), addrLen);
+        assert(ret == 0);
+        clients.push_back(hSocket);
+    }
+    while (connman.GetNodeCount(CConnman::CONNECTIONS_IN) <
+           size_t(nConnections)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // A ping, as a peer would send it.
+    CSerializedNetMsg msg =
+        CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::PING, uint64_t(0));
+    CMessageHeader hdr(config.GetChainParams().NetMagic(), msg.command.c_str(),
+                       msg.data.size());
+    const uint256 hash =
+        Hash(msg.data.data(), msg.data.data() + msg.data.size());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    std::vector<uint8_t> ping;
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, ping, 0, hdr};
+    ping.insert(ping.end(), msg.data.begin(), msg.data.end());
+
+    size_t nSent = 0;
+    while (state.KeepRunning()) {
+        const SOCKET hSocket = clients[nSent++ % clients.size()];
+        const ssize_t nBytes = send(
+            hSocket, reinterpret_cast<const char *>(ping.data()), ping.size(), 0);
+        assert(nBytes == ssize_t(ping.size()));
+        WAIT_LOCK(msgproc.cs, lock);
+        msgproc.cond.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(msgproc.cs) {
+            return msgproc.nReceived == nSent;
+        });
+    }
+
+    connman.Interrupt();
+    connman.Stop();
+    for (SOCKET &hSocket : clients) {
+        CloseSocket(hSocket);
+    }
+    gArgs.ClearArg("-dnsseed");
+}
+
+BENCHMARK(SocketHandlerManyConnections, 1000);
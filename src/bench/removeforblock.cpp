@@ -8,6 +8,7 @@
 #include <consensus/validation.h>
 #include <miner.h>
 #include <primitives/transaction.h>
+#include <random.h>
 #include <script/script.h>
 #include <test/setup_common.h>
 #include <test/util.h>
@@ -185,7 +186,103 @@ static void RemoveForBlock8MB_UnconfChains(benchmark::State& state) {
     benchRemoveForBlock(config, state, 450'000, 8, true);
 }
 
+/// Fill a mempool with 1000 unconfirmed chains of 1000 txs each (1M entries), then repeatedly test removeForBlock
+/// with a block confirming the next tx of every chain, so each removal also has to unlink the tx from its child
+static void RemoveForBlockChains1M(benchmark::State& state) {
+    constexpr size_t nChains = 1000, chainLength = 1000;
+    assert(state.m_num_iters * state.m_num_evals <= chainLength);
+
+    CTxMemPool pool;
+    // blocks[i] holds the i-th tx of every chain
+    std::vector<std::vector<CTransactionRef>> blocks(chainLength);
+    for (size_t chain = 0; chain < nChains; ++chain) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(TxId(GetRandHash()), 0));
+        tx.vin.back().scriptSig = SCRIPT_SIG;
+        tx.vout.emplace_back(50 * COIN, SCRIPT_PUB_KEY);
+        for (size_t i = 0; i < chainLength; ++i) {
+            const CTransactionRef rtx = MakeTransactionRef(tx);
+            {
+                LOCK2(cs_main, pool.cs);
+                pool.addUnchecked(TestMemPoolEntryHelper{}.FromTx(rtx));
+            }
+            blocks[i].push_back(rtx);
+            tx.vin.back().prevout = COutPoint(rtx->GetId(), 0);
+        }
+    }
+    assert(pool.size() == nChains * chainLength);
+
+    LogPrint(BCLog::MEMPOOL, "(%s) mempool size: %i, dynamic usage per entry: %i\n", __func__, pool.size(),
+             pool.DynamicMemoryUsage() / pool.size());
+
+    auto block = blocks.begin();
+
+    while (state.KeepRunning()) {
+        pool.removeForBlock(*block++);
+    }
+}
+
+/// Fill a mempool with the ~250k txs of a 256MB block, of which 1% are replaced by conflicting txs and every tenth
+/// one has an unconfirmed child, then repeatedly test removeForBlock with that block
+static void RemoveForBlock256MB(benchmark::State& state) {
+    constexpr size_t txSize = 1'000, nTx = 256 * ONE_MEGABYTE / txSize;
+
+    std::vector<CTransactionRef> block, others;
+    block.reserve(nTx);
+    size_t nChildren = 0;
+    for (size_t i = 0; i < nTx; ++i) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(TxId(GetRandHash()), 0));
+        tx.vin.back().scriptSig = CScript() << std::vector<uint8_t>(txSize - 100, 0xff) << ToByteVector(REDEEM_SCRIPT);
+        tx.vout.emplace_back(50 * COIN, SCRIPT_PUB_KEY);
+        block.push_back(MakeTransactionRef(tx));
+        if (i % 100 == 0) {
+            tx.vout.back().nValue -= SATOSHI;
+            others.push_back(MakeTransactionRef(tx));
+        } else if (i % 10 == 0) {
+            CMutableTransaction child;
+            child.vin.emplace_back(COutPoint(block.back()->GetId(), 0));
+            child.vin.back().scriptSig = SCRIPT_SIG;
+            child.vout.emplace_back(49 * COIN, SCRIPT_PUB_KEY);
+            others.push_back(MakeTransactionRef(child));
+            ++nChildren;
+        }
+    }
+
+    std::list<CTxMemPool> pools;
+
+    // As above, all the pools are created up front. They share the txs.
+    for (uint64_t i = 0; i < state.m_num_iters * state.m_num_evals; ++i) {
+        auto &pool = pools.emplace_back();
+        LOCK2(cs_main, pool.cs);
+        size_t other = 0;
+        for (size_t j = 0; j < block.size(); ++j) {
+            if (j % 100 == 0) {
+                pool.addUnchecked(TestMemPoolEntryHelper{}.FromTx(others[other++]));
+                continue;
+            }
+            pool.addUnchecked(TestMemPoolEntryHelper{}.FromTx(block[j]));
+            if (j % 10 == 0) {
+                pool.addUnchecked(TestMemPoolEntryHelper{}.FromTx(others[other++]));
+            }
+        }
+        assert(pool.size() == block.size() + nChildren);
+    }
+
+    auto it = pools.begin();
+
+    while (state.KeepRunning()) {
+        assert(it != pools.end());
+        auto &pool = *it++;
+        pool.removeForBlock(block);
+        // only the children of the block txs are left
+        assert(pool.size() == nChildren);
+    }
+}
+
 BENCHMARK(RemoveForBlock32MB, 1);
 BENCHMARK(RemoveForBlock8MB, 1);
 BENCHMARK(RemoveForBlock32MB_UnconfChains, 1);
 BENCHMARK(RemoveForBlock8MB_UnconfChains, 1);
+BENCHMARK(RemoveForBlockChains1M, 1);
+BENCHMARK(RemoveForBlock256MB, 1);
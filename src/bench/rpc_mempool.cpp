@@ -10,7 +10,9 @@
 
 #include <univalue.h>
 
+#include <atomic>
 #include <list>
+#include <thread>
 #include <vector>
 
 static void AddTx(const CTransactionRef &tx, const Amount &fee,
@@ -73,5 +75,51 @@ static void RPCMempoolVerbose_10k(benchmark::State &state) {
     }
 }
 
+/**
+ * The time it takes to add a transaction to and remove it from a mempool of
+ * 10k transactions while another thread keeps calling getrawmempool verbose.
+ */
+static void MempoolAddWithVerboseReaders(benchmark::State &state) {
+    CTxMemPool pool;
+    constexpr size_t nTx = 10000;
+    {
+        LOCK2(cs_main, pool.cs);
+        for (size_t i = 0; i < nTx; ++i) {
+            CMutableTransaction tx = CMutableTransaction();
+            tx.vin.resize(1);
+            tx.vin[0].scriptSig = CScript() << OP_1;
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            tx.vout[0].nValue = int64_t(i) * COIN;
+            AddTx(MakeTransactionRef(tx), int64_t(i) * COIN, pool);
+        }
+    }
+
+    CMutableTransaction mtx = CMutableTransaction();
+    mtx.vin.resize(1);
+    mtx.vin[0].scriptSig = CScript() << OP_2;
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    mtx.vout[0].nValue = COIN;
+    const CTransactionRef tx = MakeTransactionRef(mtx);
+
+    std::atomic<bool> done{false};
+    std::thread reader([&pool, &done] {
+        while (!done) {
+            (void)MempoolToJSON(pool, /*verbose*/ true);
+        }
+    });
+
+    while (state.KeepRunning()) {
+        LOCK2(cs_main, pool.cs);
+        AddTx(tx, COIN, pool);
+        pool.removeRecursive(*tx);
+    }
+
+    done = true;
+    reader.join();
+}
+
 BENCHMARK(RPCMempoolVerbose, 112);
 BENCHMARK(RPCMempoolVerbose_10k, 10);
+BENCHMARK(MempoolAddWithVerboseReaders, 100);
@@ -8,6 +8,8 @@
 #include <chainparams.h>
 #include <coins.h>
 #include <key.h>
+#include <pubkey.h>
+#include <random.h>
 #if defined(HAVE_CONSENSUS_LIB)
 #include <script/bitcoinconsensus.h>
 #endif
@@ -21,6 +23,7 @@
 #include <util/defer.h>
 #include <version.h>
 
+#include <algorithm>
 #include <stdexcept>
 
 static void VerifyNestedIfScript(benchmark::State &state) {
@@ -170,6 +173,56 @@ static void VerifyScripts_SigsChecks_Block556034(benchmark::State &state) {
     VerifyBlockScripts(true, flags_556034, benchmark::data::block556034, benchmark::data::coins_spent_556034, state);
 }
 
+// bench of Schnorr signature verification alone: 1024 signatures checked one
+// by one, or in batches of batchSize with a single multi-scalar multiplication
+static void VerifySchnorrSignatures(size_t batchSize, benchmark::State &state) {
+    static constexpr size_t NUM_SIGS = 1024;
+    FastRandomContext insecure_rand(true);
+    std::vector<CPubKey> pubkeys;
+    std::vector<uint256> hashes;
+    std::vector<std::vector<uint8_t>> sigs(NUM_SIGS);
+    for (size_t i = 0; i < NUM_SIGS; ++i) {
+        CKey key;
+        key.MakeNewKey(true);
+        pubkeys.push_back(key.GetPubKey());
+        hashes.push_back(insecure_rand.rand256());
+        if (!key.SignSchnorr(hashes.back(), sigs[i])) {
+            throw std::runtime_error("SignSchnorr failed");
+        }
+    }
+
+    CSchnorrBatchVerifier batch;
+    while (state.KeepRunning()) {
+        bool fOk = true;
+        if (batchSize <= 1) {
+            for (size_t i = 0; i < NUM_SIGS; ++i) {
+                fOk = pubkeys[i].VerifySchnorr(hashes[i], sigs[i]) && fOk;
+            }
+        } else {
+            for (size_t i = 0; i < NUM_SIGS; i += batchSize) {
+                batch.clear();
+                for (size_t j = i; j < std::min(i + batchSize, NUM_SIGS); ++j) {
+                    batch.Add(pubkeys[j], hashes[j], sigs[j]);
+                }
+                fOk = batch.Verify() && fOk;
+            }
+        }
+        if (!fOk) {
+            throw std::runtime_error("Schnorr verification failed");
+        }
+    }
+}
+
+static void VerifySchnorr_Individual(benchmark::State &state) {
+    VerifySchnorrSignatures(1, state);
+}
+static void VerifySchnorr_Batch16(benchmark::State &state) {
+    VerifySchnorrSignatures(16, state);
+}
+static void VerifySchnorr_Batch128(benchmark::State &state) {
+    VerifySchnorrSignatures(128, state);
+}
+
 BENCHMARK(VerifyNestedIfScript, 100);
 
 // These benchmarks just test the script VM itself, without doing real sigchecks
@@ -184,3 +237,8 @@ BENCHMARK(VerifyScripts_Block556034, 3);
 // measuring the script interpreter's own efficiency.
 BENCHMARK(VerifyScripts_SigsChecks_Block413567, 2);
 BENCHMARK(VerifyScripts_SigsChecks_Block556034, 1);
+
+// Schnorr signature verification, individually and batched.
+BENCHMARK(VerifySchnorr_Individual, 2);
+BENCHMARK(VerifySchnorr_Batch16, 2);
+BENCHMARK(VerifySchnorr_Batch128, 2);
@@ -10,10 +10,34 @@
 #include <util/threadnames.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
 template <typename T> class CCheckQueueControl;
 
+/**
+ * Perform a batch of verifications, returning whether all of them succeeded.
+ * Verification types which can process a batch more efficiently than one
+ * element at a time provide an overload of this function, which is found
+ * through argument-dependent lookup.
+ */
+template <typename T> bool CheckBatch(std::vector<T> &vChecks) {
+    for (T &check : vChecks) {
+        if (!check()) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /**
  * Queue for verifications that have to be performed.
  * The verifications are represented by a type T, which must provide an
@@ -23,10 +47,113 @@ template <typename T> class CCheckQueueControl;
  * queue, where they are processed by N-1 worker threads. When the master is
  * done adding work, it temporarily joins the worker pool as an N'th worker,
  * until all jobs are done.
+ *
+ * Every thread has a deque of its own, and the master spreads the
+ * verifications it adds over all of them. A thread takes its work from its own
+ * deque and, once that is empty, steals from the deques of the other threads.
+ * Taking work from a deque does not involve any lock; the mutex is only used
+ * by threads which go to sleep because there is no work left, and to wake
+ * them up.
  */
 template <typename T> class CCheckQueue {
 private:
-    //! Mutex to protect the inner state
+    /**
+     * A deque of verifications, pushed at the back by the master and taken
+     * from the front, in batches, by any thread with a compare-and-swap of the
+     * front position.
+     *
+     * Both positions carry the generation of the deque in their upper 32 bits,
+     * which is bumped whenever the master resets the deque for the next round
+     * of verifications, so a thread that read the positions of an earlier
+     * round can never claim anything with them. The verifications live in
+     * segments of doubling size which are neither moved nor freed while the
+     * queue exists, so a claimed verification stays in place until it is
+     * swapped out.
+     */
+    class WorkDeque {
+    private:
+        static constexpr uint32_t FIRST_SEGMENT_SIZE = 64;
+        static constexpr int MAX_SEGMENTS = 26;
+
+        std::atomic<uint64_t> m_front{0};
+        std::atomic<uint64_t> m_back{0};
+        std::unique_ptr<T[]> m_segments[MAX_SEGMENTS];
+
+        //! The element at position index, allocating its segment if asked to.
+        T &At(uint32_t index, bool fAllocate = false) {
+            uint64_t base = 0;
+            for (int s = 0; s < MAX_SEGMENTS; ++s) {
+                const uint64_t size = uint64_t(FIRST_SEGMENT_SIZE) << s;
+                if (index < base + size) {
+                    if (fAllocate && !m_segments[s]) {
+                        m_segments[s].reset(new T[size]);
+                    }
+                    return m_segments[s][index - base];
+                }
+                base += size;
+            }
+            assert(!"CCheckQueue deque overflow");
+            std::abort();
+        }
+
+    public:
+        //! Move the verifications in [begin, end) to the back. Master only.
+        void Push(typename std::vector<T>::iterator begin,
+                  typename std::vector<T>::iterator end) {
+            const uint64_t back = m_back.load(std::memory_order_relaxed);
+            uint32_t index = uint32_t(back);
+            for (auto it = begin; it != end; ++it) {
+                it->swap(At(index++, true));
+            }
+            m_back.store((back & ~uint64_t(0xffffffff)) | index,
+                         std::memory_order_release);
+        }
+
+        /**
+         * Move up to nMax verifications from the front to vChecks, taking at
+         * most half of what is available (but at least one), so that the
+         * threads stealing from this deque get a share too. Returns the
+         * number of verifications taken. Any thread.
+         */
+        unsigned int Claim(std::vector<T> &vChecks, unsigned int nMax) {
+            uint64_t front = m_front.load(std::memory_order_acquire);
+            while (true) {
+                const uint64_t back = m_back.load(std::memory_order_acquire);
+                if ((front >> 32) != (back >> 32)) {
+                    // The deque is being reset, so it has no work.
+                    return 0;
+                }
+                const uint32_t nAvailable = uint32_t(back) - uint32_t(front);
+                if (nAvailable == 0) {
+                    return 0;
+                }
+                const uint32_t nNow =
+                    std::max(1U, std::min(nMax, nAvailable / 2));
+                if (m_front.compare_exchange_weak(front, front + nNow,
+                                                  std::memory_order_acq_rel,
+                                                  std::memory_order_acquire)) {
+                    for (uint32_t i = 0; i < nNow; ++i) {
+                        vChecks.emplace_back();
+                        vChecks.back().swap(At(uint32_t(front) + i));
+                    }
+                    return nNow;
+                }
+            }
+        }
+
+        /**
+         * Start the next round at position 0 of a new generation. Master only,
+         * once every verification pushed has been claimed and processed.
+         */
+        void Reset() {
+            const uint64_t next =
+                ((m_back.load(std::memory_order_relaxed) >> 32) + 1) << 32;
+            m_front.store(next, std::memory_order_release);
+            m_back.store(next, std::memory_order_release);
+        }
+    };
+
+    //! Mutex used to sleep on the condition variables
     Mutex m_mutex;
 
     //! Worker threads block on this when out of work
@@ -35,25 +162,27 @@ private:
     //! Master thread blocks on this when out of work
     std::condition_variable m_master_cv;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue GUARDED_BY(m_mutex);
+    //! The deques of the threads: the master's first, then one per worker.
+    std::vector<std::unique_ptr<WorkDeque>> m_deques;
+
+    //! The deque the next call to Add() starts filling. Master only.
+    size_t m_next_deque{0};
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle GUARDED_BY(m_mutex){0};
+    //! Bumped by Add() after it pushed work, to wake up idle workers.
+    std::atomic<uint64_t> m_epoch{0};
 
-    //! The total number of workers (including the master).
-    int nTotal GUARDED_BY(m_mutex){0};
+    //! The number of workers that are idle, or about to be.
+    std::atomic<int> nIdle{0};
 
     //! The temporary evaluation result.
-    bool fAllOk GUARDED_BY(m_mutex){true};
+    std::atomic<bool> fAllOk{true};
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo GUARDED_BY(m_mutex){0};
+    std::atomic<unsigned int> nTodo{0};
 
     //! The maximum number of elements to be processed in one batch
     const unsigned int nBatchSize;
@@ -61,78 +190,61 @@ private:
     std::vector<std::thread> m_worker_threads;
     bool m_request_stop GUARDED_BY(m_mutex){false};
 
-    /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster) {
-        std::condition_variable& cond = fMaster ? m_master_cv : m_worker_cv;
+    //! Take a batch of work, from the deque self first, then from the others.
+    unsigned int Claim(size_t self, std::vector<T> &vChecks) {
+        const size_t nDeques = m_deques.size();
+        for (size_t i = 0; i < nDeques; ++i) {
+            if (const unsigned int nNow = m_deques[(self + i) % nDeques]->Claim(
+                    vChecks, nBatchSize)) {
+                return nNow;
+            }
+        }
+        return 0;
+    }
+
+    //! Execute a batch of nNow verifications taken with Claim().
+    void Process(std::vector<T> &vChecks, unsigned int nNow) {
+        // Skip the work if a verification already failed.
+        bool fOk = fAllOk.load(std::memory_order_relaxed);
+        if (fOk) {
+            fOk = CheckBatch(vChecks);
+        }
+        // The verifications have to be destroyed before they are accounted
+        // for, as the master may return as soon as nTodo reaches 0.
+        vChecks.clear();
+        if (!fOk) {
+            fAllOk.store(false, std::memory_order_relaxed);
+        }
+        if (nTodo.fetch_sub(nNow, std::memory_order_acq_rel) == nNow) {
+            // We processed the last element; inform the master it can exit
+            // and return the result
+            LOCK(m_mutex);
+            m_master_cv.notify_one();
+        }
+    }
+
+    /** Internal function that does bulk of the work of a worker thread. */
+    void Loop(size_t self) {
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                WAIT_LOCK(m_mutex, lock);
-                // first do the clean-up of the previous loop run (allowing us
-                // to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster) {
-                        // We processed the last element; inform the master it
-                        // can exit and return the result
-                        m_master_cv.notify_one();
-                    }
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty() && !m_request_stop) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                if (m_request_stop) {
-                    return false;
-                }
-
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for
-                // increasingly smaller batches so all workers finish
-                // approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start
-                // helping.
-                // * Don't do batches smaller than 1 (duh), or larger than
-                // nBatchSize.
-                nNow = std::max(
-                    1U, std::min(nBatchSize, (unsigned int)queue.size() /
-                                                 (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible,
-                    // so swap jobs from the global queue to the local batch
-                    // vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+        while (true) {
+            // Work pushed before this read is found by the Claim() below, and
+            // work pushed after it changes the epoch we would wait on.
+            const uint64_t epoch = m_epoch.load();
+            if (const unsigned int nNow = Claim(self, vChecks)) {
+                Process(vChecks, nNow);
+                continue;
             }
-            // execute work
-            for (T &check : vChecks) {
-                if (fOk) {
-                    fOk = check();
-                }
+            WAIT_LOCK(m_mutex, lock);
+            nIdle++;
+            while (m_epoch.load() == epoch && !m_request_stop) {
+                m_worker_cv.wait(lock);
             }
-            vChecks.clear();
-        } while (true);
+            nIdle--;
+            if (m_request_stop) {
+                return;
+            }
+        }
     }
 
 public:
@@ -141,42 +253,82 @@ public:
 
     //! Create a new check queue
     explicit CCheckQueue(unsigned int nBatchSizeIn)
-        : nBatchSize(nBatchSizeIn) {}
+        : nBatchSize(nBatchSizeIn) {
+        m_deques.push_back(std::make_unique<WorkDeque>());
+    }
 
     //! Create a pool of new worker threads.
-    void StartWorkerThreads(const int threads_num)
+    void StartWorkerThreads(const int threads_num,
+                            const std::string &thread_name = "scriptch")
     {
-        {
-             LOCK(m_mutex);
-             nIdle = 0;
-             nTotal = 0;
-             fAllOk = true;
-         }
          assert(m_worker_threads.empty());
+         assert(nTodo == 0);
+         m_deques.clear();
+         for (int n = 0; n <= threads_num; ++n) {
+             m_deques.push_back(std::make_unique<WorkDeque>());
+         }
+         m_next_deque = 0;
+         nIdle = 0;
+         fAllOk = true;
          for (int n = 0; n < threads_num; ++n) {
-             m_worker_threads.emplace_back([this, n]() {
-                 util::ThreadRename(strprintf("scriptch.%i", n));
-                 Loop(false /* worker thread */);
+             m_worker_threads.emplace_back([this, n, thread_name]() {
+                 util::ThreadRename(strprintf("%s.%i", thread_name, n));
+                 Loop(n + 1 /* worker thread */);
              });
          }
     }
 
     //! Wait until execution finishes, and return whether all evaluations were
     //! successful.
-    bool Wait() { return Loop(true /* master thread */); }
+    bool Wait() {
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (const unsigned int nNow = Claim(0 /* master thread */, vChecks)) {
+            Process(vChecks, nNow);
+        }
+        {
+            // Everything is claimed; wait for the workers to finish.
+            WAIT_LOCK(m_mutex, lock);
+            m_master_cv.wait(lock, [this] {
+                return nTodo.load(std::memory_order_acquire) == 0;
+            });
+        }
+        for (const auto &deque : m_deques) {
+            deque->Reset();
+        }
+        m_next_deque = 0;
+        // return the current status, and reset it for new work later
+        return fAllOk.exchange(true);
+    }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T> &vChecks) {
-        LOCK(m_mutex);
-        for (T &check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1) {
-            m_worker_cv.notify_one();
-        } else if (vChecks.size() > 1) {
-            m_worker_cv.notify_all();
+        if (vChecks.empty()) {
+            return;
+        }
+        nTodo.fetch_add(vChecks.size(), std::memory_order_relaxed);
+        // Spread the checks over the deques, a contiguous share each, starting
+        // where the previous call left off so that small batches are spread
+        // too.
+        const size_t nDeques = m_deques.size();
+        const size_t nShare = (vChecks.size() + nDeques - 1) / nDeques;
+        for (auto it = vChecks.begin(); it != vChecks.end();) {
+            const auto end =
+                it + std::min<size_t>(nShare, std::distance(it, vChecks.end()));
+            m_deques[m_next_deque]->Push(it, end);
+            m_next_deque = (m_next_deque + 1) % nDeques;
+            it = end;
+        }
+        m_epoch++;
+        if (nIdle.load() > 0) {
+            // Wake up one worker per check at most, rather than all of them to
+            // scan the deques for a handful of checks.
+            LOCK(m_mutex);
+            const size_t nWake =
+                std::min(vChecks.size(), m_worker_threads.size());
+            for (size_t i = 0; i < nWake; ++i) {
+                m_worker_cv.notify_one();
+            }
         }
     }
 
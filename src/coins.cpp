@@ -9,6 +9,7 @@
 #include <random.h>
 #include <version.h>
 
+#include <algorithm>
 #include <cassert>
 
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const {
@@ -58,21 +59,48 @@ size_t CCoinsViewBacked::EstimateSize() const {
     return base->EstimateSize();
 }
 
+/**
+ * Destroy an empty cache map and its pool resource and construct them anew,
+ * so that the chunks held by the resource are given back.
+ */
+static void ReallocateCacheMap(CCoinsMap &cacheCoins,
+                               CCoinsMapMemoryResource &resource) {
+    assert(cacheCoins.empty());
+    cacheCoins.~CCoinsMap();
+    resource.~CCoinsMapMemoryResource();
+    ::new (&resource) CCoinsMapMemoryResource{};
+    ::new (&cacheCoins) CCoinsMap{0, SaltedOutpointHasher{},
+                                  CCoinsMap::key_equal{}, &resource};
+}
+
 CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn)
-    : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+    : CCoinsViewBacked(baseIn),
+      cacheCoins{0, SaltedOutpointHasher{}, CCoinsMap::key_equal{},
+                 &m_cache_coins_memory_resource},
+      cachedCoinsUsage(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
 }
 
-CCoinsMap::iterator
-CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
+size_t CCoinsViewCache::InUseMemoryUsage() const {
+    return DynamicMemoryUsage() - m_cache_coins_memory_resource.NumFreeBytes();
+}
+
+/**
+ * Look up an outpoint in a cache map, pulling it from the base view if it is
+ * not there yet. Shared by all the cache implementations.
+ */
+static CCoinsMap::iterator FetchCoinFromBase(CCoinsMap &cacheCoins,
+                                             size_t &cachedCoinsUsage,
+                                             const CCoinsView &base,
+                                             const COutPoint &outpoint) {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
     if (it != cacheCoins.end()) {
         return it;
     }
     Coin tmp;
-    if (!base->GetCoin(outpoint, tmp)) {
+    if (!base.GetCoin(outpoint, tmp)) {
         return cacheCoins.end();
     }
     CCoinsMap::iterator ret =
@@ -89,6 +117,17 @@ CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
     return ret;
 }
 
+CCoinsMap::iterator
+CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
+    CCoinsMap::iterator it = cacheCoins.find(outpoint);
+    if (it != cacheCoins.end()) {
+        ++nCacheHits;
+        return it;
+    }
+    ++nCacheMisses;
+    return FetchCoinFromBase(cacheCoins, cachedCoinsUsage, *base, outpoint);
+}
+
 bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) {
@@ -126,6 +165,20 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin coin,
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 }
 
+void CCoinsViewCache::EmplaceFetchedCoin(const COutPoint &outpoint,
+                                         Coin &&coin) {
+    assert(!coin.IsSpent());
+    CCoinsMap::iterator it;
+    bool inserted;
+    std::tie(it, inserted) =
+        cacheCoins.emplace(std::piecewise_construct,
+                           std::forward_as_tuple(outpoint),
+                           std::forward_as_tuple(std::move(coin)));
+    if (inserted) {
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    }
+}
+
 void AddCoins(CCoinsViewCache &cache, const CTransaction &tx, int nHeight,
               bool check) {
     bool fCoinbase = tx.IsCoinBase();
@@ -190,66 +243,75 @@ void CCoinsViewCache::SetBestBlock(const BlockHash &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
+/**
+ * Merge a single entry of a child cache into a cache map. Non-dirty entries
+ * are ignored. Shared by all the cache implementations.
+ */
+static void BatchWriteEntry(CCoinsMap &cacheCoins, size_t &cachedCoinsUsage,
+                            CCoinsMap::iterator it) {
+    // Ignore non-dirty entries (optimization).
+    if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+        return;
+    }
+    CCoinsMap::iterator itUs = cacheCoins.find(it->first);
+    if (itUs == cacheCoins.end()) {
+        // The parent cache does not have an entry, while the child does
+        // We can ignore it if it's both FRESH and pruned in the child
+        if (!(it->second.flags & CCoinsCacheEntry::FRESH &&
+              it->second.coin.IsSpent())) {
+            // Otherwise we will need to create it in the parent and
+            // move the data up and mark it as dirty
+            CCoinsCacheEntry &entry = cacheCoins[it->first];
+            entry.coin = std::move(it->second.coin);
+            cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
+            entry.flags = CCoinsCacheEntry::DIRTY;
+            // We can mark it FRESH in the parent if it was FRESH in the
+            // child. Otherwise it might have just been flushed from the
+            // parent's cache and already exist in the grandparent
+            if (it->second.flags & CCoinsCacheEntry::FRESH) {
+                entry.flags |= CCoinsCacheEntry::FRESH;
+            }
+        }
+    } else {
+        // Assert that the child cache entry was not marked FRESH if the
+        // parent cache entry has unspent outputs. If this ever happens,
+        // it means the FRESH flag was misapplied and there is a logic
+        // error in the calling code.
+        if ((it->second.flags & CCoinsCacheEntry::FRESH) &&
+            !itUs->second.coin.IsSpent()) {
+            throw std::logic_error("FRESH flag misapplied to cache "
+                                   "entry for base transaction with "
+                                   "spendable outputs");
+        }
+
+        // Found the entry in the parent cache
+        if ((itUs->second.flags & CCoinsCacheEntry::FRESH) &&
+            it->second.coin.IsSpent()) {
+            // The grandparent does not have an entry, and the child is
+            // modified and being pruned. This means we can just delete
+            // it from the parent.
+            cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+            cacheCoins.erase(itUs);
+        } else {
+            // A normal modification.
+            cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+            itUs->second.coin = std::move(it->second.coin);
+            cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
+            itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+            // NOTE: It is possible the child has a FRESH flag here in
+            // the event the entry we found in the parent is pruned. But
+            // we must not copy that FRESH flag to the parent as that
+            // pruned state likely still needs to be communicated to the
+            // grandparent.
+        }
+    }
+}
+
 bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                                  const BlockHash &hashBlockIn) {
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();
          it = mapCoins.erase(it)) {
-        // Ignore non-dirty entries (optimization).
-        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
-            continue;
-        }
-        CCoinsMap::iterator itUs = cacheCoins.find(it->first);
-        if (itUs == cacheCoins.end()) {
-            // The parent cache does not have an entry, while the child does
-            // We can ignore it if it's both FRESH and pruned in the child
-            if (!(it->second.flags & CCoinsCacheEntry::FRESH &&
-                  it->second.coin.IsSpent())) {
-                // Otherwise we will need to create it in the parent and
-                // move the data up and mark it as dirty
-                CCoinsCacheEntry &entry = cacheCoins[it->first];
-                entry.coin = std::move(it->second.coin);
-                cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
-                entry.flags = CCoinsCacheEntry::DIRTY;
-                // We can mark it FRESH in the parent if it was FRESH in the
-                // child. Otherwise it might have just been flushed from the
-                // parent's cache and already exist in the grandparent
-                if (it->second.flags & CCoinsCacheEntry::FRESH) {
-                    entry.flags |= CCoinsCacheEntry::FRESH;
-                }
-            }
-        } else {
-            // Assert that the child cache entry was not marked FRESH if the
-            // parent cache entry has unspent outputs. If this ever happens,
-            // it means the FRESH flag was misapplied and there is a logic
-            // error in the calling code.
-            if ((it->second.flags & CCoinsCacheEntry::FRESH) &&
-                !itUs->second.coin.IsSpent()) {
-                throw std::logic_error("FRESH flag misapplied to cache "
-                                       "entry for base transaction with "
-                                       "spendable outputs");
-            }
-
-            // Found the entry in the parent cache
-            if ((itUs->second.flags & CCoinsCacheEntry::FRESH) &&
-                it->second.coin.IsSpent()) {
-                // The grandparent does not have an entry, and the child is
-                // modified and being pruned. This means we can just delete
-                // it from the parent.
-                cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
-                cacheCoins.erase(itUs);
-            } else {
-                // A normal modification.
-                cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
-                itUs->second.coin = std::move(it->second.coin);
-                cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
-                itUs->second.flags |= CCoinsCacheEntry::DIRTY;
-                // NOTE: It is possible the child has a FRESH flag here in
-                // the event the entry we found in the parent is pruned. But
-                // we must not copy that FRESH flag to the parent as that
-                // pruned state likely still needs to be communicated to the
-                // grandparent.
-            }
-        }
+        BatchWriteEntry(cacheCoins, cachedCoinsUsage, it);
     }
     hashBlock = hashBlockIn;
     return true;
@@ -258,10 +320,97 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    ReallocateCache();
     cachedCoinsUsage = 0;
     return fOk;
 }
 
+bool CCoinsViewCache::FlushAndTrim(size_t targetUsage) {
+    // Evict what we can before copying anything.
+    Trim(targetUsage);
+
+    // The entries handed to the base use our own pool, so that the memory of
+    // those which are moved is recycled.
+    CCoinsMap mapWrite{0, SaltedOutpointHasher{}, CCoinsMap::key_equal{},
+                       &m_cache_coins_memory_resource};
+    for (CCoinsMap::iterator it = cacheCoins.begin();
+         it != cacheCoins.end();) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            ++it;
+            continue;
+        }
+        if (!it->second.coin.IsSpent()) {
+            mapWrite.emplace(it->first, it->second);
+            it->second.flags = 0;
+            ++it;
+            continue;
+        }
+        // Spent coins are not needed anymore. Those which are FRESH do not
+        // even need to be written.
+        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+        if (!(it->second.flags & CCoinsCacheEntry::FRESH)) {
+            mapWrite.emplace(it->first, std::move(it->second));
+        }
+        it = cacheCoins.erase(it);
+    }
+
+    bool fOk = base->BatchWrite(mapWrite, hashBlock);
+    mapWrite.clear();
+    Trim(targetUsage);
+    return fOk;
+}
+
+void CCoinsViewCache::Trim(size_t targetUsage) {
+    const size_t usage = InUseMemoryUsage();
+    if (usage <= targetUsage || cacheCoins.empty()) {
+        return;
+    }
+
+    // Memory used by the entries themselves, besides their coins.
+    const size_t nodeUsage = (m_cache_coins_memory_resource.ChunkSizeBytes() *
+                                  m_cache_coins_memory_resource
+                                      .NumAllocatedChunks() -
+                              m_cache_coins_memory_resource.NumFreeBytes()) /
+                             cacheCoins.size();
+
+    // Find the lowest height up to which all the unmodified coins have to be
+    // evicted to get under the target.
+    uint32_t nMaxHeight = 0;
+    for (const auto &entry : cacheCoins) {
+        if (!(entry.second.flags & CCoinsCacheEntry::DIRTY)) {
+            nMaxHeight = std::max(nMaxHeight, entry.second.coin.GetHeight());
+        }
+    }
+    std::vector<size_t> usageByHeight(nMaxHeight + 1);
+    for (const auto &entry : cacheCoins) {
+        if (!(entry.second.flags & CCoinsCacheEntry::DIRTY)) {
+            usageByHeight[entry.second.coin.GetHeight()] +=
+                nodeUsage + entry.second.coin.DynamicMemoryUsage();
+        }
+    }
+    const size_t excess = usage - targetUsage;
+    uint32_t nEvictHeight = 0;
+    size_t nEvictUsage = usageByHeight[0];
+    while (nEvictUsage < excess && nEvictHeight < nMaxHeight) {
+        nEvictUsage += usageByHeight[++nEvictHeight];
+    }
+
+    for (CCoinsMap::iterator it = cacheCoins.begin();
+         it != cacheCoins.end();) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY) &&
+            it->second.coin.GetHeight() <= nEvictHeight) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void CCoinsViewCache::ReallocateCache() {
+    ReallocateCacheMap(cacheCoins, m_cache_coins_memory_resource);
+}
+
 void CCoinsViewCache::Uncache(const COutPoint &outpoint) {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
     if (it != cacheCoins.end() && it->second.flags == 0) {
@@ -307,6 +456,132 @@ bool CCoinsViewCache::HaveInputs(const CTransaction &tx) const {
     return true;
 }
 
+CCoinsViewShardedCache::CCoinsViewShardedCache(CCoinsView *baseIn,
+                                               size_t nShards)
+    : CCoinsViewBacked(baseIn) {
+    assert(nShards > 0);
+    shards.reserve(nShards);
+    for (size_t i = 0; i < nShards; ++i) {
+        shards.push_back(std::make_unique<Shard>());
+    }
+}
+
+bool CCoinsViewShardedCache::GetCoin(const COutPoint &outpoint,
+                                     Coin &coin) const {
+    Shard &shard = GetShard(outpoint);
+    LOCK(shard.cs);
+    CCoinsMap::const_iterator it = FetchCoinFromBase(
+        shard.cacheCoins, shard.cachedCoinsUsage, *base, outpoint);
+    if (it == shard.cacheCoins.end()) {
+        return false;
+    }
+    coin = it->second.coin;
+    return !coin.IsSpent();
+}
+
+bool CCoinsViewShardedCache::HaveCoin(const COutPoint &outpoint) const {
+    Shard &shard = GetShard(outpoint);
+    LOCK(shard.cs);
+    CCoinsMap::const_iterator it = FetchCoinFromBase(
+        shard.cacheCoins, shard.cachedCoinsUsage, *base, outpoint);
+    return it != shard.cacheCoins.end() && !it->second.coin.IsSpent();
+}
+
+bool CCoinsViewShardedCache::HaveCoinInCache(const COutPoint &outpoint) const {
+    Shard &shard = GetShard(outpoint);
+    LOCK(shard.cs);
+    CCoinsMap::const_iterator it = shard.cacheCoins.find(outpoint);
+    return it != shard.cacheCoins.end() && !it->second.coin.IsSpent();
+}
+
+BlockHash CCoinsViewShardedCache::GetBestBlock() const {
+    LOCK(cs_hashBlock);
+    if (hashBlock.IsNull()) {
+        hashBlock = base->GetBestBlock();
+    }
+    return hashBlock;
+}
+
+void CCoinsViewShardedCache::SetBestBlock(const BlockHash &hashBlockIn) {
+    LOCK(cs_hashBlock);
+    hashBlock = hashBlockIn;
+}
+
+bool CCoinsViewShardedCache::BatchWrite(CCoinsMap &mapCoins,
+                                        const BlockHash &hashBlockIn) {
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();
+         it = mapCoins.erase(it)) {
+        Shard &shard = GetShard(it->first);
+        LOCK(shard.cs);
+        BatchWriteEntry(shard.cacheCoins, shard.cachedCoinsUsage, it);
+    }
+    SetBestBlock(hashBlockIn);
+    return true;
+}
+
+bool CCoinsViewShardedCache::Flush() {
+    // Take all the shard locks, always in the same order, so that readers
+    // cannot pull stale coins from the base while it is being written to.
+    std::vector<std::unique_ptr<UniqueLock<Mutex>>> locks;
+    locks.reserve(shards.size());
+    for (const auto &shard : shards) {
+        locks.push_back(std::make_unique<UniqueLock<Mutex>>(
+            shard->cs, "shard->cs", __FILE__, __LINE__));
+    }
+
+    // The shards hold disjoint sets of outpoints. Their maps use different
+    // pool resources, so the entries have to be moved rather than spliced.
+    size_t nEntries = 0;
+    for (const auto &shard : shards) {
+        AssertLockHeld(shard->cs);
+        nEntries += shard->cacheCoins.size();
+    }
+    CCoinsMapMemoryResource resource;
+    CCoinsMap mapCoins{0, SaltedOutpointHasher{}, CCoinsMap::key_equal{},
+                       &resource};
+    mapCoins.reserve(nEntries);
+    for (const auto &shard : shards) {
+        for (auto &entry : shard->cacheCoins) {
+            if (entry.second.flags & CCoinsCacheEntry::DIRTY) {
+                mapCoins.emplace(entry.first, std::move(entry.second));
+            }
+        }
+        shard->cacheCoins.clear();
+        ReallocateCacheMap(shard->cacheCoins, shard->resource);
+        shard->cachedCoinsUsage = 0;
+    }
+    return base->BatchWrite(mapCoins, GetBestBlock());
+}
+
+void CCoinsViewShardedCache::Uncache(const COutPoint &outpoint) {
+    Shard &shard = GetShard(outpoint);
+    LOCK(shard.cs);
+    CCoinsMap::iterator it = shard.cacheCoins.find(outpoint);
+    if (it != shard.cacheCoins.end() && it->second.flags == 0) {
+        shard.cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+        shard.cacheCoins.erase(it);
+    }
+}
+
+unsigned int CCoinsViewShardedCache::GetCacheSize() const {
+    size_t count = 0;
+    for (const auto &shard : shards) {
+        LOCK(shard->cs);
+        count += shard->cacheCoins.size();
+    }
+    return count;
+}
+
+size_t CCoinsViewShardedCache::DynamicMemoryUsage() const {
+    size_t usage = 0;
+    for (const auto &shard : shards) {
+        LOCK(shard->cs);
+        usage += memusage::DynamicUsage(shard->cacheCoins) +
+                 shard->cachedCoinsUsage;
+    }
+    return usage;
+}
+
 // TODO: merge with similar definition in undo.h.
 static const size_t MAX_OUTPUTS_PER_TX =
     MAX_TX_SIZE / ::GetSerializeSize(CTxOut(), PROTOCOL_VERSION);
@@ -10,11 +10,15 @@
 #include <memusage.h>
 #include <primitives/blockhash.h>
 #include <serialize.h>
+#include <support/allocators/pool.h>
+#include <sync.h>
 #include <util/saltedhashers.h>
 
 #include <cassert>
 #include <cstdint>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 /**
  * A UTXO entry.
@@ -90,9 +94,29 @@ struct CCoinsCacheEntry {
         : coin(std::move(coinIn)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher>
+/**
+ * The nodes of CCoinsMap are allocated from a PoolResource, which carves them
+ * out of large chunks instead of doing one heap allocation per coin. This
+ * avoids most of the malloc overhead and fragmentation of huge caches, and
+ * makes the memory usage of the map exactly known.
+ *
+ * PoolAllocator's MAX_BLOCK_SIZE_BYTES parameter here uses sizeof the data,
+ * and adds the size of 4 pointers. We do not know the exact node size used in
+ * the std::unordered_node implementation because it is implementation
+ * defined. Most implementations have an overhead of 1 or 2 pointers, so nodes
+ * can be connected in a linked list, and in some cases the hash value is
+ * stored as well. Using 4 pointers overhead is thus very conservative, and
+ * only wastes memory for the pool's free lists that are not used.
+ */
+typedef std::unordered_map<
+    COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>,
+    PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                  sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) +
+                      sizeof(void *) * 4>>
     CCoinsMap;
 
+typedef CCoinsMap::allocator_type::ResourceType CCoinsMapMemoryResource;
+
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor {
 public:
@@ -177,11 +201,16 @@ protected:
      * declared as "const".
      */
     mutable BlockHash hashBlock;
+    mutable CCoinsMapMemoryResource m_cache_coins_memory_resource{};
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Lookups served by this cache, and those forwarded to the base. */
+    mutable uint64_t nCacheHits{0};
+    mutable uint64_t nCacheMisses{0};
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -228,6 +257,15 @@ public:
     void AddCoin(const COutPoint &outpoint, Coin coin,
                  bool potential_overwrite);
 
+    /**
+     * Insert an unspent coin that the caller has already read from the
+     * backing view, as if it had been fetched through this cache. This allows
+     * lookups against the database to be performed elsewhere (e.g. on worker
+     * threads) and the results to be handed to the cache afterwards. If the
+     * outpoint is already cached, this call has no effect.
+     */
+    void EmplaceFetchedCoin(const COutPoint &outpoint, Coin &&coin);
+
     /**
      * Spend a coin. Pass moveto in order to get the deleted data.
      * If no unspent output exists for the passed outpoint, this call has no
@@ -243,6 +281,22 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush,
+     * but keep the unspent coins in the cache (as unmodified), then Trim it
+     * to targetUsage. The modified coins which are kept are copied while
+     * they are being written.
+     */
+    bool FlushAndTrim(size_t targetUsage);
+
+    /**
+     * Evict unmodified coins until InUseMemoryUsage() is at most
+     * targetUsage, or only modified coins are left. Coins are evicted by
+     * increasing height, which approximates least-recently-used order: the
+     * most recently created coins are the most likely to be spent soon.
+     */
+    void Trim(size_t targetUsage);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is not
      * modified.
@@ -255,6 +309,18 @@ public:
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
+    /**
+     * Calculate the size of the cache (in bytes), not counting the memory
+     * freed by evicted entries, which is reused before the cache grows.
+     */
+    size_t InUseMemoryUsage() const;
+
+    //! Number of lookups served from this cache since the last ResetHitStats
+    uint64_t GetCacheHits() const { return nCacheHits; }
+    //! Number of lookups forwarded to the base since the last ResetHitStats
+    uint64_t GetCacheMisses() const { return nCacheMisses; }
+    void ResetHitStats() { nCacheHits = nCacheMisses = 0; }
+
     /**
      * Amount of bitcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of
@@ -273,6 +339,90 @@ public:
 
 private:
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
+
+    /**
+     * Release all the memory held by the (empty) cache, including the chunks
+     * of its pool resource.
+     */
+    void ReallocateCache();
+};
+
+/**
+ * CCoinsView that adds a memory cache to another CCoinsView, and which can be
+ * read from several threads at once.
+ *
+ * The cached coins are partitioned by outpoint into a number of shards, each
+ * one protected by its own lock, so that concurrent readers only contend when
+ * they hit the same shard. The base view must itself support concurrent
+ * reads (e.g. CCoinsViewDB) as cache misses are resolved while only the
+ * shard's lock is held.
+ *
+ * Writes happen in bulk through BatchWrite, typically from a CCoinsViewCache
+ * layered on top of this one, and may also run concurrently with readers.
+ * Flush takes all the shard locks and pushes the whole cache to the base.
+ */
+class CCoinsViewShardedCache : public CCoinsViewBacked {
+public:
+    //! Default number of shards
+    static constexpr size_t DEFAULT_SHARDS = 64;
+
+    explicit CCoinsViewShardedCache(CCoinsView *baseIn,
+                                    size_t nShards = DEFAULT_SHARDS);
+
+    CCoinsViewShardedCache(const CCoinsViewShardedCache &) = delete;
+
+    // Standard CCoinsView methods
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    BlockHash GetBestBlock() const override;
+    void SetBestBlock(const BlockHash &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const BlockHash &hashBlock) override;
+    CCoinsViewCursor *Cursor() const override {
+        throw std::logic_error(
+            "CCoinsViewShardedCache cursor iteration not supported.");
+    }
+
+    //! Same as CCoinsViewCache::HaveCoinInCache
+    bool HaveCoinInCache(const COutPoint &outpoint) const;
+
+    /**
+     * Push the modifications applied to this cache to its base, and empty
+     * the cache. Readers are blocked for the duration of the flush.
+     */
+    bool Flush();
+
+    //! Same as CCoinsViewCache::Uncache
+    void Uncache(const COutPoint &outpoint);
+
+    //! Calculate the size of the cache (in number of transaction outputs)
+    unsigned int GetCacheSize() const;
+
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
+    //! Number of shards the cache is partitioned into
+    size_t GetShardCount() const { return shards.size(); }
+
+private:
+    struct Shard {
+        mutable Mutex cs;
+        mutable CCoinsMapMemoryResource resource GUARDED_BY(cs){};
+        mutable CCoinsMap cacheCoins GUARDED_BY(cs){
+            0, SaltedOutpointHasher{}, CCoinsMap::key_equal{}, &resource};
+        //! Cached dynamic memory usage for the inner Coin objects.
+        mutable size_t cachedCoinsUsage GUARDED_BY(cs){0};
+    };
+
+    mutable Mutex cs_hashBlock;
+    mutable BlockHash hashBlock GUARDED_BY(cs_hashBlock);
+
+    //! Hasher used to pick a shard, independent from the maps' own hashers.
+    const SaltedOutpointHasher shardHasher;
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    Shard &GetShard(const COutPoint &outpoint) const {
+        return *shards[shardHasher(outpoint) % shards.size()];
+    }
 };
 
 //! Utility function to add all of a transaction's outputs to a cache.
@@ -45,6 +45,13 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <poll.h>
+#include <sys/epoll.h>
+// Sockets are waited for with epoll and poll, which, unlike select, are not
+// limited to FD_SETSIZE file descriptors.
+#define USE_EPOLL
+#endif
 #endif
 
 #ifndef WIN32
@@ -83,7 +90,7 @@ typedef char *sockopt_arg_type;
 #endif
 
 static bool inline IsSelectableSocket(const SOCKET &s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_EPOLL)
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -5,11 +5,27 @@
 #include <gbtlight.h>
 #include <logging.h>
 #include <scheduler.h>
+#include <streams.h>
+#include <sync.h>
+#include <util/saltedhashers.h>
 #include <util/strencodings.h>
 #include <util/system.h>
+#include <version.h>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
 #include <atomic>
+#include <ios>
 #include <limits>
+#include <map>
+#include <memory>
+#include <unordered_map>
 
 namespace gbtl {
 
@@ -23,13 +39,28 @@ namespace {
 /// Config data based on args cached for performance (since calling gArgs.GetArg() is slow).
 /// This should be initialized before RPC server startup via GBTLight::Initialize().
 struct Config {
-    fs::path storeDir, trashDir;
+    fs::path storeDir, trashDir, txDataDir;
     int64_t jobDataExpirySecs{};
     int cacheSize{};
 };
 Config config;
 std::atomic_uint initCt;
 void CleanJobDataDir();
+
+/// State of the job tx data store (see StoreJobTxs)
+struct TxStore {
+    Mutex mut;
+    /// The current segment, open for appending
+    std::unique_ptr<CAutoFile> file GUARDED_BY(mut);
+    /// The id of the current segment, which is the time it was started at, in microseconds
+    uint64_t segment GUARDED_BY(mut) = 0;
+    uint64_t segmentSize GUARDED_BY(mut) = 0;
+    /// Where the transactions of the current and the previous segment are
+    std::unordered_map<TxId, JobTxRef, SaltedTxIdHasher> index GUARDED_BY(mut);
+};
+TxStore store;
+
+std::string SegmentFileName(uint64_t segment) { return strprintf("%016x.dat", segment); }
 } // namespace
 
 void Initialize(CScheduler &scheduler) {
@@ -51,6 +82,14 @@ void Initialize(CScheduler &scheduler) {
     TryCreateDirectories(config.storeDir); // may throw
     config.trashDir = config.storeDir / "trash";
     TryCreateDirectories(config.trashDir); // may throw
+    config.txDataDir = config.storeDir / "txdata";
+    TryCreateDirectories(config.txDataDir); // may throw
+    {
+        // start a new segment in the (possibly different) txdata dir on the next job
+        LOCK(store.mut);
+        store.file.reset();
+        store.index.clear();
+    }
     // parse -gbtstoretime
     config.jobDataExpirySecs = gArgs.GetArg("-gbtstoretime", DEFAULT_JOB_DATA_EXPIRY_SECS);
     if (config.jobDataExpirySecs < 0) {
@@ -90,6 +129,156 @@ const fs::path &GetJobDataDir() { return config.storeDir; }
 const fs::path &GetJobDataTrashDir() { return config.trashDir; }
 size_t GetJobCacheSize() { return size_t(config.cacheSize); }
 int64_t GetJobDataExpiry() { return config.jobDataExpirySecs; }
+const fs::path &GetJobTxDataDir() { return config.txDataDir; }
+
+namespace {
+/// A read-only view of a whole file, memory-mapped where supported.
+class MappedFile {
+public:
+    explicit MappedFile(const fs::path &path);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const uint8_t *data() const { return begin; }
+    size_t size() const { return len; }
+
+private:
+#ifdef WIN32
+    std::vector<uint8_t> buffer;
+#else
+    void *addr{};
+#endif
+    const uint8_t *begin{};
+    size_t len{};
+};
+
+#ifdef WIN32
+MappedFile::MappedFile(const fs::path &path) {
+    fs::ifstream file(path, std::ios_base::binary);
+    if (!file.is_open()) {
+        throw std::ios_base::failure("cannot open " + path.string());
+    }
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    begin = buffer.data();
+    len = buffer.size();
+}
+
+MappedFile::~MappedFile() {}
+#else
+MappedFile::MappedFile(const fs::path &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::ios_base::failure("cannot open " + path.string());
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::ios_base::failure("cannot stat " + path.string());
+    }
+    len = size_t(st.st_size);
+    if (len) {
+        addr = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            addr = nullptr;
+            ::close(fd);
+            throw std::ios_base::failure("cannot map " + path.string());
+        }
+        begin = static_cast<const uint8_t *>(addr);
+    }
+    ::close(fd); // the mapping stays valid
+}
+
+MappedFile::~MappedFile() {
+    if (addr) {
+        ::munmap(addr, len);
+    }
+}
+#endif
+
+void StartSegment(int64_t now) EXCLUSIVE_LOCKS_REQUIRED(store.mut) {
+    AssertLockHeld(store.mut);
+    const uint64_t segment = std::max<uint64_t>(uint64_t(now), store.segment + 1);
+    const fs::path path = GetJobTxDataDir() / SegmentFileName(segment);
+    auto file = std::make_unique<CAutoFile>(fsbridge::fopen(path, "ab"), SER_NETWORK, PROTOCOL_VERSION);
+    if (file->IsNull()) {
+        throw std::runtime_error("cannot open " + path.string());
+    }
+    // only the transactions of the segment that is now the previous one can still be referred to by new jobs
+    for (auto it = store.index.begin(); it != store.index.end(); ) {
+        if (it->second.segment != store.segment)
+            it = store.index.erase(it);
+        else
+            ++it;
+    }
+    store.file = std::move(file);
+    store.segment = segment;
+    store.segmentSize = fs::file_size(path);
+    LogPrint(BCLog::RPC, "getblocktemplatelight: started tx data segment %s\n", path.filename().string());
+}
+} // namespace
+
+std::vector<JobTxRef> StoreJobTxs(const std::vector<CTransactionRef> &txs) {
+    LOCK(store.mut);
+    const int64_t now = GetTimeMicros();
+    if (!store.file
+            || (config.jobDataExpirySecs > 0
+                && now - int64_t(store.segment) >= config.jobDataExpirySecs * 1'000'000 / 2)) {
+        StartSegment(now);
+    }
+    std::vector<JobTxRef> refs;
+    refs.reserve(txs.size());
+    size_t nAppended = 0;
+    try {
+        for (const auto &tx : txs) {
+            auto it = store.index.find(tx->GetId());
+            if (it == store.index.end()) {
+                const JobTxRef ref{store.segment, store.segmentSize,
+                                   uint32_t(GetSerializeSize(*tx, PROTOCOL_VERSION))};
+                *store.file << *tx;
+                store.segmentSize += ref.size;
+                it = store.index.emplace(tx->GetId(), ref).first;
+                ++nAppended;
+            }
+            refs.push_back(it->second);
+        }
+        // the job file referring to these is read back from the same files, so they must have been written by then
+        if (std::fflush(store.file->Get()) != 0) {
+            throw std::runtime_error("cannot write tx data segment");
+        }
+    } catch (...) {
+        // the segment may end with a partial transaction; start afresh with the next job
+        store.file.reset();
+        store.index.clear();
+        throw;
+    }
+    LogPrint(BCLog::RPC, "getblocktemplatelight: %d of %d txs appended to tx data segment %s\n", nAppended,
+             txs.size(), SegmentFileName(store.segment));
+    return refs;
+}
+
+void LoadJobTxs(const std::vector<JobTxRef> &refs, std::vector<CTransactionRef> &vtx) {
+    // a job usually refers to one or two segments
+    std::map<uint64_t, std::unique_ptr<MappedFile>> segments;
+    vtx.reserve(vtx.size() + refs.size());
+    for (const auto &ref : refs) {
+        auto &segment = segments[ref.segment];
+        if (!segment) {
+            segment = std::make_unique<MappedFile>(GetJobTxDataDir() / SegmentFileName(ref.segment));
+        }
+        if (ref.offset > segment->size() || ref.size > segment->size() - ref.offset) {
+            throw std::ios_base::failure("tx data out of range of segment " + SegmentFileName(ref.segment));
+        }
+        const char *begin = reinterpret_cast<const char *>(segment->data() + ref.offset);
+        CDataStream stream(begin, begin + ref.size, SER_NETWORK, PROTOCOL_VERSION);
+        CMutableTransaction mutableTx;
+        stream >> mutableTx;
+        if (!stream.empty()) {
+            throw std::ios_base::failure("tx data size mismatch in segment " + SegmentFileName(ref.segment));
+        }
+        vtx.push_back(MakeTransactionRef(std::move(mutableTx)));
+    }
+}
 
 namespace {
 void CleanJobDataDir() {
@@ -160,6 +349,24 @@ void CleanJobDataDir() {
         // newer than absolute cutoff, older than trash cutoff -- move to trash for "purgatory"
         MV(path, trashDir / path.filename());
     }
+    // process gbt/txdata/ dir. A segment is only referred to by the jobs created before the second segment after it
+    // was started (see StoreJobTxs), so it goes once those are all past the absolute cutoff (and deleted above).
+    std::vector<std::pair<uint64_t, fs::path>> segments;
+    for (const auto &entry : fs::directory_iterator(GetJobTxDataDir())) {
+        const auto &path = entry.path();
+        const auto basename = path.filename().stem().string();
+        if (!fs::is_regular_file(path) || path.extension() != ".dat" || basename.size() != 16 || !IsHex(basename)) {
+            continue;
+        }
+        ++total;
+        segments.emplace_back(std::stoull(basename, nullptr, 16), path);
+    }
+    std::sort(segments.begin(), segments.end());
+    for (size_t i = 0; i + 2 < segments.size(); ++i) {
+        if (segments[i + 2].first < uint64_t(cutoff) * 1'000'000) {
+            RM(segments[i].second);
+        }
+    }
     if (count) {
         LogPrint(BCLog::RPC, "%s cleaned or moved %u out of %u item(s) in %f secs\n", pfx, count, total,
                  (GetTimeMicros()-t0)/1e6);
@@ -6,10 +6,13 @@
 #define BITCOIN_GBTLIGHT_H
 
 #include <fs.h>
+#include <primitives/transaction.h>
+#include <serialize.h>
 #include <uint256.h>
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 class CScheduler;
 
@@ -32,6 +35,39 @@ const fs::path &GetJobDataTrashDir();
 size_t GetJobCacheSize();
 /// Returns the job data dir file expiry time in seconds.  From arg -gbtstoretime=<n>
 int64_t GetJobDataExpiry();
+/// Returns the directory of the job tx data segments. This is always GetJobDataDir() / "txdata".
+const fs::path &GetJobTxDataDir();
+
+/// Where a serialized transaction lives in the job tx data store: the segment file it was appended to, and its
+/// position in that file.
+struct JobTxRef {
+    uint64_t segment{};
+    uint64_t offset{};
+    uint32_t size{};
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(segment);
+        READWRITE(offset);
+        READWRITE(size);
+    }
+};
+
+/// Content-addressed store for the transactions of getblocktemplatelight jobs, so that a job file only needs to
+/// reference them and consecutive jobs share the transactions they have in common.
+///
+/// Transactions are appended to segment files in GetJobTxDataDir(), each at most once per segment. A new segment is
+/// started every -gbtstoretime/2 seconds, and only the transactions of the current and the previous segment are
+/// reused by new jobs, so that an old segment is deleted along with the last job file which could refer to it (see
+/// the cleanup task scheduled by Initialize()).
+///
+/// Returns the refs of the txs, in the same order. Throws std::runtime_error if the data cannot be written.
+std::vector<JobTxRef> StoreJobTxs(const std::vector<CTransactionRef> &txs);
+/// Reads back the transactions referenced by `refs` into `vtx`, from memory-mapped segment files, so that only their
+/// bytes are read from disk.  Throws std::ios_base::failure if a segment is missing or a transaction is invalid.
+void LoadJobTxs(const std::vector<JobTxRef> &refs, std::vector<CTransactionRef> &vtx);
 
 extern const int DEFAULT_JOB_CACHE_SIZE; /**< = 10 */
 extern const char * const DEFAULT_JOB_DATA_SUBDIR; /**< = "gbt" */
@@ -35,6 +35,8 @@
 #include <net_permissions.h>
 #include <net_processing.h>
 #include <netbase.h>
+#include <node/mempooljournal.h>
+#include <node/utxosnapshot.h>
 #include <policy/mempool.h>
 #include <policy/policy.h>
 #include <rpc/blockchain.h>
@@ -221,6 +223,10 @@ void Shutdown(NodeContext &node) {
     util::ThreadRename("shutoff");
     g_mempool.AddTransactionsUpdated(1);
 
+    if (gbtl::g_template_pusher) {
+        UnregisterValidationInterface(gbtl::g_template_pusher.get());
+        gbtl::g_template_pusher.reset();
+    }
     StopHTTPRPC();
     StopREST();
     StopRPC();
@@ -249,6 +255,7 @@ void Shutdown(NodeContext &node) {
     threadGroup.interrupt_all();
     threadGroup.join_all();
     StopScriptCheckWorkerThreads();
+    StopInputFetchWorkerThreads();
 
     // After the threads that potentially access these pointers have been
     // stopped, destruct and reset all to nullptr.
@@ -257,9 +264,14 @@ void Shutdown(NodeContext &node) {
     g_banman.reset();
     g_txindex.reset();
 
+    // The journal writes the last changes, in place of the dump below.
+    const bool fMempoolJournal = bool(g_mempool_journal);
+    g_mempool_journal.reset();
     if (::g_mempool.IsLoaded() &&
         gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
-        DumpMempool(::g_mempool);
+        if (!fMempoolJournal) {
+            DumpMempool(::g_mempool);
+        }
         if (DoubleSpendProof::IsEnabled()) {
             DumpDSProofs(::g_mempool);
         }
@@ -303,6 +315,11 @@ void Shutdown(NodeContext &node) {
     }
 #endif
 
+    if (g_blocktemplatetracker) {
+        UnregisterValidationInterface(g_blocktemplatetracker.get());
+        g_blocktemplatetracker.reset();
+    }
+
     try {
         if (!fs::remove(GetPidFile())) {
             LogPrintf("%s: Unable to remove PID file: File does not exist\n",
@@ -441,6 +458,14 @@ void SetupServerArgs() {
                  ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-datadir=<dir>", "Specify data directory", ArgsManager::ALLOW_ANY,
                  OptionsCategory::OPTIONS);
+    gArgs.AddArg(
+        "-dbbackgroundflush",
+        strprintf("Write the coins database on a background thread when the "
+                  "cache is flushed, so that blocks keep being connected "
+                  "meanwhile. While a flush is in progress, memory usage may "
+                  "reach twice -dbcache (default: %d)",
+                  DEFAULT_DB_BACKGROUND_FLUSH),
+        ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg(
         "-dbbatchsize=<n>",
         strprintf("Maximum database write batch size in bytes (default: %u)",
@@ -452,6 +477,15 @@ void SetupServerArgs() {
             "Set database cache size in megabytes (%d to %d, default: %d)",
             nMinDbCache, nMaxDbCache, nDefaultDbCache),
         ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg(
+        "-dbcacheretain=<n>",
+        strprintf("Percentage of the in-memory UTXO cache to keep filled "
+                  "with the most recently created coins when the cache is "
+                  "flushed (0 to %d, default: %d). The coins kept are copied "
+                  "while being written, so a flush may temporarily use that "
+                  "much memory on top of -dbcache",
+                  nMaxDbCacheRetain, nDefaultDbCacheRetain),
+        ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-debuglogfile=<file>",
                  strprintf("Specify location of debug log file. Relative paths "
                            "will be prefixed by a net-specific datadir "
@@ -501,6 +535,13 @@ void SetupServerArgs() {
     gArgs.AddArg("-loadblock=<file>",
                  "Imports blocks from external blk000??.dat file on startup",
                  ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-loadutxosnapshot=<file>",
+                 "Populate an empty chainstate from a UTXO snapshot written by "
+                 "the dumptxoutset RPC, instead of connecting the blocks up to "
+                 "its base block. The base block and its ancestors must "
+                 "already be on disk. The snapshot is checked against the UTXO "
+                 "set hash it records.",
+                 ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-maxmempool=<n>", strprintf("Keep the transaction memory pool below <n> "
                  "megabytes (default: %u, testnet: %u, testnet4: %u, scalenet: %u)",
                  DEFAULT_MAX_MEMPOOL_SIZE_PER_MB * defaultChainParams->GetConsensus().nDefaultExcessiveBlockSize / ONE_MEGABYTE,
@@ -547,6 +588,20 @@ void SetupServerArgs() {
                   MAX_SCRIPTCHECK_THREADS,
                   DEFAULT_SCRIPTCHECK_THREADS),
         ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg(
+        "-parinputfetch=<n>",
+        strprintf("Set the number of threads used to read the inputs of a "
+                  "block from the coins database before connecting it (up to "
+                  "%d, 0 = disabled, default: %d)",
+                  MAX_INPUTFETCH_THREADS, DEFAULT_INPUTFETCH_THREADS),
+        ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg(
+        "-parmempoolinputs=<n>",
+        strprintf("Verify the scripts of transactions with at least <n> "
+                  "inputs on the script verification threads when accepting "
+                  "them to the mempool (0 = never, default: %d)",
+                  DEFAULT_MEMPOOL_PARALLEL_INPUTS),
+        ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-parkdeepreorg",
                  strprintf("If connecting a new block would require rewinding "
                            "more than one block from the active chain (i.e., "
@@ -559,6 +614,13 @@ void SetupServerArgs() {
                            "on restart (default: %u)",
                            DEFAULT_PERSIST_MEMPOOL),
                  ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-mempooljournal",
+                 strprintf("With -persistmempool, log the changes to the "
+                           "mempool to mempool.journal as they happen, instead "
+                           "of saving it on shutdown, so that it is recovered "
+                           "after a crash as well (default: %u)",
+                           DEFAULT_MEMPOOL_JOURNAL),
+                 ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-pid=<file>",
                  strprintf("Specify pid file. Relative paths will be prefixed "
                            "by a net-specific datadir location. (default: %s)",
@@ -673,6 +735,12 @@ void SetupServerArgs() {
         strprintf("Maintain at most <n> connections to peers (default: %u)",
                   DEFAULT_MAX_PEER_CONNECTIONS),
         ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
+    gArgs.AddArg(
+        "-msghandlerthreads=<n>",
+        strprintf("Number of threads processing the messages of peers, each "
+                  "peer being handled by one of them (%u to %d, default: %d)",
+                  1, MAX_MSGHANDLER_THREADS, DEFAULT_MSGHANDLER_THREADS),
+        ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
     gArgs.AddArg("-maxreceivebuffer=<n>",
                  strprintf("Maximum per-connection receive buffer, <n>*1000 "
                            "bytes (default: %u)",
@@ -806,6 +874,10 @@ void SetupServerArgs() {
     gArgs.AddArg("-zmqpubrawds=<address>",
                  "Enable publish raw double spend transaction in <address>", ArgsManager::ALLOW_ANY,
                  OptionsCategory::ZMQ);
+    gArgs.AddArg("-zmqpubgbtlight=<address>",
+                 "Enable publish getblocktemplatelight templates in <address> on a new tip and as their fees "
+                 "improve (requires -server)", ArgsManager::ALLOW_ANY,
+                 OptionsCategory::ZMQ);
 #else
     hidden_args.emplace_back("-zmqpubhashblock=<address>");
     hidden_args.emplace_back("-zmqpubhashtx=<address>");
@@ -813,6 +885,7 @@ void SetupServerArgs() {
     hidden_args.emplace_back("-zmqpubrawtx=<address>");
     hidden_args.emplace_back("-zmqpubhashds=<address>");
     hidden_args.emplace_back("-zmqpubrawds=<address>");
+    hidden_args.emplace_back("-zmqpubgbtlight=<address>");
 #endif
 
     gArgs.AddArg(
@@ -1076,6 +1149,18 @@ void SetupServerArgs() {
                            "template_request object given to gbt. (default: %d)", DEFAULT_GBT_CHECK_VALIDITY),
                  ArgsManager::ALLOW_ANY, OptionsCategory::BLOCK_CREATION);
 
+    gArgs.AddArg("-gbtincremental",
+                 strprintf("Keep the getblocktemplate block template up to date as transactions enter and leave the "
+                           "mempool, so that a new template does not have to be assembled from scratch while every "
+                           "mempool transaction fits in the block (default: %d)", DEFAULT_GBT_INCREMENTAL),
+                 ArgsManager::ALLOW_ANY, OptionsCategory::BLOCK_CREATION);
+
+    gArgs.AddArg("-blockassemblythreads=<n>",
+                 strprintf("Set the number of threads used to assemble block templates from large mempools (up to "
+                           "%d, 0 = one per core, default: %d)", MAX_BLOCK_ASSEMBLY_THREADS,
+                           DEFAULT_BLOCK_ASSEMBLY_THREADS),
+                 ArgsManager::ALLOW_ANY, OptionsCategory::BLOCK_CREATION);
+
     gArgs.AddArg("-blockmintxfee=<amt>",
                  strprintf("Set lowest fee rate (in %s/kB) for transactions to "
                            "be included in block creation. (default: %s)",
@@ -1175,6 +1260,11 @@ void SetupServerArgs() {
                            "automatically deleted (0 to disable autodeletion, default: %d).",
                            gbtl::DEFAULT_JOB_DATA_EXPIRY_SECS),
                  ArgsManager::ALLOW_ANY, OptionsCategory::RPC);
+    gArgs.AddArg("-gbtpushfeethreshold=<amt>",
+                 strprintf("Minimum increase in fees (in %s) for a getblocktemplatelight template built after "
+                           "mempool changes to be published to -zmqpubgbtlight subscribers (default: %s)",
+                           CURRENCY_UNIT, FormatMoney(gbtl::DEFAULT_PUSH_FEE_THRESHOLD)),
+                 ArgsManager::ALLOW_ANY, OptionsCategory::RPC);
 
     // Double Spend Proof
     gArgs.AddArg("-doublespendproof",
@@ -1378,9 +1468,17 @@ static void ThreadImport(const Config &config,
         if (DoubleSpendProof::IsEnabled()) {
             LoadDSProofs(::g_mempool);
         }
-        LoadMempool(config, ::g_mempool);
+        if (!g_mempool_journal || !g_mempool_journal->Recover(config)) {
+            LoadMempool(config, ::g_mempool);
+        }
     }
     ::g_mempool.SetIsLoaded(!ShutdownRequested());
+    if (g_mempool_journal && ::g_mempool.IsLoaded() &&
+        !g_mempool_journal->Start()) {
+        LogPrintf("Failed to start the mempool journal. Continuing without "
+                  "it.\n");
+        g_mempool_journal.reset();
+    }
 }
 
 /** Sanity checks
@@ -1702,6 +1800,11 @@ bool AppInitParameterInteraction(Config &config) {
         }
     }
 
+    if (gArgs.IsArgSet("-loadutxosnapshot") &&
+        gArgs.GetBoolArg("-reindex", false)) {
+        return InitError(_("-loadutxosnapshot is incompatible with -reindex."));
+    }
+
     // -bind and -whitebind can't be set when not listening
     size_t nUserBind =
         gArgs.GetArgs("-bind").size() + gArgs.GetArgs("-whitebind").size();
@@ -1711,19 +1814,23 @@ bool AppInitParameterInteraction(Config &config) {
     }
 
     // Make sure enough file descriptors are available
-    int nBind = std::max(nUserBind, size_t(1));
     nUserMaxConnections =
         gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
     // Trim requested connection counts, to fit into system limitations
+#ifndef USE_EPOLL
+    // select() cannot wait for sockets beyond FD_SETSIZE; epoll is only
+    // limited by the number of file descriptors below.
     // <int> in std::min<int>(...) to work around FreeBSD compilation issue
     // described in #2695
+    int nBind = std::max(nUserBind, size_t(1));
     nMaxConnections =
         std::max(std::min<int>(nMaxConnections, FD_SETSIZE - nBind -
                                                     MIN_CORE_FILEDESCRIPTORS -
                                                     MAX_ADDNODE_CONNECTIONS),
                  0);
+#endif
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS +
                                    MAX_ADDNODE_CONNECTIONS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS) {
@@ -1949,6 +2056,14 @@ bool AppInitParameterInteraction(Config &config) {
         }
     }
 
+    if (gArgs.IsArgSet("-gbtpushfeethreshold")) {
+        Amount n = Amount::zero();
+        if (!ParseMoney(gArgs.GetArg("-gbtpushfeethreshold", ""), n)) {
+            return InitError(AmountErrMsg("gbtpushfeethreshold",
+                                          gArgs.GetArg("-gbtpushfeethreshold", "")));
+        }
+    }
+
     // Feerate used to define dust.  Shouldn't be changed lightly as old
     // implementations may inadvertently create non-standard transactions.
     if (gArgs.IsArgSet("-dustrelayfee")) {
@@ -2151,6 +2266,16 @@ bool AppInitMain(Config &config, RPCServer &rpcServer,
     if (script_threads >= 1) {
         StartScriptCheckWorkerThreads(script_threads);
     }
+    nMempoolParallelInputs = std::max<int64_t>(
+        gArgs.GetArg("-parmempoolinputs", DEFAULT_MEMPOOL_PARALLEL_INPUTS), 0);
+
+    const int inputfetch_threads = std::clamp<int64_t>(
+        gArgs.GetArg("-parinputfetch", DEFAULT_INPUTFETCH_THREADS), 0,
+        MAX_INPUTFETCH_THREADS);
+    LogPrintf("Block input prefetching uses %d threads\n", inputfetch_threads);
+    if (inputfetch_threads >= 1) {
+        StartInputFetchWorkerThreads(inputfetch_threads);
+    }
 
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop =
@@ -2285,6 +2410,12 @@ bool AppInitMain(Config &config, RPCServer &rpcServer,
         gArgs.GetBoolArg("-enablebip61", DEFAULT_ENABLE_BIP61)));
     RegisterValidationInterface(peerLogic.get());
 
+    if (gArgs.GetBoolArg("-gbtincremental", DEFAULT_GBT_INCREMENTAL)) {
+        g_blocktemplatetracker =
+            std::make_unique<BlockTemplateTracker>(config, g_mempool);
+        RegisterValidationInterface(g_blocktemplatetracker.get());
+    }
+
     // sanitize comments per BIP-0014, format user agent and check total size
     std::vector<std::string> uacomments;
     for (const std::string &cmt : gArgs.GetArgs("-uacomment")) {
@@ -2409,6 +2540,28 @@ bool AppInitMain(Config &config, RPCServer &rpcServer,
     if (g_zmq_notification_interface) {
         RegisterValidationInterface(g_zmq_notification_interface);
     }
+
+    // The templates are stored for submitblocklight, which needs the RPC server.
+    if (g_zmq_notification_interface && gArgs.IsArgSet("-zmqpubgbtlight") && gArgs.GetBoolArg("-server", false)) {
+        Amount feeThreshold = gbtl::DEFAULT_PUSH_FEE_THRESHOLD;
+        if (gArgs.IsArgSet("-gbtpushfeethreshold")) {
+            // checked in AppInitParameterInteraction
+            ParseMoney(gArgs.GetArg("-gbtpushfeethreshold", ""), feeThreshold);
+        }
+        gbtl::g_template_pusher = std::make_unique<gbtl::TemplatePusher>(
+            config,
+            [](const std::string &json) {
+                // publish from the validation interface queue, along with the other ZMQ notifications
+                CallFunctionInValidationInterfaceQueue([json] {
+                    if (g_zmq_notification_interface) {
+                        g_zmq_notification_interface->NotifyBlockTemplateLight(json);
+                    }
+                });
+            },
+            feeThreshold);
+        RegisterValidationInterface(gbtl::g_template_pusher.get());
+        gbtl::g_template_pusher->Start();
+    }
 #endif
     // unlimited unless -maxuploadtarget is set
     uint64_t nMaxOutboundLimit = 0;
@@ -2447,6 +2600,12 @@ bool AppInitMain(Config &config, RPCServer &rpcServer,
     nTotalCache -= nCoinDBCache;
     // the rest goes to in-memory cache
     nCoinCacheUsage = nTotalCache;
+    nCoinCacheRetainUsage =
+        nCoinCacheUsage *
+        std::clamp<int64_t>(
+            gArgs.GetArg("-dbcacheretain", nDefaultDbCacheRetain), 0,
+            nMaxDbCacheRetain) /
+        100;
     int64_t nMempoolSizeMax = config.GetMaxMemPoolSize();
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n",
@@ -2461,6 +2620,9 @@ bool AppInitMain(Config &config, RPCServer &rpcServer,
               "unused mempool space)\n",
               nCoinCacheUsage * (1.0 / 1024 / 1024),
               nMempoolSizeMax * (1.0 / 1024 / 1024));
+    LogPrintf("* Keeping up to %.1fMiB of the UTXO set in memory after a "
+              "flush\n",
+              nCoinCacheRetainUsage * (1.0 / 1024 / 1024));
 
     int64_t nStart = 0;
     bool fLoaded = false;
@@ -2565,11 +2727,36 @@ bool AppInitMain(Config &config, RPCServer &rpcServer,
                     break;
                 }
 
+                if (pcoinsdbview->IsSnapshotLoading()) {
+                    strLoadError =
+                        _("Loading the UTXO snapshot was interrupted. You will "
+                          "need to rebuild the database using "
+                          "-reindex-chainstate.");
+                    break;
+                }
+
+                bool is_coinsview_empty = fReset || fReindexChainState ||
+                                          pcoinsdbview->GetBestBlock().IsNull();
+                if (is_coinsview_empty &&
+                    gArgs.IsArgSet("-loadutxosnapshot")) {
+                    uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+                    std::string strError;
+                    if (!LoadUTXOSnapshot(
+                            *pcoinsdbview,
+                            AbsPathForConfigVal(fs::path(
+                                gArgs.GetArg("-loadutxosnapshot", ""))),
+                            nCoinCacheUsage, strError)) {
+                        return InitError(strError);
+                    }
+                    is_coinsview_empty = false;
+                } else if (gArgs.IsArgSet("-loadutxosnapshot")) {
+                    LogPrintf("Chainstate is not empty, ignoring "
+                              "-loadutxosnapshot\n");
+                }
+
                 // The on-disk coinsdb is now in a good state, create the cache
                 pcoinsTip.reset(new CCoinsViewCache(pcoinscatcher.get()));
 
-                bool is_coinsview_empty = fReset || fReindexChainState ||
-                                          pcoinsTip->GetBestBlock().IsNull();
                 if (!is_coinsview_empty) {
                     // LoadChainTip sets ::ChainActive() based on pcoinsTip's
                     // best block
@@ -2721,6 +2908,16 @@ bool AppInitMain(Config &config, RPCServer &rpcServer,
         vImportFiles.push_back(strFile);
     }
 
+    const fs::path journalPath = GetDataDir() / "mempool.journal";
+    if (gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL) &&
+        gArgs.GetBoolArg("-mempooljournal", DEFAULT_MEMPOOL_JOURNAL)) {
+        g_mempool_journal =
+            std::make_unique<MempoolJournal>(::g_mempool, journalPath);
+    } else if (fs::exists(journalPath)) {
+        // It would be stale by the next time it is used.
+        fs::remove(journalPath);
+    }
+
     threadGroup.create_thread(
         std::bind(&ThreadImport, std::ref(config), vImportFiles));
 
@@ -2791,6 +2988,9 @@ bool AppInitMain(Config &config, RPCServer &rpcServer,
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
     connOptions.m_peer_connect_timeout = peer_connect_timeout;
+    connOptions.nMsgHandlerThreads = std::clamp<int64_t>(
+        gArgs.GetArg("-msghandlerthreads", DEFAULT_MSGHANDLER_THREADS), 1,
+        MAX_MSGHANDLER_THREADS);
 
     for (const std::string &strBind : gArgs.GetArgs("-bind")) {
         CService addrBind;
@@ -32,15 +32,15 @@
 #include <validationinterface.h>
 
 #include <algorithm>
+#include <future>
 #include <queue>
-#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 
 // Unconfirmed transactions in the memory pool often depend on other
 // transactions in the memory pool. When we select transactions from the
-// pool, we select by highest fee rate of a transaction combined with all
-// its ancestors.
+// pool, we select by highest fee rate of a chunk of the cluster of
+// dependent transactions it belongs to, see CTxMemPoolCluster.
 
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
@@ -68,7 +68,7 @@ int64_t UpdateTime(CBlockHeader *pblock, const Consensus::Params &params,
 BlockAssembler::Options::Options()
     : nExcessiveBlockSize(DEFAULT_EXCESSIVE_BLOCK_SIZE),
       nMaxGeneratedBlockSize(DEFAULT_EXCESSIVE_BLOCK_SIZE),
-      blockMinFeeRate(DEFAULT_BLOCK_MIN_TX_FEE_PER_KB) {}
+      blockMinFeeRate(DEFAULT_BLOCK_MIN_TX_FEE_PER_KB), nThreads(1) {}
 
 BlockAssembler::BlockAssembler(const CChainParams &params,
                                const CTxMemPool &_mempool,
@@ -76,6 +76,7 @@ BlockAssembler::BlockAssembler(const CChainParams &params,
     : chainparams(params), mempool(&_mempool),
       fPrintPriority(gArgs.GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY)) {
     blockMinFeeRate = options.blockMinFeeRate;
+    nThreads = std::clamp<unsigned>(options.nThreads, 1, MAX_BLOCK_ASSEMBLY_THREADS);
     // Limit size to between 1K and options.nExcessiveBlockSize -1K for sanity:
     nMaxGeneratedBlockSize = std::max<uint64_t>(
         1000, std::min<uint64_t>(options.nExcessiveBlockSize - 1000,
@@ -102,6 +103,12 @@ static BlockAssembler::Options DefaultOptions(const Config &config) {
         options.blockMinFeeRate = CFeeRate(n);
     }
 
+    int64_t nThreads = gArgs.GetArg("-blockassemblythreads", DEFAULT_BLOCK_ASSEMBLY_THREADS);
+    if (nThreads <= 0) {
+        nThreads = GetNumCores();
+    }
+    options.nThreads = std::clamp<int64_t>(nThreads, 1, MAX_BLOCK_ASSEMBLY_THREADS);
+
     return options;
 }
 
@@ -109,6 +116,68 @@ BlockAssembler::BlockAssembler(const Config &config, const CTxMemPool &_mempool)
     : BlockAssembler(config.GetChainParams(), _mempool,
                      DefaultOptions(config)) {}
 
+/** Create the coinbase transaction of a block at nHeight collecting nFees. */
+static CTransactionRef CreateCoinbase(const CScript &scriptPubKeyIn,
+                                      int nHeight, Amount nFees,
+                                      const Consensus::Params &params) {
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout = COutPoint();
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, params);
+    coinbaseTx.vin[0].scriptSig = CScript() << ScriptInt::fromIntUnchecked(nHeight) << OP_0;
+
+    // Make sure the coinbase is big enough.
+    uint64_t coinbaseSize = ::GetSerializeSize(coinbaseTx, PROTOCOL_VERSION);
+    if (coinbaseSize < MIN_TX_SIZE) {
+        coinbaseTx.vin[0].scriptSig << std::vector<uint8_t>(MIN_TX_SIZE - coinbaseSize - 1);
+    }
+
+    return MakeTransactionRef(std::move(coinbaseTx));
+}
+
+//! Mempool size below which a block is assembled on a single thread.
+static constexpr size_t MIN_PARALLEL_ASSEMBLY_TXS = 10'000;
+
+//! Limit the number of attempts to add transactions to the block when it is
+//! close to full; this is just a simple heuristic to finish quickly if the
+//! mempool has a lot of entries.
+static constexpr int64_t MAX_CONSECUTIVE_FAILURES = 1000;
+
+/** Sort [begin, end) by sorting nThreads chunks of it in parallel and merging them. */
+template <typename RandomIt, typename Compare>
+static void ParallelSort(RandomIt begin, RandomIt end, Compare comp, unsigned nThreads) {
+    const size_t size = end - begin;
+    const size_t chunkSize = (size + nThreads - 1) / std::max(nThreads, 1u);
+    if (nThreads <= 1 || chunkSize == 0) {
+        std::sort(begin, end, comp);
+        return;
+    }
+    std::vector<std::future<void>> futures;
+    for (size_t first = 0; first < size; first += chunkSize) {
+        futures.push_back(std::async(std::launch::async, [=] {
+            std::sort(begin + first, begin + std::min(first + chunkSize, size), comp);
+        }));
+    }
+    for (auto &future : futures) {
+        future.get();
+    }
+    // Merge neighbouring runs pairwise, the merges of a round in parallel.
+    for (size_t run = chunkSize; run < size; run *= 2) {
+        futures.clear();
+        for (size_t first = 0; first + run < size; first += 2 * run) {
+            futures.push_back(std::async(std::launch::async, [=] {
+                std::inplace_merge(begin + first, begin + first + run,
+                                   begin + std::min(first + 2 * run, size), comp);
+            }));
+        }
+        for (auto &future : futures) {
+            future.get();
+        }
+    }
+}
+
 void BlockAssembler::resetBlock() {
     // Reserve space for coinbase tx.
     nBlockSize = 1000;
@@ -170,17 +239,19 @@ BlockAssembler::CreateNewBlock(const CScript &scriptPubKeyIn, double timeLimitSe
         nAddTxsTimeLimit = nTimeStart + static_cast<int64_t>(addTxsFrac * timeLimitSecs * 1e6);
     }
 
-    addTxs(nAddTxsTimeLimit);
+    const bool fParallel = nThreads > 1 && mempool->size() >= MIN_PARALLEL_ASSEMBLY_TXS;
+    addTxs(nAddTxsTimeLimit, fParallel ? nThreads : 1);
 
     const int64_t nTime0 = GetTimeMicros();
 
     if (IsMagneticAnomalyEnabled(consensusParams, pindexPrev)) {
         // If magnetic anomaly is enabled, we make sure transaction are
         // canonically ordered.
-        std::sort(std::begin(pblocktemplate->entries) + 1,
-                  std::end(pblocktemplate->entries),
-                  [](const CBlockTemplateEntry &a, const CBlockTemplateEntry &b)
-                      -> bool { return a.tx->GetId() < b.tx->GetId(); });
+        ParallelSort(std::begin(pblocktemplate->entries) + 1,
+                     std::end(pblocktemplate->entries),
+                     [](const CBlockTemplateEntry &a, const CBlockTemplateEntry &b)
+                         -> bool { return a.tx->GetId() < b.tx->GetId(); },
+                     fParallel ? nThreads : 1);
     }
 
     // Copy all the transactions refs into the block
@@ -194,31 +265,19 @@ BlockAssembler::CreateNewBlock(const CScript &scriptPubKeyIn, double timeLimitSe
     nLastBlockTx = nBlockTx;
     nLastBlockSize = nBlockSize;
 
-    // Create coinbase transaction.
-    CMutableTransaction coinbaseTx;
-    coinbaseTx.vin.resize(1);
-    coinbaseTx.vin[0].prevout = COutPoint();
-    coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
-    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, consensusParams);
-    coinbaseTx.vin[0].scriptSig = CScript() << ScriptInt::fromIntUnchecked(nHeight) << OP_0;
-
-    // Make sure the coinbase is big enough.
-    uint64_t coinbaseSize = ::GetSerializeSize(coinbaseTx, PROTOCOL_VERSION);
-    if (coinbaseSize < MIN_TX_SIZE) {
-        coinbaseTx.vin[0].scriptSig << std::vector<uint8_t>(MIN_TX_SIZE - coinbaseSize - 1);
-    }
-
-    pblocktemplate->entries[0].tx = MakeTransactionRef(coinbaseTx);
+    pblocktemplate->entries[0].tx =
+        CreateCoinbase(scriptPubKeyIn, nHeight, nFees, consensusParams);
     pblocktemplate->entries[0].fees = -1 * nFees;
     pblock->vtx[0] = pblocktemplate->entries[0].tx;
 
-    const uint64_t nByteSize =
-            checkValidity ? GetSerializeSize(*pblock, PROTOCOL_VERSION)
-                          : nBlockSize; // if not checking validity, skip re-serializing the block and estimate the size
+    // nBlockSize has the exact size of every tx but the coinbase, for which it
+    // reserved space, so there is no need to serialize the whole block again.
+    const uint64_t nByteSize = ::GetSerializeSize(CBlockHeader(), PROTOCOL_VERSION) +
+                               GetSizeOfCompactSize(pblock->vtx.size()) +
+                               nBlockSize - 1000 + pblock->vtx[0]->GetTotalSize();
 
-    LogPrintf("CreateNewBlock(): %s: %u txs: %u fees: %ld sigchecks %d\n",
-              checkValidity ? "total size" : "estimated size", nByteSize, nBlockTx, nFees, nBlockSigChecks);
+    LogPrintf("CreateNewBlock(): total size: %u txs: %u fees: %ld sigchecks %d\n",
+              nByteSize, nBlockTx, nFees, nBlockSigChecks);
 
     // Fill in header.
     pblock->hashPrevBlock = pindexPrev->GetBlockHash();
@@ -292,10 +351,47 @@ bool BlockAssembler::CheckTx(const CTransaction &tx) const {
                                       tx, state, nHeight, nLockTimeCutoff, nMedianTimePast);
 }
 
+namespace {
+/**
+ * What addTxs() takes into the block all at once: a chunk of a cluster, or an
+ * entry without in-mempool parents and children.
+ */
+struct Candidate {
+    const CTxMemPoolEntry *entry;
+    const CTxMemPoolCluster *cluster;
+    const CTxMemPoolCluster::Chunk *chunk;
+    //! Cached, as candidates are compared by it over and over
+    CFeeRate feeRate;
+
+    explicit Candidate(const CTxMemPoolEntry &_entry)
+        : entry(&_entry), cluster(nullptr), chunk(nullptr), feeRate(_entry.GetModifiedFeeRate()) {}
+    Candidate(const CTxMemPoolCluster &_cluster, const CTxMemPoolCluster::Chunk &_chunk)
+        : entry(nullptr), cluster(&_cluster), chunk(&_chunk), feeRate(_chunk.GetFeeRate()) {}
+
+    const CFeeRate &GetFeeRate() const { return feeRate; }
+    uint64_t GetTxSize() const { return chunk ? chunk->txSize : entry->GetTxSize(); }
+    int64_t GetSigChecks() const { return chunk ? chunk->sigChecks : entry->GetSigChecks(); }
+
+    /** The entries to add, parents first. */
+    const CTxMemPoolEntry *const *begin() const {
+        return chunk ? cluster->linearization.data() + chunk->begin : &entry;
+    }
+    const CTxMemPoolEntry *const *end() const {
+        return chunk ? cluster->linearization.data() + chunk->end : &entry + 1;
+    }
+};
+} // namespace
+
 /**
- * addTxs includes transactions paying a fee by ensuring that
- * the partial ordering of transactions is maintained.  That is to say
- * children come after parents, despite having a potentially larger fee.
+ * addTxs includes transactions by decreasing feerate of their chunk, see
+ * CTxMemPoolCluster, so that children may pay for their parents. A chunk is
+ * added whole or not at all, and once one does not make it in, neither do
+ * the later chunks of its cluster, which may depend on it.
+ *
+ * The mempool is split into nPartitions partitions of whole clusters, each of
+ * which picks its candidates on a thread of its own. The candidates are then
+ * merged by feerate into the block, up to its limits.
+ *
  * @param nLimitTimePoint  A time point in the future (obtained via
  *                         GetTimeMicros() + delta). If this argument is > 0,
  *                         then stop looping after this time point elapses.
@@ -303,84 +399,118 @@ bool BlockAssembler::CheckTx(const CTransaction &tx) const {
  *                         is filled to -blockmaxsize capacity (or until all
  *                         tx's in mempool are added, whichever is smaller).
  */
-void BlockAssembler::addTxs(int64_t nLimitTimePoint) {
-    using EntryPtrHasher = StdHashWrapper<const CTxMemPoolEntry *>;
-    using ParentCountMap = std::unordered_map<const CTxMemPoolEntry *, size_t, EntryPtrHasher>;
-    using ChildSet = std::unordered_set<const CTxMemPoolEntry *, EntryPtrHasher>;
-
-    // mapped_value is the number of mempool parents that are still needed for the entry.
-    // We decrement this count each time we add a parent of the entry to the block.
-    ParentCountMap missingParentCount;
-    // set of children we skipped because we have not yet added their parents
-    ChildSet skippedChildren;
-    missingParentCount.reserve(mempool->size() / 2);
-    skippedChildren.reserve(mempool->size() / 2);
-
-    auto TrackSkippedChild = [&skippedChildren](const auto &it) { skippedChildren.insert(&*it); };
-    auto IsSkippedChild = [&skippedChildren](const auto &it) { return bool(skippedChildren.count(&*it)); };
-
-    auto MissingParents = [this, &missingParentCount](const auto &iter) EXCLUSIVE_LOCKS_REQUIRED(mempool->cs) {
-        // If we've added any of this tx's parents already, then missingParentCount will have the current count
-        if (auto pcIt = missingParentCount.find(&*iter); pcIt != missingParentCount.end())
-            return pcIt->second != 0; // when pcIt->second reaches 0, we have added all of this tx's parents
-        return !mempool->GetMemPoolParents(iter).empty();
-    };
+void BlockAssembler::addTxs(int64_t nLimitTimePoint, unsigned nPartitions) {
+    using ClusterSet = std::unordered_set<const CTxMemPoolCluster *, StdHashWrapper<const CTxMemPoolCluster *>>;
 
-    auto TrackParentAdded = [this, &missingParentCount](const auto & child) EXCLUSIVE_LOCKS_REQUIRED(mempool->cs) {
-        const auto& [parentCount, inserted] = missingParentCount.try_emplace(&*child, 0 /* dummy */);
-        if (inserted) {
-            // We haven't processed any of this child tx's parents before,
-            // so we're adding the first of its in-mempool parents
-            parentCount->second = mempool->GetMemPoolParents(child).size();
-        }
-        assert(parentCount->second > 0);
-        return --parentCount->second == 0;
-    };
+    const CTxMemPool::Clusters &clusters = mempool->GetClusters();
 
     auto TimedOut = [nLimitTimePoint] {
         return nLimitTimePoint > 0 && GetTimeMicros() >= nLimitTimePoint;
     };
+    auto HigherFeeRate = [](const Candidate &a, const Candidate &b) { return a.GetFeeRate() > b.GetFeeRate(); };
+    const size_t nReserve =
+        std::min<size_t>(mempool->mapTx.size() / nPartitions + 1, nMaxGeneratedBlockSize / MIN_TX_SIZE);
+
+    // Pick the candidates of one partition in feerate order, leaving out those
+    // that are not final and the rest of their cluster, but without the block
+    // limits, which only apply when merging. A partition cannot contribute
+    // more than a full block, so it stops there. Everything used here is only
+    // read while this thread holds mempool->cs.
+    auto SelectCandidates = [&](size_t partition) NO_THREAD_SAFETY_ANALYSIS {
+        std::vector<Candidate> chunks;
+        for (const auto &[id, cluster] : clusters) {
+            if (id % nPartitions == partition) {
+                for (const CTxMemPoolCluster::Chunk &chunk : cluster.chunks) {
+                    chunks.emplace_back(cluster, chunk);
+                }
+            }
+        }
+        // The chunks of a cluster do not gain feerate along its
+        // linearization, and keep their order among equals.
+        std::stable_sort(chunks.begin(), chunks.end(), HigherFeeRate);
+
+        std::vector<Candidate> candidates;
+        candidates.reserve(nReserve);
+        ClusterSet excluded;
+        uint64_t nSize = 0, nSigChecks = 0;
+        auto mi = mempool->mapTx.get<modified_feerate>().begin();
+        const auto miEnd = mempool->mapTx.get<modified_feerate>().end();
+        auto chunk = chunks.cbegin();
+        while (!TimedOut() && nSize < nMaxGeneratedBlockSize && nSigChecks < nMaxGeneratedBlockSigChecks) {
+            // Entries in a cluster, or in another partition, come up as chunks.
+            while (mi != miEnd && (mi->GetCluster() || mi->GetEntryId() % nPartitions != partition)) {
+                ++mi;
+            }
+            if (mi == miEnd && chunk == chunks.cend()) {
+                break;
+            }
+            const Candidate candidate =
+                chunk == chunks.cend() || (mi != miEnd && !HigherFeeRate(*chunk, Candidate(*mi)))
+                    ? Candidate(*mi++)
+                    : *chunk++;
 
-    // Limit the number of attempts to add transactions to the block when it is
-    // close to full; this is just a simple heuristic to finish quickly if the
-    // mempool has a lot of entries.
-    const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
-    int64_t nConsecutiveFailed = 0;
+            if (candidate.GetFeeRate() < blockMinFeeRate) {
+                break;
+            }
+            if (candidate.cluster && excluded.count(candidate.cluster)) {
+                continue;
+            }
+            // Test transaction finality (locktime)
+            if (!std::all_of(candidate.begin(), candidate.end(),
+                             [this](const CTxMemPoolEntry *entry) { return CheckTx(entry->GetTx()); })) {
+                if (candidate.cluster) {
+                    excluded.insert(candidate.cluster);
+                }
+                continue;
+            }
+            candidates.push_back(candidate);
+            nSize += candidate.GetTxSize();
+            nSigChecks += candidate.GetSigChecks();
+        }
+        return candidates;
+    };
 
-    // Transactions that may or may not have been skipped due to parent not
-    // being present in the block, but where a parent has now been added.
-    std::queue<CTxMemPool::txiter> backlog;
-
-    CTxMemPool::txiter iter;
-    auto mi = mempool->mapTx.get<modified_feerate>().begin();
-    while (!TimedOut() && (!backlog.empty() || mi != mempool->mapTx.get<modified_feerate>().end())) {
-
-        // Get a new or old transaction in mapTx to evaluate.
-        bool isFromBacklog = false;
-        if (!backlog.empty()) {
-            iter = backlog.front();
-            backlog.pop();
-            isFromBacklog = true;
-        } else {
-            iter = mempool->mapTx.project<0>(mi++);
+    std::vector<std::future<std::vector<Candidate>>> futures;
+    for (size_t partition = 1; partition < nPartitions; ++partition) {
+        futures.push_back(std::async(std::launch::async, SelectCandidates, partition));
+    }
+    std::vector<std::vector<Candidate>> partitions;
+    partitions.push_back(SelectCandidates(0));
+    for (auto &future : futures) {
+        partitions.push_back(future.get());
+    }
+
+    // Merge the partitions by feerate.
+    using Head = std::pair<size_t, size_t>; // partition, position
+    auto HeadAfter = [&partitions, &HigherFeeRate](const Head &a, const Head &b) {
+        return HigherFeeRate(partitions[b.first][b.second], partitions[a.first][a.second]);
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(HeadAfter)> heads(HeadAfter);
+    for (size_t partition = 0; partition < partitions.size(); ++partition) {
+        if (!partitions[partition].empty()) {
+            heads.emplace(partition, 0);
         }
+    }
 
-        if (iter->GetModifiedFeeRate() < blockMinFeeRate) {
-            break;
+    ClusterSet excluded;
+    int64_t nConsecutiveFailed = 0;
+    while (!heads.empty() && !TimedOut()) {
+        const auto [partition, pos] = heads.top();
+        heads.pop();
+        if (pos + 1 < partitions[partition].size()) {
+            heads.emplace(partition, pos + 1);
         }
+        const Candidate &candidate = partitions[partition][pos];
 
-        // Check whether all of this tx's parents are already in the block. If
-        // not, pass on it until later.
-        //
-        // If it's from the backlog, then we know all parents are already in
-        // the block.
-        if (!isFromBacklog && MissingParents(iter)) {
-            TrackSkippedChild(iter);
+        if (candidate.cluster && excluded.count(candidate.cluster)) {
             continue;
         }
 
-        // Check whether the tx will exceed the block limits.
-        if (!TestTx(iter->GetTxSize(), iter->GetSigChecks())) {
+        // Check whether the candidate will exceed the block limits.
+        if (!TestTx(candidate.GetTxSize(), candidate.GetSigChecks())) {
+            if (candidate.cluster) {
+                excluded.insert(candidate.cluster);
+            }
             ++nConsecutiveFailed;
             if (nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockSize > nMaxGeneratedBlockSize - 1000) {
                 // Give up if we're close to full and haven't succeeded in a while.
@@ -389,35 +519,221 @@ void BlockAssembler::addTxs(int64_t nLimitTimePoint) {
             continue;
         }
 
-        // Test transaction finality (locktime)
-        if (!CheckTx(iter->GetTx())) {
-            continue;
+        // This candidate will make it in; reset the failed counter.
+        nConsecutiveFailed = 0;
+
+        for (const CTxMemPoolEntry *entry : candidate) {
+            AddToBlock(mempool->mapTx.iterator_to(*entry));
         }
+    }
+}
 
-        // This transaction will make it in; reset the failed counter.
-        nConsecutiveFailed = 0;
+std::unique_ptr<BlockTemplateTracker> g_blocktemplatetracker;
 
-        // Tx can be added.
-        AddToBlock(iter);
-
-        // This tx's children may now be candidates for addition if they have
-        // higher scores than the tx at the cursor. We can only process a
-        // child once all of that tx's parents have been added, though. To
-        // avoid O(n^2) checking of dependencies, we store and decrement the
-        // number of mempool parents for each child. Although this code
-        // ends up taking O(n) time to process a single tx with n children,
-        // that's okay because the amount of time taken is proportional to the
-        // tx's byte size and fee paid.
-        for (const auto& child : mempool->GetMemPoolChildren(iter)) {
-            const bool allParentsAdded = TrackParentAdded(child);
-            // If all parents have been added to the block, and if this child
-            // has been previously skipped due to missing parents, enqueue it
-            // (if it hasn't been skipped it will come up in a later iteration)
-            if (allParentsAdded && IsSkippedChild(child)) {
-                backlog.push(child);
-            }
+BlockTemplateTracker::BlockTemplateTracker(const Config &_config,
+                                           const CTxMemPool &_mempool)
+    : config(_config), mempool(_mempool) {
+    const BlockAssembler assembler(config, mempool);
+    nMaxGeneratedBlockSize = assembler.GetMaxGeneratedBlockSize();
+    nMaxGeneratedBlockSigChecks = assembler.GetMaxGeneratedBlockSigChecks();
+    blockMinFeeRate = assembler.GetBlockMinFeeRate();
+}
+
+bool BlockTemplateTracker::CanSnapshot() const {
+    AssertLockHeld(cs_main);
+    LOCK(cs);
+    return fComplete && pindexPrev == ::ChainActive().Tip();
+}
+
+std::unique_ptr<CBlockTemplate>
+BlockTemplateTracker::CreateNewBlock(const CScript &scriptPubKeyIn,
+                                     double timeLimitSecs, bool checkValidity) {
+    LOCK2(cs_main, mempool.cs);
+    {
+        LOCK(cs);
+        if (fComplete && pindexPrev == ::ChainActive().Tip()) {
+            return Snapshot(scriptPubKeyIn, checkValidity);
         }
     }
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate =
+        BlockAssembler(config, mempool)
+            .CreateNewBlock(scriptPubKeyIn, timeLimitSecs, checkValidity);
+    LOCK(cs);
+    Seed(*pblocktemplate, ::ChainActive().Tip());
+    return pblocktemplate;
+}
+
+void BlockTemplateTracker::Seed(const CBlockTemplate &blocktemplate,
+                                CBlockIndex *pindex) {
+    pindexPrev = pindex;
+    nHeight = pindex->nHeight + 1;
+    nMedianTimePast = pindex->GetMedianTimePast();
+    nLockTimeCutoff =
+        (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+            ? nMedianTimePast
+            : blocktemplate.block.GetBlockTime();
+
+    // Same reservation for the coinbase as BlockAssembler::resetBlock().
+    txs.clear();
+    nBlockSize = 1000;
+    nBlockSigChecks = 100;
+    nFees = Amount::zero();
+    for (auto it = std::next(blocktemplate.entries.begin());
+         it != blocktemplate.entries.end(); ++it) {
+        const uint64_t txSize = it->tx->GetTotalSize();
+        txs.emplace(it->tx->GetId(), TrackedTx{*it, txSize});
+        nBlockSize += txSize;
+        nBlockSigChecks += it->sigChecks;
+        nFees += it->fees;
+    }
+
+    // BlockAssembler leaves out what does not fit or what it had no time
+    // for, and the tracked set must be in canonical order.
+    fComplete = txs.size() == mempool.size() &&
+                IsMagneticAnomalyEnabled(config.GetChainParams().GetConsensus(),
+                                         pindex);
+}
+
+void BlockTemplateTracker::Add(CTxMemPool::txiter iter) {
+    const CTransaction &tx = iter->GetTx();
+    if (txs.count(tx.GetId())) {
+        // Already taken from the mempool when the set was seeded.
+        return;
+    }
+
+    bool fits = iter->GetModifiedFeeRate() >= blockMinFeeRate &&
+                nBlockSize + iter->GetTxSize() < nMaxGeneratedBlockSize &&
+                nBlockSigChecks + iter->GetSigChecks() <
+                    nMaxGeneratedBlockSigChecks;
+    for (const auto &parent : mempool.GetMemPoolParents(iter)) {
+        fits = fits && txs.count(parent->GetTx().GetId());
+    }
+    CValidationState state;
+    if (!fits ||
+        !ContextualCheckTransaction(config.GetChainParams().GetConsensus(), tx,
+                                    state, nHeight, nLockTimeCutoff,
+                                    nMedianTimePast)) {
+        fComplete = false;
+        return;
+    }
+
+    txs.emplace(tx.GetId(),
+                TrackedTx{CBlockTemplateEntry(iter->GetSharedTx(),
+                                              iter->GetFee(),
+                                              iter->GetSigChecks()),
+                          iter->GetTxSize()});
+    nBlockSize += iter->GetTxSize();
+    nBlockSigChecks += iter->GetSigChecks();
+    nFees += iter->GetFee();
+}
+
+void BlockTemplateTracker::Remove(const TxId &txid) {
+    const auto it = txs.find(txid);
+    if (it == txs.end()) {
+        return;
+    }
+    nBlockSize -= it->second.txSize;
+    nBlockSigChecks -= it->second.entry.sigChecks;
+    nFees -= it->second.entry.fees;
+    txs.erase(it);
+}
+
+std::unique_ptr<CBlockTemplate>
+BlockTemplateTracker::Snapshot(const CScript &scriptPubKeyIn,
+                               bool checkValidity) {
+    const int64_t nTimeStart = GetTimeMicros();
+    const CChainParams &chainparams = config.GetChainParams();
+    const Consensus::Params &consensusParams = chainparams.GetConsensus();
+
+    // Removals may still be waiting in the validation interface queue.
+    std::vector<TxId> removed;
+    for (const auto &[txid, tracked] : txs) {
+        if (!mempool.exists(txid)) {
+            removed.push_back(txid);
+        }
+    }
+    for (const TxId &txid : removed) {
+        Remove(txid);
+    }
+
+    auto pblocktemplate = std::make_unique<CBlockTemplate>();
+    CBlock *pblock = &pblocktemplate->block;
+    pblocktemplate->entries.reserve(txs.size() + 1);
+    pblocktemplate->entries.emplace_back(
+        CreateCoinbase(scriptPubKeyIn, nHeight, nFees, consensusParams),
+        -1 * nFees, 0);
+    for (const auto &[txid, tracked] : txs) {
+        pblocktemplate->entries.push_back(tracked.entry);
+    }
+    pblock->vtx.reserve(pblocktemplate->entries.size());
+    for (const CBlockTemplateEntry &entry : pblocktemplate->entries) {
+        pblock->vtx.push_back(entry.tx);
+    }
+
+    nLastBlockTx = txs.size();
+    nLastBlockSize = nBlockSize;
+
+    // Fill in header.
+    pblock->nVersion = ComputeBlockVersion(pindexPrev, consensusParams);
+    if (chainparams.MineBlocksOnDemand()) {
+        pblock->nVersion = gArgs.GetArg("-blockversion", pblock->nVersion);
+    }
+    pblock->nTime = GetAdjustedTime();
+    pblock->hashPrevBlock = pindexPrev->GetBlockHash();
+    UpdateTime(pblock, consensusParams, pindexPrev);
+    pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, consensusParams);
+    pblock->nNonce = 0;
+
+    if (checkValidity) {
+        CValidationState state;
+        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev,
+                               BlockValidationOptions(GetConfig())
+                                   .withCheckPoW(false)
+                                   .withCheckMerkleRoot(false))) {
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s",
+                                               __func__,
+                                               FormatStateMessage(state)));
+        }
+    }
+
+    LogPrint(BCLog::BENCH,
+             "BlockTemplateTracker::CreateNewBlock() snapshot: %u txs, "
+             "estimated size %u, %.2fms\n",
+             txs.size(), nBlockSize, 0.001 * (GetTimeMicros() - nTimeStart));
+
+    return pblocktemplate;
+}
+
+void BlockTemplateTracker::TransactionAddedToMempool(
+    const CTransactionRef &ptx) {
+    LOCK2(mempool.cs, cs);
+    if (!fComplete) {
+        // Nothing to keep up to date until the next seed.
+        return;
+    }
+    const auto iter = mempool.mapTx.find(ptx->GetId());
+    if (iter != mempool.mapTx.end()) {
+        Add(iter);
+    }
+}
+
+void BlockTemplateTracker::TransactionRemovedFromMempool(
+    const CTransactionRef &ptx) {
+    LOCK(cs);
+    Remove(ptx->GetId());
+}
+
+void BlockTemplateTracker::BlockConnected(
+    const std::shared_ptr<const CBlock> &pblock, const CBlockIndex *pindex,
+    const std::vector<CTransactionRef> &txnConflicted) {
+    LOCK(cs);
+    // The set may already have been seeded on this block by CreateNewBlock.
+    if (pindex != pindexPrev) {
+        pindexPrev = nullptr;
+        fComplete = false;
+        txs.clear();
+    }
 }
 
 static
@@ -7,12 +7,15 @@
 #define BITCOIN_MINER_H
 
 #include <primitives/block.h>
+#include <sync.h>
 #include <txmempool.h>
+#include <validationinterface.h>
 
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index_container.hpp>
 
 #include <cstdint>
+#include <map>
 #include <memory>
 
 class CBlockIndex;
@@ -25,6 +28,12 @@ struct Params;
 }
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -gbtincremental */
+static const bool DEFAULT_GBT_INCREMENTAL = true;
+/** Default for -blockassemblythreads, 0 = one per core */
+static const int DEFAULT_BLOCK_ASSEMBLY_THREADS = 0;
+/** Maximum number of threads used to assemble a block */
+static const int MAX_BLOCK_ASSEMBLY_THREADS = 16;
 
 struct CBlockTemplateEntry {
     CTransactionRef tx;
@@ -72,12 +81,17 @@ private:
 
     const bool fPrintPriority;
 
+    //! Threads used to select txs and sort the block, when the mempool is
+    //! large enough for it to pay off.
+    unsigned nThreads;
+
 public:
     struct Options {
         Options();
         uint64_t nExcessiveBlockSize;
         uint64_t nMaxGeneratedBlockSize;
         CFeeRate blockMinFeeRate;
+        unsigned nThreads;
     };
 
     BlockAssembler(const Config &config, const CTxMemPool &_mempool);
@@ -99,6 +113,10 @@ public:
     CreateNewBlock(const CScript &scriptPubKeyIn, double timeLimitSecs = 0., bool checkValidity = true);
 
     uint64_t GetMaxGeneratedBlockSize() const { return nMaxGeneratedBlockSize; }
+    uint64_t GetMaxGeneratedBlockSigChecks() const {
+        return nMaxGeneratedBlockSigChecks;
+    }
+    CFeeRate GetBlockMinFeeRate() const { return blockMinFeeRate; }
 
 private:
     // utility functions
@@ -109,9 +127,10 @@ private:
 
     // Methods for how to add transactions to a block.
     /**
-     * Add transactions from the mempool based on individual tx feerate.
+     * Add transactions from the mempool based on the feerate of their
+     * chunk, picking them on nPartitions threads.
      */
-    void addTxs(int64_t nLimitTimePoint)
+    void addTxs(int64_t nLimitTimePoint, unsigned nPartitions)
         EXCLUSIVE_LOCKS_REQUIRED(mempool->cs);
 
     // helper functions for addTxs()
@@ -122,6 +141,88 @@ private:
     bool CheckTx(const CTransaction &tx) const;
 };
 
+/**
+ * Keeps a block template up to date as transactions enter and leave the
+ * mempool, so that getblocktemplate does not have to assemble one from scratch
+ * each time the mempool changes.
+ *
+ * The template is seeded by a regular BlockAssembler run on the current tip.
+ * As long as every mempool transaction fits in it, the template is simply the
+ * whole mempool, so later additions and removals are applied as deltas to a
+ * set kept in canonical (txid) order, and a new template is a snapshot of it.
+ * Once a transaction does not make it in (block limits, -blockmintxfee or
+ * finality), choosing between transactions matters again and the next
+ * template is assembled from scratch. A new tip always starts over.
+ */
+class BlockTemplateTracker final : public CValidationInterface {
+public:
+    BlockTemplateTracker(const Config &config, const CTxMemPool &_mempool);
+
+    /**
+     * Whether CreateNewBlock can take a snapshot of the tracked set instead
+     * of assembling a new template from scratch.
+     */
+    bool CanSnapshot() const EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /**
+     * Construct a new block template with coinbase to scriptPubKeyIn, either
+     * as a snapshot of the tracked set or, if that is not possible, with
+     * BlockAssembler::CreateNewBlock, which then seeds the tracked set.
+     * timeLimitSecs only applies to the latter.
+     */
+    std::unique_ptr<CBlockTemplate>
+    CreateNewBlock(const CScript &scriptPubKeyIn, double timeLimitSecs = 0.,
+                   bool checkValidity = true);
+
+protected:
+    // CValidationInterface
+    void TransactionAddedToMempool(const CTransactionRef &ptx) override;
+    void TransactionRemovedFromMempool(const CTransactionRef &ptx) override;
+    void BlockConnected(const std::shared_ptr<const CBlock> &pblock,
+                        const CBlockIndex *pindex,
+                        const std::vector<CTransactionRef> &txnConflicted) override;
+
+private:
+    struct TrackedTx {
+        CBlockTemplateEntry entry;
+        uint64_t txSize;
+    };
+
+    const Config &config;
+    const CTxMemPool &mempool;
+    uint64_t nMaxGeneratedBlockSize;
+    uint64_t nMaxGeneratedBlockSigChecks;
+    CFeeRate blockMinFeeRate;
+
+    mutable Mutex cs;
+    //! The tip the tracked set was seeded on, or nullptr if there is none
+    CBlockIndex *pindexPrev GUARDED_BY(cs){nullptr};
+    //! False once a mempool transaction did not make it into the set
+    bool fComplete GUARDED_BY(cs){false};
+    //! The template transactions, excluding the coinbase, by txid
+    std::map<TxId, TrackedTx> txs GUARDED_BY(cs);
+    uint64_t nBlockSize GUARDED_BY(cs){0};
+    uint64_t nBlockSigChecks GUARDED_BY(cs){0};
+    Amount nFees GUARDED_BY(cs){Amount::zero()};
+    int nHeight GUARDED_BY(cs){0};
+    int64_t nLockTimeCutoff GUARDED_BY(cs){0};
+    int64_t nMedianTimePast GUARDED_BY(cs){0};
+
+    void Seed(const CBlockTemplate &blocktemplate, CBlockIndex *pindex)
+        EXCLUSIVE_LOCKS_REQUIRED(cs_main, mempool.cs, cs);
+    void Add(CTxMemPool::txiter iter) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs, cs);
+    void Remove(const TxId &txid) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    std::unique_ptr<CBlockTemplate> Snapshot(const CScript &scriptPubKeyIn,
+                                             bool checkValidity)
+        EXCLUSIVE_LOCKS_REQUIRED(cs_main, mempool.cs, cs);
+};
+
+/**
+ * Tracks the block template for getblocktemplate, or nullptr if
+ * -gbtincremental is off.
+ */
+extern std::unique_ptr<BlockTemplateTracker> g_blocktemplatetracker;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock *pblock, const CBlockIndex *pindexPrev,
                          uint64_t nExcessiveBlockSize,
@@ -40,11 +40,23 @@
 #include <miniupnpc/upnperrors.h>
 #endif
 
+#include <array>
 #include <cmath>
 
 // Dump addresses to peers.dat every 15 minutes (900s)
 static constexpr int DUMP_PEERS_INTERVAL = 15 * 60;
 
+#ifdef USE_EPOLL
+// How long to wait for socket events at most, so as to notice the nodes which
+// resumed receiving
+static constexpr int SOCKET_WAIT_MILLIS = 50;
+// How many socket events to handle per epoll_wait() call
+static constexpr size_t MAX_SOCKET_EVENTS = 1024;
+// The events of the listening sockets carry this plus their index, those of
+// the nodes their id, which is below it.
+static constexpr uint64_t LISTEN_SOCKET_EVENT = uint64_t(1) << 63;
+#endif
+
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent
 // synchronization.
 #define FEELER_SLEEP_WINDOW 1
@@ -1092,6 +1104,7 @@ void CConnman::AcceptConnection(const ListenSocket &hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterSocket(pnode);
     }
 }
 
@@ -1118,6 +1131,9 @@ void CConnman::DisconnectNodes() {
                 // remove from vNodes
                 vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode),
                              vNodes.end());
+#ifdef USE_EPOLL
+                mapSocketNodes.erase(pnode->GetId());
+#endif
 
                 // release outbound grant (if any)
                 pnode->grantOutbound.Release();
@@ -1203,6 +1219,222 @@ void CConnman::InactivityCheck(CNode *pnode) {
     }
 }
 
+void CConnman::RegisterSocket(CNode *pnode) {
+#ifdef USE_EPOLL
+    if (epollfd == -1) {
+        return;
+    }
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET) {
+        return;
+    }
+    // Edge-triggered: the readiness is reported once per change, and kept in
+    // the node until it is used up. The events carry the node id rather than
+    // the node, as they may outlive it: the registration only goes away once
+    // no process has the socket open anymore.
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = pnode->GetId();
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("epoll_ctl error %s\n", NetworkErrorString(errno));
+        pnode->fDisconnect = true;
+        return;
+    }
+    mapSocketNodes.emplace(pnode->GetId(), pnode);
+#endif
+}
+
+bool CConnman::SocketRecvData(CNode *pnode) {
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int32_t nBytes = 0;
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET) {
+            return false;
+        }
+        nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    }
+    if (nBytes > 0) {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(*config, pchBuf, nBytes, notify)) {
+            pnode->CloseSocketDisconnect();
+        }
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                if (!it->complete()) {
+                    break;
+                }
+                nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+            }
+            {
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(),
+                                          pnode->vRecvMsg,
+                                          pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            WakeMessageHandler();
+        }
+        // A short read drained the socket.
+        return size_t(nBytes) == sizeof(pchBuf);
+    }
+    if (nBytes == 0) {
+        // socket closed gracefully
+        if (!pnode->fDisconnect) {
+            LogPrint(BCLog::NET, "socket closed\n");
+        }
+        pnode->CloseSocketDisconnect();
+        return false;
+    }
+    // error
+    int nErr = WSAGetLastError();
+    if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR &&
+        nErr != WSAEINPROGRESS) {
+        if (!pnode->fDisconnect) {
+            LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+        }
+        pnode->CloseSocketDisconnect();
+        return false;
+    }
+    return nErr != WSAEWOULDBLOCK;
+}
+
+#ifdef USE_EPOLL
+void CConnman::SocketHandler() {
+    //
+    // Find which sockets became ready. Only the changes are reported, so the
+    // nodes left with something to read are kept from one round to the next,
+    // and not waited for if they can read right away.
+    //
+    std::array<struct epoll_event, MAX_SOCKET_EVENTS> events;
+    int nEvents = epoll_wait(epollfd, events.data(), events.size(),
+                             fSocketsPending ? 0 : SOCKET_WAIT_MILLIS);
+    if (interruptNet) {
+        return;
+    }
+
+    if (nEvents == SOCKET_ERROR) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll error %s\n", NetworkErrorString(nErr));
+            if (!interruptNet.sleep_for(
+                    std::chrono::milliseconds(SOCKET_WAIT_MILLIS))) {
+                return;
+            }
+        }
+        nEvents = 0;
+    }
+
+    // The nodes with a ready socket, each referenced once
+    std::vector<CNode *> vNodesReady;
+    vNodesReady.swap(vNodesSocketReady);
+    std::vector<size_t> vListenReady;
+    {
+        LOCK(cs_vNodes);
+        for (int i = 0; i < nEvents; ++i) {
+            const struct epoll_event &event = events[i];
+            if (event.data.u64 >= LISTEN_SOCKET_EVENT) {
+                vListenReady.push_back(event.data.u64 - LISTEN_SOCKET_EVENT);
+                continue;
+            }
+
+            auto it = mapSocketNodes.find(NodeId(event.data.u64));
+            if (it == mapSocketNodes.end()) {
+                continue;
+            }
+            CNode *pnode = it->second;
+            if (!pnode->fSocketRecvReady && !pnode->fSocketSendReady) {
+                vNodesReady.push_back(pnode->AddRef());
+            }
+            if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                pnode->fSocketRecvReady = true;
+            }
+            if (event.events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                pnode->fSocketSendReady = true;
+            }
+        }
+    }
+
+    //
+    // Accept new connections
+    //
+    for (size_t nListen : vListenReady) {
+        AcceptConnection(vhListenSocket[nListen]);
+    }
+
+    //
+    // Service the ready sockets
+    //
+    fSocketsPending = false;
+    std::vector<CNode *> vNodesDone;
+    for (CNode *pnode : vNodesReady) {
+        // Send what the optimistic write in PushMessage() left over. Anything
+        // left now means the socket is full, and will be reported once it is
+        // not.
+        bool fSendPending = false;
+        {
+            LOCK(pnode->cs_vSend);
+            if (pnode->fSocketSendReady) {
+                size_t nBytes = SocketSendData(pnode);
+                if (nBytes) {
+                    RecordBytesSent(nBytes);
+                }
+            }
+            fSendPending = !pnode->vSendMsg.empty();
+        }
+        pnode->fSocketSendReady = false;
+
+        // As with select(), drain the write buffer before receiving more, and
+        // only receive while there is space left in the receive buffer. What
+        // is left in the meantime stays in the socket, for TCP flow control to
+        // hold the peer back.
+        if (pnode->fSocketRecvReady && !fSendPending && !pnode->fPauseRecv) {
+            pnode->fSocketRecvReady = SocketRecvData(pnode);
+            fSocketsPending |= pnode->fSocketRecvReady;
+        }
+
+        if (pnode->fSocketRecvReady && !pnode->fDisconnect) {
+            vNodesSocketReady.push_back(pnode);
+        } else {
+            pnode->fSocketRecvReady = false;
+            vNodesDone.push_back(pnode);
+        }
+    }
+    {
+        LOCK(cs_vNodes);
+        for (CNode *pnode : vNodesDone) {
+            pnode->Release();
+        }
+    }
+
+    const int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime >= nLastInactivityCheck + 1) {
+        nLastInactivityCheck = nTime;
+        std::vector<CNode *> vNodesCopy;
+        {
+            LOCK(cs_vNodes);
+            vNodesCopy = vNodes;
+            for (CNode *pnode : vNodesCopy) {
+                pnode->AddRef();
+            }
+        }
+        for (CNode *pnode : vNodesCopy) {
+            InactivityCheck(pnode);
+        }
+        {
+            LOCK(cs_vNodes);
+            for (CNode *pnode : vNodesCopy) {
+                pnode->Release();
+            }
+        }
+    }
+}
+#else
 void CConnman::SocketHandler() {
     //
     // Find which sockets have data to receive
@@ -1332,62 +1564,7 @@ void CConnman::SocketHandler() {
             errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
         }
         if (recvSet || errorSet) {
-            // typical socket buffer is 8K-64K
-            char pchBuf[0x10000];
-            int32_t nBytes = 0;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET) {
-                    continue;
-                }
-                nBytes =
-                    recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-            }
-            if (nBytes > 0) {
-                bool notify = false;
-                if (!pnode->ReceiveMsgBytes(*config, pchBuf, nBytes, notify)) {
-                    pnode->CloseSocketDisconnect();
-                }
-                RecordBytesRecv(nBytes);
-                if (notify) {
-                    size_t nSizeAdded = 0;
-                    auto it(pnode->vRecvMsg.begin());
-                    for (; it != pnode->vRecvMsg.end(); ++it) {
-                        if (!it->complete()) {
-                            break;
-                        }
-                        nSizeAdded +=
-                            it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                    }
-                    {
-                        LOCK(pnode->cs_vProcessMsg);
-                        pnode->vProcessMsg.splice(pnode->vProcessMsg.end(),
-                                                  pnode->vRecvMsg,
-                                                  pnode->vRecvMsg.begin(), it);
-                        pnode->nProcessQueueSize += nSizeAdded;
-                        pnode->fPauseRecv =
-                            pnode->nProcessQueueSize > nReceiveFloodSize;
-                    }
-                    WakeMessageHandler();
-                }
-            } else if (nBytes == 0) {
-                // socket closed gracefully
-                if (!pnode->fDisconnect) {
-                    LogPrint(BCLog::NET, "socket closed\n");
-                }
-                pnode->CloseSocketDisconnect();
-            } else if (nBytes < 0) {
-                // error
-                int nErr = WSAGetLastError();
-                if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE &&
-                    nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                    if (!pnode->fDisconnect) {
-                        LogPrintf("socket recv error %s\n",
-                                  NetworkErrorString(nErr));
-                    }
-                    pnode->CloseSocketDisconnect();
-                }
-            }
+            SocketRecvData(pnode);
         }
 
         //
@@ -1410,6 +1587,7 @@ void CConnman::SocketHandler() {
         }
     }
 }
+#endif
 
 void CConnman::ThreadSocketHandler() {
     while (!interruptNet) {
@@ -1421,10 +1599,10 @@ void CConnman::ThreadSocketHandler() {
 
 void CConnman::WakeMessageHandler() {
     {
-        std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        LOCK(mutexMsgProc);
+        ++nMsgProcWake;
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
 }
 
 #ifdef USE_UPNP
@@ -2008,17 +2186,20 @@ void CConnman::OpenNetworkConnection(const CAddress &addrConnect,
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterSocket(pnode);
     }
 }
 
-void CConnman::ThreadMessageHandler() {
+void CConnman::ThreadMessageHandler(int nThread) {
+    uint64_t nWakeSeen = WITH_LOCK(mutexMsgProc, return nMsgProcWake);
     while (!flagInterruptMsgProc) {
         std::vector<CNode *> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode *pnode : vNodesCopy) {
-                pnode->AddRef();
+            for (CNode *pnode : vNodes) {
+                if (pnode->GetId() % nMsgHandlerThreads == nThread) {
+                    vNodesCopy.push_back(pnode->AddRef());
+                }
             }
         }
 
@@ -2060,9 +2241,13 @@ void CConnman::ThreadMessageHandler() {
         WAIT_LOCK(mutexMsgProc, lock);
         if (!fMoreWork) {
             int64_t nSleepFor = std::max((int64_t)0, std::min((int64_t)100000, nSleepUntil - GetTimeMicros()));
-            condMsgProc.wait_for(lock, std::chrono::microseconds(nSleepFor), [this] { return fMsgProcWake; });
+            condMsgProc.wait_for(
+                lock, std::chrono::microseconds(nSleepFor),
+                [&]() EXCLUSIVE_LOCKS_REQUIRED(mutexMsgProc) {
+                    return nMsgProcWake != nWakeSeen;
+                });
         }
-        fMsgProcWake = false;
+        nWakeSeen = nMsgProcWake;
     }
 }
 
@@ -2328,10 +2513,29 @@ bool CConnman::Start(CScheduler &scheduler, const Options &connOptions) {
     interruptNet.reset();
     flagInterruptMsgProc = false;
 
-    {
-        LOCK(mutexMsgProc);
-        fMsgProcWake = false;
+#ifdef USE_EPOLL
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == -1) {
+        if (clientInterface) {
+            clientInterface->ThreadSafeMessageBox(
+                _("Failed to create the epoll instance"), "",
+                CClientUIInterface::MSG_ERROR);
+        }
+        return false;
+    }
+    // The listening sockets are level-triggered, for AcceptConnection() to
+    // take one connection per event.
+    for (size_t i = 0; i < vhListenSocket.size(); ++i) {
+        const ListenSocket &hListenSocket = vhListenSocket[i];
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = LISTEN_SOCKET_EVENT + i;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) !=
+            0) {
+            LogPrintf("epoll_ctl error %s\n", NetworkErrorString(errno));
+        }
     }
+#endif
 
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(
@@ -2372,10 +2576,13 @@ bool CConnman::Start(CScheduler &scheduler, const Options &connOptions) {
     }
 
     // Process messages
-    threadMessageHandler =
-        std::thread(&TraceThread<std::function<void()>>, "msghand",
-                    std::function<void()>(
-                        std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMsgHandlerThreads; ++i) {
+        const std::string name =
+            i == 0 ? std::string("msghand") : strprintf("msghand.%d", i);
+        threadMessageHandlers.emplace_back([this, i, name] {
+            TraceThread(name.c_str(), [this, i] { ThreadMessageHandler(i); });
+        });
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery(
@@ -2424,9 +2631,10 @@ void CConnman::Interrupt() {
 }
 
 void CConnman::Stop() {
-    if (threadMessageHandler.joinable()) {
-        threadMessageHandler.join();
+    for (std::thread &thread : threadMessageHandlers) {
+        thread.join();
     }
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable()) {
         threadOpenConnections.join();
     }
@@ -2468,6 +2676,14 @@ void CConnman::Stop() {
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+#ifdef USE_EPOLL
+    vNodesSocketReady.clear();
+    WITH_LOCK(cs_vNodes, mapSocketNodes.clear());
+    if (epollfd != -1) {
+        close(epollfd);
+        epollfd = -1;
+    }
+#endif
     semOutbound.reset();
     semAddnode.reset();
 }
@@ -2804,11 +3020,9 @@ bool CConnman::ForNode(NodeId id, std::function<bool(CNode *pnode)> func) {
 }
 
 int64_t CConnman::PoissonNextSendInbound(int64_t now, int average_interval_ms) {
+    // The message handler threads all share the same schedule.
+    LOCK(cs_next_send_inv_to_incoming);
     if (m_next_send_inv_to_incoming < now) {
-        // If this function were called from multiple threads simultaneously
-        // it would be possible that both update the next send variable, and
-        // return a different result to their caller. This is not possible in
-        // practice as only the net processing thread invokes this function.
         m_next_send_inv_to_incoming =
             PoissonNextSend(now, average_interval_ms);
     }
@@ -34,12 +34,14 @@
 #include <deque>
 #include <memory>
 #include <thread>
+#include <unordered_map>
 
 #ifndef WIN32
 #include <arpa/inet.h>
 #endif
 
 class BanMan;
+class CBlockIndex;
 class Config;
 class CNode;
 class CScheduler;
@@ -93,6 +95,10 @@ static const int64_t DEFAULT_PEER_CONNECT_TIMEOUT = 60;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER = 1 * 1000;
+/** -msghandlerthreads default */
+static const int DEFAULT_MSGHANDLER_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHANDLER_THREADS = 16;
 
 struct AddedNodeInfo {
     std::string strAddedNode;
@@ -141,6 +147,7 @@ public:
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
         int64_t m_peer_connect_timeout = DEFAULT_PEER_CONNECT_TIMEOUT;
+        int nMsgHandlerThreads = DEFAULT_MSGHANDLER_THREADS;
         std::vector<std::string> vSeedNodes;
         std::vector<NetWhitelistPermissions> vWhitelistedRange;
         std::vector<NetWhitebindPermissions> vWhiteBinds;
@@ -165,6 +172,7 @@ public:
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
         m_peer_connect_timeout = connOptions.m_peer_connect_timeout;
+        nMsgHandlerThreads = std::max(connOptions.nMsgHandlerThreads, 1);
         {
             LOCK(cs_totalBytesSent);
             nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
@@ -350,11 +358,26 @@ private:
     void AddOneShot(const std::string &strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    /**
+     * Process the messages of the nodes whose id modulo nMsgHandlerThreads is
+     * nThread, so that the messages of a node are all processed in order, by
+     * the same thread.
+     */
+    void ThreadMessageHandler(int nThread);
     void AcceptConnection(const ListenSocket &hListenSocket);
     void DisconnectNodes();
     void NotifyNumConnectionsChanged();
     void InactivityCheck(CNode *pnode);
+    /**
+     * Register the socket of a new node with the epoll instance, if any, for
+     * edge-triggered notifications of its readiness.
+     */
+    void RegisterSocket(CNode *pnode) EXCLUSIVE_LOCKS_REQUIRED(cs_vNodes);
+    /**
+     * Receive what the socket of a node has to read, up to a buffer. Returns
+     * whether the socket may have more to read.
+     */
+    bool SocketRecvData(CNode *pnode);
     void SocketHandler();
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
@@ -411,6 +434,19 @@ private:
     unsigned int nReceiveFloodSize{0};
 
     std::vector<ListenSocket> vhListenSocket;
+#ifdef USE_EPOLL
+    //! The epoll instance the sockets are registered with, once started
+    int epollfd{-1};
+    //! The nodes with a registered socket, by id
+    std::unordered_map<NodeId, CNode *> mapSocketNodes GUARDED_BY(cs_vNodes);
+    //! The nodes which were left with something to read by the last
+    //! SocketHandler() round, each referenced once
+    std::vector<CNode *> vNodesSocketReady;
+    //! Whether some of them may read right away
+    bool fSocketsPending{false};
+    //! When the nodes were last checked for inactivity, in seconds
+    int64_t nLastInactivityCheck{0};
+#endif
     std::atomic<bool> fNetworkActive{true};
     bool fAddressesInitialized{false};
     CAddrMan addrman;
@@ -442,8 +478,11 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /**
+     * Counts the requests to wake the message handlers up, each of which
+     * remembers the last count it saw.
+     */
+    uint64_t nMsgProcWake GUARDED_BY(mutexMsgProc){0};
 
     std::condition_variable condMsgProc;
     Mutex mutexMsgProc;
@@ -455,7 +494,8 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
+    int nMsgHandlerThreads{DEFAULT_MSGHANDLER_THREADS};
 
     /**
      * Flag for deciding to connect to an extra outbound peer, in excess of
@@ -464,7 +504,9 @@ private:
      */
     std::atomic_bool m_try_another_outbound_peer;
 
-    std::atomic<int64_t> m_next_send_inv_to_incoming{0};
+    Mutex cs_next_send_inv_to_incoming;
+    int64_t m_next_send_inv_to_incoming
+        GUARDED_BY(cs_next_send_inv_to_incoming){0};
 
     friend struct CConnmanTest;
 };
@@ -718,6 +760,11 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv{false};
     std::atomic_bool fPauseSend{false};
+    //! Whether the socket may have data to read, or has room to write again,
+    //! as epoll reported. It only reports changes, so the former is kept until
+    //! the socket is drained. Only used by the socket handler thread.
+    bool fSocketRecvReady{false};
+    bool fSocketSendReady{false};
 
     /* ExtVersion support */
     Mutex cs_extversion;
@@ -734,11 +781,18 @@ protected:
 
 public:
     BlockHash hashContinue;
+    //! The last header sent in reply to a getheaders served without cs_main,
+    //! for SendMessages() to record in the node state. Only used by the
+    //! message handler thread of the node.
+    const CBlockIndex *pindexHeadersSent{nullptr};
     std::atomic<int> nStartingHeight{-1};
 
     // flood relay
-    std::vector<CAddress> vAddrToSend;
-    CRollingBloomFilter addrKnown;
+    //! Guards the addresses to relay, which the message handler threads of
+    //! other nodes push to.
+    Mutex cs_addrToSend;
+    std::vector<CAddress> vAddrToSend GUARDED_BY(cs_addrToSend);
+    CRollingBloomFilter addrKnown GUARDED_BY(cs_addrToSend);
     bool fGetAddr{false};
     int64_t nNextAddrSend GUARDED_BY(cs_sendProcessing){0};
     int64_t nNextLocalAddrSend GUARDED_BY(cs_sendProcessing){0};
@@ -842,6 +896,7 @@ public:
     void Release() { nRefCount--; }
 
     void AddAddressKnown(const CAddress &_addr) {
+        LOCK(cs_addrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -849,6 +904,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrToSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] =
@@ -24,6 +24,7 @@
 #include <net.h>
 #include <netbase.h>
 #include <netmessagemaker.h>
+#include <node/chainsnapshot.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
 #include <primitives/block.h>
@@ -694,10 +695,15 @@ static bool TipMayBeStale(const Consensus::Params &consensusParams)
            mapBlocksInFlight.empty();
 }
 
+static bool CanDirectFetch(const CBlockIndex *pindexTip,
+                           const Consensus::Params &consensusParams) {
+    return pindexTip->GetBlockTime() >
+           GetAdjustedTime() - consensusParams.nPowTargetSpacing * 20;
+}
+
 static bool CanDirectFetch(const Consensus::Params &consensusParams)
     EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
-    return ::ChainActive().Tip()->GetBlockTime() >
-           GetAdjustedTime() - consensusParams.nPowTargetSpacing * 20;
+    return CanDirectFetch(::ChainActive().Tip(), consensusParams);
 }
 
 static bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex)
@@ -1263,6 +1269,39 @@ static std::shared_ptr<const CBlockHeaderAndShortTxIDs>
     most_recent_compact_block GUARDED_BY(cs_most_recent_block);
 static uint256 most_recent_block_hash GUARDED_BY(cs_most_recent_block);
 
+// The active chain as of the last tip update, from which the message handlers
+// serve headers and blocks without cs_main. There is none during the initial
+// block download, nor in prune mode, where blocks may be deleted while they
+// are read.
+static Mutex cs_chain_snapshot;
+static std::shared_ptr<const ChainSnapshot>
+    g_chain_snapshot GUARDED_BY(cs_chain_snapshot);
+
+static std::shared_ptr<const ChainSnapshot> GetChainSnapshot() {
+    LOCK(cs_chain_snapshot);
+    return g_chain_snapshot;
+}
+
+static void UpdateChainSnapshot(bool fInitialDownload)
+    EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+    if (fInitialDownload || fPruneMode) {
+        snapshot.reset();
+    } else if (!snapshot || snapshot->Tip() != ::ChainActive().Tip()) {
+        // Only this function replaces the snapshot, under cs_main, so the
+        // new one can be taken without holding cs_chain_snapshot.
+        snapshot = ChainSnapshot::Make(::ChainActive(), snapshot.get());
+    }
+    LOCK(cs_chain_snapshot);
+    g_chain_snapshot = std::move(snapshot);
+}
+
+PeerLogicValidation::~PeerLogicValidation() {
+    // The snapshot must not outlive the block index it points to.
+    LOCK(cs_chain_snapshot);
+    g_chain_snapshot.reset();
+}
+
 /**
  * Maintain state about the best-seen block and fast-announce a compact block
  * to compatible peers.
@@ -1324,6 +1363,10 @@ void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew,
     const int nNewHeight = pindexNew->nHeight;
     connman->SetBestHeight(nNewHeight);
 
+    // Before announcing the new blocks, so that they are served from the
+    // snapshot when requested.
+    WITH_LOCK(cs_main, UpdateChainSnapshot(fInitialDownload));
+
     SetServiceFlagsIBDCache(!fInitialDownload);
     if (!fInitialDownload) {
         // Find the hashes of all blocks that weren't previously in the best
@@ -1498,6 +1541,32 @@ static void RelayAddress(const CAddress &addr, bool fReachable,
     connman->ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+/**
+ * The headers of chain from pindex on, up to hashStop, in reply to a
+ * getheaders. pindex is set to the last header sent, or to nullptr if the
+ * headers go up to the tip of chain.
+ */
+template <typename Chain>
+static std::vector<CBlock> GetHeadersToSend(const Chain &chain,
+                                            const CBlockIndex *&pindex,
+                                            const BlockHash &hashStop,
+                                            const CNode *pfrom) {
+    // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx
+    // count at the end
+    std::vector<CBlock> vHeaders;
+    int nLimit = MAX_HEADERS_RESULTS;
+    LogPrint(BCLog::NET, "getheaders %d to %s from peer=%d\n",
+             (pindex ? pindex->nHeight : -1),
+             hashStop.IsNull() ? "end" : hashStop.ToString(), pfrom->GetId());
+    for (; pindex; pindex = chain.Next(pindex)) {
+        vHeaders.push_back(pindex->GetBlockHeader());
+        if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop) {
+            break;
+        }
+    }
+    return vHeaders;
+}
+
 static void ProcessGetBlockData(const Config &config, CNode *pfrom,
                                 const CInv &inv, CConnman *connman,
                                 const std::atomic<bool> &interruptMsgProc) {
@@ -1515,49 +1584,67 @@ static void ProcessGetBlockData(const Config &config, CNode *pfrom,
         a_recent_compact_block = most_recent_compact_block;
     }
 
-    bool need_activate_chain = false;
-    {
-        LOCK(cs_main);
-        const CBlockIndex *pindex = LookupBlockIndex(hash);
-        if (pindex) {
-            if (pindex->HaveTxsDownloaded() &&
+    // The blocks of the active chain are served without cs_main, from the
+    // chain snapshot. The others, and all blocks while there is no snapshot,
+    // are looked up in the block index.
+    const std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+    const CBlockIndex *pindex = snapshot ? snapshot->Find(hash) : nullptr;
+    const CBlockIndex *pindexTip = nullptr;
+    const CBlockIndex *pindexBest = nullptr;
+    FlatFilePos pos;
+    if (pindex) {
+        send = true;
+        pindexTip = snapshot->Tip();
+        pindexBest = pindexTip;
+        pos = snapshot->GetBlockPos(pindex);
+    } else {
+        bool need_activate_chain = false;
+        {
+            LOCK(cs_main);
+            pindex = LookupBlockIndex(hash);
+            if (pindex && pindex->HaveTxsDownloaded() &&
                 !pindex->IsValid(BlockValidity::SCRIPTS) &&
                 pindex->IsValid(BlockValidity::TREE)) {
-                // If we have the block and all of its parents, but have not yet
-                // validated it, we might be in the middle of connecting it (ie
-                // in the unlock of cs_main before ActivateBestChain but after
-                // AcceptBlock). In this case, we need to run ActivateBestChain
-                // prior to checking the relay conditions below.
+                // If we have the block and all of its parents, but have not
+                // yet validated it, we might be in the middle of connecting it
+                // (ie in the unlock of cs_main before ActivateBestChain but
+                // after AcceptBlock). In this case, we need to run
+                // ActivateBestChain prior to checking the relay conditions
+                // below.
                 need_activate_chain = true;
             }
+        } // release cs_main before calling ActivateBestChain
+        if (need_activate_chain) {
+            CValidationState state;
+            if (!ActivateBestChain(config, state, a_recent_block)) {
+                LogPrint(BCLog::NET, "failed to activate chain (%s)\n",
+                         FormatStateMessage(state));
+            }
         }
-    } // release cs_main before calling ActivateBestChain
-    if (need_activate_chain) {
-        CValidationState state;
-        if (!ActivateBestChain(config, state, a_recent_block)) {
-            LogPrint(BCLog::NET, "failed to activate chain (%s)\n",
-                     FormatStateMessage(state));
-        }
-    }
 
-    LOCK(cs_main);
-    const CBlockIndex *pindex = LookupBlockIndex(hash);
-    if (pindex) {
-        send = BlockRequestAllowed(pindex, consensusParams);
-        if (!send) {
-            LogPrint(BCLog::NET,
-                     "%s: ignoring request from peer=%i for old "
-                     "block that isn't in the main chain\n",
-                     __func__, pfrom->GetId());
+        LOCK(cs_main);
+        pindex = LookupBlockIndex(hash);
+        if (pindex) {
+            send = BlockRequestAllowed(pindex, consensusParams);
+            if (!send) {
+                LogPrint(BCLog::NET,
+                         "%s: ignoring request from peer=%i for old "
+                         "block that isn't in the main chain\n",
+                         __func__, pfrom->GetId());
+            }
+            pos = pindex->GetBlockPos();
         }
+        pindexTip = ::ChainActive().Tip();
+        pindexBest = pindexBestHeader;
     }
+
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
     // Disconnect node in case we have reached the outbound limit for serving
     // historical blocks.
     // Never disconnect whitelisted nodes.
     if (send && connman->OutboundTargetReached(true) &&
-        (((pindexBestHeader != nullptr) &&
-          (pindexBestHeader->GetBlockTime() - pindex->GetBlockTime() >
+        (((pindexBest != nullptr) &&
+          (pindexBest->GetBlockTime() - pindex->GetBlockTime() >
            HISTORICAL_BLOCK_AGE)) ||
          inv.type == MSG_FILTERED_BLOCK) &&
         !pfrom->HasPermission(PF_NOBAN)) {
@@ -1576,7 +1663,7 @@ static void ProcessGetBlockData(const Config &config, CNode *pfrom,
         ((((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) ==
            NODE_NETWORK_LIMITED) &&
           ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) &&
-          (::ChainActive().Tip()->nHeight - pindex->nHeight >
+          (pindexTip->nHeight - pindex->nHeight >
            (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2)))) {
         LogPrint(BCLog::NET,
                  "Ignore block request below NODE_NETWORK_LIMITED "
@@ -1588,22 +1675,55 @@ static void ProcessGetBlockData(const Config &config, CNode *pfrom,
         pfrom->fDisconnect = true;
         send = false;
     }
-    // Pruned nodes may have deleted the block, so check whether it's available
-    // before trying to send.
-    if (send && pindex->nStatus.hasData()) {
+    // Pruned nodes may have deleted the block, in which case it has no
+    // position.
+    if (send && !pos.IsNull()) {
+        // If a peer is asking for old blocks, we're almost guaranteed they
+        // won't have a useful mempool to match against a compact block, and
+        // we don't feel like constructing the object for them, so instead
+        // we respond with the full, non-compact block.
+        const bool fSendCompact =
+            inv.type == MSG_CMPCT_BLOCK &&
+            CanDirectFetch(pindexTip, consensusParams) &&
+            pindex->nHeight >= pindexTip->nHeight - MAX_CMPCTBLOCK_DEPTH;
+        const bool fRecent =
+            a_recent_block &&
+            a_recent_block->GetHash() == pindex->GetBlockHash();
+        // A full block is sent from disk as it is serialized there, without
+        // deserializing it.
+        const bool fSendRaw =
+            !fRecent && (inv.type == MSG_BLOCK ||
+                         (inv.type == MSG_CMPCT_BLOCK && !fSendCompact));
+
         std::shared_ptr<const CBlock> pblock;
-        if (a_recent_block &&
-            a_recent_block->GetHash() == pindex->GetBlockHash()) {
+        CSerializedNetMsg rawBlock;
+        bool fRead = true;
+        if (fRecent) {
             pblock = a_recent_block;
+        } else if (fSendRaw) {
+            rawBlock.command = NetMsgType::BLOCK;
+            fRead = ReadRawBlockFromDisk(
+                rawBlock.data, pos, hash, config.GetChainParams().DiskMagic(),
+                config.GetExcessiveBlockSize());
         } else {
             // Send block from disk
             std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
-            if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams)) {
-                assert(!"cannot load block from disk");
-            }
+            fRead = ReadBlockFromDisk(*pblockRead, pos, consensusParams) &&
+                    pblockRead->GetHash() == pindex->GetBlockHash();
             pblock = pblockRead;
         }
-        if (inv.type == MSG_BLOCK) {
+        if (!fRead) {
+            // The block may have been pruned since it was looked up.
+            LogPrint(BCLog::NET,
+                     "cannot load block %s from disk, disconnect peer=%d\n",
+                     hash.ToString(), pfrom->GetId());
+            pfrom->fDisconnect = true;
+            return;
+        }
+
+        if (fSendRaw) {
+            connman->PushMessage(pfrom, std::move(rawBlock));
+        } else if (inv.type == MSG_BLOCK) {
             connman->PushMessage(pfrom,
                                  msgMaker.Make(NetMsgType::BLOCK, *pblock));
         } else if (inv.type == MSG_FILTERED_BLOCK) {
@@ -1638,14 +1758,8 @@ static void ProcessGetBlockData(const Config &config, CNode *pfrom,
             // else
             // no response
         } else if (inv.type == MSG_CMPCT_BLOCK) {
-            // If a peer is asking for old blocks, we're almost guaranteed they
-            // won't have a useful mempool to match against a compact block, and
-            // we don't feel like constructing the object for them, so instead
-            // we respond with the full, non-compact block.
             int nSendFlags = 0;
-            if (CanDirectFetch(consensusParams) &&
-                pindex->nHeight >=
-                    ::ChainActive().Height() - MAX_CMPCTBLOCK_DEPTH) {
+            if (fSendCompact) {
                 CBlockHeaderAndShortTxIDs cmpctblock(*pblock);
                 connman->PushMessage(
                     pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK,
@@ -1664,8 +1778,7 @@ static void ProcessGetBlockData(const Config &config, CNode *pfrom,
             // want it right after the last block so they don't wait for other
             // stuff first.
             std::vector<CInv> vInv;
-            vInv.emplace_back(
-                MSG_BLOCK, ::ChainActive().Tip()->GetBlockHash());
+            vInv.emplace_back(MSG_BLOCK, pindexTip->GetBlockHash());
             connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
             pfrom->hashContinue = BlockHash();
         }
@@ -1779,7 +1892,6 @@ inline static void SendBlockTransactions(const CBlock &block,
         }
         resp.txn[i] = block.vtx[req.indices[i]];
     }
-    LOCK(cs_main);
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
     int nSendFlags = 0;
     connman->PushMessage(pfrom,
@@ -2735,10 +2847,26 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             return true;
         }
 
-        LOCK(cs_main);
-
-        const CBlockIndex *pindex = LookupBlockIndex(req.blockhash);
-        if (!pindex || !pindex->nStatus.hasData()) {
+        // Blocks of the active chain are looked up in the chain snapshot,
+        // without cs_main.
+        const std::shared_ptr<const ChainSnapshot> snapshot =
+            GetChainSnapshot();
+        const CBlockIndex *pindex =
+            snapshot ? snapshot->Find(req.blockhash) : nullptr;
+        int nTipHeight;
+        FlatFilePos pos;
+        if (pindex) {
+            nTipHeight = snapshot->Height();
+            pos = snapshot->GetBlockPos(pindex);
+        } else {
+            LOCK(cs_main);
+            pindex = LookupBlockIndex(req.blockhash);
+            if (pindex) {
+                pos = pindex->GetBlockPos();
+            }
+            nTipHeight = ::ChainActive().Height();
+        }
+        if (!pindex || pos.IsNull()) {
             LogPrint(
                 BCLog::NET,
                 "Peer %d sent us a getblocktxn for a block we don't have\n",
@@ -2746,7 +2874,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             return true;
         }
 
-        if (pindex->nHeight < ::ChainActive().Height() - MAX_BLOCKTXN_DEPTH) {
+        if (pindex->nHeight < nTipHeight - MAX_BLOCKTXN_DEPTH) {
             // If an older block is requested (should never happen in practice,
             // but can happen in tests) send a block response instead of a
             // blocktxn response. Sending a full block response instead of a
@@ -2764,8 +2892,15 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         }
 
         CBlock block;
-        bool ret = ReadBlockFromDisk(block, pindex, chainparams.GetConsensus());
-        assert(ret);
+        if (!ReadBlockFromDisk(block, pos, chainparams.GetConsensus()) ||
+            block.GetHash() != req.blockhash) {
+            // The block may have been pruned since it was looked up.
+            LogPrint(BCLog::NET,
+                     "cannot load block %s from disk, disconnect peer=%d\n",
+                     req.blockhash.ToString(), pfrom->GetId());
+            pfrom->fDisconnect = true;
+            return true;
+        }
 
         SendBlockTransactions(block, req, pfrom, connman);
         return true;
@@ -2784,6 +2919,24 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             return true;
         }
 
+        // The headers of the active chain are served without cs_main, from
+        // the chain snapshot, which only exists outside of the initial block
+        // download.
+        const std::shared_ptr<const ChainSnapshot> snapshot =
+            GetChainSnapshot();
+        if (snapshot && (!locator.IsNull() || snapshot->Find(hashStop))) {
+            const CBlockIndex *pindex =
+                locator.IsNull() ? snapshot->Find(hashStop)
+                                 : snapshot->Next(snapshot->FindFork(locator));
+            const std::vector<CBlock> vHeaders =
+                GetHeadersToSend(*snapshot, pindex, hashStop, pfrom);
+            // See below.
+            pfrom->pindexHeadersSent = pindex ? pindex : snapshot->Tip();
+            connman->PushMessage(pfrom,
+                                 msgMaker.Make(NetMsgType::HEADERS, vHeaders));
+            return true;
+        }
+
         LOCK(cs_main);
         if (IsInitialBlockDownload() && !pfrom->HasPermission(PF_NOBAN)) {
             LogPrint(BCLog::NET,
@@ -2817,20 +2970,8 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             }
         }
 
-        // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx
-        // count at the end
-        std::vector<CBlock> vHeaders;
-        int nLimit = MAX_HEADERS_RESULTS;
-        LogPrint(BCLog::NET, "getheaders %d to %s from peer=%d\n",
-                 (pindex ? pindex->nHeight : -1),
-                 hashStop.IsNull() ? "end" : hashStop.ToString(),
-                 pfrom->GetId());
-        for (; pindex; pindex = ::ChainActive().Next(pindex)) {
-            vHeaders.push_back(pindex->GetBlockHeader());
-            if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop) {
-                break;
-            }
-        }
+        const std::vector<CBlock> vHeaders =
+            GetHeadersToSend(::ChainActive(), pindex, hashStop, pfrom);
         // pindex can be nullptr either if we sent ::ChainActive().Tip() OR
         // if our peer has ::ChainActive().Tip() (and thus we are sending an
         // empty headers message). In both cases it's safe to update
@@ -2845,6 +2986,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         // in the SendMessages logic.
         nodestate->pindexBestHeaderSent =
             pindex ? pindex : ::ChainActive().Tip();
+        pfrom->pindexHeadersSent = nullptr;
         connman->PushMessage(pfrom,
                              msgMaker.Make(NetMsgType::HEADERS, vHeaders));
         return true;
@@ -3575,7 +3717,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        WITH_LOCK(pfrom->cs_addrToSend, pfrom->vAddrToSend.clear());
         std::vector<CAddress> vAddr = connman->GetAddresses();
         FastRandomContext insecure_rand;
         for (const CAddress &addr : vAddr) {
@@ -4233,6 +4375,9 @@ void PeerLogicValidation::CheckForStaleTipAndEvictPeers(
     const Consensus::Params &consensusParams) {
     LOCK(cs_main);
 
+    // The tip may not move for a while after startup.
+    UpdateChainSnapshot(IsInitialBlockDownload());
+
     if (connman == nullptr) {
         return;
     }
@@ -4331,6 +4476,10 @@ bool PeerLogicValidation::SendMessages(const Config &config, CNode *pto,
         return true;
     }
     CNodeState &state = *State(pto->GetId());
+    if (pto->pindexHeadersSent) {
+        state.pindexBestHeaderSent = pto->pindexHeadersSent;
+        pto->pindexHeadersSent = nullptr;
+    }
 
     // Address refresh broadcast
     int64_t nNow = GetTimeMicros();
@@ -4347,27 +4496,30 @@ bool PeerLogicValidation::SendMessages(const Config &config, CNode *pto,
         pto->nNextAddrSend =
             PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
         std::vector<CAddress> vAddr;
-        vAddr.reserve(pto->vAddrToSend.size());
-        for (const CAddress &addr : pto->vAddrToSend) {
-            if (!pto->addrKnown.contains(addr.GetKey())) {
-                pto->addrKnown.insert(addr.GetKey());
-                vAddr.push_back(addr);
-                // receiver rejects addr messages larger than 1000
-                if (vAddr.size() >= 1000) {
-                    connman->PushMessage(
-                        pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
-                    vAddr.clear();
+        {
+            LOCK(pto->cs_addrToSend);
+            vAddr.reserve(pto->vAddrToSend.size());
+            for (const CAddress &addr : pto->vAddrToSend) {
+                if (!pto->addrKnown.contains(addr.GetKey())) {
+                    pto->addrKnown.insert(addr.GetKey());
+                    vAddr.push_back(addr);
                 }
             }
-        }
-        pto->vAddrToSend.clear();
-        if (!vAddr.empty()) {
-            connman->PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
-        }
+            pto->vAddrToSend.clear();
 
-        // we only send the big addr message once
-        if (pto->vAddrToSend.capacity() > 40) {
-            pto->vAddrToSend.shrink_to_fit();
+            // we only send the big addr message once
+            if (pto->vAddrToSend.capacity() > 40) {
+                pto->vAddrToSend.shrink_to_fit();
+            }
+        }
+        // receiver rejects addr messages larger than 1000
+        for (size_t i = 0; i < vAddr.size(); i += 1000) {
+            connman->PushMessage(
+                pto, msgMaker.Make(NetMsgType::ADDR,
+                                   std::vector<CAddress>(
+                                       vAddr.begin() + i,
+                                       vAddr.begin() +
+                                           std::min(i + 1000, vAddr.size()))));
         }
     }
 
@@ -4944,8 +5096,11 @@ bool PeerLogicValidation::SendMessages(const Config &config, CNode *pto,
         if (timeNow > pto->nextSendTimeFeeFilter) {
             static CFeeRate default_feerate =
                 CFeeRate(DEFAULT_MIN_RELAY_TX_FEE_PER_KB);
-            static FeeFilterRounder filterRounder(default_feerate);
-            Amount filterToSend = filterRounder.round(currentFilter);
+            static Mutex cs_filterRounder;
+            static FeeFilterRounder filterRounder GUARDED_BY(cs_filterRounder)(
+                default_feerate);
+            Amount filterToSend = WITH_LOCK(
+                cs_filterRounder, return filterRounder.round(currentFilter));
             filterToSend = std::max(filterToSend, ::minRelayTxFee.GetFeePerK());
 
             if (filterToSend != pto->lastSentFeeFilter) {
@@ -55,6 +55,7 @@ private:
 public:
     PeerLogicValidation(CConnman *connman, BanMan *banman,
                         CScheduler &scheduler, bool enable_bip61);
+    ~PeerLogicValidation();
 
     /**
      * Overridden from CValidationInterface.
@@ -0,0 +1,128 @@
+// Copyright (c) 2022 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/chainsnapshot.h>
+
+#include <chain.h>
+#include <primitives/block.h>
+#include <validation.h>
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+
+std::shared_ptr<const ChainSnapshot>
+ChainSnapshot::Make(const CChain &chain, const ChainSnapshot *prev) {
+    AssertLockHeld(cs_main);
+
+    auto snapshot = std::make_shared<ChainSnapshot>();
+    snapshot->nHeight = chain.Height();
+    if (prev) {
+        snapshot->chunks = prev->chunks;
+        snapshot->shards = prev->shards;
+    } else {
+        snapshot->shards.fill(std::make_shared<const Shard>());
+    }
+
+    // The shards which change, copied from the shared ones.
+    std::map<size_t, Shard> edited;
+    const auto editShard = [&](uint64_t key) -> Shard & {
+        const size_t i = key % NUM_SHARDS;
+        auto it = edited.find(i);
+        if (it == edited.end()) {
+            it = edited.emplace(i, *snapshot->shards[i]).first;
+        }
+        return it->second;
+    };
+
+    // Drop the blocks which are no longer in the chain.
+    int nFork = -1;
+    if (prev && prev->nHeight >= 0) {
+        const CBlockIndex *pfork = chain.FindFork(prev->Tip());
+        nFork = pfork ? pfork->nHeight : -1;
+        for (int nHeightIn = nFork + 1; nHeightIn <= prev->nHeight;
+             ++nHeightIn) {
+            const HashEntry entry{(*prev)[nHeightIn]->GetBlockHash().GetUint64(0),
+                                  nHeightIn};
+            Shard &shard = editShard(entry.key);
+            const auto it = std::lower_bound(shard.begin(), shard.end(), entry);
+            assert(it != shard.end() && it->key == entry.key &&
+                   it->height == nHeightIn);
+            shard.erase(it);
+        }
+    }
+
+    // Rebuild the chunks from the one the fork is in, and add the new blocks.
+    const size_t nFirstChunk = (nFork + 1) / CHUNK_SIZE;
+    Chunk chunk;
+    chunk.reserve(CHUNK_SIZE);
+    if (nFirstChunk < snapshot->chunks.size()) {
+        const Chunk &shared = *snapshot->chunks[nFirstChunk];
+        chunk.assign(shared.begin(),
+                     shared.begin() + (nFork + 1) % CHUNK_SIZE);
+    }
+    snapshot->chunks.resize(nFirstChunk);
+    for (int nHeightIn = nFork + 1; nHeightIn <= snapshot->nHeight;
+         ++nHeightIn) {
+        const CBlockIndex *pindex = chain[nHeightIn];
+        chunk.push_back({pindex, pindex->GetBlockPos()});
+        if (chunk.size() == CHUNK_SIZE) {
+            snapshot->chunks.push_back(
+                std::make_shared<const Chunk>(std::move(chunk)));
+            chunk = Chunk();
+            chunk.reserve(CHUNK_SIZE);
+        }
+        const HashEntry entry{pindex->GetBlockHash().GetUint64(0), nHeightIn};
+        editShard(entry.key).push_back(entry);
+    }
+    if (!chunk.empty()) {
+        snapshot->chunks.push_back(
+            std::make_shared<const Chunk>(std::move(chunk)));
+    }
+
+    for (auto &[i, shard] : edited) {
+        std::sort(shard.begin(), shard.end());
+        snapshot->shards[i] = std::make_shared<const Shard>(std::move(shard));
+    }
+    return snapshot;
+}
+
+bool ChainSnapshot::Contains(const CBlockIndex *pindex) const {
+    return pindex && (*this)[pindex->nHeight] == pindex;
+}
+
+const CBlockIndex *ChainSnapshot::Next(const CBlockIndex *pindex) const {
+    return Contains(pindex) ? (*this)[pindex->nHeight + 1] : nullptr;
+}
+
+FlatFilePos ChainSnapshot::GetBlockPos(const CBlockIndex *pindex) const {
+    if (!Contains(pindex)) {
+        return FlatFilePos();
+    }
+    return (*chunks[pindex->nHeight / CHUNK_SIZE])[pindex->nHeight % CHUNK_SIZE]
+        .pos;
+}
+
+const CBlockIndex *ChainSnapshot::Find(const BlockHash &hash) const {
+    const uint64_t key = hash.GetUint64(0);
+    const Shard &shard = *shards[key % NUM_SHARDS];
+    for (auto it = std::lower_bound(shard.begin(), shard.end(),
+                                    HashEntry{key, -1});
+         it != shard.end() && it->key == key; ++it) {
+        const CBlockIndex *pindex = (*this)[it->height];
+        if (pindex->GetBlockHash() == hash) {
+            return pindex;
+        }
+    }
+    return nullptr;
+}
+
+const CBlockIndex *ChainSnapshot::FindFork(const CBlockLocator &locator) const {
+    for (const BlockHash &hash : locator.vHave) {
+        if (const CBlockIndex *pindex = Find(hash)) {
+            return pindex;
+        }
+    }
+    return (*this)[0];
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2022 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_CHAINSNAPSHOT_H
+#define BITCOIN_NODE_CHAINSNAPSHOT_H
+
+#include <flatfile.h>
+#include <primitives/blockhash.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class CBlockIndex;
+class CChain;
+struct CBlockLocator;
+
+/**
+ * An immutable copy of the active chain, from which the P2P message handlers
+ * serve headers and blocks without cs_main.
+ *
+ * The block index entries of the chain are never freed while the node runs,
+ * and their header fields, hash, height and pprev do not change once they are
+ * in the block index, so a snapshot can hand them out and be read from any
+ * thread. Their other fields may still change, and require cs_main: the
+ * snapshot keeps its own copy of the position of each block on disk.
+ *
+ * The chain is stored in chunks of CHUNK_SIZE blocks and its hashes in
+ * NUM_SHARDS sorted shards, which a snapshot shares with the one it was taken
+ * after: taking a snapshot for a new tip only copies the last chunk and the
+ * shard of the new block.
+ */
+class ChainSnapshot {
+public:
+    static constexpr size_t CHUNK_SIZE = 2048;
+    static constexpr size_t NUM_SHARDS = 1024;
+
+    /**
+     * Take a snapshot of chain, sharing what did not change since prev, if
+     * any. The caller must hold cs_main.
+     */
+    static std::shared_ptr<const ChainSnapshot>
+    Make(const CChain &chain, const ChainSnapshot *prev);
+
+    int Height() const { return nHeight; }
+
+    const CBlockIndex *Tip() const { return (*this)[nHeight]; }
+
+    /** The block at the given height, or nullptr if out of range. */
+    const CBlockIndex *operator[](int nHeightIn) const {
+        if (nHeightIn < 0 || nHeightIn > nHeight) {
+            return nullptr;
+        }
+        return (*chunks[nHeightIn / CHUNK_SIZE])[nHeightIn % CHUNK_SIZE]
+            .pindex;
+    }
+
+    bool Contains(const CBlockIndex *pindex) const;
+
+    /** The successor of pindex in the chain, or nullptr if there is none. */
+    const CBlockIndex *Next(const CBlockIndex *pindex) const;
+
+    /** The block of the chain with the given hash, or nullptr. */
+    const CBlockIndex *Find(const BlockHash &hash) const;
+
+    /**
+     * The first block of the locator in the chain, or the genesis block: as
+     * FindForkInGlobalIndex, but only knowing the blocks of the chain.
+     */
+    const CBlockIndex *FindFork(const CBlockLocator &locator) const;
+
+    /**
+     * The position on disk of a block of the chain, as of the snapshot, or a
+     * null position if pindex is not in the chain.
+     */
+    FlatFilePos GetBlockPos(const CBlockIndex *pindex) const;
+
+private:
+    struct Entry {
+        const CBlockIndex *pindex;
+        FlatFilePos pos;
+    };
+    using Chunk = std::vector<Entry>;
+    struct HashEntry {
+        //! The first 8 bytes of the block hash
+        uint64_t key;
+        int32_t height;
+        bool operator<(const HashEntry &other) const {
+            return key < other.key ||
+                   (key == other.key && height < other.height);
+        }
+    };
+    using Shard = std::vector<HashEntry>;
+
+    int nHeight{-1};
+    std::vector<std::shared_ptr<const Chunk>> chunks;
+    std::array<std::shared_ptr<const Shard>, NUM_SHARDS> shards;
+};
+
+#endif // BITCOIN_NODE_CHAINSNAPSHOT_H
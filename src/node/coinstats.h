@@ -0,0 +1,47 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_COINSTATS_H
+#define BITCOIN_NODE_COINSTATS_H
+
+#include <amount.h>
+#include <primitives/blockhash.h>
+#include <uint256.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+
+class CCoinsView;
+class Coin;
+struct TxId;
+
+struct CCoinsStats {
+    int nHeight;
+    BlockHash hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    uint256 hashSerialized;
+    uint64_t nDiskSize;
+    Amount nTotalAmount;
+
+    CCoinsStats()
+        : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0),
+          nDiskSize(0), nTotalAmount() {}
+};
+
+/**
+ * Called for the unspent outputs of each transaction, in the order they are
+ * hashed. Returning false aborts the calculation.
+ */
+using CoinsStatsVisitor =
+    std::function<bool(const TxId &txid, const std::map<uint32_t, Coin> &)>;
+
+//! Calculate statistics about the unspent transaction output set
+bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats,
+                  const CoinsStatsVisitor &visitor = {});
+
+#endif // BITCOIN_NODE_COINSTATS_H
@@ -0,0 +1,360 @@
+// Copyright (c) 2022 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/mempooljournal.h>
+
+#include <clientversion.h>
+#include <config.h>
+#include <logging.h>
+#include <shutdown.h>
+#include <txmempool.h>
+#include <util/saltedhashers.h>
+#include <util/system.h>
+#include <util/time.h>
+#include <validation.h>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+std::unique_ptr<MempoolJournal> g_mempool_journal;
+
+//! Roughly how many bytes of records go in a chunk when compacting
+static constexpr size_t MEMPOOL_JOURNAL_CHUNK_SIZE = 1'000'000;
+//! How many recovered transactions are added to the mempool at once
+static constexpr size_t MEMPOOL_JOURNAL_LOAD_BATCH = 1'000;
+
+MempoolJournal::MempoolJournal(CTxMemPool &poolIn, const fs::path &pathIn)
+    : pool(poolIn), path(pathIn) {}
+
+MempoolJournal::~MempoolJournal() {
+    Stop();
+}
+
+bool MempoolJournal::Recover(const Config &config) {
+    CAutoFile fileIn(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (fileIn.IsNull()) {
+        return false;
+    }
+
+    // Replay the records: the transactions still in the mempool at the end
+    // are those added last, in the order of their last addition.
+    struct Live {
+        uint64_t sequence;
+        MempoolDumpEntry entry;
+    };
+    std::unordered_map<TxId, Live, SaltedTxIdHasher> live;
+    std::map<TxId, Amount> mapDeltas;
+    uint64_t sequence = 0;
+    try {
+        uint64_t version;
+        fileIn >> version;
+        if (version != MEMPOOL_JOURNAL_VERSION) {
+            LogPrintf("Unknown mempool journal version %d, not recovering "
+                      "the mempool from it\n",
+                      version);
+            return false;
+        }
+    } catch (const std::exception &e) {
+        LogPrintf("Failed to read mempool journal: %s\n", e.what());
+        return false;
+    }
+    size_t nChunks = 0;
+    while (true) {
+        std::vector<uint8_t> payload;
+        try {
+            payload = ReadMempoolChunk(fileIn);
+        } catch (const std::exception &) {
+            // The end of the file, or a chunk torn by a crash while it was
+            // being written: either way, everything before it stands.
+            break;
+        }
+        VectorReader reader(SER_DISK, CLIENT_VERSION, payload, 0);
+        try {
+            while (!reader.empty()) {
+                uint8_t type;
+                reader >> type;
+                switch (RecordType(type)) {
+                    case RecordType::ADD: {
+                        MempoolDumpEntry entry;
+                        reader >> entry;
+                        const TxId txid = entry.tx->GetId();
+                        live.insert_or_assign(
+                            txid, Live{sequence++, std::move(entry)});
+                        break;
+                    }
+                    case RecordType::REMOVE: {
+                        TxId txid;
+                        reader >> txid;
+                        live.erase(txid);
+                        break;
+                    }
+                    case RecordType::DELTAS:
+                        mapDeltas.clear();
+                        reader >> mapDeltas;
+                        break;
+                    default:
+                        throw std::ios_base::failure(
+                            "unknown mempool journal record");
+                }
+            }
+        } catch (const std::exception &e) {
+            LogPrintf("Failed to read mempool journal: %s\n", e.what());
+            return false;
+        }
+        ++nChunks;
+    }
+
+    // Put the parents first, as they may have come back to the mempool after
+    // their children, in a reorg.
+    std::unordered_map<TxId, std::vector<const Live *>, SaltedTxIdHasher>
+        children;
+    std::unordered_map<const Live *, size_t> missingParents;
+    std::set<std::pair<uint64_t, const Live *>> ready;
+    for (const auto &[txid, tx] : live) {
+        size_t nParents = 0;
+        for (const CTxIn &txin : tx.entry.tx->vin) {
+            if (live.count(txin.prevout.GetTxId())) {
+                children[txin.prevout.GetTxId()].push_back(&tx);
+                ++nParents;
+            }
+        }
+        if (nParents) {
+            missingParents.emplace(&tx, nParents);
+        } else {
+            ready.emplace(tx.sequence, &tx);
+        }
+    }
+    std::vector<MempoolDumpEntry> entries;
+    entries.reserve(live.size());
+    while (!ready.empty()) {
+        const Live *tx = ready.begin()->second;
+        ready.erase(ready.begin());
+        entries.push_back(tx->entry);
+        mapDeltas.erase(tx->entry.tx->GetId());
+        for (const Live *child : children[tx->entry.tx->GetId()]) {
+            if (--missingParents[child] == 0) {
+                ready.emplace(child->sequence, child);
+            }
+        }
+    }
+
+    MempoolLoadStats stats;
+    for (size_t begin = 0; begin < entries.size();
+         begin += MEMPOOL_JOURNAL_LOAD_BATCH) {
+        const size_t end =
+            std::min(begin + MEMPOOL_JOURNAL_LOAD_BATCH, entries.size());
+        if (!LoadMempoolEntries(
+                config, pool,
+                std::vector<MempoolDumpEntry>(entries.begin() + begin,
+                                              entries.begin() + end),
+                stats)) {
+            return false;
+        }
+    }
+    for (const auto &[txid, delta] : mapDeltas) {
+        pool.PrioritiseTransaction(txid, delta);
+    }
+
+    LogPrintf("Recovered mempool transactions from %u chunks of the journal: "
+              "%i succeeded, %i failed, %i expired, %i already there\n",
+              nChunks, stats.count, stats.failed, stats.expired,
+              stats.already_there);
+    return true;
+}
+
+bool MempoolJournal::Start() {
+    connAdded = pool.NotifyEntryAdded.connect([this](CTransactionRef tx) {
+        LOCK(cs_events);
+        events.push_back({std::move(tx), true});
+    });
+    connRemoved = pool.NotifyEntryRemoved.connect(
+        [this](CTransactionRef tx, MemPoolRemovalReason) {
+            LOCK(cs_events);
+            events.push_back({std::move(tx), false});
+        });
+
+    {
+        LOCK(cs_file);
+        if (!CompactInternal()) {
+            connAdded.disconnect();
+            connRemoved.disconnect();
+            return false;
+        }
+    }
+
+    interrupt.reset();
+    thread = std::thread(&TraceThread<std::function<void()>>, "mempooljournal",
+                         std::function<void()>([this] { ThreadFlush(); }));
+    return true;
+}
+
+void MempoolJournal::Stop() {
+    if (thread.joinable()) {
+        interrupt();
+        thread.join();
+    }
+    connAdded.disconnect();
+    connRemoved.disconnect();
+
+    LOCK(cs_file);
+    if (file) {
+        FlushInternal();
+        file.reset();
+    }
+}
+
+bool MempoolJournal::Flush() {
+    LOCK(cs_file);
+    return FlushInternal();
+}
+
+bool MempoolJournal::Compact() {
+    LOCK(cs_file);
+    return CompactInternal();
+}
+
+void MempoolJournal::ThreadFlush() {
+    while (interrupt.sleep_for(MEMPOOL_JOURNAL_FLUSH_INTERVAL)) {
+        LOCK(cs_file);
+        FlushInternal();
+        // Also retry after a failed compaction, which leaves no file open.
+        if (!file ||
+            nRecords > std::max<uint64_t>(MEMPOOL_JOURNAL_MIN_COMPACT_RECORDS,
+                                          2 * pool.size())) {
+            CompactInternal();
+        }
+    }
+}
+
+bool MempoolJournal::FlushInternal() {
+    AssertLockHeld(cs_file);
+
+    std::vector<Event> pending;
+    {
+        LOCK(cs_events);
+        pending.swap(events);
+    }
+    if (pending.empty() || !file) {
+        return true;
+    }
+
+    std::vector<uint8_t> payload;
+    uint64_t nWritten = 0;
+    {
+        LOCK(pool.cs);
+        for (const Event &event : pending) {
+            const TxId &txid = event.tx->GetId();
+            if (!event.added) {
+                CVectorWriter(SER_DISK, CLIENT_VERSION, payload, payload.size(),
+                              uint8_t(RecordType::REMOVE), txid);
+                ++nWritten;
+                continue;
+            }
+            // The entry is looked up now, as the notification comes before it
+            // is in the mempool. If it is gone already, its removal is queued
+            // as well.
+            const auto it = pool.GetIter(txid);
+            if (!it) {
+                continue;
+            }
+            const CTxMemPoolEntry &entry = **it;
+            const MempoolDumpEntry dumpEntry{
+                entry.GetSharedTx(),
+                entry.GetTime(),
+                entry.GetModifiedFee() - entry.GetFee(),
+                entry.GetFee(),
+                uint32_t(entry.GetTxSize()),
+                entry.GetSigChecks()};
+            CVectorWriter(SER_DISK, CLIENT_VERSION, payload, payload.size(),
+                          uint8_t(RecordType::ADD), dumpEntry);
+            ++nWritten;
+        }
+    }
+
+    try {
+        WriteMempoolChunk(*file, payload);
+        if (!FileCommit(file->Get())) {
+            throw std::runtime_error("FileCommit failed");
+        }
+    } catch (const std::exception &e) {
+        LogPrintf("Failed to write to the mempool journal: %s\n", e.what());
+        return false;
+    }
+    nRecords += nWritten;
+    return true;
+}
+
+bool MempoolJournal::CompactInternal() {
+    AssertLockHeld(cs_file);
+
+    const int64_t nStart = GetTimeMicros();
+
+    // The changes queued from here on are written after the snapshot. Those
+    // queued before it may be written again, which is harmless: the last
+    // record of a transaction is the one that counts.
+    std::shared_ptr<const MempoolSnapshot> snapshot;
+    std::map<TxId, Amount> mapDeltas;
+    {
+        LOCK(pool.cs);
+        snapshot = pool.GetSnapshot();
+        mapDeltas = pool.mapDeltas;
+    }
+
+    const fs::path pathNew = path.string() + ".new";
+    try {
+        CAutoFile fileNew(fsbridge::fopen(pathNew, "wb"), SER_DISK,
+                          CLIENT_VERSION);
+        if (fileNew.IsNull()) {
+            throw std::runtime_error("cannot open " + pathNew.string());
+        }
+        fileNew << MEMPOOL_JOURNAL_VERSION;
+
+        std::vector<uint8_t> payload;
+        for (const MempoolSnapshot::Entry &entry : snapshot->entries) {
+            const MempoolDumpEntry dumpEntry{entry.tx,
+                                             entry.time,
+                                             entry.modifiedFee - entry.fee,
+                                             entry.fee,
+                                             uint32_t(entry.txSize),
+                                             entry.sigChecks};
+            CVectorWriter(SER_DISK, CLIENT_VERSION, payload, payload.size(),
+                          uint8_t(RecordType::ADD), dumpEntry);
+            if (payload.size() >= MEMPOOL_JOURNAL_CHUNK_SIZE) {
+                WriteMempoolChunk(fileNew, payload);
+                payload.clear();
+            }
+        }
+        CVectorWriter(SER_DISK, CLIENT_VERSION, payload, payload.size(),
+                      uint8_t(RecordType::DELTAS), mapDeltas);
+        WriteMempoolChunk(fileNew, payload);
+
+        if (!FileCommit(fileNew.Get())) {
+            throw std::runtime_error("FileCommit failed");
+        }
+        fileNew.fclose();
+
+        file.reset();
+        if (!RenameOver(pathNew, path)) {
+            throw std::runtime_error("cannot rename " + pathNew.string());
+        }
+        file = std::make_unique<CAutoFile>(fsbridge::fopen(path, "ab"),
+                                           SER_DISK, CLIENT_VERSION);
+        if (file->IsNull()) {
+            file.reset();
+            throw std::runtime_error("cannot open " + path.string());
+        }
+    } catch (const std::exception &e) {
+        LogPrintf("Failed to compact the mempool journal: %s\n", e.what());
+        return false;
+    }
+    nRecords = snapshot->entries.size() + 1;
+
+    LogPrint(BCLog::MEMPOOL, "Compacted the mempool journal to %u "
+                             "transactions in %.2fms\n",
+             snapshot->entries.size(), (GetTimeMicros() - nStart) * 0.001);
+    return FlushInternal();
+}
@@ -0,0 +1,113 @@
+// Copyright (c) 2022 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_MEMPOOLJOURNAL_H
+#define BITCOIN_NODE_MEMPOOLJOURNAL_H
+
+#include <fs.h>
+#include <primitives/transaction.h>
+#include <streams.h>
+#include <sync.h>
+#include <threadinterrupt.h>
+
+#include <boost/signals2/connection.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class Config;
+class CTxMemPool;
+
+static constexpr bool DEFAULT_MEMPOOL_JOURNAL = false;
+static constexpr uint64_t MEMPOOL_JOURNAL_VERSION = 1;
+//! How often the journal is appended to
+static constexpr std::chrono::seconds MEMPOOL_JOURNAL_FLUSH_INTERVAL{1};
+//! The journal is not compacted while it holds fewer records than this
+static constexpr uint64_t MEMPOOL_JOURNAL_MIN_COMPACT_RECORDS = 10'000;
+
+/**
+ * An append-only log of the transactions entering and leaving the mempool
+ * (mempool.journal), from which the mempool is recovered on startup, after a
+ * clean shutdown or not, without ever dumping it in full.
+ *
+ * The mempool notifications are only queued as they happen. A background
+ * thread appends the queued records to the file every
+ * MEMPOOL_JOURNAL_FLUSH_INTERVAL, as one chunk (see WriteMempoolChunk), so
+ * that a chunk torn by a crash is detected and ends the replay. Once the file
+ * holds more than twice as many records as the mempool holds transactions,
+ * the thread rewrites it from a snapshot of the mempool (compaction).
+ *
+ * Fee deltas are recorded along with the transactions they apply to, and in
+ * full at compaction; a change to the delta of a transaction already in the
+ * mempool only makes it to the journal at the next compaction.
+ */
+class MempoolJournal {
+public:
+    MempoolJournal(CTxMemPool &poolIn, const fs::path &pathIn);
+    ~MempoolJournal();
+
+    /**
+     * Add the transactions of the journal file, if any, to the mempool.
+     * Returns false if there is no journal, it cannot be read or shutdown was
+     * requested, in which case the file is left as it is.
+     */
+    bool Recover(const Config &config);
+
+    /**
+     * Rewrite the journal from the mempool and start logging its changes, in
+     * the background.
+     */
+    bool Start();
+
+    /** Write what is queued and stop logging. */
+    void Stop();
+
+    /** Append the queued records to the file. */
+    bool Flush();
+
+    /** Rewrite the file from a snapshot of the mempool. */
+    bool Compact();
+
+private:
+    enum class RecordType : uint8_t {
+        ADD = 1,
+        REMOVE = 2,
+        //! All the fee deltas of the mempool, replacing any earlier ones
+        DELTAS = 3,
+    };
+
+    struct Event {
+        CTransactionRef tx;
+        bool added;
+    };
+
+    CTxMemPool &pool;
+    const fs::path path;
+
+    Mutex cs_events;
+    std::vector<Event> events GUARDED_BY(cs_events);
+
+    //! Serializes the writes to the file.
+    Mutex cs_file;
+    std::unique_ptr<CAutoFile> file GUARDED_BY(cs_file);
+    //! The number of records in the file.
+    uint64_t nRecords GUARDED_BY(cs_file) = 0;
+
+    boost::signals2::scoped_connection connAdded;
+    boost::signals2::scoped_connection connRemoved;
+
+    CThreadInterrupt interrupt;
+    std::thread thread;
+
+    void ThreadFlush();
+    bool CompactInternal() EXCLUSIVE_LOCKS_REQUIRED(cs_file);
+    bool FlushInternal() EXCLUSIVE_LOCKS_REQUIRED(cs_file);
+};
+
+extern std::unique_ptr<MempoolJournal> g_mempool_journal;
+
+#endif // BITCOIN_NODE_MEMPOOLJOURNAL_H
@@ -87,3 +87,76 @@ TxId BroadcastTransaction(const Config &config, const CTransactionRef tx,
 
     return txid;
 }
+
+std::vector<std::string>
+BroadcastTransactions(const Config &config,
+                      const std::vector<CTransactionRef> &txs,
+                      const bool allowhighfees) {
+    std::promise<void> promise;
+    std::vector<std::string> errors(txs.size());
+    std::vector<TxId> toRelay;
+
+    Amount nMaxRawTxFee = maxTxFee;
+    if (allowhighfees) {
+        nMaxRawTxFee = Amount::zero();
+    }
+
+    { // cs_main scope
+        LOCK(cs_main);
+        CCoinsViewCache &view = *pcoinsTip;
+        std::vector<CTransactionRef> toAccept;
+        std::vector<size_t> toAcceptIndex;
+        for (size_t i = 0; i < txs.size(); ++i) {
+            const TxId &txid = txs[i]->GetId();
+            bool fHaveChain = false;
+            for (size_t o = 0; !fHaveChain && o < txs[i]->vout.size(); o++) {
+                const Coin &existingCoin = view.AccessCoin(COutPoint(txid, o));
+                fHaveChain = !existingCoin.IsSpent();
+            }
+            if (fHaveChain) {
+                errors[i] = "transaction already in block chain";
+            } else if (g_mempool.exists(txid)) {
+                // Relay it again, as sendrawtransaction does.
+                toRelay.push_back(txid);
+            } else {
+                toAccept.push_back(txs[i]);
+                toAcceptIndex.push_back(i);
+            }
+        }
+
+        const std::vector<MempoolBatchAcceptResult> results =
+            AcceptToMemoryPoolBatch(config, g_mempool, toAccept,
+                                    false /* bypass_limits */, nMaxRawTxFee);
+        for (size_t j = 0; j < results.size(); ++j) {
+            const MempoolBatchAcceptResult &result = results[j];
+            if (result.accepted) {
+                toRelay.push_back(toAccept[j]->GetId());
+            } else if (!result.state.IsInvalid() && result.missingInputs) {
+                errors[toAcceptIndex[j]] = "Missing inputs";
+            } else {
+                errors[toAcceptIndex[j]] = FormatStateMessage(result.state);
+            }
+        }
+
+        // Ensure the wallet has been made aware of the new transactions
+        // prior to returning, see BroadcastTransaction().
+        CallFunctionInValidationInterfaceQueue(
+            [&promise] { promise.set_value(); });
+    } // cs_main
+
+    promise.get_future().wait();
+
+    if (!g_connman) {
+        throw JSONRPCError(
+            RPC_CLIENT_P2P_DISABLED,
+            "Error: Peer-to-peer functionality missing or disabled");
+    }
+
+    g_connman->ForEachNode([&toRelay](CNode *pnode) {
+        for (const TxId &txid : toRelay) {
+            pnode->PushInventory(CInv(MSG_TX, txid));
+        }
+    });
+
+    return errors;
+}
@@ -7,6 +7,9 @@
 
 #include <primitives/transaction.h>
 
+#include <string>
+#include <vector>
+
 class Config;
 struct TxId;
 
@@ -14,4 +17,14 @@ struct TxId;
 TxId BroadcastTransaction(const Config &config, CTransactionRef tx,
                           bool allowhighfees = false);
 
+/**
+ * Broadcast a batch of transactions, which are added to the mempool together
+ * and in order. Returns an error message for each transaction, which is empty
+ * if the transaction was broadcast.
+ */
+std::vector<std::string>
+BroadcastTransactions(const Config &config,
+                      const std::vector<CTransactionRef> &txs,
+                      bool allowhighfees = false);
+
 #endif // BITCOIN_NODE_TRANSACTION_H
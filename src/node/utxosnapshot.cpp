@@ -0,0 +1,213 @@
+// Copyright (c) 2022 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/utxosnapshot.h>
+
+#include <chain.h>
+#include <clientversion.h>
+#include <coins.h>
+#include <logging.h>
+#include <memusage.h>
+#include <node/coinstats.h>
+#include <primitives/txid.h>
+#include <shutdown.h>
+#include <streams.h>
+#include <sync.h>
+#include <txdb.h>
+#include <util/system.h>
+#include <validation.h>
+
+#include <map>
+#include <memory>
+
+#define MICRO 0.000001
+
+bool DumpUTXOSnapshot(CCoinsView *view, const fs::path &path,
+                      CCoinsStats &stats) {
+    int64_t start = GetTimeMicros();
+    const fs::path temppath = path.string() + ".incomplete";
+
+    try {
+        FILE *filestr = fsbridge::fopen(temppath, "wb");
+        if (!filestr) {
+            return error("%s: unable to open %s", __func__, temppath.string());
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        // The header is rewritten once the UTXO set has been hashed.
+        SnapshotMetadata metadata;
+        file << metadata;
+
+        if (!GetUTXOStats(
+                view, stats,
+                [&file](const TxId &txid,
+                        const std::map<uint32_t, Coin> &outputs) {
+                    file << txid;
+                    file << COMPACTSIZE(uint64_t(outputs.size()));
+                    for (const auto &output : outputs) {
+                        file << VARINT(output.first);
+                        file << output.second;
+                    }
+                    return true;
+                })) {
+            file.fclose();
+            fs::remove(temppath);
+            return error("%s: unable to read UTXO set", __func__);
+        }
+
+        metadata.base_blockhash = stats.hashBlock;
+        metadata.transactions_count = stats.nTransactions;
+        metadata.coins_count = stats.nTransactionOutputs;
+        metadata.hash_serialized = stats.hashSerialized;
+        if (fseek(file.Get(), 0, SEEK_SET) != 0) {
+            throw std::runtime_error("fseek failed");
+        }
+        file << metadata;
+
+        if (!FileCommit(file.Get())) {
+            throw std::runtime_error("FileCommit failed");
+        }
+        file.fclose();
+        if (!RenameOver(temppath, path)) {
+            throw std::runtime_error("rename failed");
+        }
+    } catch (const std::exception &e) {
+        fs::remove(temppath);
+        return error("%s: failed to write %s: %s", __func__, path.string(),
+                     e.what());
+    }
+
+    LogPrintf("Dumped UTXO snapshot of %u coins at block %s to %s: %.2fs\n",
+              stats.nTransactionOutputs, stats.hashBlock.ToString(),
+              path.string(), (GetTimeMicros() - start) * MICRO);
+    return true;
+}
+
+bool LoadUTXOSnapshot(CCoinsViewDB &view, const fs::path &path,
+                      size_t nBatchUsage, std::string &strError) {
+    int64_t start = GetTimeMicros();
+
+    FILE *filestr = fsbridge::fopen(path, "rb");
+    if (!filestr) {
+        strError = strprintf("Unable to open UTXO snapshot %s", path.string());
+        return false;
+    }
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+    SnapshotMetadata metadata;
+    try {
+        file >> metadata;
+    } catch (const std::exception &e) {
+        strError = strprintf("Unable to read UTXO snapshot %s", path.string());
+        return false;
+    }
+    if (metadata.magic != UTXO_SNAPSHOT_MAGIC) {
+        strError = strprintf("%s is not a UTXO snapshot", path.string());
+        return false;
+    }
+    if (metadata.version != UTXO_SNAPSHOT_VERSION) {
+        strError = strprintf("Unsupported UTXO snapshot version %u",
+                             metadata.version);
+        return false;
+    }
+
+    const BlockHash &hashBlock = metadata.base_blockhash;
+    {
+        LOCK(cs_main);
+        const CBlockIndex *pindex = LookupBlockIndex(hashBlock);
+        if (!pindex || !pindex->HaveTxsDownloaded() ||
+            pindex->nStatus.isInvalid()) {
+            strError = strprintf(
+                "The base block %s of the UTXO snapshot, and all its "
+                "ancestors, must be on disk",
+                hashBlock.ToString());
+            return false;
+        }
+        LogPrintf("Loading UTXO snapshot of %u coins at block %s (height "
+                  "%d)\n",
+                  metadata.coins_count, hashBlock.ToString(), pindex->nHeight);
+    }
+
+    if (!view.WriteSnapshotLoading(true)) {
+        strError = "Unable to write to the coins database";
+        return false;
+    }
+
+    CCoinsMapMemoryResource resource;
+    CCoinsMap coins(0, SaltedOutpointHasher{}, CCoinsMap::key_equal{},
+                    &resource);
+    uint64_t nCoins = 0;
+    try {
+        for (uint64_t i = 0; i < metadata.transactions_count; ++i) {
+            if (ShutdownRequested()) {
+                strError = "UTXO snapshot load interrupted";
+                return false;
+            }
+
+            TxId txid;
+            uint64_t nOutputs = 0;
+            file >> txid;
+            file >> COMPACTSIZE(nOutputs);
+            for (uint64_t j = 0; j < nOutputs; ++j) {
+                uint32_t n = 0;
+                Coin coin;
+                file >> VARINT(n);
+                file >> coin;
+                CCoinsCacheEntry &entry = coins[COutPoint(txid, n)];
+                entry.coin = std::move(coin);
+                entry.flags =
+                    CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                ++nCoins;
+            }
+
+            if (memusage::DynamicUsage(coins) >= nBatchUsage) {
+                if (!view.BatchWrite(coins, hashBlock)) {
+                    strError = "Unable to write to the coins database";
+                    return false;
+                }
+                coins.clear();
+            }
+        }
+    } catch (const std::exception &e) {
+        strError = strprintf("Unable to read UTXO snapshot %s: %s",
+                             path.string(), e.what());
+        return false;
+    }
+    if (nCoins != metadata.coins_count) {
+        strError = strprintf("The UTXO snapshot contains %u coins, %u expected",
+                             nCoins, metadata.coins_count);
+        return false;
+    }
+    if (!view.BatchWrite(coins, hashBlock) || !view.Sync()) {
+        strError = "Unable to write to the coins database";
+        return false;
+    }
+    coins.clear();
+
+    int64_t mid = GetTimeMicros();
+
+    CCoinsStats stats;
+    if (!GetUTXOStats(&view, stats)) {
+        strError = "Unable to read the coins database";
+        return false;
+    }
+    if (stats.hashBlock != hashBlock ||
+        stats.hashSerialized != metadata.hash_serialized) {
+        strError = strprintf(
+            "The UTXO set loaded from the snapshot has hash %s, %s expected",
+            stats.hashSerialized.ToString(),
+            metadata.hash_serialized.ToString());
+        return false;
+    }
+
+    if (!view.WriteSnapshotLoading(false)) {
+        strError = "Unable to write to the coins database";
+        return false;
+    }
+
+    LogPrintf("Loaded UTXO snapshot: %.2fs to load, %.2fs to verify\n",
+              (mid - start) * MICRO, (GetTimeMicros() - mid) * MICRO);
+    return true;
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2022 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_UTXOSNAPSHOT_H
+#define BITCOIN_NODE_UTXOSNAPSHOT_H
+
+#include <fs.h>
+#include <primitives/blockhash.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class CCoinsView;
+class CCoinsViewDB;
+struct CCoinsStats;
+
+static constexpr std::array<uint8_t, 5> UTXO_SNAPSHOT_MAGIC{
+    {'u', 't', 'x', 'o', 0xff}};
+static constexpr uint16_t UTXO_SNAPSHOT_VERSION = 1;
+
+/**
+ * Header of a UTXO snapshot file, as written by the dumptxoutset RPC.
+ *
+ * The header is followed by the unspent outputs of coins_count /
+ * transactions_count transactions, grouped by transaction in the order of the
+ * coins database: the txid, the number of outputs and, for each output, its
+ * index and the Coin. hash_serialized is the hash reported by gettxoutsetinfo
+ * for the UTXO set as of base_blockhash.
+ */
+struct SnapshotMetadata {
+    std::array<uint8_t, 5> magic = UTXO_SNAPSHOT_MAGIC;
+    uint16_t version = UTXO_SNAPSHOT_VERSION;
+    BlockHash base_blockhash;
+    uint64_t transactions_count = 0;
+    uint64_t coins_count = 0;
+    uint256 hash_serialized;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(magic, version, base_blockhash, transactions_count,
+                  coins_count, hash_serialized);
+    }
+};
+
+/**
+ * Write the UTXO set of view to a snapshot file at path. The file is written
+ * under a temporary name and only renamed to path once complete. stats is
+ * filled in as for gettxoutsetinfo.
+ */
+bool DumpUTXOSnapshot(CCoinsView *view, const fs::path &path,
+                      CCoinsStats &stats);
+
+/**
+ * Populate the (empty) coins database from the snapshot file at path, then
+ * check the resulting UTXO set against the hash recorded in the snapshot.
+ * The snapshot base block must be in the block index, with the data of all
+ * its ancestors. Coins are written in batches of about nBatchUsage bytes.
+ */
+bool LoadUTXOSnapshot(CCoinsViewDB &view, const fs::path &path,
+                      size_t nBatchUsage, std::string &strError);
+
+#endif // BITCOIN_NODE_UTXOSNAPSHOT_H
@@ -21,6 +21,9 @@
  */
 class CBlockHeader {
 public:
+    //! The size of a serialized header
+    static constexpr size_t SIZE = 80;
+
     // header
     int32_t nVersion;
     BlockHash hashPrevBlock;
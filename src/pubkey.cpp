@@ -9,6 +9,8 @@
 #include <secp256k1_recovery.h>
 #include <secp256k1_schnorr.h>
 
+#include <cassert>
+
 namespace {
 /* Global secp256k1_context object used for verification. */
 secp256k1_context *secp256k1_context_verify = nullptr;
@@ -215,6 +217,54 @@ bool CPubKey::VerifySchnorr(const uint256 &hash,
                                     hash.begin(), &pubkey);
 }
 
+//! Scratch space for the multi-multiplication of a batch verification.
+static constexpr size_t SCHNORR_BATCH_SCRATCH_SIZE = 1 << 20;
+
+bool CSchnorrBatchVerifier::Verify() const {
+    if (entries.size() <= 1) {
+        return VerifyIndividually(0, entries.size());
+    }
+
+    std::vector<secp256k1_pubkey> pubkeys(entries.size());
+    std::vector<const secp256k1_pubkey *> pubkeyptrs(entries.size());
+    std::vector<const uint8_t *> sigptrs(entries.size());
+    std::vector<const uint8_t *> msgptrs(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const Entry &entry = entries[i];
+        if (!entry.pubkey.IsValid() || entry.vchSig.size() != 64 ||
+            !secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkeys[i],
+                                       entry.pubkey.begin(),
+                                       entry.pubkey.size())) {
+            return false;
+        }
+        pubkeyptrs[i] = &pubkeys[i];
+        sigptrs[i] = entry.vchSig.data();
+        msgptrs[i] = entry.hash.begin();
+    }
+
+    secp256k1_scratch_space *scratch = secp256k1_scratch_space_create(
+        secp256k1_context_verify, SCHNORR_BATCH_SCRATCH_SIZE);
+    const bool fValid = secp256k1_schnorr_verify_batch(
+        secp256k1_context_verify, scratch, sigptrs.data(), msgptrs.data(),
+        pubkeyptrs.data(), entries.size());
+    if (scratch) {
+        secp256k1_scratch_space_destroy(secp256k1_context_verify, scratch);
+    }
+    return fValid;
+}
+
+bool CSchnorrBatchVerifier::VerifyIndividually(size_t begin,
+                                               size_t end) const {
+    assert(begin <= end && end <= entries.size());
+    for (size_t i = begin; i < end; ++i) {
+        const Entry &entry = entries[i];
+        if (!entry.pubkey.VerifySchnorr(entry.hash, entry.vchSig)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool CPubKey::RecoverCompact(const uint256 &hash,
                              const std::vector<uint8_t> &vchSig) {
     if (vchSig.size() != COMPACT_SIGNATURE_SIZE) {
@@ -187,6 +187,37 @@ public:
                 const ChainCode &cc) const;
 };
 
+/**
+ * A set of Schnorr signatures that are verified all at once. Verifying them
+ * as a batch is significantly cheaper than verifying them one by one, but only
+ * tells whether they are all valid.
+ */
+class CSchnorrBatchVerifier {
+private:
+    struct Entry {
+        CPubKey pubkey;
+        uint256 hash;
+        std::vector<uint8_t> vchSig;
+    };
+    std::vector<Entry> entries;
+
+public:
+    void Add(const CPubKey &pubkey, const uint256 &hash,
+             const std::vector<uint8_t> &vchSig) {
+        entries.push_back({pubkey, hash, vchSig});
+    }
+
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    void clear() { entries.clear(); }
+
+    //! Whether all the signatures are valid, as per CPubKey::VerifySchnorr.
+    bool Verify() const;
+
+    //! Verify the signatures in [begin, end) one by one.
+    bool VerifyIndividually(size_t begin, size_t end) const;
+};
+
 struct CExtPubKey {
     uint8_t nDepth;
     uint8_t vchFingerprint[4];
@@ -17,6 +17,8 @@
 #include <hash.h>
 #include <index/txindex.h>
 #include <key_io.h>
+#include <node/coinstats.h>
+#include <node/utxosnapshot.h>
 #include <policy/policy.h>
 #include <primitives/transaction.h>
 #include <rpc/server.h>
@@ -441,29 +443,22 @@ static std::string EntryDescriptionString() {
            "       ... ]\n";
 }
 
-static UniValue::Object entryToJSON(const CTxMemPool &pool, const CTxMemPoolEntry &e)
-    EXCLUSIVE_LOCKS_REQUIRED(pool.cs) {
-    AssertLockHeld(pool.cs);
-
+static UniValue::Object entryToJSON(const MempoolSnapshot::Entry &e) {
     UniValue::Object info;
     info.reserve(5);
 
     UniValue::Object fees;
     fees.reserve(2);
-    fees.emplace_back("base", ValueFromAmount(e.GetFee()));
-    fees.emplace_back("modified", ValueFromAmount(e.GetModifiedFee()));
+    fees.emplace_back("base", ValueFromAmount(e.fee));
+    fees.emplace_back("modified", ValueFromAmount(e.modifiedFee));
 
     info.emplace_back("fees", std::move(fees));
-    info.emplace_back("size", e.GetTxSize());
-    info.emplace_back("time", e.GetTime());
-
-    const CTransaction &tx = e.GetTx();
+    info.emplace_back("size", e.txSize);
+    info.emplace_back("time", e.time);
 
     std::set<std::string> setDepends;
-    for (const CTxIn &txin : tx.vin) {
-        if (pool.exists(txin.prevout.GetTxId())) {
-            setDepends.insert(txin.prevout.GetTxId().ToString());
-        }
+    for (const TxId &parent : e.parents) {
+        setDepends.insert(parent.ToString());
     }
     UniValue::Array depends;
     depends.reserve(setDepends.size());
@@ -473,35 +468,38 @@ static UniValue::Object entryToJSON(const CTxMemPool &pool, const CTxMemPoolEntr
     info.emplace_back("depends", std::move(depends));
 
     UniValue::Array spent;
-    const CTxMemPool::txiter &it = pool.mapTx.find(tx.GetId());
-    const CTxMemPool::setEntries &setChildren = pool.GetMemPoolChildren(it);
-    spent.reserve(setChildren.size());
-    for (CTxMemPool::txiter childiter : setChildren) {
-        spent.emplace_back(childiter->GetTx().GetId().ToString());
+    spent.reserve(e.children.size());
+    for (const TxId &child : e.children) {
+        spent.emplace_back(child.ToString());
     }
     info.emplace_back("spentby", std::move(spent));
 
     return info;
 }
 
+static UniValue::Object entryToJSON(const CTxMemPool &pool, const CTxMemPoolEntry &e)
+    EXCLUSIVE_LOCKS_REQUIRED(pool.cs) {
+    AssertLockHeld(pool.cs);
+    return entryToJSON(pool.GetSnapshotEntry(pool.mapTx.find(e.GetTx().GetId())));
+}
+
 UniValue MempoolToJSON(const CTxMemPool &pool, bool verbose) {
+    // Work on a snapshot so that building the JSON does not hold up the
+    // mempool.
+    const std::shared_ptr<const MempoolSnapshot> snapshot = pool.GetSnapshot();
     if (verbose) {
         UniValue::Object ret;
-        LOCK(pool.cs);
-        ret.reserve(pool.mapTx.size());
-        for (const CTxMemPoolEntry &e : pool.mapTx) {
-            const uint256 &txid = e.GetTx().GetId();
-            ret.emplace_back(txid.ToString(), entryToJSON(pool, e));
+        ret.reserve(snapshot->entries.size());
+        for (const MempoolSnapshot::Entry &e : snapshot->entries) {
+            ret.emplace_back(e.tx->GetId().ToString(), entryToJSON(e));
         }
         return ret;
     }
 
-    std::vector<uint256> vtxids;
-    pool.queryHashes(vtxids);
     UniValue::Array ret;
-    ret.reserve(vtxids.size());
-    for (const uint256 &txid : vtxids) {
-        ret.emplace_back(txid.ToString());
+    ret.reserve(snapshot->entries.size());
+    for (const MempoolSnapshot::Entry &e : snapshot->entries) {
+        ret.emplace_back(e.tx->GetId().ToString());
     }
     return ret;
 }
@@ -972,81 +970,6 @@ static UniValue getblock(const Config &config, const JSONRPCRequest &request) {
     return blockToJSON(config, block, ::ChainActive().Tip(), pblockindex, verbosity >= 2);
 }
 
-struct CCoinsStats {
-    int nHeight;
-    BlockHash hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    Amount nTotalAmount;
-
-    CCoinsStats()
-        : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0),
-          nDiskSize(0), nTotalAmount() {}
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter &ss, const uint256 &hash,
-                       const std::map<uint32_t, Coin> &outputs) {
-    assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.GetHeight() * 2 +
-                 outputs.begin()->second.IsCoinBase());
-    stats.nTransactions++;
-    for (const auto &output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.GetTxOut().scriptPubKey;
-        ss << VARINT(output.second.GetTxOut().nValue / SATOSHI,
-                     VarIntMode::NONNEGATIVE_SIGNED);
-        stats.nTransactionOutputs++;
-        stats.nTotalAmount += output.second.GetTxOut().nValue;
-        stats.nBogoSize +=
-            32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ +
-            8 /* amount */ + 2 /* scriptPubKey len */ +
-            output.second.GetTxOut().scriptPubKey.size() /* scriptPubKey */;
-    }
-    ss << VARINT(0u);
-}
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats) {
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.GetTxId() != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.GetTxId();
-            outputs[key.GetN()] = std::move(coin);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
-    return true;
-}
-
 static UniValue pruneblockchain(const Config &config,
                                 const JSONRPCRequest &request) {
     if (request.fHelp || request.params.size() != 1) {
@@ -1491,10 +1414,11 @@ static UniValue getchaintips(const Config &config,
 UniValue::Object MempoolInfoToJSON(const Config &config, const CTxMemPool &pool) {
     UniValue::Object ret;
     ret.reserve(7);
+    const std::shared_ptr<const MempoolSnapshot> snapshot = pool.GetSnapshot();
     ret.emplace_back("loaded", pool.IsLoaded());
-    ret.emplace_back("size", pool.size());
-    ret.emplace_back("bytes", pool.GetTotalTxSize());
-    ret.emplace_back("usage", pool.DynamicMemoryUsage());
+    ret.emplace_back("size", snapshot->entries.size());
+    ret.emplace_back("bytes", snapshot->totalTxSize);
+    ret.emplace_back("usage", snapshot->dynamicMemoryUsage);
     auto maxmempool = config.GetMaxMemPoolSize();
     ret.emplace_back("maxmempool", maxmempool);
     ret.emplace_back("mempoolminfee", ValueFromAmount(std::max(pool.GetMinFee(maxmempool), ::minRelayTxFee).GetFeePerK()));
@@ -2276,6 +2200,56 @@ static UniValue savemempool(const Config &config,
     return UniValue();
 }
 
+static UniValue dumptxoutset(const Config &config,
+                             const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() != 1) {
+        throw std::runtime_error(
+            RPCHelpMan{"dumptxoutset",
+                "\nWrite the UTXO set to a snapshot file, which can be loaded with -loadutxosnapshot.\n"
+                "Note this call may take some time.\n",
+                {
+                    {"path", RPCArg::Type::STR, /* opt */ false, /* default_val */ "", "Path to the output file. If relative, will be prefixed by datadir."},
+                }}
+                .ToString() +
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,       (numeric) The number of coins written to the snapshot\n"
+            "  \"base_hash\": \"hex\",      (string) The hash of the block the snapshot is based on\n"
+            "  \"base_height\": n,         (numeric) The height of the block the snapshot is based on\n"
+            "  \"path\": \"path\",          (string) The absolute path the snapshot was written to\n"
+            "  \"hash_serialized\": \"hash\", (string) The serialized hash of the UTXO set, as reported by gettxoutsetinfo\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "utxo.dat")
+            + HelpExampleRpc("dumptxoutset", "utxo.dat")
+        );
+    }
+
+    const fs::path path =
+        AbsPathForConfigVal(fs::path(request.params[0].get_str()));
+    if (fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER,
+                           path.string() + " already exists. If you are sure "
+                                           "this is what you want, move it "
+                                           "out of the way first");
+    }
+
+    CCoinsStats stats;
+    FlushStateToDisk();
+    if (!DumpUTXOSnapshot(pcoinsdbview.get(), path, stats)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to dump UTXO set to disk");
+    }
+
+    UniValue::Object ret;
+    ret.reserve(5);
+    ret.emplace_back("coins_written", stats.nTransactionOutputs);
+    ret.emplace_back("base_hash", stats.hashBlock.GetHex());
+    ret.emplace_back("base_height", stats.nHeight);
+    ret.emplace_back("path", path.string());
+    ret.emplace_back("hash_serialized", stats.hashSerialized.GetHex());
+    return ret;
+}
+
 //! Search for a given set of pubkey scripts
 static bool FindScriptPubKey(std::atomic<int> &scan_progress,
                              const std::atomic<bool> &should_abort,
@@ -2540,6 +2514,7 @@ static UniValue scantxoutset(const Config &config,
 static const ContextFreeRPCCommand commands[] = {
     //  category            name                      actor (function)        argNames
     //  ------------------- ------------------------  ----------------------  ----------
+    { "blockchain",         "dumptxoutset",           dumptxoutset,           {"path"} },
     { "blockchain",         "finalizeblock",          finalizeblock,          {"blockhash"} },
     { "blockchain",         "getbestblockhash",       getbestblockhash,       {} },
     { "blockchain",         "getblock",               getblock,               {"blockhash","verbosity|verbose"} },
@@ -96,6 +96,8 @@ static const CRPCConvertParam vRPCConvertParams[] = {
     {"signrawtransactionwithkey", 2, "prevtxs"},
     {"signrawtransactionwithwallet", 1, "prevtxs"},
     {"sendrawtransaction", 1, "allowhighfees"},
+    {"sendrawtransactions", 0, "rawtxs"},
+    {"sendrawtransactions", 1, "allowhighfees"},
     {"testmempoolaccept", 0, "rawtxs"},
     {"testmempoolaccept", 1, "allowhighfees"},
     {"combinerawtransaction", 0, "txs"},
@@ -27,6 +27,7 @@
 #include <rpc/util.h>
 #include <shutdown.h>
 #include <txmempool.h>
+#include <util/moneystr.h>
 #include <util/strencodings.h>
 #include <util/system.h>
 #include <validation.h>
@@ -41,6 +42,7 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -363,8 +365,12 @@ std::unordered_map<JobId, std::vector<CTransactionRef>, TrivialJobIdHasher> gJob
 /// This list allows us to implement an LRU cache. We remove items when this grows too large.
 std::list<JobId> gJobIdList GUARDED_BY(gJobIdMut);
 
-/// Bytes used as header and footer for the getblocktemplatelight data files we write out.
+/// Bytes used as header and footer for the getblocktemplatelight data files written by earlier versions, which hold
+/// the transactions themselves.
 const std::string kDataFileMagic = "GBT";
+/// Bytes used as header and footer for the getblocktemplatelight data files we write out, which hold references to
+/// the transactions in the job tx data store (see gbtl::StoreJobTxs).
+const std::string kRefsFileMagic = "GBR";
 } // namespace
 } // namespace gbtl
 
@@ -518,9 +524,12 @@ static UniValue getblocktemplatecommon(bool fLight, const Config &config, const
     static std::unique_ptr<LightResult> plightresult; // fLight mode only, cached result associated with pblocktemplate
     static bool fIgnoreCache = false;
     bool fNewTip = (pindexPrev && pindexPrev != ::ChainActive().Tip());
+    // A snapshot of the incrementally maintained template is cheap, so there
+    // is no need to hold on to the cached template for 5 seconds then.
+    const bool fCanSnapshot = g_blocktemplatetracker && g_blocktemplatetracker->CanSnapshot();
     if (pindexPrev != ::ChainActive().Tip() || fIgnoreCache || ignoreCacheOverride ||
         (g_mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast &&
-         GetTime() - nStart > 5)) {
+         (GetTime() - nStart > 5 || fCanSnapshot))) {
         // Clear pindexPrev so future calls make a new block, despite any
         // failures from here on
         pindexPrev = nullptr;
@@ -548,7 +557,9 @@ static UniValue getblocktemplatecommon(bool fLight, const Config &config, const
         // Create new block
         CScript scriptDummy = CScript() << OP_TRUE;
         pblocktemplate =
-            BlockAssembler(config, g_mempool).CreateNewBlock(scriptDummy, timeLimitSecs, checkValidity);
+            g_blocktemplatetracker
+                ? g_blocktemplatetracker->CreateNewBlock(scriptDummy, timeLimitSecs, checkValidity)
+                : BlockAssembler(config, g_mempool).CreateNewBlock(scriptDummy, timeLimitSecs, checkValidity);
         plightresult.reset();
         if (!pblocktemplate) {
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
@@ -1280,8 +1291,9 @@ void LoadTxsFromFile(const JobId &jobId, CBlock &block) {
     }
     LogPrint(BCLog::RPC, "SubmitBlockLight job_id %s found in %s\n", jobIdStr, filename.string());
     try {
-        const auto magicLen = kDataFileMagic.size(); // 3 for "GBT"
+        const auto magicLen = kDataFileMagic.size(); // 3 for "GBT" or "GBR"
         std::vector<uint8_t> dataBuf;
+        bool fRefs{};
         {
             fs::ifstream file(filename);
 
@@ -1299,19 +1311,28 @@ void LoadTxsFromFile(const JobId &jobId, CBlock &block) {
             dataBuf.resize(size_t(fileSize));
             char * const charDataBuf = reinterpret_cast<char *>(dataBuf.data());
             file.read(charDataBuf, fileSize);
+            fRefs = 0 == std::memcmp(charDataBuf, kRefsFileMagic.data(), magicLen);
+            const std::string &magic = fRefs ? kRefsFileMagic : kDataFileMagic;
             // check read was good and that header and footer match
             if (file.fail()
-                    // header must match "GBT"
-                    || 0 != std::memcmp(charDataBuf, kDataFileMagic.data(), magicLen)
-                    // footer must match "GBT"
-                    || 0 != std::memcmp(charDataBuf + fileSize - magicLen, kDataFileMagic.data(), magicLen)) {
+                    // header must match "GBT" or "GBR"
+                    || 0 != std::memcmp(charDataBuf, magic.data(), magicLen)
+                    // footer must match the header
+                    || 0 != std::memcmp(charDataBuf + fileSize - magicLen, magic.data(), magicLen)) {
                 LogPrintf("WARNING: SubmitBlockLight job_id %s appears to be corrupt\n", jobIdStr);
                 throw JSONRPCError(RPC_DESERIALIZATION_ERROR, errDataBad);
             }
             // everything's ok, proceed
         }
-        // deserialize the vector directly, starting at pos 3 (after "GBT" header)
+        // deserialize the vector directly, starting at pos 3 (after "GBT" or "GBR" header)
         VectorReader vr(SER_NETWORK, PROTOCOL_VERSION, dataBuf, magicLen /* start pos */);
+        if (fRefs) {
+            // only the referenced transactions are read from the job tx data store
+            std::vector<JobTxRef> refs;
+            vr >> refs;
+            LoadJobTxs(refs, block.vtx);
+            return;
+        }
         uint32_t txCount = 0;
         vr >> txCount;
         for (uint32_t i = 0; i < txCount; ++i) {
@@ -1350,28 +1371,34 @@ void CacheAndSaveTxsToFile(const JobId &jobId, const std::vector<CTransactionRef
         AssertLockHeld(cs_main);
         if (!fs::exists(outputFile)) {
             setupStoreTxs();
+            const auto t0 = GetTimeMicros(); // for perf. logging iff BCLog::RPC is enabled
+            // The transactions go to the job tx data store, which only appends those the recent jobs do not have
+            // already, and the job file refers to them.
+            std::vector<JobTxRef> refs;
+            try {
+                refs = StoreJobTxs(storeTxs);
+            } catch (const std::exception &e) {
+                LogPrintf("getblocktemplatelight: cannot write tx data to %s: %s\n", GetJobTxDataDir().string(),
+                          e.what());
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "failed to save job tx data to disk");
+            }
             CDataStream datastream(SER_NETWORK, PROTOCOL_VERSION);
-            const uint32_t nTx = uint32_t(storeTxs.size());
-            datastream.reserve(256 * nTx + sizeof(nTx)); // assume avg 256 byte tx size. This doesn't have to be exact, this is just to avoid redundant allocations as we serialize.
-            datastream << nTx; // first write the size
-            for (const auto &txRef : storeTxs)
-                datastream << *txRef;
+            datastream << refs;
 
-            const auto t0 = GetTimeMicros(); // for perf. logging iff BCLog::RPC is enabled
             auto tmpOut = outputFile;
             tmpOut += gbtl::tmpExt; // += ".tmp"
             bool ok{};
             {
                 fs::ofstream ofile(tmpOut, std::ios_base::binary|std::ios_base::out|std::ios_base::trunc);
                 if ((ok = ofile.is_open())) {
-                    // "GBT" magic bytes at front
+                    // "GBR" magic bytes at front
                     using std::streamsize;
-                    ofile.write(kDataFileMagic.data(), streamsize(kDataFileMagic.size()));
+                    ofile.write(kRefsFileMagic.data(), streamsize(kRefsFileMagic.size()));
                     if (ofile)
                         ofile.write(datastream.data(), streamsize(datastream.size()));
                     if (ofile)
-                        // "GBT" magic bytes at end
-                        ofile.write(kDataFileMagic.data(), streamsize(kDataFileMagic.size()));
+                        // "GBR" magic bytes at end
+                        ofile.write(kRefsFileMagic.data(), streamsize(kRefsFileMagic.size()));
                     ok = bool(ofile);
                 }
             } // file is closed
@@ -1413,6 +1440,116 @@ void CacheAndSaveTxsToFile(const JobId &jobId, const std::vector<CTransactionRef
     }
 }
 
+std::unique_ptr<TemplatePusher> g_template_pusher;
+
+TemplatePusher::TemplatePusher(const Config &configIn, PublishFn publishIn, Amount feeThresholdIn)
+    : config(configIn), publish(std::move(publishIn)), feeThreshold(feeThresholdIn) {}
+
+TemplatePusher::~TemplatePusher() {
+    Stop();
+}
+
+void TemplatePusher::Start() {
+    {
+        LOCK(cs);
+        fStop = false;
+    }
+    thread = std::thread(&TraceThread<std::function<void()>>, "gbtpush", std::function<void()>([this] { ThreadPush(); }));
+}
+
+void TemplatePusher::Stop() {
+    {
+        LOCK(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void TemplatePusher::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork,
+                                     bool fInitialDownload) {
+    // In IBD or blocks were disconnected without any new ones
+    if (fInitialDownload || pindexNew == pindexFork) {
+        return;
+    }
+    {
+        LOCK(cs);
+        fNewTip = true;
+    }
+    cond.notify_all();
+}
+
+void TemplatePusher::TransactionAddedToMempool(const CTransactionRef &) {
+    {
+        LOCK(cs);
+        fMempoolUpdated = true;
+    }
+    cond.notify_all();
+}
+
+void TemplatePusher::ThreadPush() {
+    auto nextMempoolPush = std::chrono::steady_clock::now();
+    while (true) {
+        bool fNewTipPending;
+        {
+            WAIT_LOCK(cs, lock);
+            while (!fStop && !fNewTip && !(fMempoolUpdated && std::chrono::steady_clock::now() >= nextMempoolPush)) {
+                if (fMempoolUpdated) {
+                    cond.wait_until(lock, nextMempoolPush);
+                } else {
+                    cond.wait(lock);
+                }
+            }
+            if (fStop) {
+                return;
+            }
+            fNewTipPending = fNewTip;
+            fNewTip = fMempoolUpdated = false;
+        }
+        nextMempoolPush = std::chrono::steady_clock::now() + PUSH_MEMPOOL_INTERVAL;
+        Push(fNewTipPending);
+    }
+}
+
+void TemplatePusher::Push(bool fNewTipIn) {
+    const auto t0 = GetTimeMicros(); // perf. info, used iff logging BCLog::RPC
+    JSONRPCRequest request;
+    {
+        // On a new tip the cached template is stale anyway; otherwise, the mempool has changed since it was built.
+        UniValue::Object templateRequest;
+        templateRequest.emplace_back("ignorecache", !fNewTipIn);
+        UniValue::Array params;
+        params.emplace_back(std::move(templateRequest));
+        request.params = std::move(params);
+    }
+    UniValue result;
+    try {
+        result = getblocktemplatecommon(true, config, request);
+    } catch (const JSONRPCError &error) {
+        // not connected, in IBD, ...
+        LogPrint(BCLog::RPC, "gbtpush: cannot build a template: %s\n", error.message);
+        return;
+    } catch (const std::exception &e) {
+        LogPrintf("gbtpush: cannot build a template: %s\n", e.what());
+        return;
+    }
+
+    const BlockHash prevBlockHash(ParseHashV(result["previousblockhash"], "previousblockhash"));
+    const Amount coinbaseValue = result["coinbasevalue"].get_int64() * SATOSHI;
+    if (prevBlockHash == lastPrevBlockHash && coinbaseValue - lastCoinbaseValue < feeThreshold) {
+        LogPrint(BCLog::RPC, "gbtpush: template fees up by %s, not published\n",
+                 FormatMoney(coinbaseValue - lastCoinbaseValue));
+        return;
+    }
+    lastPrevBlockHash = prevBlockHash;
+    lastCoinbaseValue = coinbaseValue;
+    publish(UniValue::stringify(result));
+    LogPrint(BCLog::RPC, "gbtpush: published job_id %s in %f secs\n", result["job_id"].get_str(),
+             (GetTimeMicros() - t0) / 1e6);
+}
+
 } // namespace gbtl
 
 // clang-format off
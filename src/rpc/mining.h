@@ -6,13 +6,22 @@
 #ifndef BITCOIN_RPC_MINING_H
 #define BITCOIN_RPC_MINING_H
 
+#include <amount.h>
 #include <gbtlight.h>
+#include <primitives/blockhash.h>
 #include <primitives/transaction.h>
 #include <script/script.h>
+#include <sync.h>
+#include <validationinterface.h>
 
 #include <univalue.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <string>
+#include <thread>
 
 class CBlock;
 class Config;
@@ -51,5 +60,58 @@ void LoadTxsFromFile(const JobId &jobId, CBlock &block);
  *  IMPORTANT: This function must be called with the cs_main lock held.  Test code should take cs_main before
  *             calling this function.   */
 void CacheAndSaveTxsToFile(const JobId &jobId, const std::vector<CTransactionRef> *pvtx);
+
+/** Default for -gbtpushfeethreshold */
+static constexpr Amount DEFAULT_PUSH_FEE_THRESHOLD(10000 * SATOSHI);
+/** A new template is built for mempool changes at most this often */
+static constexpr std::chrono::seconds PUSH_MEMPOOL_INTERVAL{1};
+
+/**
+ * Publishes getblocktemplatelight results as they change, so that pool servers can subscribe to them (see
+ * -zmqpubgbtlight) instead of polling.
+ *
+ * A new tip makes the background thread build and publish a template right away. Mempool changes make it build one
+ * at most every PUSH_MEMPOOL_INTERVAL, which is only published if its fees improve on the last published one by at
+ * least the fee threshold. A template is the same JSON object getblocktemplatelight returns without arguments, and
+ * its job is stored in the same way, so that it can be submitted with submitblocklight.
+ */
+class TemplatePusher final : public CValidationInterface {
+public:
+    using PublishFn = std::function<void(const std::string &json)>;
+
+    TemplatePusher(const Config &configIn, PublishFn publishIn, Amount feeThresholdIn);
+    ~TemplatePusher();
+
+    void Start();
+    void Stop();
+
+protected:
+    // CValidationInterface
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+    void TransactionAddedToMempool(const CTransactionRef &ptx) override;
+
+private:
+    const Config &config;
+    const PublishFn publish;
+    const Amount feeThreshold;
+
+    Mutex cs;
+    std::condition_variable cond;
+    bool fNewTip GUARDED_BY(cs){false};
+    bool fMempoolUpdated GUARDED_BY(cs){false};
+    bool fStop GUARDED_BY(cs){false};
+    std::thread thread;
+
+    //! What the last published template was built on, and its coinbase value
+    BlockHash lastPrevBlockHash;
+    Amount lastCoinbaseValue{Amount::zero()};
+
+    void ThreadPush();
+    //! Build a template and publish it if it is worth it
+    void Push(bool fNewTipIn);
+};
+
+/** Publishes getblocktemplatelight results, or nullptr if nobody subscribes to them. */
+extern std::unique_ptr<TemplatePusher> g_template_pusher;
 }
 #endif // BITCOIN_RPC_MINING_H
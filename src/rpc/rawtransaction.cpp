@@ -1096,6 +1096,75 @@ static UniValue sendrawtransaction(const Config &config,
     return BroadcastTransaction(config, tx, allowhighfees).GetHex();
 }
 
+static UniValue sendrawtransactions(const Config &config,
+                                    const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() < 1 ||
+        request.params.size() > 2) {
+        throw std::runtime_error(
+            RPCHelpMan{"sendrawtransactions",
+                "\nSubmits raw transactions (serialized, hex-encoded) to local node and network.\n"
+                "\nThe transactions are added to the mempool together, in the order given, so a transaction may spend\n"
+                "the outputs of one before it. This is faster than calling sendrawtransaction for each of them.\n"
+                "\nSee sendrawtransaction call.\n",
+                {
+                    {"rawtxs", RPCArg::Type::ARR, /* opt */ false, /* default_val */ "", "An array of hex strings of raw transactions.",
+                        {
+                            {"rawtx", RPCArg::Type::STR_HEX, /* opt */ false, /* default_val */ "", ""},
+                        },
+                        },
+                    {"allowhighfees", RPCArg::Type::BOOL, /* opt */ true, /* default_val */ "false", "Allow high fees"},
+                }}
+                .ToString() +
+            "\nResult:\n"
+            "[                   (array) The result for each raw transaction in the input array.\n"
+            " {\n"
+            "  \"txid\"           (string) The transaction hash in hex\n"
+            "  \"error\"          (string) Why the transaction was not sent (only present if it was not)\n"
+            " }\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendrawtransactions", "\"[\\\"signedhex1\\\",\\\"signedhex2\\\"]\"") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("sendrawtransactions", "[\"signedhex1\",\"signedhex2\"]")
+        );
+    }
+
+    RPCTypeCheck(request.params, {UniValue::VARR, UniValue::MBOOL});
+
+    const UniValue::Array &rawtxs = request.params[0].get_array();
+    std::vector<CTransactionRef> txs;
+    txs.reserve(rawtxs.size());
+    for (size_t i = 0; i < rawtxs.size(); ++i) {
+        CMutableTransaction mtx;
+        if (!DecodeHexTx(mtx, rawtxs[i].get_str())) {
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR,
+                               strprintf("TX decode failed for rawtxs[%u]", i));
+        }
+        txs.push_back(MakeTransactionRef(std::move(mtx)));
+    }
+
+    bool allowhighfees = false;
+    if (!request.params[1].isNull()) {
+        allowhighfees = request.params[1].get_bool();
+    }
+
+    const std::vector<std::string> errors =
+        BroadcastTransactions(config, txs, allowhighfees);
+
+    UniValue::Array result;
+    result.reserve(txs.size());
+    for (size_t i = 0; i < txs.size(); ++i) {
+        UniValue::Object entry;
+        entry.reserve(errors[i].empty() ? 1 : 2);
+        entry.emplace_back("txid", txs[i]->GetId().GetHex());
+        if (!errors[i].empty()) {
+            entry.emplace_back("error", errors[i]);
+        }
+        result.emplace_back(std::move(entry));
+    }
+    return result;
+}
+
 static UniValue testmempoolaccept(const Config &config,
                                   const JSONRPCRequest &request) {
     if (request.fHelp || request.params.size() < 1 ||
@@ -1756,6 +1825,7 @@ static const ContextFreeRPCCommand commands[] = {
     { "rawtransactions",    "decoderawtransaction",      decoderawtransaction,      {"hexstring"} },
     { "rawtransactions",    "decodescript",              decodescript,              {"hexstring"} },
     { "rawtransactions",    "sendrawtransaction",        sendrawtransaction,        {"hexstring","allowhighfees"} },
+    { "rawtransactions",    "sendrawtransactions",       sendrawtransactions,       {"rawtxs","allowhighfees"} },
     { "rawtransactions",    "combinerawtransaction",     combinerawtransaction,     {"txs"} },
     { "rawtransactions",    "signrawtransactionwithkey", signrawtransactionwithkey, {"hexstring","privkeys","prevtxs","sighashtype"} },
     { "rawtransactions",    "testmempoolaccept",         testmempoolaccept,         {"rawtxs","allowhighfees"} },
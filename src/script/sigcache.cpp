@@ -107,9 +107,37 @@ bool CachingTransactionSignatureChecker::IsCached(
                             [] { return false; });
 }
 
+void SchnorrSignatureBatch::Add(const std::vector<uint8_t> &vchSig,
+                                const CPubKey &pubkey, const uint256 &sighash,
+                                bool store) {
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+    if (signatureCache.Get(entry, !store)) {
+        return;
+    }
+    verifier.Add(pubkey, sighash, vchSig);
+    if (store) {
+        cacheEntries.push_back(entry);
+    }
+}
+
+bool SchnorrSignatureBatch::Verify() {
+    if (!verifier.Verify()) {
+        return false;
+    }
+    for (uint256 &entry : cacheEntries) {
+        signatureCache.Set(entry);
+    }
+    return true;
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(
     const std::vector<uint8_t> &vchSig, const CPubKey &pubkey,
     const uint256 &sighash) const {
+    if (batch && vchSig.size() == 64) {
+        batch->Add(vchSig, pubkey, sighash, store);
+        return true;
+    }
     return RunMemoizedCheck(vchSig, pubkey, sighash, store, [&] {
         return TransactionSignatureChecker::VerifySignature(vchSig, pubkey,
                                                             sighash);
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include <pubkey.h>
 #include <script/interpreter.h>
 
 #include <vector>
@@ -17,8 +18,6 @@ static constexpr int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
 // Maximum sig cache size allowed
 static constexpr int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
-class CPubKey;
-
 /**
  * We're hashing a nonce into the entries themselves, so we don't need extra
  * blinding in the set hash computation.
@@ -39,9 +38,41 @@ public:
     }
 };
 
+/**
+ * Schnorr signatures whose verification CachingTransactionSignatureChecker
+ * has deferred, so that they are verified all at once.
+ */
+class SchnorrSignatureBatch {
+private:
+    CSchnorrBatchVerifier verifier;
+    //! Signature cache entries to add once the signatures are verified.
+    std::vector<uint256> cacheEntries;
+
+    void Add(const std::vector<uint8_t> &vchSig, const CPubKey &pubkey,
+             const uint256 &sighash, bool store);
+
+public:
+    //! Number of deferred signatures.
+    size_t size() const { return verifier.size(); }
+
+    /**
+     * Whether all the deferred signatures are valid. If so, those deferred
+     * with the store flag are added to the signature cache.
+     */
+    bool Verify();
+
+    //! Verify the deferred signatures in [begin, end) one by one.
+    bool VerifyIndividually(size_t begin, size_t end) const {
+        return verifier.VerifyIndividually(begin, end);
+    }
+
+    friend class CachingTransactionSignatureChecker;
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker {
 private:
     bool store;
+    SchnorrSignatureBatch *batch;
 
     bool IsCached(const std::vector<uint8_t> &vchSig, const CPubKey &vchPubKey,
                   const uint256 &sighash) const;
@@ -50,9 +81,18 @@ public:
     CachingTransactionSignatureChecker(const CTransaction *txToIn,
                                        unsigned int nInIn,
                                        const Amount amountIn, bool storeIn,
-                                       PrecomputedTransactionData &txdataIn)
+                                       PrecomputedTransactionData &txdataIn,
+                                       SchnorrSignatureBatch *batchIn = nullptr)
         : TransactionSignatureChecker(txToIn, nInIn, amountIn, txdataIn),
-          store(storeIn) {}
+          store(storeIn), batch(batchIn) {}
+
+    /**
+     * With a batch, Schnorr signatures which are not in the signature cache
+     * are not verified but added to the batch, and reported as valid. This is
+     * only sound if the script fails whenever a non-empty signature is
+     * invalid, i.e. under SCRIPT_VERIFY_NULLFAIL, and if the batch is verified
+     * before the script is considered valid.
+     */
 
     bool VerifySignature(const std::vector<uint8_t> &vchSig,
                          const CPubKey &vchPubKey,
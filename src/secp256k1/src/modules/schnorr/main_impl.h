@@ -27,6 +27,107 @@ int secp256k1_schnorr_verify(
     return secp256k1_schnorr_sig_verify(&ctx->ecmult_ctx, sig64, &q, msg32);
 }
 
+typedef struct {
+    const secp256k1_context *ctx;
+    const unsigned char *const *sig64;
+    const unsigned char *const *msg32;
+    const secp256k1_pubkey *const *pubkeys;
+    secp256k1_sha256 seeded;
+} secp256k1_schnorr_verify_batch_data;
+
+/* Points 2i and 2i+1 are R_i and P_i, with scalars a_i and a_i * e_i. */
+static int secp256k1_schnorr_verify_batch_callback(
+    secp256k1_scalar *sc,
+    secp256k1_ge *pt,
+    size_t idx,
+    void *cbdata
+) {
+    const secp256k1_schnorr_verify_batch_data *data = cbdata;
+    size_t i = idx / 2;
+    const unsigned char *sig64 = data->sig64[i];
+    secp256k1_scalar e;
+    secp256k1_fe Rx;
+
+    secp256k1_schnorr_batch_coefficient(sc, &data->seeded, i);
+
+    if (idx % 2 == 0) {
+        /* Decompress R, with R.y a quadratic residue. */
+        if (!secp256k1_fe_set_b32(&Rx, sig64)) {
+            return 0;
+        }
+        return secp256k1_ge_set_xquad(pt, &Rx);
+    }
+
+    if (!secp256k1_pubkey_load(data->ctx, pt, data->pubkeys[i]) ||
+        secp256k1_ge_is_infinity(pt)) {
+        return 0;
+    }
+    secp256k1_schnorr_compute_e(&e, sig64, pt, data->msg32[i]);
+    secp256k1_scalar_mul(sc, sc, &e);
+    return 1;
+}
+
+int secp256k1_schnorr_verify_batch(
+    const secp256k1_context* ctx,
+    secp256k1_scratch_space *scratch,
+    const unsigned char *const *sig64,
+    const unsigned char *const *msg32,
+    const secp256k1_pubkey *const *pubkeys,
+    size_t n
+) {
+    secp256k1_schnorr_verify_batch_data data;
+    secp256k1_sha256 sha;
+    secp256k1_scalar a, s, sum;
+    secp256k1_gej r;
+    unsigned char seed[32];
+    size_t i;
+    int overflow;
+    VERIFY_CHECK(ctx != NULL);
+    ARG_CHECK(secp256k1_ecmult_context_is_built(&ctx->ecmult_ctx));
+    ARG_CHECK(n == 0 || sig64 != NULL);
+    ARG_CHECK(n == 0 || msg32 != NULL);
+    ARG_CHECK(n == 0 || pubkeys != NULL);
+
+    if (n == 0) {
+        return 1;
+    }
+
+    secp256k1_sha256_initialize(&sha);
+    for (i = 0; i < n; i++) {
+        secp256k1_sha256_write(&sha, sig64[i], 64);
+        secp256k1_sha256_write(&sha, msg32[i], 32);
+        secp256k1_sha256_write(&sha, pubkeys[i]->data, sizeof(pubkeys[i]->data));
+    }
+    secp256k1_sha256_finalize(&sha, seed);
+
+    data.ctx = ctx;
+    data.sig64 = sig64;
+    data.msg32 = msg32;
+    data.pubkeys = pubkeys;
+    secp256k1_sha256_initialize(&data.seeded);
+    secp256k1_sha256_write(&data.seeded, seed, 32);
+
+    /* Compute -sum(a_i * s_i) */
+    secp256k1_scalar_clear(&sum);
+    for (i = 0; i < n; i++) {
+        overflow = 0;
+        secp256k1_scalar_set_b32(&s, sig64[i] + 32, &overflow);
+        if (overflow) {
+            return 0;
+        }
+        secp256k1_schnorr_batch_coefficient(&a, &data.seeded, i);
+        secp256k1_scalar_mul(&s, &s, &a);
+        secp256k1_scalar_add(&sum, &sum, &s);
+    }
+    secp256k1_scalar_negate(&sum, &sum);
+
+    if (!secp256k1_ecmult_multi_var(&ctx->error_callback, &ctx->ecmult_ctx, scratch, &r, &sum,
+                                    secp256k1_schnorr_verify_batch_callback, &data, 2 * n)) {
+        return 0;
+    }
+    return secp256k1_gej_is_infinity(&r);
+}
+
 int secp256k1_schnorr_sign(
     const secp256k1_context *ctx,
     unsigned char *sig64,
@@ -9,6 +9,7 @@
 
 #include "scalar.h"
 #include "group.h"
+#include "hash.h"
 
 static int secp256k1_schnorr_sig_verify(
     const secp256k1_ecmult_context* ctx,
@@ -24,6 +25,12 @@ static int secp256k1_schnorr_compute_e(
     const unsigned char *msg32
 );
 
+static void secp256k1_schnorr_batch_coefficient(
+    secp256k1_scalar *a,
+    const secp256k1_sha256 *seeded,
+    size_t i
+);
+
 static int secp256k1_schnorr_sig_sign(
     const secp256k1_ecmult_gen_context* ctx,
     unsigned char *sig64,
@@ -129,6 +129,39 @@ static int secp256k1_schnorr_compute_e(
     return !overflow & !secp256k1_scalar_is_zero(e);
 }
 
+/**
+ * Batch verification of n signatures (Option 2 above, for all of them at once):
+ *   Compute random scalars a_i, with a_0 = 1.
+ *   The signatures are valid if
+ *     sum(a_i * R_i) + sum(a_i * e_i * P_i) - sum(a_i * s_i) * G == 0.
+ *
+ * The a_i are derived from a hash of all the signatures, messages and public
+ * keys, so that they cannot be known before the signatures are chosen.
+ * seeded is a SHA256 state which has been fed that hash.
+ */
+static void secp256k1_schnorr_batch_coefficient(
+    secp256k1_scalar *a,
+    const secp256k1_sha256 *seeded,
+    size_t i
+) {
+    secp256k1_sha256 sha;
+    unsigned char buf[32];
+    int j;
+
+    if (i == 0) {
+        secp256k1_scalar_set_int(a, 1);
+        return;
+    }
+
+    for (j = 0; j < 8; j++) {
+        buf[j] = (i >> (8 * j)) & 0xff;
+    }
+    sha = *seeded;
+    secp256k1_sha256_write(&sha, buf, 8);
+    secp256k1_sha256_finalize(&sha, buf);
+    secp256k1_scalar_set_b32(a, buf, NULL);
+}
+
 static int secp256k1_schnorr_sig_sign(
     const secp256k1_ecmult_gen_context* ctx,
     unsigned char *sig64,
@@ -509,6 +509,61 @@ void run_schnorr_compact_test(void) {
     }
 }
 
+#define BATCH_COUNT 64
+
+void test_schnorr_verify_batch(void) {
+    unsigned char privkey[32];
+    unsigned char msg[BATCH_COUNT][32];
+    unsigned char sig[BATCH_COUNT][64];
+    secp256k1_pubkey pubkey[BATCH_COUNT];
+    const unsigned char *sigptr[BATCH_COUNT];
+    const unsigned char *msgptr[BATCH_COUNT];
+    const secp256k1_pubkey *pubkeyptr[BATCH_COUNT];
+    secp256k1_scratch_space *scratch = secp256k1_scratch_space_create(ctx, 1 << 20);
+    int i, n;
+
+    for (i = 0; i < BATCH_COUNT; i++) {
+        secp256k1_scalar key;
+        random_scalar_order_test(&key);
+        secp256k1_scalar_get_b32(privkey, &key);
+        secp256k1_rand256_test(msg[i]);
+        CHECK(secp256k1_ec_pubkey_create(ctx, &pubkey[i], privkey) == 1);
+        CHECK(secp256k1_schnorr_sign(ctx, sig[i], msg[i], privkey, NULL, NULL) == 1);
+        sigptr[i] = sig[i];
+        msgptr[i] = msg[i];
+        pubkeyptr[i] = &pubkey[i];
+    }
+
+    /* An empty batch is valid. */
+    CHECK(secp256k1_schnorr_verify_batch(ctx, scratch, NULL, NULL, NULL, 0) == 1);
+
+    for (n = 1; n <= BATCH_COUNT; n *= 2) {
+        int pos = secp256k1_rand_int(n);
+        int byte = secp256k1_rand_bits(6);
+        int mod = 1 + secp256k1_rand_int(255);
+
+        /* With and without scratch space. */
+        CHECK(secp256k1_schnorr_verify_batch(ctx, scratch, sigptr, msgptr, pubkeyptr, n) == 1);
+        CHECK(secp256k1_schnorr_verify_batch(ctx, NULL, sigptr, msgptr, pubkeyptr, n) == 1);
+
+        /* A single bad signature makes the whole batch fail. */
+        sig[pos][byte] ^= mod;
+        CHECK(secp256k1_schnorr_verify(ctx, sig[pos], msg[pos], &pubkey[pos]) == 0);
+        CHECK(secp256k1_schnorr_verify_batch(ctx, scratch, sigptr, msgptr, pubkeyptr, n) == 0);
+        CHECK(secp256k1_schnorr_verify_batch(ctx, NULL, sigptr, msgptr, pubkeyptr, n) == 0);
+        sig[pos][byte] ^= mod;
+
+        /* So does a signature for another message. */
+        msgptr[pos] = msg[(pos + 1) % BATCH_COUNT];
+        CHECK(secp256k1_schnorr_verify_batch(ctx, scratch, sigptr, msgptr, pubkeyptr, n) == 0);
+        msgptr[pos] = msg[pos];
+    }
+
+    secp256k1_scratch_space_destroy(ctx, scratch);
+}
+
+#undef BATCH_COUNT
+
 void run_schnorr_tests(void) {
     int i;
     for (i = 0; i < 32 * count; i++) {
@@ -516,6 +571,7 @@ void run_schnorr_tests(void) {
     }
 
     test_schnorr_sign_verify();
+    test_schnorr_verify_batch();
     run_schnorr_compact_test();
 }
 
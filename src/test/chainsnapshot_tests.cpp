@@ -0,0 +1,102 @@
+// Copyright (c) 2022 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/chainsnapshot.h>
+
+#include <chain.h>
+#include <primitives/block.h>
+#include <validation.h>
+
+#include <test/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <deque>
+
+namespace {
+//! Block index entries with random hashes, which outlive the snapshots.
+struct Blocks {
+    std::deque<BlockHash> hashes;
+    std::deque<CBlockIndex> index;
+
+    CBlockIndex *Extend(CBlockIndex *pprev, int nBlocks) {
+        for (int i = 0; i < nBlocks; ++i) {
+            hashes.emplace_back(InsecureRand256());
+            CBlockIndex &block = index.emplace_back();
+            block.phashBlock = &hashes.back();
+            block.pprev = pprev;
+            block.nHeight = pprev ? pprev->nHeight + 1 : 0;
+            block.nStatus = block.nStatus.withData();
+            block.nFile = block.nHeight / 1000;
+            block.nDataPos = block.nHeight;
+            block.BuildSkip();
+            pprev = &block;
+        }
+        return pprev;
+    }
+};
+
+void CheckSnapshot(const ChainSnapshot &snapshot, const CChain &chain) {
+    BOOST_REQUIRE_EQUAL(snapshot.Height(), chain.Height());
+    BOOST_CHECK(snapshot.Tip() == chain.Tip());
+    BOOST_CHECK(snapshot[chain.Height() + 1] == nullptr);
+    BOOST_CHECK(snapshot[-1] == nullptr);
+    for (int nHeight = 0; nHeight <= chain.Height(); ++nHeight) {
+        const CBlockIndex *pindex = chain[nHeight];
+        BOOST_CHECK(snapshot[nHeight] == pindex);
+        BOOST_CHECK(snapshot.Find(pindex->GetBlockHash()) == pindex);
+        BOOST_CHECK(snapshot.Next(pindex) == chain.Next(pindex));
+        BOOST_CHECK(snapshot.GetBlockPos(pindex) == pindex->GetBlockPos());
+    }
+}
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(chainsnapshot_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(chainsnapshot_reorg) {
+    LOCK(cs_main);
+    Blocks blocks;
+    CChain chain;
+
+    chain.SetTip(blocks.Extend(nullptr, 3000));
+    const auto first = ChainSnapshot::Make(chain, nullptr);
+    CheckSnapshot(*first, chain);
+    BOOST_CHECK(first->Find(BlockHash(InsecureRand256())) == nullptr);
+
+    // Extending the chain leaves the earlier snapshot as it was.
+    CBlockIndex *const pindexFirstTip = chain.Tip();
+    chain.SetTip(blocks.Extend(chain.Tip(), 2000));
+    const auto extended = ChainSnapshot::Make(chain, first.get());
+    CheckSnapshot(*extended, chain);
+    BOOST_CHECK_EQUAL(first->Height(), 2999);
+    BOOST_CHECK(first->Tip() == pindexFirstTip);
+    BOOST_CHECK(first->Next(pindexFirstTip) == nullptr);
+    BOOST_CHECK(first->Find(chain.Tip()->GetBlockHash()) == nullptr);
+
+    // Reorganize to a shorter branch, forking in the chunk before the tip's.
+    CBlockIndex *const pindexOldTip = chain.Tip();
+    CChain oldChain;
+    oldChain.SetTip(pindexOldTip);
+    chain.SetTip(blocks.Extend(chain[4000], 50));
+    const auto reorged = ChainSnapshot::Make(chain, extended.get());
+    CheckSnapshot(*reorged, chain);
+    BOOST_CHECK(!reorged->Contains(pindexOldTip));
+    BOOST_CHECK(reorged->Find(pindexOldTip->GetBlockHash()) == nullptr);
+    BOOST_CHECK(reorged->GetBlockPos(pindexOldTip).IsNull());
+    CheckSnapshot(*extended, oldChain);
+
+    // The fork point of a locator is the first of its blocks in the chain.
+    const CBlockLocator locator = oldChain.GetLocator();
+    const CBlockIndex *pindexFork = reorged->FindFork(locator);
+    BOOST_CHECK(reorged->Contains(pindexFork));
+    BOOST_CHECK(pindexFork->nHeight <= 4000);
+    BOOST_CHECK(std::find(locator.vHave.begin(), locator.vHave.end(),
+                          pindexFork->GetBlockHash()) != locator.vHave.end());
+    BOOST_CHECK(extended->FindFork(locator) == pindexOldTip);
+    BOOST_CHECK(reorged->FindFork(CBlockLocator(std::vector<BlockHash>{
+                    BlockHash(InsecureRand256())})) == chain.Genesis());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
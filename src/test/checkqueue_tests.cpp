@@ -124,9 +124,10 @@ typedef CCheckQueue<FrozenCleanupCheck> FrozenCleanup_Queue;
 /** This test case checks that the CCheckQueue works properly
  * with each specified size_t Checks pushed.
  */
-static void Correct_Queue_range(std::vector<size_t> range) {
+static void Correct_Queue_range(std::vector<size_t> range,
+                                int nThreads = SCRIPT_CHECK_THREADS) {
     auto small_queue = std::make_unique<Correct_Queue>(QUEUE_BATCH_SIZE);
-    small_queue->StartWorkerThreads(SCRIPT_CHECK_THREADS);
+    small_queue->StartWorkerThreads(nThreads);
     // Make vChecks here to save on malloc (this test can be slow...)
     std::vector<FakeCheckCheckCompletion> vChecks;
     for (const size_t i : range) {
@@ -180,6 +181,15 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Random) {
     Correct_Queue_range(range);
 }
 
+/** Test that the checks are correct when the master does all the work, and
+ * when many more threads than cores steal from each other
+ */
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Threads) {
+    const std::vector<size_t> range{0, 1, 2, 1000, 100000};
+    Correct_Queue_range(range, 0);
+    Correct_Queue_range(range, 64);
+}
+
 /** Test that failing checks are caught */
 BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure) {
     auto fail_queue = std::make_unique<Failing_Queue>(QUEUE_BATCH_SIZE);
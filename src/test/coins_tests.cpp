@@ -8,6 +8,7 @@
 #include <consensus/validation.h>
 #include <script/standard.h>
 #include <streams.h>
+#include <txdb.h>
 #include <undo.h>
 #include <util/strencodings.h>
 #include <validation.h>
@@ -16,7 +17,10 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <atomic>
+#include <limits>
 #include <map>
+#include <thread>
 #include <vector>
 
 namespace {
@@ -624,7 +628,9 @@ void GetCoinMapEntry(const CCoinsMap &map, Amount &value, char &flags) {
 }
 
 void WriteCoinViewEntry(CCoinsView &view, const Amount value, char flags) {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map{0, SaltedOutpointHasher{}, CCoinsMap::key_equal{},
+                  &resource};
     InsertCoinMapEntry(map, value, flags);
     view.BatchWrite(map, BlockHash());
 }
@@ -911,4 +917,282 @@ BOOST_AUTO_TEST_CASE(coin_write) {
     }
 }
 
+static void CheckEmplaceFetchedCoin(Amount cache_value, Amount expected_value,
+                                    char cache_flags, char expected_flags) {
+    SingleEntryCacheTest test(ABSENT, cache_value, cache_flags);
+    Coin coin;
+    SetCoinValue(VALUE3, coin);
+    test.cache.EmplaceFetchedCoin(OUTPOINT, std::move(coin));
+    test.cache.SelfTest();
+
+    Amount result_value;
+    char result_flags;
+    GetCoinMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_flags);
+}
+
+BOOST_AUTO_TEST_CASE(coin_emplace_fetched) {
+    /* Check EmplaceFetchedCoin behavior, handing a coin that was looked up
+     * outside of the cache, and checking the resulting entry in the cache.
+     * Entries already present in the cache must never be touched.
+     *
+     *                      Cache   Result  Cache        Result
+     *                      Value   Value   Flags        Flags
+     */
+    CheckEmplaceFetchedCoin(ABSENT, VALUE3, NO_ENTRY, 0);
+    for (const char flags : FLAGS) {
+        CheckEmplaceFetchedCoin(PRUNED, PRUNED, flags, flags);
+        CheckEmplaceFetchedCoin(VALUE2, VALUE2, flags, flags);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sharded_cache_concurrent_reads) {
+    // Only unspent coins are stored in the base, so that it can be read from
+    // several threads at once (CCoinsViewTest only uses randomness on spent
+    // entries).
+    CCoinsViewTest base;
+    std::map<COutPoint, Coin> expected;
+    {
+        CCoinsViewCacheTest cache(&base);
+        for (int i = 0; i < 1000; ++i) {
+            COutPoint outpoint(TxId(InsecureRand256()), i % 3);
+            CTxOut txout(int64_t(InsecureRand32()) * SATOSHI, CScript());
+            Coin coin(txout, i, false);
+            cache.AddCoin(outpoint, coin, false);
+            expected.emplace(outpoint, coin);
+        }
+        cache.SetBestBlock(BlockHash(InsecureRand256()));
+        BOOST_CHECK(cache.Flush());
+    }
+    const std::vector<COutPoint> missing{
+        COutPoint(TxId(InsecureRand256()), 0),
+        COutPoint(TxId(InsecureRand256()), 1)};
+
+    CCoinsViewShardedCache sharded(&base, 8);
+    BOOST_CHECK_EQUAL(sharded.GetShardCount(), 8);
+    BOOST_CHECK(sharded.GetBestBlock() == base.GetBestBlock());
+
+    std::atomic<bool> all_ok{true};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            for (const auto &entry : expected) {
+                Coin coin;
+                if (!sharded.GetCoin(entry.first, coin) ||
+                    !(coin == entry.second)) {
+                    all_ok = false;
+                }
+            }
+            for (const COutPoint &outpoint : missing) {
+                if (sharded.HaveCoin(outpoint)) {
+                    all_ok = false;
+                }
+            }
+        });
+    }
+    for (std::thread &t : readers) {
+        t.join();
+    }
+    BOOST_CHECK(all_ok);
+    BOOST_CHECK_EQUAL(sharded.GetCacheSize(), expected.size());
+    BOOST_CHECK(sharded.DynamicMemoryUsage() > 0);
+
+    // Spend half of the coins and add some new ones through a child cache.
+    {
+        CCoinsViewCacheTest child(&sharded);
+        bool spend = false;
+        for (auto it = expected.begin(); it != expected.end();) {
+            spend = !spend;
+            if (!spend) {
+                ++it;
+                continue;
+            }
+            BOOST_CHECK(child.SpendCoin(it->first));
+            it = expected.erase(it);
+        }
+        for (int i = 0; i < 100; ++i) {
+            COutPoint outpoint(TxId(InsecureRand256()), 0);
+            Coin coin(CTxOut(i * SATOSHI, CScript()), 1000 + i, false);
+            child.AddCoin(outpoint, coin, false);
+            expected.emplace(outpoint, coin);
+        }
+        child.SetBestBlock(BlockHash(InsecureRand256()));
+        BOOST_CHECK(child.Flush());
+        BOOST_CHECK(sharded.GetBestBlock() == child.GetBestBlock());
+    }
+    for (const auto &entry : expected) {
+        Coin coin;
+        BOOST_CHECK(sharded.GetCoin(entry.first, coin));
+        BOOST_CHECK(coin == entry.second);
+    }
+
+    // Flushing pushes everything to the base and empties the cache.
+    const BlockHash best = sharded.GetBestBlock();
+    BOOST_CHECK(sharded.Flush());
+    BOOST_CHECK_EQUAL(sharded.GetCacheSize(), 0);
+    BOOST_CHECK(base.GetBestBlock() == best);
+    for (const auto &entry : expected) {
+        Coin coin;
+        BOOST_CHECK(base.GetCoin(entry.first, coin));
+        BOOST_CHECK(coin == entry.second);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(db_background_flush) {
+    gArgs.ForceSetArg("-dbbackgroundflush", "1");
+    CCoinsViewDB db(1 << 20, true);
+    gArgs.ClearArg("-dbbackgroundflush");
+
+    std::map<COutPoint, Coin> expected;
+    std::vector<COutPoint> spent;
+    auto check_db = [&]() {
+        for (const auto &entry : expected) {
+            Coin coin;
+            BOOST_CHECK(db.HaveCoin(entry.first));
+            BOOST_CHECK(db.GetCoin(entry.first, coin));
+            BOOST_CHECK(coin == entry.second);
+        }
+        for (const COutPoint &outpoint : spent) {
+            Coin coin;
+            BOOST_CHECK(!db.HaveCoin(outpoint));
+            BOOST_CHECK(!db.GetCoin(outpoint, coin));
+        }
+    };
+
+    const BlockHash block1(InsecureRand256());
+    {
+        CCoinsViewCacheTest cache(&db);
+        for (int i = 0; i < 1000; ++i) {
+            COutPoint outpoint(TxId(InsecureRand256()), i % 3);
+            Coin coin(CTxOut(int64_t(InsecureRand32()) * SATOSHI, CScript()),
+                      i, false);
+            cache.AddCoin(outpoint, coin, false);
+            expected.emplace(outpoint, coin);
+        }
+        cache.SetBestBlock(block1);
+        BOOST_CHECK(cache.Flush());
+    }
+    // Whether or not the write is still in progress, the view is consistent.
+    BOOST_CHECK(db.GetBestBlock() == block1);
+    check_db();
+
+    // A second flush, spending half of the coins, waits for the first one.
+    const BlockHash block2(InsecureRand256());
+    {
+        CCoinsViewCacheTest cache(&db);
+        bool spend = false;
+        for (auto it = expected.begin(); it != expected.end();) {
+            spend = !spend;
+            if (!spend) {
+                ++it;
+                continue;
+            }
+            BOOST_CHECK(cache.SpendCoin(it->first));
+            spent.push_back(it->first);
+            it = expected.erase(it);
+        }
+        // A coin which is created and spent before the flush is never
+        // written.
+        const COutPoint ephemeral(TxId(InsecureRand256()), 0);
+        cache.AddCoin(ephemeral, Coin(CTxOut(SATOSHI, CScript()), 1, false),
+                      false);
+        BOOST_CHECK(cache.SpendCoin(ephemeral));
+        spent.push_back(ephemeral);
+        cache.SetBestBlock(block2);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.GetBestBlock() == block2);
+    check_db();
+
+    // Once synced, everything is in the database.
+    BOOST_CHECK(db.Sync());
+    BOOST_CHECK(!db.WriteFailed());
+    BOOST_CHECK(db.GetBestBlock() == block2);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    check_db();
+
+    size_t count = 0;
+    std::unique_ptr<CCoinsViewCursor> cursor(db.Cursor());
+    BOOST_CHECK(cursor->GetBestBlock() == block2);
+    for (; cursor->Valid(); cursor->Next()) {
+        COutPoint outpoint;
+        Coin coin;
+        BOOST_CHECK(cursor->GetKey(outpoint));
+        BOOST_CHECK(cursor->GetValue(coin));
+        BOOST_CHECK(expected.count(outpoint));
+        ++count;
+    }
+    BOOST_CHECK_EQUAL(count, expected.size());
+}
+
+BOOST_AUTO_TEST_CASE(flush_and_trim) {
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    // One coin per height, with scripts of various sizes.
+    std::vector<COutPoint> outpoints;
+    for (uint32_t height = 1; height <= 200; ++height) {
+        COutPoint outpoint(TxId(InsecureRand256()), 0);
+        CScript script;
+        script.resize(InsecureRandRange(100));
+        cache.AddCoin(outpoint, Coin(CTxOut(int64_t(height) * SATOSHI, script), height,
+                                     false),
+                      false);
+        outpoints.push_back(outpoint);
+    }
+
+    // Everything is written, and everything is kept, as unmodified coins.
+    cache.SetBestBlock(BlockHash(InsecureRand256()));
+    BOOST_CHECK(cache.FlushAndTrim(std::numeric_limits<size_t>::max()));
+    BOOST_CHECK(base.GetBestBlock() == cache.GetBestBlock());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size());
+    for (const COutPoint &outpoint : outpoints) {
+        Coin coin;
+        BOOST_CHECK(base.GetCoin(outpoint, coin));
+        BOOST_CHECK_EQUAL(cache.map().at(outpoint).flags, 0);
+    }
+    cache.SelfTest();
+
+    // Spent coins are written and dropped from the cache.
+    BOOST_CHECK(cache.SpendCoin(outpoints.back()));
+    outpoints.pop_back();
+    BOOST_CHECK(cache.FlushAndTrim(std::numeric_limits<size_t>::max()));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size());
+    cache.SelfTest();
+
+    // Hits and misses are counted.
+    cache.ResetHitStats();
+    cache.AccessCoin(outpoints.front());
+    cache.AccessCoin(COutPoint(TxId(InsecureRand256()), 0));
+    BOOST_CHECK_EQUAL(cache.GetCacheHits(), 1);
+    BOOST_CHECK_EQUAL(cache.GetCacheMisses(), 1);
+
+    // Trimming evicts the lowest heights first, down to the target.
+    const size_t target = cache.InUseMemoryUsage() / 2;
+    cache.Trim(target);
+    BOOST_CHECK(cache.InUseMemoryUsage() <= target);
+    BOOST_CHECK(cache.GetCacheSize() > 0);
+    BOOST_CHECK(cache.GetCacheSize() < outpoints.size());
+    const size_t nEvicted = outpoints.size() - cache.GetCacheSize();
+    for (size_t i = 0; i < outpoints.size(); ++i) {
+        BOOST_CHECK_EQUAL(cache.HaveCoinInCache(outpoints[i]), i >= nEvicted);
+    }
+    cache.SelfTest();
+
+    // Evicted memory is reused before the cache grows again.
+    BOOST_CHECK(cache.InUseMemoryUsage() < cache.DynamicMemoryUsage());
+    const size_t map_usage = memusage::DynamicUsage(cache.map());
+    BOOST_CHECK(cache.HaveCoin(outpoints.front()));
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(cache.map()), map_usage);
+
+    // Modified coins are never evicted.
+    const COutPoint added(TxId(InsecureRand256()), 0);
+    cache.AddCoin(added, Coin(CTxOut(SATOSHI, CScript()), 1, false), false);
+    cache.Trim(0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1);
+    BOOST_CHECK(cache.HaveCoinInCache(added));
+    cache.SelfTest();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
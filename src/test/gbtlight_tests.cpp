@@ -14,6 +14,7 @@
 #include <util/strencodings.h>
 #include <test/setup_common.h>
 #include <util/system.h>
+#include <version.h>
 
 #include <algorithm>
 #include <list>
@@ -183,6 +184,56 @@ BOOST_AUTO_TEST_CASE(CacheTest) {
     BOOST_CHECK(okct == cacheSize);
 }
 
+/// Consecutive jobs share the transactions they have in common in the job tx data store, and the job files written
+/// by earlier versions, which hold the transactions themselves, can still be loaded.
+BOOST_AUTO_TEST_CASE(JobTxStore_Test) {
+    using gbtl::JobId;
+    const auto txDataSize = [] {
+        uint64_t size = 0;
+        for (const auto &entry : fs::directory_iterator(gbtl::GetJobTxDataDir()))
+            size += fs::file_size(entry.path());
+        return size;
+    };
+    JobId jobA, jobB, jobC;
+    GetRandBytes(jobA.begin(), jobA.size());
+    GetRandBytes(jobB.begin(), jobB.size());
+    GetRandBytes(jobC.begin(), jobC.size());
+    const std::vector<CTransactionRef> txsA(txs.begin(), txs.begin() + 2);
+    {
+        LOCK(cs_main);
+        // below requires cs_main
+        gbtl::CacheAndSaveTxsToFile(jobA, &txsA);
+    }
+    const auto sizeA = txDataSize();
+    BOOST_CHECK_EQUAL(sizeA, GetSerializeSize(*txs[0], PROTOCOL_VERSION) + GetSerializeSize(*txs[1], PROTOCOL_VERSION));
+    {
+        LOCK(cs_main);
+        gbtl::CacheAndSaveTxsToFile(jobB, &txs);
+    }
+    // only the tx that jobA did not have was added
+    BOOST_CHECK_EQUAL(txDataSize() - sizeA, GetSerializeSize(*txs[2], PROTOCOL_VERSION));
+    for (const auto &[jobId, jobTxs] : {std::make_pair(jobA, txsA), std::make_pair(jobB, txs)}) {
+        CBlock block;
+        BOOST_CHECK_NO_THROW(gbtl::LoadTxsFromFile(jobId, block));
+        BOOST_CHECK_MESSAGE(CompareVTX(block.vtx, jobTxs), "Loading txs from the job tx data should yield identical txs");
+    }
+
+    // a job file as written by earlier versions: "GBT", the number of txs, the txs, "GBT"
+    {
+        CDataStream datastream(SER_NETWORK, PROTOCOL_VERSION);
+        datastream << uint32_t(txs.size());
+        for (const auto &tx : txs)
+            datastream << *tx;
+        fs::ofstream ofile(gbtl::GetJobDataDir() / jobC.GetHex(), std::ios_base::binary | std::ios_base::trunc);
+        ofile << "GBT";
+        ofile.write(datastream.data(), std::streamsize(datastream.size()));
+        ofile << "GBT";
+    }
+    CBlock block;
+    BOOST_CHECK_NO_THROW(gbtl::LoadTxsFromFile(jobC, block));
+    BOOST_CHECK_MESSAGE(CompareVTX(block.vtx, txs), "Loading txs from a legacy job file should yield identical txs");
+}
+
 /// Check that the merkle branch algorithm works as expected. We check both an odd number and an even number
 /// of hashes to test the if (even) conditional in CheckMerkleBranch.
 BOOST_AUTO_TEST_CASE(CheckMerkleBranch) {
@@ -330,4 +330,40 @@ BOOST_AUTO_TEST_CASE(key_signature_tests) {
     BOOST_CHECK(found_small);
 }
 
+BOOST_AUTO_TEST_CASE(schnorr_batch_verify) {
+    std::vector<CKey> keys(8);
+    CSchnorrBatchVerifier batch;
+    BOOST_CHECK(batch.empty());
+    BOOST_CHECK(batch.Verify());
+
+    for (size_t i = 0; i < 32; i++) {
+        CKey &key = keys[i % keys.size()];
+        if (!key.IsValid()) {
+            key.MakeNewKey(i % 2 == 0);
+        }
+        const uint256 hash = InsecureRand256();
+        std::vector<uint8_t> sig;
+        BOOST_CHECK(key.SignSchnorr(hash, sig));
+        batch.Add(key.GetPubKey(), hash, sig);
+        BOOST_CHECK_EQUAL(batch.size(), i + 1);
+        BOOST_CHECK(batch.Verify());
+    }
+    BOOST_CHECK(batch.VerifyIndividually(0, batch.size()));
+
+    // A signature for another message poisons the whole batch, but only the
+    // range that contains it fails when verified one by one.
+    std::vector<uint8_t> sig;
+    BOOST_CHECK(keys[0].SignSchnorr(InsecureRand256(), sig));
+    batch.Add(keys[0].GetPubKey(), InsecureRand256(), sig);
+    BOOST_CHECK(!batch.Verify());
+    BOOST_CHECK(batch.VerifyIndividually(0, 32));
+    BOOST_CHECK(!batch.VerifyIndividually(16, 33));
+
+    // An ECDSA-sized signature is never a valid Schnorr signature.
+    batch.clear();
+    BOOST_CHECK(keys[1].SignECDSA(InsecureRand256(), sig));
+    batch.Add(keys[1].GetPubKey(), InsecureRand256(), sig);
+    BOOST_CHECK(!batch.Verify());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -14,7 +14,9 @@
 #include <boost/test/unit_test.hpp>
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <future>
 #include <list>
 #include <vector>
 
@@ -519,7 +521,7 @@ struct TestMemPoolWithAncestryChecker : CTxMemPool
             if (!counted.insert(candidate).second) {
                 continue;
             }
-            const setEntries &parents = GetMemPoolParents(candidate);
+            const auto parents = GetMemPoolParents(candidate);
             if (parents.size() == 0) {
                 setEntries descendants;
                 CalculateDescendants(candidate, descendants);
@@ -824,4 +826,362 @@ BOOST_AUTO_TEST_CASE(CompareTxMemPoolEntryByModifiedFeeRateTest) {
     BOOST_CHECK(After(entryA, entryB));
 }
 
+BOOST_AUTO_TEST_CASE(MempoolLinksMemoryTest) {
+    // Entries with at most two in-mempool parents and children keep their
+    // links inline, so a chain uses no more memory than unrelated txs.
+    CTxMemPool chained, unchained;
+    TestMemPoolEntryHelper entry;
+
+    std::vector<CTransactionRef> chain;
+    TxId prevId;
+    for (int i = 0; i < 100; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vin[0].prevout = COutPoint(prevId, 0);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = (100000 - i) * SATOSHI;
+        CMutableTransaction unrelated = tx;
+        unrelated.vin[0].prevout = COutPoint(TxId(InsecureRand256()), 0);
+
+        LOCK2(cs_main, chained.cs);
+        LOCK(unchained.cs);
+        chained.addUnchecked(entry.FromTx(tx));
+        unchained.addUnchecked(entry.FromTx(unrelated));
+        chain.push_back(MakeTransactionRef(tx));
+        prevId = tx.GetId();
+    }
+    // The chain also makes up a cluster, which unrelated txs do not.
+    size_t clusterUsage;
+    {
+        LOCK(chained.cs);
+        const CTxMemPool::Clusters &clusters = chained.GetClusters();
+        BOOST_REQUIRE_EQUAL(clusters.size(), 1U);
+        clusterUsage = memusage::DynamicUsage(clusters) +
+                       clusters.begin()->second.DynamicMemoryUsage();
+    }
+    const size_t chainUsage = chained.DynamicMemoryUsage();
+    BOOST_CHECK_EQUAL(chainUsage,
+                      unchained.DynamicMemoryUsage() + clusterUsage);
+    {
+        LOCK(chained.cs);
+        const auto it = *chained.GetIter(chain[50]->GetId());
+        const auto parents = chained.GetMemPoolParents(it);
+        BOOST_REQUIRE_EQUAL(parents.size(), 1U);
+        BOOST_CHECK((*parents.begin())->GetTx().GetId() ==
+                    chain[49]->GetId());
+        const auto children = chained.GetMemPoolChildren(it);
+        BOOST_REQUIRE_EQUAL(children.size(), 1U);
+        BOOST_CHECK((*children.begin())->GetTx().GetId() ==
+                    chain[51]->GetId());
+    }
+
+    // Past two children the links of the tip spill to the heap, which is
+    // accounted for and given back when they go away.
+    std::vector<CTransactionRef> fanout;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vin[0].prevout = COutPoint(prevId, i);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = 1000 * SATOSHI;
+        LOCK2(cs_main, chained.cs);
+        chained.addUnchecked(entry.FromTx(tx));
+        fanout.push_back(MakeTransactionRef(tx));
+    }
+    {
+        LOCK(chained.cs);
+        const auto children =
+            chained.GetMemPoolChildren(*chained.GetIter(prevId));
+        BOOST_REQUIRE_EQUAL(children.size(), 3U);
+        // Children are kept in entry order.
+        auto child = children.begin();
+        for (const CTransactionRef &tx : fanout) {
+            BOOST_CHECK((*child)->GetTx().GetId() == tx->GetId());
+            ++child;
+        }
+    }
+    const size_t fanoutUsage = chained.DynamicMemoryUsage();
+    for (const CTransactionRef &tx : fanout) {
+        chained.removeRecursive(*tx);
+    }
+    BOOST_CHECK_EQUAL(chained.size(), chain.size());
+    BOOST_CHECK_EQUAL(chained.DynamicMemoryUsage(), chainUsage);
+    BOOST_CHECK(fanoutUsage > chainUsage);
+
+    // Removing the head of the chain takes everything with it.
+    chained.removeRecursive(*chain.front());
+    BOOST_CHECK_EQUAL(chained.size(), 0U);
+    BOOST_CHECK_EQUAL(chained.DynamicMemoryUsage(),
+                      CTxMemPool().DynamicMemoryUsage());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolRemoveForBlockTest) {
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    auto MakeTx = [](const COutPoint &prevout, int64_t value) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vin[0].prevout = prevout;
+        tx.vout.resize(2);
+        for (CTxOut &out : tx.vout) {
+            out.scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+            out.nValue = value * SATOSHI;
+        }
+        return MakeTransactionRef(tx);
+    };
+
+    // txA and its child txB are in the mempool, and the block confirms txA.
+    // txC spends the same coin as txD of the block, which never made it to
+    // the mempool, so txC and its child txE are conflicts. txF, the other
+    // child of txA, is confirmed along with it.
+    const COutPoint coinA(TxId(InsecureRand256()), 0);
+    const COutPoint coinD(TxId(InsecureRand256()), 0);
+    const CTransactionRef txA = MakeTx(coinA, 10000);
+    const CTransactionRef txB = MakeTx(COutPoint(txA->GetId(), 0), 9000);
+    const CTransactionRef txF = MakeTx(COutPoint(txA->GetId(), 1), 9000);
+    const CTransactionRef txC = MakeTx(coinD, 8000);
+    const CTransactionRef txD = MakeTx(coinD, 7000);
+    const CTransactionRef txE = MakeTx(COutPoint(txC->GetId(), 1), 6000);
+    {
+        LOCK2(cs_main, pool.cs);
+        for (const CTransactionRef &tx : {txA, txB, txF, txC, txE}) {
+            pool.addUnchecked(entry.FromTx(tx));
+        }
+    }
+    pool.PrioritiseTransaction(txA->GetId(), 1000 * SATOSHI);
+    pool.PrioritiseTransaction(txC->GetId(), 1000 * SATOSHI);
+    pool.PrioritiseTransaction(txD->GetId(), 1000 * SATOSHI);
+
+    pool.removeForBlock({txF, txD, txA});
+
+    BOOST_CHECK_EQUAL(pool.size(), 1U);
+    BOOST_CHECK(pool.exists(txB->GetId()));
+    LOCK(pool.cs);
+    BOOST_CHECK(pool.GetMemPoolParents(*pool.GetIter(txB->GetId())).empty());
+    BOOST_CHECK_EQUAL(pool.GetTotalTxSize(), txB->GetTotalSize());
+    // Prioritisations of both the block txs and the conflicts are gone.
+    Amount delta = Amount::zero();
+    for (const CTransactionRef &tx : {txA, txC, txD}) {
+        pool.ApplyDelta(tx->GetId(), delta);
+    }
+    BOOST_CHECK_EQUAL(delta, Amount::zero());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterTest) {
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    auto MakeTx = [](const COutPoint &prevout) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vin[0].prevout = prevout;
+        tx.vout.resize(2);
+        for (CTxOut &out : tx.vout) {
+            out.scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+            out.nValue = 1000 * SATOSHI;
+        }
+        return MakeTransactionRef(tx);
+    };
+
+    // txA pays little, but its child txC pays for both of them, and txE,
+    // the child of txC, pays nothing. txD, the other child of txA, pays in
+    // between. txB is unrelated.
+    const CTransactionRef txA = MakeTx(COutPoint(TxId(InsecureRand256()), 0));
+    const CTransactionRef txB = MakeTx(COutPoint(TxId(InsecureRand256()), 0));
+    const CTransactionRef txC = MakeTx(COutPoint(txA->GetId(), 0));
+    const CTransactionRef txD = MakeTx(COutPoint(txA->GetId(), 1));
+    const CTransactionRef txE = MakeTx(COutPoint(txC->GetId(), 0));
+    {
+        LOCK2(cs_main, pool.cs);
+        pool.addUnchecked(entry.Fee(100 * SATOSHI).FromTx(txA));
+        pool.addUnchecked(entry.Fee(5000 * SATOSHI).FromTx(txB));
+        pool.addUnchecked(entry.Fee(20000 * SATOSHI).FromTx(txC));
+        pool.addUnchecked(entry.Fee(3000 * SATOSHI).FromTx(txD));
+        pool.addUnchecked(entry.Fee(Amount::zero()).FromTx(txE));
+    }
+
+    auto TxIds = [](const CTxMemPoolCluster &cluster,
+                    const CTxMemPoolCluster::Chunk &chunk) {
+        std::vector<TxId> txids;
+        for (size_t i = chunk.begin; i < chunk.end; ++i) {
+            txids.push_back(cluster.linearization[i]->GetTx().GetId());
+        }
+        return txids;
+    };
+
+    {
+        LOCK(pool.cs);
+        const CTxMemPool::Clusters &clusters = pool.GetClusters();
+        BOOST_REQUIRE_EQUAL(clusters.size(), 1U);
+        const CTxMemPoolCluster &cluster = clusters.begin()->second;
+        BOOST_CHECK(!pool.GetIter(txB->GetId()).value()->GetCluster());
+        BOOST_CHECK(pool.GetIter(txA->GetId()).value()->GetCluster() ==
+                    &cluster);
+        BOOST_CHECK_EQUAL(cluster.entries.size(), 4U);
+        // txA is mined along with txC, ahead of txD and then txE.
+        BOOST_REQUIRE_EQUAL(cluster.chunks.size(), 3U);
+        BOOST_CHECK(TxIds(cluster, cluster.chunks[0]) ==
+                    std::vector<TxId>({txA->GetId(), txC->GetId()}));
+        BOOST_CHECK(TxIds(cluster, cluster.chunks[1]) ==
+                    std::vector<TxId>({txD->GetId()}));
+        BOOST_CHECK(TxIds(cluster, cluster.chunks[2]) ==
+                    std::vector<TxId>({txE->GetId()}));
+        BOOST_CHECK_EQUAL(cluster.chunks[0].modifiedFee, 20100 * SATOSHI);
+        BOOST_CHECK(cluster.chunks[0].GetFeeRate() ==
+                    CFeeRate(20100 * SATOSHI, cluster.chunks[0].virtualSize));
+        BOOST_CHECK(cluster.chunks[0].GetFeeRate() >
+                    cluster.chunks[1].GetFeeRate());
+        BOOST_CHECK(cluster.chunks[1].GetFeeRate() >
+                    cluster.chunks[2].GetFeeRate());
+    }
+
+    // Prioritising txE lets it pay for txA and txC as well.
+    pool.PrioritiseTransaction(txE->GetId(), 100000 * SATOSHI);
+    {
+        LOCK(pool.cs);
+        const CTxMemPoolCluster &cluster =
+            pool.GetClusters().begin()->second;
+        BOOST_REQUIRE_EQUAL(cluster.chunks.size(), 2U);
+        BOOST_CHECK(TxIds(cluster, cluster.chunks[0]) ==
+                    std::vector<TxId>(
+                        {txA->GetId(), txC->GetId(), txE->GetId()}));
+    }
+
+    // Once txA is confirmed, txC and txE are left on their own, as is txD,
+    // which no longer needs a cluster.
+    pool.removeForBlock({txA});
+    {
+        LOCK(pool.cs);
+        const CTxMemPool::Clusters &clusters = pool.GetClusters();
+        BOOST_REQUIRE_EQUAL(clusters.size(), 1U);
+        const CTxMemPoolCluster &cluster = clusters.begin()->second;
+        BOOST_CHECK_EQUAL(cluster.entries.size(), 2U);
+        BOOST_CHECK(TxIds(cluster, cluster.chunks[0]) ==
+                    std::vector<TxId>({txC->GetId(), txE->GetId()}));
+        BOOST_CHECK(!pool.GetIter(txD->GetId()).value()->GetCluster());
+    }
+
+    pool.removeRecursive(*txC);
+    LOCK(pool.cs);
+    BOOST_CHECK(pool.GetClusters().empty());
+    BOOST_CHECK_EQUAL(pool.size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest) {
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000 * SATOSHI;
+    }
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout = COutPoint(txParent.GetId(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 11000 * SATOSHI;
+
+    {
+        LOCK2(cs_main, pool.cs);
+        pool.addUnchecked(entry.Fee(1000 * SATOSHI).Time(1).FromTx(txParent));
+        pool.addUnchecked(entry.Fee(2000 * SATOSHI).Time(2).FromTx(txChild));
+    }
+
+    const std::shared_ptr<const MempoolSnapshot> snapshot = pool.GetSnapshot();
+    BOOST_CHECK_EQUAL(snapshot->nTransactionsUpdated,
+                      pool.GetTransactionsUpdated());
+    BOOST_CHECK_EQUAL(snapshot->totalTxSize, pool.GetTotalTxSize());
+    BOOST_REQUIRE_EQUAL(snapshot->entries.size(), 2U);
+    const MempoolSnapshot::Entry &parent = snapshot->entries[0];
+    const MempoolSnapshot::Entry &child = snapshot->entries[1];
+    BOOST_CHECK(parent.tx->GetId() == txParent.GetId());
+    BOOST_CHECK_EQUAL(parent.fee, 1000 * SATOSHI);
+    BOOST_CHECK_EQUAL(parent.time, 1);
+    BOOST_CHECK(parent.parents.empty());
+    BOOST_REQUIRE_EQUAL(parent.children.size(), 1U);
+    BOOST_CHECK(parent.children[0] == txChild.GetId());
+    BOOST_CHECK(child.tx->GetId() == txChild.GetId());
+    BOOST_REQUIRE_EQUAL(child.parents.size(), 1U);
+    BOOST_CHECK(child.parents[0] == txParent.GetId());
+    BOOST_CHECK(child.children.empty());
+
+    // Until the mempool changes, readers share the snapshot without taking
+    // cs, so they are not held up by a writer holding it.
+    {
+        LOCK(pool.cs);
+        auto reader = std::async(std::launch::async,
+                                 [&pool] { return pool.GetSnapshot(); });
+        BOOST_REQUIRE(reader.wait_for(std::chrono::seconds(10)) ==
+                      std::future_status::ready);
+        BOOST_CHECK(reader.get() == snapshot);
+    }
+
+    // A change makes the next reader take a new snapshot, while the old one
+    // stays as it was.
+    pool.PrioritiseTransaction(txChild.GetId(), 500 * SATOSHI);
+    const std::shared_ptr<const MempoolSnapshot> snapshot2 = pool.GetSnapshot();
+    BOOST_CHECK(snapshot2 != snapshot);
+    BOOST_CHECK_EQUAL(snapshot2->entries[1].modifiedFee, 2500 * SATOSHI);
+    BOOST_CHECK_EQUAL(snapshot->entries[1].modifiedFee, 2000 * SATOSHI);
+
+    pool.removeRecursive(CTransaction(txParent));
+    BOOST_CHECK(pool.GetSnapshot()->entries.empty());
+    BOOST_CHECK_EQUAL(snapshot2->entries.size(), 2U);
+
+    // Snapshots taken while another thread keeps changing the mempool are
+    // consistent with themselves.
+    std::atomic<bool> done{false};
+    auto reader = std::async(std::launch::async, [&pool, &done] {
+        bool consistent = true;
+        while (!done) {
+            const std::shared_ptr<const MempoolSnapshot> s = pool.GetSnapshot();
+            std::set<TxId> txids;
+            for (const MempoolSnapshot::Entry &e : s->entries) {
+                txids.insert(e.tx->GetId());
+            }
+            for (const MempoolSnapshot::Entry &e : s->entries) {
+                for (const TxId &txid : e.parents) {
+                    consistent = consistent && txids.count(txid);
+                }
+                for (const TxId &txid : e.children) {
+                    consistent = consistent && txids.count(txid);
+                }
+            }
+        }
+        return consistent;
+    });
+    CMutableTransaction root = txParent;
+    CMutableTransaction tx = root;
+    for (int i = 0; i < 200; i++) {
+        LOCK2(cs_main, pool.cs);
+        pool.addUnchecked(entry.Fee(1000 * SATOSHI).FromTx(tx));
+        CMutableTransaction next;
+        next.vin.resize(1);
+        next.vin[0].scriptSig = CScript() << OP_11;
+        next.vin[0].prevout = COutPoint(tx.GetId(), 0);
+        next.vout = tx.vout;
+        if (i % 50 == 49) {
+            // Drop the whole chain and start a new one.
+            pool.removeRecursive(CTransaction(root));
+            root = next;
+        }
+        tx = next;
+    }
+    done = true;
+    BOOST_CHECK(reader.get());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,141 @@
+// Copyright (c) 2022 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/mempooljournal.h>
+
+#include <chainparams.h>
+#include <coins.h>
+#include <config.h>
+#include <consensus/validation.h>
+#include <key.h>
+#include <script/interpreter.h>
+#include <script/sighashtype.h>
+#include <script/standard.h>
+#include <txmempool.h>
+#include <util/system.h>
+#include <util/time.h>
+#include <validation.h>
+
+#include <test/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <map>
+
+namespace {
+// Every upgrade is active from the genesis block on regtest.
+struct RegtestingSetup : public TestingSetup {
+    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(mempooljournal_tests, RegtestingSetup)
+
+BOOST_AUTO_TEST_CASE(mempooljournal_recover) {
+    const Amount amount = 1 * COIN;
+    const Amount fee = 1 * CENT;
+    const SigHashType sigHashType = SigHashType().withForkId();
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptPubKey =
+        GetScriptForDestination(key.GetPubKey().GetID());
+
+    const auto spend = [&](const COutPoint &outpoint, const Amount value) {
+        CMutableTransaction mtx;
+        mtx.vin.emplace_back(outpoint);
+        mtx.vout.emplace_back(value - fee, scriptPubKey);
+        std::vector<uint8_t> vchSig;
+        const uint256 hash =
+            SignatureHash(scriptPubKey, mtx, 0, sigHashType, value);
+        BOOST_CHECK(key.SignSchnorr(hash, vchSig));
+        vchSig.push_back(uint8_t(sigHashType.getRawSigHashType()));
+        mtx.vin[0].scriptSig = CScript() << vchSig
+                                         << ToByteVector(key.GetPubKey());
+        return MakeTransactionRef(mtx);
+    };
+
+    LOCK(cs_main);
+    std::vector<COutPoint> outpoints;
+    for (size_t i = 0; i < 3; ++i) {
+        outpoints.emplace_back(TxId(InsecureRand256()), 0);
+        pcoinsTip->AddCoin(outpoints.back(),
+                           Coin(CTxOut(amount, scriptPubKey), 1, false), false);
+    }
+    const CTransactionRef parent = spend(outpoints[0], amount);
+    const CTransactionRef child =
+        spend(COutPoint(parent->GetId(), 0), amount - fee);
+    const CTransactionRef removed = spend(outpoints[1], amount);
+    const CTransactionRef late = spend(outpoints[2], amount);
+
+    std::map<TxId, int64_t> times;
+    const auto Accept = [&](const CTransactionRef &tx) {
+        SetMockTime(GetTime() + 1);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(GetConfig(), g_mempool, state, tx,
+                                       nullptr, false /* bypass_limits */,
+                                       Amount::zero()));
+        times[tx->GetId()] = GetTime();
+    };
+    const auto Recover = [&] {
+        g_mempool.clear();
+        g_mempool.ClearPrioritisation(child->GetId());
+        MempoolJournal journal(g_mempool, GetDataDir() / "mempool.journal");
+        BOOST_REQUIRE(journal.Recover(GetConfig()));
+        LOCK(g_mempool.cs);
+        std::map<TxId, int64_t> recovered;
+        for (const auto &entry : g_mempool.mapTx) {
+            recovered.emplace(entry.GetTx().GetId(), entry.GetTime());
+        }
+        return recovered;
+    };
+
+    {
+        MempoolJournal journal(g_mempool, GetDataDir() / "mempool.journal");
+        // Nothing to recover yet.
+        BOOST_CHECK(!journal.Recover(GetConfig()));
+        BOOST_REQUIRE(journal.Start());
+
+        Accept(parent);
+        Accept(removed);
+        g_mempool.PrioritiseTransaction(child->GetId(), 1000 * SATOSHI);
+        Accept(child);
+        g_mempool.removeRecursive(*removed);
+        times.erase(removed->GetId());
+        BOOST_CHECK(journal.Flush());
+
+        // What was flushed survives a crash, which tears the last chunk.
+        Accept(late);
+        journal.Flush();
+        const auto size = fs::file_size(GetDataDir() / "mempool.journal");
+        fs::resize_file(GetDataDir() / "mempool.journal", size - 10);
+        times.erase(late->GetId());
+        // Stop the journal with nothing left to write, as a crash would.
+        journal.Stop();
+    }
+    BOOST_CHECK(Recover() == times);
+    {
+        LOCK(g_mempool.cs);
+        BOOST_CHECK_EQUAL(
+            (*g_mempool.GetIter(child->GetId()))->GetModifiedFee(),
+            fee + 1000 * SATOSHI);
+    }
+
+    // Compaction keeps the mempool as it is, with a smaller file.
+    {
+        MempoolJournal journal(g_mempool, GetDataDir() / "mempool.journal");
+        Accept(late);
+        BOOST_REQUIRE(journal.Start());
+        g_mempool.removeRecursive(*late);
+        times.erase(late->GetId());
+        journal.Stop();
+        const auto size = fs::file_size(GetDataDir() / "mempool.journal");
+        BOOST_REQUIRE(journal.Compact());
+        BOOST_CHECK(fs::file_size(GetDataDir() / "mempool.journal") < size);
+    }
+    BOOST_CHECK(Recover() == times);
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -21,12 +21,15 @@
 #include <util/strencodings.h>
 #include <util/system.h>
 #include <validation.h>
+#include <validationinterface.h>
 
 #include <test/setup_common.h>
 
 #include <boost/test/unit_test.hpp>
 
+#include <algorithm>
 #include <memory>
+#include <set>
 
 BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
 
@@ -703,4 +706,206 @@ BOOST_AUTO_TEST_CASE(TestCBlockTemplateEntry) {
     BOOST_CHECK_EQUAL(txEntry.sigChecks, 10);
 }
 
+struct RegtestingSetup : public TestingSetup {
+    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+BOOST_FIXTURE_TEST_CASE(BlockTemplateTracker_incremental, RegtestingSetup) {
+    const Config &config = GetConfig();
+    const CScript scriptPubKey = CScript() << OP_TRUE;
+    BlockTemplateTracker tracker(config, g_mempool);
+    RegisterValidationInterface(&tracker);
+    GetMainSignals().RegisterWithMempoolSignals(g_mempool);
+
+    const auto CanSnapshot = [&tracker] {
+        return WITH_LOCK(cs_main, return tracker.CanSnapshot());
+    };
+    const auto AddToMempool = [](CMutableTransaction &tx, const Amount fee) {
+        // Stay above the minimum transaction size.
+        for (CTxIn &txin : tx.vin) {
+            txin.scriptSig = CScript() << std::vector<uint8_t>(MIN_TX_SIZE);
+        }
+        TestMemPoolEntryHelper entry;
+        {
+            LOCK2(cs_main, g_mempool.cs);
+            g_mempool.addUnchecked(entry.Fee(fee).FromTx(tx));
+        }
+        GetMainSignals().TransactionAddedToMempool(MakeTransactionRef(tx));
+        SyncWithValidationInterfaceQueue();
+    };
+
+    // The first template seeds the tracked set.
+    BOOST_CHECK(!CanSnapshot());
+    std::unique_ptr<CBlockTemplate> pblocktemplate =
+        tracker.CreateNewBlock(scriptPubKey, 0., false);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK(CanSnapshot());
+
+    CMutableTransaction parent;
+    parent.vin.emplace_back(COutPoint(TxId(InsecureRand256()), 0));
+    parent.vout.emplace_back(10 * COIN, scriptPubKey);
+    parent.vout.emplace_back(10 * COIN, scriptPubKey);
+    AddToMempool(parent, 10000 * SATOSHI);
+    CMutableTransaction child;
+    child.vin.emplace_back(COutPoint(parent.GetId(), 0));
+    child.vout.emplace_back(9 * COIN, scriptPubKey);
+    AddToMempool(child, 20000 * SATOSHI);
+
+    // A snapshot holds the same transactions and fees as a template
+    // assembled from scratch.
+    BOOST_CHECK(CanSnapshot());
+    pblocktemplate = tracker.CreateNewBlock(scriptPubKey, 0., false);
+    const std::unique_ptr<CBlockTemplate> pfulltemplate =
+        BlockAssembler(config, g_mempool).CreateNewBlock(scriptPubKey, 0., false);
+    const std::vector<CTransactionRef> &vtx = pblocktemplate->block.vtx;
+    BOOST_REQUIRE_EQUAL(vtx.size(), 3U);
+    BOOST_REQUIRE_EQUAL(pfulltemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(vtx[1]->GetId() < vtx[2]->GetId());
+    for (size_t i = 1; i < vtx.size(); ++i) {
+        BOOST_CHECK(vtx[i] == pfulltemplate->block.vtx[i]);
+    }
+    BOOST_CHECK_EQUAL(vtx[0]->vout[0].nValue,
+                      pfulltemplate->block.vtx[0]->vout[0].nValue);
+    BOOST_CHECK_EQUAL(pblocktemplate->entries[0].fees, -30000 * SATOSHI);
+
+    // Removing the parent takes the child with it, whether or not the
+    // notifications have been delivered yet.
+    {
+        LOCK(g_mempool.cs);
+        g_mempool.removeRecursive(CTransaction(parent),
+                                  MemPoolRemovalReason::EXPIRY);
+    }
+    pblocktemplate = tracker.CreateNewBlock(scriptPubKey, 0., false);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    SyncWithValidationInterfaceQueue();
+    pblocktemplate = tracker.CreateNewBlock(scriptPubKey, 0., false);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK(CanSnapshot());
+
+    // A transaction paying less than -blockmintxfee is left out, after which
+    // templates are assembled from scratch again.
+    CMutableTransaction lowFee;
+    lowFee.vin.emplace_back(COutPoint(TxId(InsecureRand256()), 0));
+    lowFee.vout.emplace_back(1 * COIN, scriptPubKey);
+    AddToMempool(lowFee, Amount::zero());
+    BOOST_CHECK(!CanSnapshot());
+    pblocktemplate = tracker.CreateNewBlock(scriptPubKey, 0., false);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK(!CanSnapshot());
+
+    GetMainSignals().UnregisterWithMempoolSignals(g_mempool);
+    UnregisterValidationInterface(&tracker);
+    SyncWithValidationInterfaceQueue();
+    g_mempool.clear();
+}
+
+BOOST_FIXTURE_TEST_CASE(BlockAssembler_parallel, RegtestingSetup) {
+    const CChainParams &chainparams = GetConfig().GetChainParams();
+    const CScript scriptPubKey = CScript() << OP_TRUE;
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // Enough txs for the parallel path: loose ones, chains of three, and
+    // txs spending two chains at once to join their clusters.
+    FastRandomContext rng(true);
+    std::vector<CTransactionRef> txs;
+    auto AddTx = [&](const std::vector<COutPoint> &prevouts) {
+        CMutableTransaction tx;
+        for (const COutPoint &prevout : prevouts) {
+            tx.vin.emplace_back(prevout, CScript() << std::vector<uint8_t>(MIN_TX_SIZE));
+        }
+        tx.vout.emplace_back(1000 * SATOSHI, scriptPubKey);
+        const CTransactionRef rtx = MakeTransactionRef(tx);
+        LOCK2(cs_main, pool.cs);
+        pool.addUnchecked(entry.Fee(int64_t(1000 + rng.randrange(100000)) * SATOSHI).FromTx(rtx));
+        txs.push_back(rtx);
+        return COutPoint(rtx->GetId(), 0);
+    };
+    while (pool.size() < 12'000) {
+        const COutPoint a = AddTx({COutPoint(TxId(rng.rand256()), 0)});
+        const COutPoint b = AddTx({AddTx({COutPoint(TxId(rng.rand256()), 0)})});
+        AddTx({AddTx({a}), b});
+    }
+
+    auto Assemble = [&](unsigned nThreads, uint64_t nMaxGeneratedBlockSize) {
+        BlockAssembler::Options options;
+        options.nExcessiveBlockSize = 32 * ONE_MEGABYTE;
+        options.nMaxGeneratedBlockSize = nMaxGeneratedBlockSize;
+        options.nThreads = nThreads;
+        return BlockAssembler(chainparams, pool, options).CreateNewBlock(scriptPubKey, 0., false);
+    };
+    auto TxIds = [](const CBlock &block) {
+        std::set<TxId> txids;
+        for (size_t i = 1; i < block.vtx.size(); ++i) {
+            txids.insert(block.vtx[i]->GetId());
+        }
+        return txids;
+    };
+
+    // With room for everything, both take the whole mempool, in CTOR order.
+    const auto sequential = Assemble(1, 32 * ONE_MEGABYTE);
+    const auto parallel = Assemble(4, 32 * ONE_MEGABYTE);
+    BOOST_CHECK_EQUAL(parallel->block.vtx.size(), txs.size() + 1);
+    BOOST_CHECK(TxIds(parallel->block) == TxIds(sequential->block));
+    BOOST_CHECK(std::is_sorted(parallel->block.vtx.begin() + 1, parallel->block.vtx.end(),
+                               [](const CTransactionRef &a, const CTransactionRef &b) {
+                                   return a->GetId() < b->GetId();
+                               }));
+    BOOST_CHECK_EQUAL(parallel->block.vtx[0]->vout[0].nValue, sequential->block.vtx[0]->vout[0].nValue);
+
+    // A smaller block stays within its limit and has the parents of all its
+    // txs.
+    const uint64_t nMaxSize = 500'000;
+    const auto limited = Assemble(4, nMaxSize);
+    BOOST_CHECK(limited->block.vtx.size() > 1);
+    BOOST_CHECK(limited->block.vtx.size() < txs.size());
+    BOOST_CHECK(GetSerializeSize(limited->block, PROTOCOL_VERSION) < nMaxSize);
+    const std::set<TxId> inBlock = TxIds(limited->block);
+    for (size_t i = 1; i < limited->block.vtx.size(); ++i) {
+        for (const CTxIn &in : limited->block.vtx[i]->vin) {
+            BOOST_CHECK(!pool.exists(in.prevout.GetTxId()) || inBlock.count(in.prevout.GetTxId()));
+        }
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(BlockAssembler_cpfp, RegtestingSetup) {
+    const CChainParams &chainparams = GetConfig().GetChainParams();
+    const CScript scriptPubKey = CScript() << OP_TRUE;
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // A parent paying nothing, and its child paying for both of them at a
+    // higher feerate than an unrelated tx.
+    auto AddTx = [&](const COutPoint &prevout, Amount fee) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(prevout, CScript() << std::vector<uint8_t>(1000));
+        tx.vout.emplace_back(1000 * SATOSHI, scriptPubKey);
+        const CTransactionRef rtx = MakeTransactionRef(tx);
+        LOCK2(cs_main, pool.cs);
+        pool.addUnchecked(entry.Fee(fee).FromTx(rtx));
+        return rtx;
+    };
+    const CTransactionRef parent = AddTx(COutPoint(TxId(InsecureRand256()), 0), Amount::zero());
+    const CTransactionRef child = AddTx(COutPoint(parent->GetId(), 0), 30000 * SATOSHI);
+    const CTransactionRef other = AddTx(COutPoint(TxId(InsecureRand256()), 0), 10000 * SATOSHI);
+
+    auto Assemble = [&](uint64_t nMaxGeneratedBlockSize) {
+        BlockAssembler::Options options;
+        options.nMaxGeneratedBlockSize = nMaxGeneratedBlockSize;
+        auto pblocktemplate = BlockAssembler(chainparams, pool, options).CreateNewBlock(scriptPubKey, 0., false);
+        std::set<TxId> txids;
+        for (size_t i = 1; i < pblocktemplate->block.vtx.size(); ++i) {
+            txids.insert(pblocktemplate->block.vtx[i]->GetId());
+        }
+        return txids;
+    };
+
+    // With room for two of them, the parent and child make it in together.
+    const uint64_t txSize = parent->GetTotalSize();
+    BOOST_CHECK(Assemble(1000 + 5 * txSize / 2) == std::set<TxId>({parent->GetId(), child->GetId()}));
+    // With room for one, only the unrelated tx fits.
+    BOOST_CHECK(Assemble(1000 + 3 * txSize / 2) == std::set<TxId>({other->GetId()}));
+    BOOST_CHECK_EQUAL(Assemble(ONE_MEGABYTE).size(), 3U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,161 @@
+// Copyright (c) 2022 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <support/allocators/pool.h>
+
+#include <memusage.h>
+#include <random.h>
+
+#include <test/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Helper to inspect the internals of a PoolResource (it is a friend class).
+ */
+class PoolResourceTester {
+public:
+    //! Number of free blocks in each of the resource's freelists
+    template <typename PoolResource>
+    static std::vector<size_t> FreeListSizes(const PoolResource &resource) {
+        std::vector<size_t> sizes;
+        for (const auto *node : resource.m_free_lists) {
+            size_t size = 0;
+            for (; node != nullptr; node = node->m_next) {
+                ++size;
+            }
+            sizes.push_back(size);
+        }
+        return sizes;
+    }
+
+    //! Bytes left in the current chunk
+    template <typename PoolResource>
+    static size_t AvailableMemoryFromChunk(const PoolResource &resource) {
+        return resource.m_available_memory_end -
+               resource.m_available_memory_it;
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(basic_allocating) {
+    auto resource = PoolResource<8, 8>(16);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 16);
+
+    // first chunk is already allocated
+    BOOST_CHECK_EQUAL(resource.NumFreeBytes(), 16);
+    void *block = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(PoolResourceTester::AvailableMemoryFromChunk(resource),
+                      8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+    BOOST_CHECK_EQUAL(resource.NumFreeBytes(), 8);
+
+    // a deallocated block goes to the freelist, and is handed out again
+    resource.Deallocate(block, 8, 8);
+    BOOST_CHECK_EQUAL(PoolResourceTester::FreeListSizes(resource)[1], 1);
+    BOOST_CHECK_EQUAL(resource.NumFreeBytes(), 16);
+    void *same = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(same, block);
+    BOOST_CHECK_EQUAL(PoolResourceTester::FreeListSizes(resource)[1], 0);
+    BOOST_CHECK_EQUAL(resource.NumFreeBytes(), 8);
+
+    // use up the first chunk, then a second one gets allocated
+    void *b2 = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(PoolResourceTester::AvailableMemoryFromChunk(resource),
+                      0);
+    void *b3 = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+
+    // blocks too large or with a too strict alignment bypass the pool
+    void *big = resource.Allocate(16, 8);
+    void *aligned = resource.Allocate(8, 16);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+    resource.Deallocate(big, 16, 8);
+    resource.Deallocate(aligned, 8, 16);
+    for (size_t size : PoolResourceTester::FreeListSizes(resource)) {
+        BOOST_CHECK_EQUAL(size, 0);
+    }
+
+    resource.Deallocate(same, 8, 8);
+    resource.Deallocate(b2, 8, 8);
+    resource.Deallocate(b3, 8, 8);
+    BOOST_CHECK_EQUAL(PoolResourceTester::FreeListSizes(resource)[1], 3);
+    // everything is free again: both chunks
+    BOOST_CHECK_EQUAL(resource.NumFreeBytes(), 32);
+}
+
+// Allocations of any size up to the maximum block size are served by the
+// pool, rounded up to the alignment.
+BOOST_AUTO_TEST_CASE(allocate_any_byte) {
+    auto resource = PoolResource<128, 8>(16384);
+
+    std::vector<std::pair<uint8_t *, size_t>> blocks;
+    for (size_t size = 0; size <= 128; ++size) {
+        auto *p = static_cast<uint8_t *>(resource.Allocate(size, 1));
+        // the memory must be writable over its whole size
+        std::fill(p, p + size, uint8_t(size));
+        blocks.emplace_back(p, size);
+    }
+    for (const auto &block : blocks) {
+        for (size_t i = 0; i < block.second; ++i) {
+            BOOST_CHECK_EQUAL(block.first[i], uint8_t(block.second));
+        }
+        resource.Deallocate(block.first, block.second, 1);
+    }
+
+    // 0 and 1..8 bytes share a freelist, then every 8 bytes get their own.
+    const auto sizes = PoolResourceTester::FreeListSizes(resource);
+    BOOST_CHECK_EQUAL(sizes[0], 0);
+    BOOST_CHECK_EQUAL(sizes[1], 9);
+    for (size_t i = 2; i < sizes.size(); ++i) {
+        BOOST_CHECK_EQUAL(sizes[i], 8);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(memusage_test) {
+    using Map = std::unordered_map<
+        int, int, std::hash<int>, std::equal_to<int>,
+        PoolAllocator<std::pair<const int, int>,
+                      sizeof(std::pair<const int, int>) + sizeof(void *) * 4>>;
+    auto resource = Map::allocator_type::ResourceType(1024);
+
+    {
+        Map map{0, std::hash<int>{}, std::equal_to<int>{}, &resource};
+
+        // Even an empty map has some usage, as the first chunk is allocated
+        // up front.
+        const size_t empty_usage = memusage::DynamicUsage(map);
+        BOOST_CHECK(empty_usage > 0);
+
+        size_t prev_usage = empty_usage;
+        for (int i = 0; i < 1000; ++i) {
+            map[i];
+            const size_t usage = memusage::DynamicUsage(map);
+            // usage only ever grows, and always covers all the nodes
+            BOOST_CHECK(usage >= prev_usage);
+            BOOST_CHECK(usage >= map.size() * sizeof(std::pair<const int, int>));
+            prev_usage = usage;
+        }
+        BOOST_CHECK(resource.NumAllocatedChunks() > 1);
+
+        // Erased nodes are kept in the pool for reuse, so usage doesn't
+        // change.
+        const size_t chunks = resource.NumAllocatedChunks();
+        const size_t full_usage = memusage::DynamicUsage(map);
+        map.erase(map.begin(), map.end());
+        BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), full_usage);
+        for (int i = 0; i < 1000; ++i) {
+            map[i];
+        }
+        BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
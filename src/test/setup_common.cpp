@@ -128,6 +128,9 @@ TestingSetup::TestingSetup(const std::string &chainName)
     // Start script-checking threads
     constexpr int script_check_threads = 2;
     StartScriptCheckWorkerThreads(script_check_threads);
+    // Start block input fetching threads
+    constexpr int input_fetch_threads = 2;
+    StartInputFetchWorkerThreads(input_fetch_threads);
 
     g_banman =
         std::make_unique<BanMan>(GetDataDir() / "banlist.dat", chainparams,
@@ -140,6 +143,7 @@ TestingSetup::~TestingSetup() {
     threadGroup.interrupt_all();
     threadGroup.join_all();
     StopScriptCheckWorkerThreads();
+    StopInputFetchWorkerThreads();
     GetMainSignals().FlushBackgroundCallbacks();
     rpc::UnregisterSubmitBlockCatcher();
     GetMainSignals().UnregisterBackgroundSignalScheduler();
@@ -5,13 +5,18 @@
 #include <amount.h>
 #include <config.h>
 #include <consensus/validation.h>
+#include <key.h>
 #include <primitives/transaction.h>
+#include <script/interpreter.h>
 #include <script/script.h>
+#include <script/standard.h>
 #include <test/setup_common.h>
 #include <txmempool.h>
 #include <validation.h>
 #include <consensus/tx_check.h>
+#include <util/system.h>
 #include <util/time.h>
+#include <fs.h>
 
 #include <boost/test/unit_test.hpp>
 
@@ -111,4 +116,260 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_dup_txin, TestChain100Setup) {
     }
 }
 
+// Every upgrade is active from the genesis block on regtest.
+struct RegtestingSetup : public TestingSetup {
+    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+/**
+ * Ensure that the scripts of a transaction with many inputs verified by the
+ * script check threads give the same result as when verified serially.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_parallel_inputs, RegtestingSetup) {
+    static constexpr size_t NUM_INPUTS = 32;
+    const Amount amount = 1 * COIN;
+    const SigHashType sigHashType = SigHashType().withForkId();
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptPubKey =
+        GetScriptForDestination(key.GetPubKey().GetID());
+
+    LOCK(cs_main);
+    CMutableTransaction mtx;
+    for (size_t i = 0; i < NUM_INPUTS; ++i) {
+        const COutPoint outpoint(TxId(InsecureRand256()), 0);
+        pcoinsTip->AddCoin(outpoint, Coin(CTxOut(amount, scriptPubKey), 1, false),
+                           false);
+        mtx.vin.emplace_back(outpoint);
+    }
+    mtx.vout.emplace_back((int64_t(NUM_INPUTS) - 1) * amount, scriptPubKey);
+    for (size_t i = 0; i < NUM_INPUTS; ++i) {
+        std::vector<uint8_t> vchSig;
+        const uint256 hash =
+            SignatureHash(scriptPubKey, mtx, i, sigHashType, amount);
+        BOOST_CHECK(key.SignSchnorr(hash, vchSig));
+        vchSig.push_back(uint8_t(sigHashType.getRawSigHashType()));
+        mtx.vin[i].scriptSig = CScript() << vchSig
+                                         << ToByteVector(key.GetPubKey());
+    }
+
+    // Break the signature of one of the inputs.
+    CMutableTransaction badMtx = mtx;
+    std::vector<uint8_t> vchSig(badMtx.vin[NUM_INPUTS / 2].scriptSig.begin() + 1,
+                                badMtx.vin[NUM_INPUTS / 2].scriptSig.begin() + 66);
+    vchSig[10] ^= 1;
+    badMtx.vin[NUM_INPUTS / 2].scriptSig = CScript()
+                                           << vchSig
+                                           << ToByteVector(key.GetPubKey());
+
+    const size_t nMempoolParallelInputsSaved = nMempoolParallelInputs;
+    std::string rejectReason;
+    for (const size_t nParallelInputs : {size_t(0), size_t(16)}) {
+        nMempoolParallelInputs = nParallelInputs;
+        CValidationState state;
+        BOOST_CHECK(!AcceptToMemoryPool(GetConfig(), g_mempool, state,
+                                        MakeTransactionRef(badMtx), nullptr,
+                                        true /* bypass_limits */,
+                                        Amount::zero(), true /* test_accept */));
+        BOOST_CHECK(state.IsInvalid());
+        BOOST_CHECK_EQUAL(state.GetRejectCode(), REJECT_INVALID);
+        if (nParallelInputs == 0) {
+            rejectReason = state.GetRejectReason();
+        }
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), rejectReason);
+    }
+
+    nMempoolParallelInputs = 16;
+    CValidationState state;
+    const CTransactionRef tx = MakeTransactionRef(mtx);
+    BOOST_CHECK(AcceptToMemoryPool(GetConfig(), g_mempool, state, tx, nullptr,
+                                   true /* bypass_limits */, Amount::zero()));
+    BOOST_CHECK(state.IsValid());
+    {
+        LOCK(g_mempool.cs);
+        const auto it = g_mempool.mapTx.find(tx->GetId());
+        BOOST_REQUIRE(it != g_mempool.mapTx.end());
+        BOOST_CHECK_EQUAL(it->GetSigChecks(), int64_t(NUM_INPUTS));
+    }
+    nMempoolParallelInputs = nMempoolParallelInputsSaved;
+}
+
+
+/**
+ * Ensure that a batch of transactions is admitted in order, so that a child
+ * can follow its parent, and that each transaction gets its own result.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_accept_batch, RegtestingSetup) {
+    const Amount amount = 1 * COIN;
+    const Amount fee = 1 * CENT;
+    const SigHashType sigHashType = SigHashType().withForkId();
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptPubKey =
+        GetScriptForDestination(key.GetPubKey().GetID());
+
+    // Build a signed transaction spending the given output to scriptPubKey.
+    const auto spend = [&](const COutPoint &outpoint, const Amount value) {
+        CMutableTransaction mtx;
+        mtx.vin.emplace_back(outpoint);
+        mtx.vout.emplace_back(value - fee, scriptPubKey);
+        std::vector<uint8_t> vchSig;
+        const uint256 hash =
+            SignatureHash(scriptPubKey, mtx, 0, sigHashType, value);
+        BOOST_CHECK(key.SignSchnorr(hash, vchSig));
+        vchSig.push_back(uint8_t(sigHashType.getRawSigHashType()));
+        mtx.vin[0].scriptSig = CScript() << vchSig
+                                         << ToByteVector(key.GetPubKey());
+        return mtx;
+    };
+
+    LOCK(cs_main);
+    std::vector<COutPoint> outpoints;
+    for (size_t i = 0; i < 3; ++i) {
+        outpoints.emplace_back(TxId(InsecureRand256()), 0);
+        pcoinsTip->AddCoin(outpoints.back(),
+                           Coin(CTxOut(amount, scriptPubKey), 1, false), false);
+    }
+
+    const CMutableTransaction parent = spend(outpoints[0], amount);
+    const CMutableTransaction child =
+        spend(COutPoint(parent.GetId(), 0), amount - fee);
+    // Spends the same coin as the parent with a different output value.
+    const CMutableTransaction doubleSpend = spend(outpoints[0], amount - fee);
+    CMutableTransaction badSig = spend(outpoints[1], amount);
+    badSig.vout[0].nValue -= fee;
+    const CMutableTransaction orphan =
+        spend(COutPoint(TxId(InsecureRand256()), 0), amount);
+    const CMutableTransaction good = spend(outpoints[2], amount);
+
+    const std::vector<CTransactionRef> txs{
+        MakeTransactionRef(child),       MakeTransactionRef(parent),
+        MakeTransactionRef(child),       MakeTransactionRef(doubleSpend),
+        MakeTransactionRef(badSig),      MakeTransactionRef(orphan),
+        MakeTransactionRef(good)};
+    const std::vector<MempoolBatchAcceptResult> results =
+        AcceptToMemoryPoolBatch(GetConfig(), g_mempool, txs,
+                                true /* bypass_limits */, Amount::zero());
+    BOOST_REQUIRE_EQUAL(results.size(), txs.size());
+
+    // The child comes before its parent the first time around.
+    BOOST_CHECK(!results[0].accepted);
+    BOOST_CHECK(results[0].missingInputs);
+    BOOST_CHECK(results[1].accepted);
+    BOOST_CHECK(results[1].state.IsValid());
+    BOOST_CHECK(results[2].accepted);
+
+    BOOST_CHECK(!results[3].accepted);
+    BOOST_CHECK(!results[3].missingInputs);
+    BOOST_CHECK_EQUAL(results[3].state.GetRejectReason(),
+                      "txn-mempool-conflict");
+
+    BOOST_CHECK(!results[4].accepted);
+    BOOST_CHECK(results[4].state.IsInvalid());
+    BOOST_CHECK_EQUAL(results[4].state.GetRejectCode(), REJECT_INVALID);
+
+    BOOST_CHECK(!results[5].accepted);
+    BOOST_CHECK(results[5].missingInputs);
+
+    BOOST_CHECK(results[6].accepted);
+
+    LOCK(g_mempool.cs);
+    BOOST_CHECK_EQUAL(g_mempool.size(), 3U);
+    BOOST_CHECK(g_mempool.exists(parent.GetId()));
+    BOOST_CHECK(g_mempool.exists(child.GetId()));
+    BOOST_CHECK(g_mempool.exists(good.GetId()));
+}
+
+/**
+ * Ensure that the mempool is loaded back from disk with the times and fee
+ * deltas of its transactions, and that a damaged mempool.dat is not.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_dump_load, RegtestingSetup) {
+    const Amount amount = 1 * COIN;
+    const Amount fee = 1 * CENT;
+    const SigHashType sigHashType = SigHashType().withForkId();
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptPubKey =
+        GetScriptForDestination(key.GetPubKey().GetID());
+
+    const auto spend = [&](const COutPoint &outpoint, const Amount value) {
+        CMutableTransaction mtx;
+        mtx.vin.emplace_back(outpoint);
+        mtx.vout.emplace_back(value - fee, scriptPubKey);
+        std::vector<uint8_t> vchSig;
+        const uint256 hash =
+            SignatureHash(scriptPubKey, mtx, 0, sigHashType, value);
+        BOOST_CHECK(key.SignSchnorr(hash, vchSig));
+        vchSig.push_back(uint8_t(sigHashType.getRawSigHashType()));
+        mtx.vin[0].scriptSig = CScript() << vchSig
+                                         << ToByteVector(key.GetPubKey());
+        return MakeTransactionRef(mtx);
+    };
+
+    LOCK(cs_main);
+    std::vector<COutPoint> outpoints;
+    for (size_t i = 0; i < 2; ++i) {
+        outpoints.emplace_back(TxId(InsecureRand256()), 0);
+        pcoinsTip->AddCoin(outpoints.back(),
+                           Coin(CTxOut(amount, scriptPubKey), 1, false), false);
+    }
+    const CTransactionRef parent = spend(outpoints[0], amount);
+    const CTransactionRef child =
+        spend(COutPoint(parent->GetId(), 0), amount - fee);
+    const CTransactionRef other = spend(outpoints[1], amount);
+    const TxId absent(InsecureRand256());
+
+    std::map<TxId, int64_t> times;
+    for (const CTransactionRef &tx : {parent, child, other}) {
+        SetMockTime(GetTime() + 1);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(GetConfig(), g_mempool, state, tx,
+                                       nullptr, false /* bypass_limits */,
+                                       Amount::zero()));
+        times[tx->GetId()] = GetTime();
+    }
+    g_mempool.PrioritiseTransaction(other->GetId(), 1000 * SATOSHI);
+    g_mempool.PrioritiseTransaction(absent, 2000 * SATOSHI);
+
+    BOOST_REQUIRE(DumpMempool(g_mempool));
+
+    const auto Clear = [&] {
+        g_mempool.clear();
+        g_mempool.ClearPrioritisation(other->GetId());
+        g_mempool.ClearPrioritisation(absent);
+    };
+    Clear();
+    BOOST_REQUIRE(LoadMempool(GetConfig(), g_mempool));
+    {
+        LOCK(g_mempool.cs);
+        BOOST_CHECK_EQUAL(g_mempool.size(), 3U);
+        for (const auto &[txid, time] : times) {
+            const auto it = g_mempool.GetIter(txid);
+            BOOST_REQUIRE(it);
+            BOOST_CHECK_EQUAL((*it)->GetTime(), time);
+        }
+        BOOST_CHECK_EQUAL((*g_mempool.GetIter(other->GetId()))->GetModifiedFee(),
+                          fee + 1000 * SATOSHI);
+        Amount delta = Amount::zero();
+        g_mempool.ApplyDelta(absent, delta);
+        BOOST_CHECK_EQUAL(delta, 2000 * SATOSHI);
+    }
+
+    // Flip a bit of the first transaction.
+    const fs::path path = GetDataDir() / "mempool.dat";
+    {
+        fs::ifstream in(path, std::ios::binary);
+        std::vector<char> data((std::istreambuf_iterator<char>(in)),
+                               std::istreambuf_iterator<char>());
+        data.at(100) ^= 1;
+        fs::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), data.size());
+    }
+    Clear();
+    BOOST_CHECK(!LoadMempool(GetConfig(), g_mempool));
+    BOOST_CHECK_EQUAL(g_mempool.size(), 0U);
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,143 @@
+// Copyright (c) 2022 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/utxosnapshot.h>
+
+#include <chainparams.h>
+#include <clientversion.h>
+#include <coins.h>
+#include <node/coinstats.h>
+#include <script/script.h>
+#include <streams.h>
+#include <txdb.h>
+#include <util/system.h>
+
+#include <test/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <map>
+
+BOOST_FIXTURE_TEST_SUITE(utxosnapshot_tests, TestingSetup)
+
+static std::map<COutPoint, Coin> AddCoins(CCoinsView &view,
+                                          const BlockHash &hashBlock) {
+    std::map<COutPoint, Coin> coins;
+    CCoinsViewCache cache(&view);
+    for (int i = 0; i < 1000; ++i) {
+        COutPoint outpoint(TxId(InsecureRand256()), InsecureRandRange(4));
+        Coin coin(CTxOut(int64_t(InsecureRand32()) * SATOSHI,
+                         CScript() << ScriptInt::fromIntUnchecked(i) << OP_DROP),
+                  InsecureRandRange(1000), InsecureRandBool());
+        cache.AddCoin(outpoint, coin, true);
+        coins[outpoint] = std::move(coin);
+    }
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(cache.Flush());
+    return coins;
+}
+
+BOOST_AUTO_TEST_CASE(dump_and_load) {
+    const BlockHash &genesis = Params().GetConsensus().hashGenesisBlock;
+    CCoinsViewDB source(1 << 20, true);
+    const std::map<COutPoint, Coin> coins = AddCoins(source, genesis);
+
+    const fs::path path = GetDataDir() / "utxo.dat";
+    CCoinsStats dumped;
+    BOOST_CHECK(DumpUTXOSnapshot(&source, path, dumped));
+    BOOST_CHECK(fs::exists(path));
+    BOOST_CHECK(!fs::exists(path.string() + ".incomplete"));
+    BOOST_CHECK(dumped.hashBlock == genesis);
+    BOOST_CHECK_EQUAL(dumped.nTransactionOutputs, coins.size());
+
+    CCoinsStats expected;
+    BOOST_CHECK(GetUTXOStats(&source, expected));
+    BOOST_CHECK(dumped.hashSerialized == expected.hashSerialized);
+
+    // Load in small batches, so that several are written.
+    CCoinsViewDB target(1 << 20, true);
+    std::string strError;
+    BOOST_CHECK(LoadUTXOSnapshot(target, path, 16 << 10, strError));
+    BOOST_CHECK(!target.IsSnapshotLoading());
+    BOOST_CHECK(target.GetBestBlock() == genesis);
+    for (const auto &entry : coins) {
+        Coin coin;
+        BOOST_CHECK(target.GetCoin(entry.first, coin));
+        BOOST_CHECK(coin.GetTxOut() == entry.second.GetTxOut());
+        BOOST_CHECK_EQUAL(coin.GetHeight(), entry.second.GetHeight());
+        BOOST_CHECK_EQUAL(coin.IsCoinBase(), entry.second.IsCoinBase());
+    }
+
+    CCoinsStats loaded;
+    BOOST_CHECK(GetUTXOStats(&target, loaded));
+    BOOST_CHECK(loaded.hashSerialized == expected.hashSerialized);
+    BOOST_CHECK_EQUAL(loaded.nTransactionOutputs, coins.size());
+}
+
+BOOST_AUTO_TEST_CASE(load_rejects_bad_snapshot) {
+    const BlockHash &genesis = Params().GetConsensus().hashGenesisBlock;
+    CCoinsViewDB source(1 << 20, true);
+    AddCoins(source, genesis);
+
+    const fs::path path = GetDataDir() / "utxo.dat";
+    CCoinsStats stats;
+    BOOST_CHECK(DumpUTXOSnapshot(&source, path, stats));
+
+    auto rewriteMetadata = [&](std::function<void(SnapshotMetadata &)> fn) {
+        FILE *filestr = fsbridge::fopen(path, "rb+");
+        BOOST_REQUIRE(filestr);
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        SnapshotMetadata metadata;
+        file >> metadata;
+        fn(metadata);
+        BOOST_REQUIRE(fseek(file.Get(), 0, SEEK_SET) == 0);
+        file << metadata;
+    };
+    std::string strError;
+
+    // The base block must be known.
+    rewriteMetadata([](SnapshotMetadata &metadata) {
+        metadata.base_blockhash = BlockHash(InsecureRand256());
+    });
+    {
+        CCoinsViewDB target(1 << 20, true);
+        BOOST_CHECK(!LoadUTXOSnapshot(target, path, 1 << 20, strError));
+        BOOST_CHECK(!target.IsSnapshotLoading());
+        BOOST_CHECK(target.GetBestBlock().IsNull());
+    }
+
+    // A UTXO set that does not match the hash is rejected, and the database
+    // stays marked as incomplete.
+    rewriteMetadata([&](SnapshotMetadata &metadata) {
+        metadata.base_blockhash = genesis;
+        metadata.hash_serialized = InsecureRand256();
+    });
+    {
+        CCoinsViewDB target(1 << 20, true);
+        BOOST_CHECK(!LoadUTXOSnapshot(target, path, 1 << 20, strError));
+        BOOST_CHECK(target.IsSnapshotLoading());
+    }
+
+    // So is one that holds fewer coins than announced.
+    rewriteMetadata([&](SnapshotMetadata &metadata) {
+        metadata.hash_serialized = stats.hashSerialized;
+        metadata.coins_count++;
+    });
+    {
+        CCoinsViewDB target(1 << 20, true);
+        BOOST_CHECK(!LoadUTXOSnapshot(target, path, 1 << 20, strError));
+        BOOST_CHECK(target.IsSnapshotLoading());
+    }
+
+    rewriteMetadata([](SnapshotMetadata &metadata) {
+        metadata.magic[0] = 'x';
+    });
+    {
+        CCoinsViewDB target(1 << 20, true);
+        BOOST_CHECK(!LoadUTXOSnapshot(target, path, 1 << 20, strError));
+        BOOST_CHECK(!target.IsSnapshotLoading());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -129,4 +129,40 @@ BOOST_AUTO_TEST_CASE(validation_load_external_block_file) {
     BOOST_CHECK_NO_THROW({ LoadExternalBlockFile(config, fp, 0); });
 }
 
+BOOST_AUTO_TEST_CASE(validation_read_raw_block) {
+    const Config &config = GetConfig();
+    const CChainParams &chainparams = config.GetChainParams();
+    FlatFilePos pos;
+    BlockHash hash;
+    {
+        LOCK(cs_main);
+        pos = ::ChainActive().Genesis()->GetBlockPos();
+        hash = ::ChainActive().Genesis()->GetBlockHash();
+    }
+
+    // The raw block is the block as serialized for the network.
+    std::vector<uint8_t> raw;
+    BOOST_REQUIRE(ReadRawBlockFromDisk(raw, pos, hash, chainparams.DiskMagic(),
+                                       config.GetExcessiveBlockSize()));
+    CBlock block;
+    BOOST_REQUIRE(ReadBlockFromDisk(block, pos, chainparams.GetConsensus()));
+    std::vector<uint8_t> serialized;
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, serialized, 0, block);
+    BOOST_CHECK(raw == serialized);
+
+    // Anything but the block at pos is refused.
+    BOOST_CHECK(!ReadRawBlockFromDisk(raw, pos, BlockHash(),
+                                      chainparams.DiskMagic(),
+                                      config.GetExcessiveBlockSize()));
+    BOOST_CHECK(!ReadRawBlockFromDisk(raw, pos, hash, chainparams.NetMagic(),
+                                      config.GetExcessiveBlockSize()));
+    BOOST_CHECK(!ReadRawBlockFromDisk(raw, pos, hash, chainparams.DiskMagic(),
+                                      serialized.size() - 1));
+    FlatFilePos shifted = pos;
+    ++shifted.nPos;
+    BOOST_CHECK(!ReadRawBlockFromDisk(raw, shifted, hash,
+                                      chainparams.DiskMagic(),
+                                      config.GetExcessiveBlockSize()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
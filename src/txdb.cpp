@@ -17,6 +17,8 @@
 #include <boost/thread.hpp> // boost::this_thread::interruption_point() (mingw)
 
 #include <cstdint>
+#include <functional>
+#include <type_traits>
 
 static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
@@ -28,6 +30,7 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_SNAPSHOT_FLAG = 'S';
 
 namespace {
 
@@ -55,17 +58,54 @@ struct CoinEntry {
 } // namespace
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe)
-    : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) {}
+    : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true),
+      fBackgroundWrites(gArgs.GetBoolArg("-dbbackgroundflush",
+                                         DEFAULT_DB_BACKGROUND_FLUSH)) {}
+
+CCoinsViewDB::~CCoinsViewDB() {
+    Sync();
+}
+
+const Coin *CCoinsViewDB::GetPendingCoin(const COutPoint &outpoint) const {
+    AssertLockHeld(cs_pending);
+    if (!pendingCoins) {
+        return nullptr;
+    }
+    CCoinsMap::const_iterator it = pendingCoins->find(outpoint);
+    return it == pendingCoins->end() ? nullptr : &it->second.coin;
+}
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        LOCK(cs_pending);
+        if (const Coin *pending = GetPendingCoin(outpoint)) {
+            if (pending->IsSpent()) {
+                return false;
+            }
+            coin = *pending;
+            return true;
+        }
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    {
+        LOCK(cs_pending);
+        if (const Coin *pending = GetPendingCoin(outpoint)) {
+            return !pending->IsSpent();
+        }
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
 BlockHash CCoinsViewDB::GetBestBlock() const {
+    {
+        LOCK(cs_pending);
+        if (pendingCoins) {
+            return pendingBlock;
+        }
+    }
     BlockHash hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain)) {
         return BlockHash();
@@ -73,6 +113,18 @@ BlockHash CCoinsViewDB::GetBestBlock() const {
     return hashBestChain;
 }
 
+bool CCoinsViewDB::WriteSnapshotLoading(bool fLoading) {
+    if (fLoading) {
+        return db.Write(DB_SNAPSHOT_FLAG, '1', true);
+    } else {
+        return db.Erase(DB_SNAPSHOT_FLAG, true);
+    }
+}
+
+bool CCoinsViewDB::IsSnapshotLoading() const {
+    return db.Exists(DB_SNAPSHOT_FLAG);
+}
+
 std::vector<BlockHash> CCoinsViewDB::GetHeadBlocks() const {
     std::vector<BlockHash> vhashHeadBlocks;
     if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks)) {
@@ -81,7 +133,14 @@ std::vector<BlockHash> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const BlockHash &hashBlock) {
+/**
+ * Write the dirty coins of mapCoins to the database. When mapCoins is
+ * mutable, its entries are erased as they are written; a const map (the
+ * pending coins of a background write) is left untouched so that it can be
+ * read concurrently.
+ */
+template <typename Map>
+bool CCoinsViewDB::WriteCoins(Map &mapCoins, const BlockHash &hashBlock) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -90,9 +149,10 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const BlockHash &hashBlock) {
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
 
-    BlockHash old_tip = GetBestBlock();
-    if (old_tip.IsNull()) {
+    BlockHash old_tip;
+    if (!db.Read(DB_BEST_BLOCK, old_tip)) {
         // We may be in the middle of replaying.
+        old_tip = BlockHash();
         std::vector<BlockHash> old_heads = GetHeadBlocks();
         if (old_heads.size() == 2) {
             assert(old_heads[0] == hashBlock);
@@ -107,7 +167,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const BlockHash &hashBlock) {
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, std::vector<BlockHash>{hashBlock, old_tip});
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (auto it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent()) {
@@ -118,8 +178,11 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const BlockHash &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if constexpr (std::is_const_v<Map>) {
+            ++it;
+        } else {
+            it = mapCoins.erase(it);
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n",
                      batch.SizeEstimate() * (1.0 / 1048576.0));
@@ -149,6 +212,83 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const BlockHash &hashBlock) {
     return ret;
 }
 
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const BlockHash &hashBlock) {
+    if (!fBackgroundWrites) {
+        return WriteCoins(mapCoins, hashBlock);
+    }
+
+    LOCK(cs_writer);
+    // Only one write can be pending at a time.
+    SyncInternal();
+    if (WriteFailed()) {
+        return false;
+    }
+
+    // Take the dirty coins out of mapCoins. Only those need to be written,
+    // and they have to remain readable until they are.
+    auto resource = std::make_unique<CCoinsMapMemoryResource>();
+    auto coins = std::make_unique<CCoinsMap>(0, SaltedOutpointHasher{},
+                                             CCoinsMap::key_equal{},
+                                             resource.get());
+    for (auto &entry : mapCoins) {
+        if (entry.second.flags & CCoinsCacheEntry::DIRTY) {
+            coins->emplace(entry.first, std::move(entry.second));
+        }
+    }
+    mapCoins.clear();
+
+    const CCoinsMap *coinsToWrite = coins.get();
+    {
+        LOCK(cs_pending);
+        pendingResource = std::move(resource);
+        pendingCoins = std::move(coins);
+        pendingBlock = hashBlock;
+    }
+
+    LogPrint(BCLog::COINDB,
+             "Writing %u changed transaction outputs to coin database in "
+             "the background\n",
+             (unsigned int)coinsToWrite->size());
+    writerThread = std::thread(
+        &TraceThread<std::function<void()>>, "coinsflush",
+        std::function<void()>([this, coinsToWrite, hashBlock]() {
+            bool fOk = false;
+            try {
+                fOk = WriteCoins(*coinsToWrite, hashBlock);
+            } catch (const std::runtime_error &e) {
+                LogPrintf("Error writing to coin database: %s\n", e.what());
+            }
+            LOCK(cs_pending);
+            if (!fOk) {
+                // Keep serving the pending coins, the database is now
+                // inconsistent until the write is replayed.
+                fWriteFailed = true;
+                return;
+            }
+            pendingCoins.reset();
+            pendingResource.reset();
+        }));
+    return true;
+}
+
+void CCoinsViewDB::SyncInternal() const {
+    AssertLockHeld(cs_writer);
+    if (writerThread.joinable()) {
+        writerThread.join();
+    }
+}
+
+bool CCoinsViewDB::Sync() const {
+    LOCK(cs_writer);
+    SyncInternal();
+    return !WriteFailed();
+}
+
+bool CCoinsViewDB::WriteFailed() const {
+    LOCK(cs_pending);
+    return fWriteFailed;
+}
+
 size_t CCoinsViewDB::EstimateSize() const {
     return db.EstimateSize(DB_COIN, char(DB_COIN + 1));
 }
@@ -177,6 +317,8 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 }
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const {
+    // The cursor iterates over the database only.
+    Sync();
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(
         const_cast<CDBWrapper &>(db).NewIterator(), GetBestBlock());
     /**
@@ -11,10 +11,12 @@
 #include <dbwrapper.h>
 #include <flatfile.h>
 #include <primitives/block.h>
+#include <sync.h>
 
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -30,8 +32,14 @@ struct Params;
 static constexpr int MAX_BLOCK_COINSDB_USAGE = 10;
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 450;
+//! -dbcacheretain default (percentage of the in-memory UTXO cache)
+static const int64_t nDefaultDbCacheRetain = 25;
+//! max. -dbcacheretain (percentage of the in-memory UTXO cache)
+static const int64_t nMaxDbCacheRetain = 90;
 //! -dbbatchsize default (bytes)
 static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -dbbackgroundflush default
+static const bool DEFAULT_DB_BACKGROUND_FLUSH = false;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void *) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
@@ -46,7 +54,20 @@ static const int64_t nMaxTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/**
+ * CCoinsView backed by the coin database (chainstate/)
+ *
+ * With -dbbackgroundflush, BatchWrite does not write to the database itself:
+ * it takes the dirty coins out of the map it is given and returns, while a
+ * background thread writes them. Until that write completes, the pending
+ * coins are served from memory, so that the caches on top of this view can
+ * keep on fetching coins and connecting blocks. A new BatchWrite, Sync or
+ * Cursor waits for the pending write to complete first.
+ *
+ * The database is marked as being in transition (DB_HEAD_BLOCKS) for the
+ * whole duration of a write, background or not, so that an interrupted write
+ * is completed by ReplayBlocks on the next startup.
+ */
 class CCoinsViewDB final : public CCoinsView {
 protected:
     CDBWrapper db;
@@ -54,6 +75,7 @@ protected:
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false,
                           bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
@@ -66,6 +88,52 @@ public:
     //! Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+    /**
+     * Wait for the pending background write, if any, to be committed to the
+     * database. Returns false if it (or any earlier one) failed.
+     */
+    bool Sync() const;
+
+    //! Whether a background write has failed.
+    bool WriteFailed() const;
+
+    /**
+     * Mark the database as being populated from a UTXO snapshot. The mark is
+     * only cleared once the snapshot has been fully loaded and verified, so
+     * that an interrupted load is detected on the next startup.
+     */
+    bool WriteSnapshotLoading(bool fLoading);
+    bool IsSnapshotLoading() const;
+
+private:
+    //! Whether BatchWrite hands the coins to a background thread.
+    const bool fBackgroundWrites;
+
+    //! Serializes the management of writerThread.
+    mutable Mutex cs_writer;
+    mutable std::thread writerThread GUARDED_BY(cs_writer);
+
+    /**
+     * The coins being written in the background and the block they are
+     * consistent with. The thread writing them does not take cs_pending: the
+     * map is never modified while it is pending.
+     */
+    mutable Mutex cs_pending;
+    std::unique_ptr<CCoinsMapMemoryResource> pendingResource
+        GUARDED_BY(cs_pending);
+    std::unique_ptr<CCoinsMap> pendingCoins GUARDED_BY(cs_pending);
+    BlockHash pendingBlock GUARDED_BY(cs_pending);
+    bool fWriteFailed GUARDED_BY(cs_pending){false};
+
+    //! Look up a pending coin. Returns nullptr if the outpoint is not pending.
+    const Coin *GetPendingCoin(const COutPoint &outpoint) const
+        EXCLUSIVE_LOCKS_REQUIRED(cs_pending);
+
+    void SyncInternal() const EXCLUSIVE_LOCKS_REQUIRED(cs_writer);
+
+    template <typename Map>
+    bool WriteCoins(Map &mapCoins, const BlockHash &hashBlock);
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
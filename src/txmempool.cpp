@@ -31,9 +31,13 @@
 
 #include <algorithm>
 #include <functional>
+#include <future>
 #include <optional>
+#include <queue>
 #include <stdexcept>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef &_tx, const Amount _nFee,
@@ -80,7 +84,9 @@ void CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an entry in
         // the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        for (txiter piter : GetMemPoolParents(it)) {
+            parentHashes.insert(piter);
+        }
     }
 
     while (!parentHashes.empty()) {
@@ -89,8 +95,7 @@ void CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         setAncestors.insert(stageit);
         parentHashes.erase(parentHashes.begin());
 
-        const setEntries &setMemPoolParents = GetMemPoolParents(stageit);
-        for (txiter phash : setMemPoolParents) {
+        for (txiter phash : GetMemPoolParents(stageit)) {
             // If this is a new ancestor, add it.
             if (!algo::contains(setAncestors, phash)) {
                 parentHashes.insert(phash);
@@ -107,16 +112,16 @@ void CTxMemPool::UpdateParentsOf(bool add, txiter it) {
 }
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it) {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
-    for (txiter updateIt : setMemPoolChildren) {
+    for (txiter updateIt : GetMemPoolChildren(it)) {
         UpdateParent(updateIt, it, false);
     }
 }
 
-void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove) {
+template <typename Entries>
+void CTxMemPool::UpdateForRemoveFromMempool(const Entries &entriesToRemove) {
     for (txiter removeIt : entriesToRemove) {
         // Note that UpdateParentsOf severs the child links that point to
-        // removeIt in the mapLinks entries for the parents of removeIt.
+        // removeIt in the entries for the parents of removeIt.
         UpdateParentsOf(false, removeIt);
     }
     // After updating all the parent links, we can now sever the link between
@@ -148,7 +153,6 @@ bool CTxMemPool::isSpent(const COutPoint &outpoint) const {
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const {
-    LOCK(cs);
     return nTransactionsUpdated;
 }
 
@@ -160,6 +164,10 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n) {
 void CTxMemPool::addUnchecked(CTxMemPoolEntry &&entry) {
     // get a guaranteed unique id (in case tests re-use the same object)
     entry.SetEntryId(nextEntryId++);
+    // the entry may be a copy of one in another pool
+    entry.parents.clear();
+    entry.children.clear();
+    entry.cluster = nullptr;
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     {
@@ -178,8 +186,6 @@ void CTxMemPool::addUnchecked(CTxMemPoolEntry &&entry) {
     // Sanity check: We should always end up inserting at the end of the entry_id index
     assert(&*mapTx.get<entry_id>().rbegin() == &*newit);
 
-    mapLinks.try_emplace(newit);
-
     // Update cachedInnerUsage to include contained transaction's usage.
     // (When we update the entry for in-mempool parents, memory usage will be
     // further updated.)
@@ -200,17 +206,23 @@ void CTxMemPool::addUnchecked(CTxMemPoolEntry &&entry) {
         UpdateParent(newit, pit, true);
     }
     UpdateParentsOf(true, newit);
+    AddToCluster(newit);
 
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
 }
 
-void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason) {
+void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason,
+                                 std::vector<DspId> *dspIdsToOrphan) {
     NotifyEntryRemoved(it->GetSharedTx(), reason);
     if (it->HasDsp()) {
         // we put known dsproofs back into the orphan pool just in case there is
         // a reorg in the future and this deleted tx comes back.
-        m_dspStorage->orphanExisting(it->GetDspId());
+        if (dspIdsToOrphan) {
+            dspIdsToOrphan->push_back(it->GetDspId());
+        } else {
+            m_dspStorage->orphanExisting(it->GetDspId());
+        }
     }
     for (const CTxIn &txin : it->GetTx().vin) {
         mapNextTx.erase(txin.prevout);
@@ -218,11 +230,9 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason) {
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    if (const auto linksiter = mapLinks.find(it); linksiter != mapLinks.end()) {
-        cachedInnerUsage -= memusage::DynamicUsage(linksiter->second.parents) +
-                            memusage::DynamicUsage(linksiter->second.children);
-        mapLinks.erase(linksiter);
-    }
+    cachedInnerUsage -= memusage::DynamicUsage(it->GetMemPoolParents()) +
+                        memusage::DynamicUsage(it->GetMemPoolChildren());
+    RemoveFromCluster(it);
     mapTx.erase(it);
     nTransactionsUpdated++;
 }
@@ -247,8 +257,7 @@ void CTxMemPool::CalculateDescendants(txiter entryit,
         setDescendants.insert(it);
         stage.erase(stage.begin());
 
-        const setEntries &setChildren = GetMemPoolChildren(it);
-        for (txiter childiter : setChildren) {
+        for (txiter childiter : GetMemPoolChildren(it)) {
             if (!algo::contains(setDescendants, childiter)) {
                 stage.insert(childiter);
             }
@@ -301,55 +310,128 @@ void CTxMemPool::removeConflicts(const CTransaction &tx) {
     }
 }
 
+//! Block txs below which removeForBlock() does not bother spawning a thread to
+//! look them up in the mempool.
+static constexpr size_t REMOVE_FOR_BLOCK_TXS_PER_THREAD = 16'384;
+
 /**
  * Called when a block is connected. Removes from mempool and updates the miner
  * fee estimator.
+ *
+ * The whole removal set is worked out up front: the txs of the block that are
+ * in the mempool, and the in-mempool descendants of any tx spending the same
+ * inputs as a block tx that is not. Both are then unlinked and erased in one
+ * go, instead of staging each block tx on its own in topological order.
  */
 void CTxMemPool::removeForBlock(const std::vector<CTransactionRef> &vtx) {
-    LOCK(cs);
+    std::vector<DspId> dspIdsToOrphan;
+    {
+        LOCK(cs);
 
-    if (mapTx.empty() && mapDeltas.empty()) {
-        // fast-path for IBD and/or when mempool is empty; there is no need to
-        // do any of the set-up work below which eats precious cycles.
-        return;
-    }
+        if (mapTx.empty() && mapDeltas.empty()) {
+            // fast-path for IBD and/or when mempool is empty; there is no need
+            // to do any of the set-up work below which eats precious cycles.
+            return;
+        }
+
+        // Find the block txs in the mempool and the mempool txs conflicting
+        // with the rest. These are only lookups, so large blocks are split
+        // among several threads while we hold cs.
+        struct Lookups {
+            std::vector<txiter> inBlock;
+            std::vector<const CTransaction *> conflicts;
+        };
+        auto lookup = [this, &vtx](size_t begin, size_t end) NO_THREAD_SAFETY_ANALYSIS {
+            Lookups ret;
+            for (size_t i = begin; i < end; ++i) {
+                const CTransaction &tx = *vtx[i];
+                if (const txiter it = mapTx.find(tx.GetId()); it != mapTx.end()) {
+                    ret.inBlock.push_back(it);
+                    continue;
+                }
+                for (const CTxIn &txin : tx.vin) {
+                    if (const auto it = mapNextTx.find(txin.prevout);
+                        it != mapNextTx.end() && *it->second != tx) {
+                        ret.conflicts.push_back(it->second);
+                    }
+                }
+            }
+            return ret;
+        };
+        const size_t nThreads = std::clamp<size_t>(vtx.size() / REMOVE_FOR_BLOCK_TXS_PER_THREAD, 1,
+                                                   std::max(GetNumCores(), 1));
+        const size_t chunkSize = (vtx.size() + nThreads - 1) / nThreads;
+        std::vector<std::future<Lookups>> futures;
+        for (size_t begin = chunkSize; begin < vtx.size(); begin += chunkSize) {
+            futures.push_back(std::async(std::launch::async, lookup, begin,
+                                         std::min(begin + chunkSize, vtx.size())));
+        }
+        Lookups found = lookup(0, std::min(chunkSize, vtx.size()));
+        for (auto &future : futures) {
+            Lookups more = future.get();
+            found.inBlock.insert(found.inBlock.end(), more.inBlock.begin(), more.inBlock.end());
+            found.conflicts.insert(found.conflicts.end(), more.conflicts.begin(), more.conflicts.end());
+        }
 
-    DisconnectedBlockTransactions disconnectpool;
-    disconnectpool.addForBlock(vtx);
+        setEntries conflicted;
+        for (const CTransaction *txConflict : found.conflicts) {
+            ClearPrioritisation(txConflict->GetId());
+            CalculateDescendants(mapTx.find(txConflict->GetId()), conflicted);
+        }
+        if (!conflicted.empty()) {
+            // Not expected for a valid block, but never remove an entry twice.
+            for (const txiter it : found.inBlock) {
+                conflicted.erase(it);
+            }
+        }
 
-    // iterate in topological order (parents before children)
-    for (const CTransactionRef &tx : reverse_iterate(disconnectpool.GetQueuedTx().get<insertion_order>())) {
-        const txiter it = mapTx.find(tx->GetId());
-        if (it != mapTx.end()) {
-            setEntries stage;
-            stage.insert(it);
-            RemoveStaged(stage, MemPoolRemovalReason::BLOCK);
-        } else {
-            removeConflicts(*tx);
+        // Sever all links first, as the entries of a chain are removed in no
+        // particular order.
+        UpdateForRemoveFromMempool(found.inBlock);
+        UpdateForRemoveFromMempool(conflicted);
+        for (const txiter it : found.inBlock) {
+            removeUnchecked(it, MemPoolRemovalReason::BLOCK, &dspIdsToOrphan);
+        }
+        for (const txiter it : conflicted) {
+            removeUnchecked(it, MemPoolRemovalReason::CONFLICT, &dspIdsToOrphan);
         }
-    }
-    // clear prioritisations (mapDeltas); optmized for the common case where
-    // mapDeltas is empty or much smaller than block.vtx
-    algo::erase_if(mapDeltas, [&disconnectpool](const auto &kv) {
-        return algo::contains(disconnectpool.GetQueuedTx(), kv.first);
-    });
 
-    lastRollingFeeUpdate = GetTime();
-    blockSinceLastRollingFeeBump = true;
+        // clear prioritisations (mapDeltas); optimized for the common case
+        // where mapDeltas is empty
+        if (!mapDeltas.empty()) {
+            for (const CTransactionRef &tx : vtx) {
+                mapDeltas.erase(tx->GetId());
+            }
+        }
 
-    disconnectpool.clear();
+        lastRollingFeeUpdate = GetTime();
+        blockSinceLastRollingFeeBump = true;
+
+        // Do not keep the transactions of the block alive in a snapshot that
+        // nobody may ask for until the next change.
+        std::atomic_store(&m_snapshot, std::shared_ptr<const MempoolSnapshot>());
+    }
+
+    // The proofs of the removed txs go back to the orphan pool after cs is
+    // released, so that readers of the mempool do not wait on them. The
+    // caller holds cs_main, so the txs cannot come back in the meantime.
+    for (const DspId &dspId : dspIdsToOrphan) {
+        m_dspStorage->orphanExisting(dspId);
+    }
 }
 
 void CTxMemPool::_clear(bool clearDspOrphans /*= true*/) {
-    mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
+    clusters.clear();
+    cachedClusterUsage = 0;
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
     m_dspStorage->clear(clearDspOrphans);
+    std::atomic_store(&m_snapshot, std::shared_ptr<const MempoolSnapshot>());
     ++nTransactionsUpdated;
 }
 
@@ -386,6 +468,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const {
 
     uint64_t checkTotal = 0;
     uint64_t innerUsage = 0;
+    size_t nClusteredEntries = 0;
 
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache *>(pcoins));
     const int64_t spendheight = GetSpendHeight(mempoolDuplicate);
@@ -396,11 +479,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const {
         checkTotal += it->GetTxSize();
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction &tx = it->GetTx();
-        auto linksiter = mapLinks.find(it);
-        assert(linksiter != mapLinks.end());
-        const TxLinks &links = linksiter->second;
-        innerUsage += memusage::DynamicUsage(links.parents) +
-                      memusage::DynamicUsage(links.children);
+        innerUsage += memusage::DynamicUsage(it->GetMemPoolParents()) +
+                      memusage::DynamicUsage(it->GetMemPoolChildren());
         bool fDependsWait = false;
         setEntries setParentCheck;
         for (const CTxIn &txin : tx.vin) {
@@ -425,7 +505,18 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const {
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        const auto parents = GetMemPoolParents(it);
+        assert(setParentCheck == setEntries(parents.begin(), parents.end()));
+        // Linked entries share a cluster, which lists them.
+        if (it->cluster) {
+            assert(it->cluster->entries.at(it->clusterPos) == &*it);
+            ++nClusteredEntries;
+        } else {
+            assert(parents.empty() && it->GetMemPoolChildren().empty());
+        }
+        for (const txiter parent : parents) {
+            assert(parent->cluster == it->cluster);
+        }
         // Verify ancestor state is correct.
         setEntries setAncestors;
         CalculateMemPoolAncestors(*it, setAncestors);
@@ -444,7 +535,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const {
             assert(childit != mapTx.end());
             setChildrenCheck.insert(childit);
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        const auto children = GetMemPoolChildren(it);
+        assert(setChildrenCheck == setEntries(children.begin(), children.end()));
 
         if (fDependsWait) {
             waitingOnDependants.push_back(&(*it));
@@ -478,6 +570,14 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const {
 
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
+    size_t clusterUsage = 0;
+    for (const auto &[id, cluster] : clusters) {
+        assert(cluster.id == id && cluster.entries.size() > 1);
+        nClusteredEntries -= cluster.entries.size();
+        clusterUsage += cluster.DynamicMemoryUsage();
+    }
+    assert(nClusteredEntries == 0);
+    assert(clusterUsage == cachedClusterUsage);
 }
 
 bool CTxMemPool::CompareTopologically(const TxId &txida, const TxId &txidb) const {
@@ -490,13 +590,13 @@ bool CTxMemPool::CompareTopologically(const TxId &txida, const TxId &txidb) cons
 }
 
 void CTxMemPool::queryHashes(std::vector<uint256> &vtxid) const {
-    LOCK(cs);
+    const std::shared_ptr<const MempoolSnapshot> snapshot = GetSnapshot();
 
     vtxid.clear();
-    vtxid.reserve(mapTx.size());
+    vtxid.reserve(snapshot->entries.size());
 
-    for (const auto &entry : mapTx.get<entry_id>()) {
-        vtxid.push_back(entry.GetTx().GetId());
+    for (const MempoolSnapshot::Entry &entry : snapshot->entries) {
+        vtxid.push_back(entry.tx->GetId());
     }
 }
 
@@ -508,19 +608,68 @@ GetInfo(CTxMemPool::indexed_transaction_set::const_iterator it) {
 }
 
 std::vector<TxMempoolInfo> CTxMemPool::infoAll() const {
-    LOCK(cs);
+    const std::shared_ptr<const MempoolSnapshot> snapshot = GetSnapshot();
 
     std::vector<TxMempoolInfo> ret;
-    ret.reserve(mapTx.size());
+    ret.reserve(snapshot->entries.size());
 
-    const auto & index = mapTx.get<entry_id>();
-    for (auto it = index.begin(); it != index.end(); ++it) {
-        ret.push_back(GetInfo(mapTx.project<0>(it)));
+    for (const MempoolSnapshot::Entry &entry : snapshot->entries) {
+        ret.push_back(TxMempoolInfo{entry.tx, entry.time,
+                                    CFeeRate(entry.fee, entry.txSize),
+                                    entry.modifiedFee - entry.fee});
     }
 
     return ret;
 }
 
+MempoolSnapshot::Entry CTxMemPool::GetSnapshotEntry(txiter it) const {
+    AssertLockHeld(cs);
+
+    MempoolSnapshot::Entry entry{it->GetSharedTx(), it->GetFee(),
+                                 it->GetModifiedFee(), it->GetTxSize(),
+                                 it->GetSigChecks(), it->GetTime(), {}, {}};
+    const auto parents = GetMemPoolParents(it);
+    entry.parents.reserve(parents.size());
+    for (const txiter &parent : parents) {
+        entry.parents.push_back(parent->GetTx().GetId());
+    }
+    const auto children = GetMemPoolChildren(it);
+    entry.children.reserve(children.size());
+    for (const txiter &child : children) {
+        entry.children.push_back(child->GetTx().GetId());
+    }
+    return entry;
+}
+
+std::shared_ptr<const MempoolSnapshot> CTxMemPool::GetSnapshot() const {
+    std::shared_ptr<const MempoolSnapshot> snapshot =
+        std::atomic_load(&m_snapshot);
+    if (snapshot && snapshot->nTransactionsUpdated == nTransactionsUpdated) {
+        return snapshot;
+    }
+
+    LOCK(cs);
+    // Another caller may have taken it while we were waiting for cs.
+    snapshot = std::atomic_load(&m_snapshot);
+    if (snapshot && snapshot->nTransactionsUpdated == nTransactionsUpdated) {
+        return snapshot;
+    }
+
+    auto newSnapshot = std::make_shared<MempoolSnapshot>();
+    newSnapshot->nTransactionsUpdated = nTransactionsUpdated;
+    newSnapshot->totalTxSize = totalTxSize;
+    newSnapshot->dynamicMemoryUsage = DynamicMemoryUsage();
+    newSnapshot->entries.reserve(mapTx.size());
+    const auto &index = mapTx.get<entry_id>();
+    for (auto it = index.begin(); it != index.end(); ++it) {
+        newSnapshot->entries.push_back(GetSnapshotEntry(mapTx.project<0>(it)));
+    }
+
+    snapshot = std::move(newSnapshot);
+    std::atomic_store(&m_snapshot, snapshot);
+    return snapshot;
+}
+
 CTransactionRef CTxMemPool::get(const TxId &txid) const {
     LOCK(cs);
     indexed_transaction_set::const_iterator i = mapTx.find(txid);
@@ -562,6 +711,9 @@ void CTxMemPool::PrioritiseTransaction(const TxId &txid,
         txiter it = mapTx.find(txid);
         if (it != mapTx.end()) {
             mapTx.modify(it, update_fee_delta(delta));
+            if (it->cluster) {
+                it->cluster->dirty = true;
+            }
             ++nTransactionsUpdated;
         }
     }
@@ -648,7 +800,7 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
                mapTx.size() +
            memusage::DynamicUsage(mapNextTx) +
            memusage::DynamicUsage(mapDeltas) +
-           memusage::DynamicUsage(mapLinks) +
+           memusage::DynamicUsage(clusters) + cachedClusterUsage +
            cachedInnerUsage;
 }
 
@@ -690,40 +842,236 @@ void CTxMemPool::LimitSize(size_t limit, unsigned long age) {
     }
 }
 
-// NB: The pointer type is only used for template overload selection and never dereferenced so this is safe.
-inline constexpr size_t setEntriesIncrementalUsage =
-        memusage::IncrementalDynamicUsage(static_cast<CTxMemPool::setEntries *>(nullptr));
+// Insert or erase `link` in the sorted `links`, keeping cachedInnerUsage in
+// step with any change in the heap memory they use.
+static void UpdateLinks(CTxMemPoolEntry::Links &links,
+                        const CTxMemPoolEntry *link, bool add,
+                        size_t &cachedInnerUsage) {
+    const auto pos = std::lower_bound(
+        links.begin(), links.end(), link,
+        [](const CTxMemPoolEntry *a, const CTxMemPoolEntry *b) {
+            return a->GetEntryId() < b->GetEntryId();
+        });
+    const bool found = pos != links.end() && *pos == link;
+    if (add == found) {
+        return;
+    }
+    const size_t usageBefore = memusage::DynamicUsage(links);
+    if (add) {
+        links.insert(pos, link);
+    } else {
+        links.erase(pos);
+        // Give back the heap memory once the links fit inline again.
+        if (links.size() == CTxMemPoolEntry::INLINE_LINKS) {
+            links.shrink_to_fit();
+        }
+    }
+    cachedInnerUsage += memusage::DynamicUsage(links);
+    cachedInnerUsage -= usageBefore;
+}
 
 void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add) {
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += setEntriesIncrementalUsage;
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= setEntriesIncrementalUsage;
-    }
+    UpdateLinks(entry->GetMemPoolChildren(), &*child, add, cachedInnerUsage);
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add) {
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += setEntriesIncrementalUsage;
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= setEntriesIncrementalUsage;
-    }
+    UpdateLinks(entry->GetMemPoolParents(), &*parent, add, cachedInnerUsage);
 }
 
-const CTxMemPool::setEntries &
-CTxMemPool::GetMemPoolParents(txiter entry) const {
+CTxMemPool::LinkedEntries CTxMemPool::GetMemPoolParents(txiter entry) const {
     assert(entry != mapTx.end());
-    auto it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.parents;
+    return {mapTx, entry->GetMemPoolParents()};
 }
 
-const CTxMemPool::setEntries &
-CTxMemPool::GetMemPoolChildren(txiter entry) const {
+CTxMemPool::LinkedEntries CTxMemPool::GetMemPoolChildren(txiter entry) const {
     assert(entry != mapTx.end());
-    auto it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.children;
+    return {mapTx, entry->GetMemPoolChildren()};
+}
+
+CTxMemPoolCluster &CTxMemPool::NewCluster() const {
+    const uint64_t id = nextClusterId++;
+    return clusters.try_emplace(id, id).first->second;
+}
+
+void CTxMemPool::EraseCluster(CTxMemPoolCluster &cluster) const {
+    cachedClusterUsage -= cluster.DynamicMemoryUsage();
+    clusters.erase(cluster.id);
+}
+
+void CTxMemPool::MoveToCluster(const CTxMemPoolEntry &entry, CTxMemPoolCluster &cluster) const {
+    assert(entry.cluster == nullptr);
+    cachedClusterUsage -= cluster.DynamicMemoryUsage();
+    entry.cluster = &cluster;
+    entry.clusterPos = cluster.entries.size();
+    cluster.entries.push_back(&entry);
+    cluster.dirty = true;
+    cachedClusterUsage += cluster.DynamicMemoryUsage();
+}
+
+void CTxMemPool::AddToCluster(txiter it) {
+    const LinkedEntries parents = GetMemPoolParents(it);
+    if (parents.empty()) {
+        return;
+    }
+    // Join the largest of the parents' clusters, and move the others into it,
+    // so that an entry changes clusters at most log2(n) times.
+    CTxMemPoolCluster *cluster = nullptr;
+    for (const txiter parent : parents) {
+        if (parent->cluster && (!cluster || parent->cluster->entries.size() > cluster->entries.size())) {
+            cluster = parent->cluster;
+        }
+    }
+    if (!cluster) {
+        cluster = &NewCluster();
+    }
+    for (const txiter parent : parents) {
+        CTxMemPoolCluster *const other = parent->cluster;
+        if (!other) {
+            MoveToCluster(*parent, *cluster);
+        } else if (other != cluster) {
+            for (const CTxMemPoolEntry *entry : other->entries) {
+                entry->cluster = nullptr;
+                MoveToCluster(*entry, *cluster);
+            }
+            EraseCluster(*other);
+        }
+    }
+    MoveToCluster(*it, *cluster);
+}
+
+void CTxMemPool::RemoveFromCluster(txiter it) {
+    CTxMemPoolCluster *const cluster = it->cluster;
+    if (!cluster) {
+        return;
+    }
+    // The cluster may have fallen apart, which UpdateCluster() sorts out.
+    cachedClusterUsage -= cluster->DynamicMemoryUsage();
+    const CTxMemPoolEntry *const last = cluster->entries.back();
+    cluster->entries[it->clusterPos] = last;
+    last->clusterPos = it->clusterPos;
+    cluster->entries.pop_back();
+    cluster->dirty = true;
+    cachedClusterUsage += cluster->DynamicMemoryUsage();
+    it->cluster = nullptr;
+    if (cluster->entries.size() <= 1) {
+        for (const CTxMemPoolEntry *entry : cluster->entries) {
+            entry->cluster = nullptr;
+        }
+        EraseCluster(*cluster);
+    }
+}
+
+bool CTxMemPool::UpdateCluster(CTxMemPoolCluster &cluster) const {
+    cachedClusterUsage -= cluster.DynamicMemoryUsage();
+
+    // Find the parts that are still linked, and give all but the largest one
+    // a cluster of their own, or none for single entries.
+    std::unordered_set<const CTxMemPoolEntry *> seen;
+    seen.reserve(cluster.entries.size());
+    std::vector<std::vector<const CTxMemPoolEntry *>> parts;
+    for (const CTxMemPoolEntry *start : cluster.entries) {
+        if (!seen.insert(start).second) {
+            continue;
+        }
+        auto &part = parts.emplace_back(1, start);
+        for (size_t i = 0; i < part.size(); ++i) {
+            for (const auto &links : {part[i]->GetMemPoolParents(), part[i]->GetMemPoolChildren()}) {
+                for (const CTxMemPoolEntry *linked : links) {
+                    if (seen.insert(linked).second) {
+                        part.push_back(linked);
+                    }
+                }
+            }
+        }
+    }
+    if (parts.size() > 1) {
+        std::sort(parts.begin(), parts.end(),
+                  [](const auto &a, const auto &b) { return a.size() > b.size(); });
+        for (size_t i = 1; i < parts.size(); ++i) {
+            CTxMemPoolCluster *other = parts[i].size() > 1 ? &NewCluster() : nullptr;
+            for (const CTxMemPoolEntry *entry : parts[i]) {
+                entry->cluster = nullptr;
+                if (other) {
+                    MoveToCluster(*entry, *other);
+                }
+            }
+        }
+        cluster.entries = std::move(parts[0]);
+        if (cluster.entries.size() == 1) {
+            cluster.entries[0]->cluster = nullptr;
+            return false;
+        }
+        for (size_t pos = 0; pos < cluster.entries.size(); ++pos) {
+            cluster.entries[pos]->clusterPos = pos;
+        }
+    }
+
+    // Linearize, taking the ready entry of highest modified feerate each time.
+    auto LowerFeeRate = [](const CTxMemPoolEntry *a, const CTxMemPoolEntry *b) {
+        return CompareTxMemPoolEntryByModifiedFeeRate{}(*b, *a);
+    };
+    std::priority_queue<const CTxMemPoolEntry *, std::vector<const CTxMemPoolEntry *>, decltype(LowerFeeRate)>
+        ready(LowerFeeRate);
+    std::unordered_map<const CTxMemPoolEntry *, size_t> missingParents;
+    missingParents.reserve(cluster.entries.size());
+    for (const CTxMemPoolEntry *entry : cluster.entries) {
+        if (entry->GetMemPoolParents().empty()) {
+            ready.push(entry);
+        } else {
+            missingParents.emplace(entry, entry->GetMemPoolParents().size());
+        }
+    }
+    cluster.linearization.clear();
+    cluster.linearization.reserve(cluster.entries.size());
+    while (!ready.empty()) {
+        const CTxMemPoolEntry *entry = ready.top();
+        ready.pop();
+        cluster.linearization.push_back(entry);
+        for (const CTxMemPoolEntry *child : entry->GetMemPoolChildren()) {
+            if (--missingParents[child] == 0) {
+                ready.push(child);
+            }
+        }
+    }
+    assert(cluster.linearization.size() == cluster.entries.size());
+
+    // Cut it into chunks, merging each chunk into the one before it for as
+    // long as it pays a higher feerate.
+    cluster.chunks.clear();
+    for (size_t i = 0; i < cluster.linearization.size(); ++i) {
+        const CTxMemPoolEntry &entry = *cluster.linearization[i];
+        cluster.chunks.push_back({i, i + 1, entry.GetModifiedFee(), entry.GetTxSize(), entry.GetTxVirtualSize(),
+                                  entry.GetSigChecks()});
+        while (cluster.chunks.size() > 1 &&
+               cluster.chunks.back().GetFeeRate() > cluster.chunks[cluster.chunks.size() - 2].GetFeeRate()) {
+            const CTxMemPoolCluster::Chunk chunk = cluster.chunks.back();
+            cluster.chunks.pop_back();
+            CTxMemPoolCluster::Chunk &prev = cluster.chunks.back();
+            prev.end = chunk.end;
+            prev.modifiedFee += chunk.modifiedFee;
+            prev.txSize += chunk.txSize;
+            prev.virtualSize += chunk.virtualSize;
+            prev.sigChecks += chunk.sigChecks;
+        }
+    }
+    cluster.dirty = false;
+
+    cachedClusterUsage += cluster.DynamicMemoryUsage();
+    return true;
+}
+
+const CTxMemPool::Clusters &CTxMemPool::GetClusters() const {
+    AssertLockHeld(cs);
+    // Clusters split off by UpdateCluster() have higher ids, so they come up
+    // later in this loop.
+    for (auto it = clusters.begin(); it != clusters.end();) {
+        if (it->second.dirty && !UpdateCluster(it->second)) {
+            it = clusters.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return clusters;
 }
 
 CTransactionRef CTxMemPool::addDoubleSpendProof(const DoubleSpendProof &proof, const std::optional<txiter> &optIter) {
@@ -12,6 +12,7 @@
 #include <core_memusage.h>
 #include <dsproof/dspid.h>
 #include <indirectmap.h>
+#include <prevector.h>
 #include <primitives/transaction.h>
 #include <random.h>
 #include <sync.h>
@@ -23,6 +24,7 @@
 #include <boost/multi_index_container.hpp>
 #include <boost/signals2/signal.hpp>
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <optional>
@@ -62,6 +64,7 @@ struct LockPoints {
 };
 
 class CTxMemPool;
+class CTxMemPoolCluster;
 
 /** \class CTxMemPoolEntry
  *
@@ -75,6 +78,16 @@ class CTxMemPool;
  */
 
 class CTxMemPoolEntry {
+public:
+    /**
+     * The in-mempool parents or children of an entry, sorted by entry id.
+     * Most entries have at most a couple of each, which then live inline in
+     * the entry rather than in separately allocated nodes.
+     */
+    static constexpr unsigned int INLINE_LINKS = 2;
+    using Links = prevector<INLINE_LINKS, const CTxMemPoolEntry *>;
+
+private:
     //! Unique identifier -- used for topological sorting
     uint64_t entryId = 0;
 
@@ -103,6 +116,20 @@ class CTxMemPoolEntry {
     //! class copy constructible.
     DspIdPtr dspIdPtr;
 
+    //! Links to the in-mempool parents and children, maintained by the
+    //! CTxMemPool holding this entry under its cs. They are not part of the
+    //! mapTx indices, so they may be changed through a const entry.
+    mutable Links parents;
+    mutable Links children;
+
+    //! The cluster of entries this one is linked with, or nullptr while it
+    //! has no in-mempool parents or children, and its position in
+    //! cluster->entries. Maintained by the CTxMemPool holding this entry.
+    mutable CTxMemPoolCluster *cluster = nullptr;
+    mutable size_t clusterPos = 0;
+
+    friend class CTxMemPool;
+
 public:
     CTxMemPoolEntry(const CTransactionRef &_tx, const Amount _nFee,
                     int64_t _nTime,
@@ -142,6 +169,57 @@ public:
         return dspIdPtr ? *dspIdPtr : staticNull;
     }
     void SetDspId(const DspId &dspId) { dspIdPtr = dspId; }
+
+    Links &GetMemPoolParents() const { return parents; }
+    Links &GetMemPoolChildren() const { return children; }
+    const CTxMemPoolCluster *GetCluster() const { return cluster; }
+};
+
+/**
+ * A set of mempool entries connected through their in-mempool parent and
+ * child links, linearized for mining.
+ *
+ * The linearization puts parents before their children, taking the ready
+ * entry of highest modified feerate first, and is cut into chunks of
+ * non-increasing feerate. A block takes a chunk whole or not at all, which
+ * lets a high-fee child pay for its low-fee parents.
+ *
+ * Membership is kept up to date as entries come and go, merging the smaller
+ * of two clusters into the larger one. The rest of the work, including
+ * splitting a cluster whose parts are no longer linked, only happens for
+ * clusters that changed, when CTxMemPool::GetClusters() is called.
+ */
+class CTxMemPoolCluster {
+public:
+    /** A run [begin, end) of the linearization. */
+    struct Chunk {
+        size_t begin;
+        size_t end;
+        Amount modifiedFee;
+        uint64_t txSize;
+        uint64_t virtualSize;
+        int64_t sigChecks;
+
+        //! Like CTxMemPoolEntry::GetModifiedFeeRate, over the whole chunk
+        CFeeRate GetFeeRate() const { return CFeeRate(modifiedFee, virtualSize); }
+    };
+
+    //! Key of this cluster in CTxMemPool::Clusters
+    const uint64_t id;
+    //! The entries, in no particular order.
+    std::vector<const CTxMemPoolEntry *> entries;
+    //! The entries in mining order, and its chunks. Only valid while !dirty.
+    std::vector<const CTxMemPoolEntry *> linearization;
+    std::vector<Chunk> chunks;
+    bool dirty = true;
+
+    explicit CTxMemPoolCluster(uint64_t _id) : id(_id) {}
+
+    size_t DynamicMemoryUsage() const {
+        return memusage::DynamicUsage(entries) +
+               memusage::DynamicUsage(linearization) +
+               memusage::DynamicUsage(chunks);
+    }
 };
 
 // --- Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -221,6 +299,32 @@ struct TxMempoolInfo {
     Amount nFeeDelta;
 };
 
+/**
+ * An immutable copy of the mempool contents at one point in time, which
+ * readers such as the RPC and REST interfaces can walk without holding
+ * CTxMemPool::cs.
+ */
+struct MempoolSnapshot {
+    struct Entry {
+        CTransactionRef tx;
+        Amount fee;
+        Amount modifiedFee;
+        size_t txSize;
+        int64_t sigChecks;
+        int64_t time;
+        /** The in-mempool parents and children of tx. */
+        std::vector<TxId> parents;
+        std::vector<TxId> children;
+    };
+
+    /** CTxMemPool::GetTransactionsUpdated() when the snapshot was taken. */
+    unsigned int nTransactionsUpdated;
+    size_t totalTxSize;
+    size_t dynamicMemoryUsage;
+    /** In the order the transactions entered the mempool. */
+    std::vector<Entry> entries;
+};
+
 /**
  * Reason why a transaction was removed from the mempool, this is passed to the
  * notification signal.
@@ -296,8 +400,9 @@ class CTxMemPool {
 private:
     //! Value n means that n times in 2^32 we check.
     uint32_t nCheckFrequency GUARDED_BY(cs);
-    //! Used by getblocktemplate to trigger CreateNewBlock() invocation
-    unsigned int nTransactionsUpdated;
+    //! Used by getblocktemplate to trigger CreateNewBlock() invocation, and
+    //! to tell whether m_snapshot is up to date. Only changed with cs held.
+    std::atomic<unsigned int> nTransactionsUpdated;
 
     //! sum of all mempool tx's sizes.
     size_t totalTxSize;
@@ -317,6 +422,21 @@ private:
     //! Used by addUnchecked to generate ever-increasing CTxMemPoolEntry::entryId's
     uint64_t nextEntryId GUARDED_BY(cs) = 1;
 
+    //! The last snapshot returned by GetSnapshot(). Only accessed with
+    //! std::atomic_load and std::atomic_store, and only stored with cs held.
+    mutable std::shared_ptr<const MempoolSnapshot> m_snapshot;
+
+public:
+    //! The clusters of linked entries, by ever-increasing id.
+    using Clusters = std::map<uint64_t, CTxMemPoolCluster>;
+
+private:
+    //! Brought up to date lazily by GetClusters(), hence mutable.
+    mutable Clusters clusters GUARDED_BY(cs);
+    mutable uint64_t nextClusterId GUARDED_BY(cs) = 0;
+    //! Sum of CTxMemPoolCluster::DynamicMemoryUsage() of all clusters
+    mutable size_t cachedClusterUsage GUARDED_BY(cs) = 0;
+
 public:
     // public only for testing
     static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12;
@@ -385,11 +505,59 @@ public:
     };
     using setEntries = std::set<txiter, CompareIteratorByEntryId>;
 
-    const setEntries &GetMemPoolParents(txiter entry) const
+    /** The parents or children of an entry as a range of txiter. */
+    class LinkedEntries {
+        const indexed_transaction_set &mapTx;
+        const CTxMemPoolEntry::Links &links;
+
+    public:
+        class const_iterator {
+            const indexed_transaction_set *mapTx;
+            CTxMemPoolEntry::Links::const_iterator it;
+
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = txiter;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const txiter *;
+            using reference = txiter;
+
+            const_iterator(const indexed_transaction_set &_mapTx,
+                           CTxMemPoolEntry::Links::const_iterator _it)
+                : mapTx(&_mapTx), it(_it) {}
+            txiter operator*() const { return mapTx->iterator_to(**it); }
+            const_iterator &operator++() {
+                ++it;
+                return *this;
+            }
+            bool operator==(const const_iterator &other) const {
+                return it == other.it;
+            }
+            bool operator!=(const const_iterator &other) const {
+                return it != other.it;
+            }
+        };
+
+        LinkedEntries(const indexed_transaction_set &_mapTx,
+                      const CTxMemPoolEntry::Links &_links)
+            : mapTx(_mapTx), links(_links) {}
+        const_iterator begin() const { return {mapTx, links.begin()}; }
+        const_iterator end() const { return {mapTx, links.end()}; }
+        size_t size() const { return links.size(); }
+        bool empty() const { return links.empty(); }
+    };
+
+    LinkedEntries GetMemPoolParents(txiter entry) const
         EXCLUSIVE_LOCKS_REQUIRED(cs);
-    const setEntries &GetMemPoolChildren(txiter entry) const
+    LinkedEntries GetMemPoolChildren(txiter entry) const
         EXCLUSIVE_LOCKS_REQUIRED(cs);
 
+    /**
+     * The clusters of entries with in-mempool parents or children, all
+     * linearized and chunked. Entries without any are not in a cluster.
+     */
+    const Clusters &GetClusters() const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
     /**
      * Add a double-spend proof to an existing mempool entry.
      * Returns the CTransactionRef of the mempool entry we added it to.
@@ -488,17 +656,25 @@ private:
     //! Helper function for getDoubleSpendProof_common and others
     DspDescendants getDspDescendantsForIter(txiter) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
-    struct TxLinks {
-        setEntries parents;
-        setEntries children;
-    };
-
-    using txlinksMap = std::map<txiter, TxLinks, CompareIteratorByEntryId>;
-    txlinksMap mapLinks;
-
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
+    /** Put a new entry into the cluster of its parents, merging theirs. */
+    void AddToCluster(txiter entry) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Take an entry about to be removed out of its cluster. */
+    void RemoveFromCluster(txiter entry) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    CTxMemPoolCluster &NewCluster() const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void EraseCluster(CTxMemPoolCluster &cluster) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Move an entry without a cluster into `cluster`. */
+    void MoveToCluster(const CTxMemPoolEntry &entry, CTxMemPoolCluster &cluster) const
+        EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /**
+     * Split off the parts of `cluster` no longer linked to each other, then
+     * linearize and chunk it. Returns false if a single entry is left, which
+     * the caller must then erase the cluster of.
+     */
+    bool UpdateCluster(CTxMemPoolCluster &cluster) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
 public:
     indirectmap<COutPoint, const CTransaction *> mapNextTx GUARDED_BY(cs);
     std::map<TxId, Amount> mapDeltas;
@@ -598,7 +774,7 @@ public:
      * Try to calculate all in-mempool ancestors of entry.
      *  (these are all calculated including the tx itself)
      * fSearchForParents = whether to search a tx's vin for in-mempool parents,
-     * or look up parents from mapLinks. Must be true for entries not in the
+     * or look up the parents linked from the entry. Must be true for entries not in the
      * mempool.
      */
     void CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors,
@@ -669,6 +845,15 @@ public:
     TxMempoolInfo info(const TxId &txid) const;
     std::vector<TxMempoolInfo> infoAll() const;
 
+    /**
+     * Return a snapshot of the mempool contents. Callers share the snapshot
+     * until the mempool changes and do not take cs for it; the first caller
+     * after a change takes cs to copy the entries into a new one.
+     */
+    std::shared_ptr<const MempoolSnapshot> GetSnapshot() const;
+    MempoolSnapshot::Entry GetSnapshotEntry(txiter it) const
+        EXCLUSIVE_LOCKS_REQUIRED(cs);
+
     CFeeRate estimateFee() const;
 
     size_t DynamicMemoryUsage() const;
@@ -679,15 +864,16 @@ public:
 
 private:
     /**
-     * Update parents of `it` to add/remove it as a child transaction (updates mapLinks).
+     * Update parents of `it` to add/remove it as a child transaction (updates their links).
      */
     void UpdateParentsOf(bool add, txiter it)
         EXCLUSIVE_LOCKS_REQUIRED(cs);
     /**
      * For each transaction being removed, sever links between parents
-     * and children in mapLinks
+     * and children
      */
-    void UpdateForRemoveFromMempool(const setEntries &entriesToRemove)
+    template <typename Entries>
+    void UpdateForRemoveFromMempool(const Entries &entriesToRemove)
         EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** Sever link between specified transaction and direct children. */
     void UpdateChildrenForRemoval(txiter entry) EXCLUSIVE_LOCKS_REQUIRED(cs);
@@ -699,10 +885,14 @@ private:
      * CTxMemPoolEntry's setMemPoolParents in order to walk ancestors of a given
      * transaction that is removed, so we can't remove intermediate transactions
      * in a chain before we've updated all the state for the removal.
+     * If dspIdsToOrphan is given, the id of any double-spend proof of the
+     * entry is appended to it for the caller to orphan, instead of orphaning
+     * the proof right away.
      */
     void
     removeUnchecked(txiter entry,
-                    MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN)
+                    MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN,
+                    std::vector<DspId> *dspIdsToOrphan = nullptr)
         EXCLUSIVE_LOCKS_REQUIRED(cs);
 
     std::unique_ptr<DoubleSpendProofStorage> m_dspStorage;
@@ -38,6 +38,7 @@
 #include <script/sigcache.h>
 #include <script/standard.h>
 #include <shutdown.h>
+#include <streams.h>
 #include <timedata.h>
 #include <tinyformat.h>
 #include <txdb.h>
@@ -57,11 +58,14 @@
 
 #include <algorithm>
 #include <atomic>
+#include <deque>
 #include <future>
+#include <iterator>
 #include <list>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_set>
 #include <utility>
 
 #define MICRO 0.000001
@@ -270,6 +274,8 @@ bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+size_t nCoinCacheRetainUsage = 0;
+size_t nMempoolParallelInputs = DEFAULT_MEMPOOL_PARALLEL_INPUTS;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 
@@ -504,6 +510,14 @@ static bool CheckInputsFromMempoolAndCache(
                        txdata, nSigChecksOut);
 }
 
+static bool CheckInputsParallel(const CTransaction &tx,
+                                CValidationState &state,
+                                const CCoinsViewCache &view,
+                                const uint32_t flags,
+                                const PrecomputedTransactionData &txdata,
+                                int &nSigChecksOut)
+    EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 static bool
 AcceptToMemoryPoolWorker(const Config &config, CTxMemPool &pool,
                          CValidationState &state, const CTransactionRef &ptx,
@@ -723,8 +737,17 @@ AcceptToMemoryPoolWorker(const Config &config, CTxMemPool &pool,
             nextBlockScriptVerifyFlags | STANDARD_SCRIPT_VERIFY_FLAGS;
         PrecomputedTransactionData txdata(tx);
         int nSigChecksStandard;
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false,
-                         txdata, nSigChecksStandard)) {
+        if (nMempoolParallelInputs > 0 &&
+            tx.vin.size() >= nMempoolParallelInputs) {
+            // Spread the inputs of large transactions over the script check
+            // threads, which are idle unless a block is being connected.
+            if (!CheckInputsParallel(tx, state, view, scriptVerifyFlags,
+                                     txdata, nSigChecksStandard)) {
+                // State filled in by CheckInputs.
+                return false;
+            }
+        } else if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true,
+                                false, txdata, nSigChecksStandard)) {
             // State filled in by CheckInputs.
             return false;
         }
@@ -1024,6 +1047,50 @@ bool ReadBlockFromDisk(CBlock &block, const CBlockIndex *pindex,
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<uint8_t> &block, const FlatFilePos &pos,
+                          const BlockHash &hash,
+                          const CMessageHeader::MessageMagic &diskMagic,
+                          uint64_t nMaxBlockSize) {
+    // The block is preceded by the disk magic and its size.
+    FlatFilePos hpos = pos;
+    if (hpos.nPos < diskMagic.size() + sizeof(uint32_t)) {
+        return error("%s: Invalid position %s", __func__, pos.ToString());
+    }
+    hpos.nPos -= diskMagic.size() + sizeof(uint32_t);
+
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        return error("%s: OpenBlockFile failed for %s", __func__,
+                     pos.ToString());
+    }
+
+    try {
+        CMessageHeader::MessageMagic blockMagic;
+        uint32_t nSize;
+        filein >> blockMagic >> nSize;
+        if (blockMagic != diskMagic) {
+            return error("%s: Block magic mismatch at %s", __func__,
+                         pos.ToString());
+        }
+        if (nSize < CBlockHeader::SIZE || nSize > nMaxBlockSize) {
+            return error("%s: Invalid block size %u at %s", __func__, nSize,
+                         pos.ToString());
+        }
+        block.resize(nSize);
+        filein.read(reinterpret_cast<char *>(block.data()), nSize);
+    } catch (const std::exception &e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(),
+                     pos.ToString());
+    }
+
+    if (BlockHash(Hash(block.data(), block.data() + CBlockHeader::SIZE)) !=
+        hash) {
+        return error("%s: Block hash mismatch at %s", __func__,
+                     pos.ToString());
+    }
+    return true;
+}
+
 Amount GetBlockSubsidy(int nHeight, const Consensus::Params &consensusParams) {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
     // Force block reward to zero when right shift is undefined.
@@ -1240,13 +1307,24 @@ void UpdateCoins(CCoinsViewCache &view, const CTransaction &tx, int nHeight) {
 }
 
 bool CScriptCheck::operator()() {
+    return Run(nullptr);
+}
+
+bool CScriptCheck::operator()(SchnorrSignatureBatch &batch) {
+    // Deferring the verification of a signature amounts to assuming that it
+    // is valid while the script runs. If it is not, the script would have
+    // failed anyway thanks to NULLFAIL, whatever the rest of it does.
+    return Run((nFlags & SCRIPT_VERIFY_NULLFAIL) ? &batch : nullptr);
+}
+
+bool CScriptCheck::Run(SchnorrSignatureBatch *batch) {
     assert(bool(context));
     assert(bool(context->tx().constantTx()));
 
     if ( ! VerifyScript(context->scriptSig(), context->coinScriptPubKey(), nFlags,
                         CachingTransactionSignatureChecker(context->tx().constantTx(),
                                                            context->inputIndex(), context->coinAmount(),
-                                                           cacheStore, txdata),
+                                                           cacheStore, txdata, batch),
                         metrics, context, &error)) {
         return false;
     }
@@ -1263,6 +1341,36 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CheckBatch(std::vector<CScriptCheck> &vChecks) {
+    SchnorrSignatureBatch batch;
+    // The deferred signatures of vChecks[i] are [sigsEnd[i - 1], sigsEnd[i]).
+    std::vector<size_t> sigsEnd;
+    sigsEnd.reserve(vChecks.size());
+    for (CScriptCheck &check : vChecks) {
+        if (!check(batch)) {
+            return false;
+        }
+        sigsEnd.push_back(batch.size());
+    }
+    if (batch.Verify()) {
+        return true;
+    }
+
+    // Some signature is invalid: find out which, so that the check it belongs
+    // to fails as it would have without batching.
+    size_t sigsBegin = 0;
+    for (size_t i = 0; i < vChecks.size(); ++i) {
+        if (!batch.VerifyIndividually(sigsBegin, sigsEnd[i])) {
+            vChecks[i].error = ScriptError::SIG_NULLFAIL;
+            return false;
+        }
+        sigsBegin = sigsEnd[i];
+    }
+    // Every signature is valid on its own, which means the batch should have
+    // verified. The individual verifications are authoritative.
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache &inputs) {
     LOCK(cs_main);
     CBlockIndex *pindexPrev = LookupBlockIndex(inputs.GetBestBlock());
@@ -1617,15 +1725,285 @@ static bool WriteUndoDataForBlock(const CBlockUndo &blockundo,
 }
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static std::atomic<bool> g_scriptcheck_threads_running{false};
 
 void StartScriptCheckWorkerThreads(int threads_num) {
     scriptcheckqueue.StartWorkerThreads(threads_num);
+    g_scriptcheck_threads_running = true;
 }
 
 void StopScriptCheckWorkerThreads() {
+    g_scriptcheck_threads_running = false;
     scriptcheckqueue.StopWorkerThreads();
 }
 
+/**
+ * Same as CheckInputs() storing signatures in the signature cache but not the
+ * script execution cache, except that the scripts are verified by the script
+ * check queue rather than one after the other on this thread. If any of them
+ * fails, they are all verified again serially, so that the failure is reported
+ * exactly as CheckInputs() reports it.
+ *
+ * The queue is shared with ConnectBlock(), which is serialized with this by
+ * cs_main.
+ */
+static bool CheckInputsParallel(const CTransaction &tx,
+                                CValidationState &state,
+                                const CCoinsViewCache &view,
+                                const uint32_t flags,
+                                const PrecomputedTransactionData &txdata,
+                                int &nSigChecksOut) {
+    AssertLockHeld(cs_main);
+
+    if (!g_scriptcheck_threads_running) {
+        return CheckInputs(tx, state, view, true, flags, true, false, txdata,
+                           nSigChecksOut);
+    }
+
+    // The checks report their sigchecks to the limiter only.
+    struct CountingSigCheckLimiter : TxSigCheckLimiter {
+        int64_t used() const {
+            return int64_t(MAX_TX_SIGCHECKS) - remaining.load();
+        }
+    };
+    CountingSigCheckLimiter txLimitSigChecks;
+    std::vector<CScriptCheck> vChecks;
+    int nSigChecks = 0;
+    if (!CheckInputs(tx, state, view, true, flags, true, false, txdata,
+                     nSigChecks, txLimitSigChecks, nullptr, &vChecks)) {
+        return false;
+    }
+    if (vChecks.empty()) {
+        // The script execution cache had the result.
+        nSigChecksOut = nSigChecks;
+        return true;
+    }
+
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    if (!control.Wait()) {
+        return CheckInputs(tx, state, view, true, flags, true, false, txdata,
+                           nSigChecksOut);
+    }
+    nSigChecksOut = txLimitSigChecks.used();
+    return true;
+}
+
+std::vector<MempoolBatchAcceptResult>
+AcceptToMemoryPoolBatch(const Config &config, CTxMemPool &pool,
+                        const std::vector<CTransactionRef> &txs,
+                        bool bypass_limits, const Amount nAbsurdFee,
+                        const std::vector<int64_t> &acceptTimes) {
+    AssertLockHeld(cs_main);
+    LOCK(pool.cs);
+
+    std::vector<MempoolBatchAcceptResult> results(txs.size());
+    std::vector<std::vector<COutPoint>> coins_to_uncache(txs.size());
+
+    if (g_scriptcheck_threads_running && txs.size() > 1) {
+        const uint32_t scriptVerifyFlags =
+            GetNextBlockScriptFlags(config.GetChainParams().GetConsensus(),
+                                    ::ChainActive().Tip()) |
+            STANDARD_SCRIPT_VERIFY_FLAGS;
+
+        CCoinsView dummy;
+        CCoinsViewCache view(&dummy);
+        CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
+        view.SetBackend(viewMemPool);
+
+        // The checks refer to these, which must not move.
+        std::deque<PrecomputedTransactionData> txdata;
+        std::deque<TxSigCheckLimiter> txLimitSigChecks;
+        std::vector<CScriptCheck> vChecks;
+        for (size_t i = 0; i < txs.size(); ++i) {
+            const CTransaction &tx = *txs[i];
+            CValidationState state;
+            std::string reason;
+            if (!CheckRegularTransaction(tx, state) ||
+                (fRequireStandard && !IsStandardTx(tx, reason))) {
+                continue;
+            }
+            for (const CTxIn &txin : tx.vin) {
+                if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                    coins_to_uncache[i].push_back(txin.prevout);
+                }
+            }
+            // Transactions spending outputs of the batch are verified when
+            // they are accepted, after their parents.
+            if (!view.HaveInputs(tx)) {
+                continue;
+            }
+            txdata.emplace_back(tx);
+            txLimitSigChecks.emplace_back();
+            std::vector<CScriptCheck> vTxChecks;
+            int nSigChecks;
+            if (CheckInputs(tx, state, view, true, scriptVerifyFlags, true,
+                            false, txdata.back(), nSigChecks,
+                            txLimitSigChecks.back(), nullptr, &vTxChecks)) {
+                std::move(vTxChecks.begin(), vTxChecks.end(),
+                          std::back_inserter(vChecks));
+            }
+        }
+
+        // The outcome does not matter: the signatures which were found valid
+        // are now cached, and the others are verified (and the failures
+        // reported) by AcceptToMemoryPoolWorker().
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    const int64_t nAcceptTime = GetTime();
+    for (size_t i = 0; i < txs.size(); ++i) {
+        MempoolBatchAcceptResult &result = results[i];
+        result.accepted = AcceptToMemoryPoolWorker(
+            config, pool, result.state, txs[i], &result.missingInputs,
+            acceptTimes.empty() ? nAcceptTime : acceptTimes[i], bypass_limits, nAbsurdFee, coins_to_uncache[i],
+            false /* test_accept */);
+        if (!result.accepted) {
+            for (const COutPoint &outpoint : coins_to_uncache[i]) {
+                pcoinsTip->Uncache(outpoint);
+            }
+        }
+    }
+
+    // After we've (potentially) uncached entries, ensure our coins cache is
+    // still within its size limits
+    CValidationState stateDummy;
+    FlushStateToDisk(config.GetChainParams(), stateDummy,
+                     FlushStateMode::PERIODIC);
+    return results;
+}
+
+namespace {
+/**
+ * A single lookup of a block input against the coins database, performed by
+ * the input fetch worker threads. The result is written to a slot owned by
+ * the caller; a spent (cleared) coin means the lookup did not find anything.
+ */
+class CCoinFetch {
+    const CCoinsView *db{nullptr};
+    const COutPoint *outpoint{nullptr};
+    Coin *coin{nullptr};
+
+public:
+    CCoinFetch() = default;
+    CCoinFetch(const CCoinsView &dbIn, const COutPoint &outpointIn,
+               Coin &coinIn)
+        : db(&dbIn), outpoint(&outpointIn), coin(&coinIn) {}
+
+    bool operator()() {
+        try {
+            if (!db->GetCoin(*outpoint, *coin)) {
+                coin->Clear();
+            }
+        } catch (const std::runtime_error &) {
+            // Leave the lookup to the regular (serial) code path, which
+            // handles database errors properly.
+            coin->Clear();
+        }
+        // A failed lookup is not a validation failure, keep going.
+        return true;
+    }
+
+    void swap(CCoinFetch &check) {
+        std::swap(db, check.db);
+        std::swap(outpoint, check.outpoint);
+        std::swap(coin, check.coin);
+    }
+};
+} // namespace
+
+static CCheckQueue<CCoinFetch> inputfetchqueue(16);
+static std::atomic<bool> g_inputfetch_threads_running{false};
+
+void StartInputFetchWorkerThreads(int threads_num) {
+    inputfetchqueue.StartWorkerThreads(threads_num, "inputfetch");
+    g_inputfetch_threads_running = true;
+}
+
+void StopInputFetchWorkerThreads() {
+    g_inputfetch_threads_running = false;
+    inputfetchqueue.StopWorkerThreads();
+}
+
+/**
+ * Warm up the coins cache with all the inputs spent by a block, so that
+ * ConnectBlock does not have to wait for the database one input at a time.
+ *
+ * This is a three stage pipeline:
+ * - the outpoints which are neither created by the block itself nor already
+ *   present in the cache are collected (serially, this is cheap);
+ * - they are looked up in the coins database in parallel on the input fetch
+ *   worker threads (the database supports concurrent reads);
+ * - the coins found are inserted in the cache (serially).
+ *
+ * Nothing is validated here: missing inputs and double spends are still
+ * detected by the ordered connection loop in ConnectBlock. The database must
+ * not be written to while this runs, which is guaranteed by cs_main.
+ */
+static void PrefetchBlockInputs(const CBlock &block, CCoinsViewCache &cache,
+                                const CCoinsView &db)
+    EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+    AssertLockHeld(cs_main);
+    if (!g_inputfetch_threads_running || block.vtx.size() <= 1) {
+        return;
+    }
+
+    int64_t nTimeStart = GetTimeMicros();
+
+    std::unordered_set<TxId, SaltedTxIdHasher> blockTxIds;
+    blockTxIds.reserve(block.vtx.size());
+    for (const auto &ptx : block.vtx) {
+        blockTxIds.insert(ptx->GetId());
+    }
+
+    std::vector<const COutPoint *> outpoints;
+    for (const auto &ptx : block.vtx) {
+        if (ptx->IsCoinBase()) {
+            continue;
+        }
+        for (const CTxIn &txin : ptx->vin) {
+            if (blockTxIds.count(txin.prevout.GetTxId()) ||
+                cache.HaveCoinInCache(txin.prevout)) {
+                continue;
+            }
+            outpoints.push_back(&txin.prevout);
+        }
+    }
+
+    if (outpoints.empty()) {
+        return;
+    }
+
+    std::vector<Coin> coins(outpoints.size());
+    {
+        std::vector<CCoinFetch> vChecks;
+        vChecks.reserve(outpoints.size());
+        for (size_t i = 0; i < outpoints.size(); ++i) {
+            vChecks.emplace_back(db, *outpoints[i], coins[i]);
+        }
+
+        CCheckQueueControl<CCoinFetch> control(&inputfetchqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    size_t nFound = 0;
+    for (size_t i = 0; i < outpoints.size(); ++i) {
+        if (coins[i].IsSpent()) {
+            continue;
+        }
+        cache.EmplaceFetchedCoin(*outpoints[i], std::move(coins[i]));
+        ++nFound;
+    }
+
+    LogPrint(BCLog::BENCH,
+             "    - Prefetch %u/%u inputs: %.2fms\n", (unsigned)nFound,
+             (unsigned)outpoints.size(),
+             MILLI * (GetTimeMicros() - nTimeStart));
+}
+
 int32_t ComputeBlockVersion(const CBlockIndex *pindexPrev,
                             const Consensus::Params &params) {
     return VERSIONBITS_TOP_BITS;
@@ -2090,6 +2468,11 @@ static bool FlushStateToDisk(const CChainParams &chainparams,
             bool fFlushForPrune = false;
             bool fDoFullFlush = false;
             LOCK(cs_LastBlockFile);
+            // A background write of the coins may have failed since we were
+            // last called.
+            if (pcoinsdbview->WriteFailed()) {
+                return AbortNode(state, "Failed to write to coin database");
+            }
             if (fPruneMode && (fCheckForPruning || nManualPruneHeight > 0) &&
                 !fReindex) {
                 if (nManualPruneHeight > 0) {
@@ -2117,7 +2500,7 @@ static bool FlushStateToDisk(const CChainParams &chainparams,
             }
             const Config &config = GetConfig();
             int64_t nMempoolSizeMax = config.GetMaxMemPoolSize();
-            int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+            int64_t cacheSize = pcoinsTip->InUseMemoryUsage();
             int64_t nTotalSpace =
                 nCoinCacheUsage +
                 std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
@@ -2180,8 +2563,14 @@ static bool FlushStateToDisk(const CChainParams &chainparams,
                     }
                 }
 
-                // Finally remove any pruned files
+                // Finally remove any pruned files. The coins database must
+                // not be behind them, so wait for any write still in progress
+                // in the background.
                 if (fFlushForPrune) {
+                    if (!pcoinsdbview->Sync()) {
+                        return AbortNode(state,
+                                         "Failed to write to coin database");
+                    }
                     UnlinkPrunedFiles(setFilesToPrune);
                 }
                 nLastWrite = nNow;
@@ -2202,8 +2591,33 @@ static bool FlushStateToDisk(const CChainParams &chainparams,
                 }
 
                 // Flush the chainstate (which may refer to block index
-                // entries).
-                if (!pcoinsTip->Flush()) {
+                // entries). Unless everything has to go, keep the most
+                // recently created coins in the cache, so that the hit rate
+                // does not collapse after the flush.
+                const uint64_t nCacheHits = pcoinsTip->GetCacheHits();
+                const uint64_t nCacheLookups =
+                    nCacheHits + pcoinsTip->GetCacheMisses();
+                const bool fFlushed =
+                    (mode == FlushStateMode::ALWAYS || fFlushForPrune ||
+                     nCoinCacheRetainUsage == 0)
+                        ? pcoinsTip->Flush()
+                        : pcoinsTip->FlushAndTrim(nCoinCacheRetainUsage);
+                if (!fFlushed) {
+                    return AbortNode(state, "Failed to write to coin database");
+                }
+                LogPrint(BCLog::COINDB,
+                         "Flushed coins cache, hit rate since last flush "
+                         "%.2f%% (%u lookups), kept %u coins (%.1fMiB)\n",
+                         nCacheLookups ? 100.0 * nCacheHits / nCacheLookups
+                                       : 0.0,
+                         nCacheLookups, pcoinsTip->GetCacheSize(),
+                         pcoinsTip->InUseMemoryUsage() * (1.0 / (1 << 20)));
+                pcoinsTip->ResetHitStats();
+                // With -dbbackgroundflush, the coins may still be being
+                // written. That is fine, since the blocks they depend on are
+                // already on disk, unless the caller wants everything on disk
+                // now.
+                if (mode == FlushStateMode::ALWAYS && !pcoinsdbview->Sync()) {
                     return AbortNode(state, "Failed to write to coin database");
                 }
                 nLastFlush = nNow;
@@ -2549,6 +2963,8 @@ bool CChainState::ConnectTip(const Config &config, CValidationState &state,
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n",
              (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
     {
+        PrefetchBlockInputs(blockConnecting, *pcoinsTip, *pcoinsdbview);
+
         CCoinsViewCache view(pcoinsTip.get());
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, params,
                                BlockValidationOptions(config));
@@ -5709,11 +6125,200 @@ CBlockFileInfo *GetBlockFileInfo(size_t n) {
     return &vinfoBlockFile.at(n);
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+//! mempool.dat as one run of transactions, as written by older versions
+static const uint64_t MEMPOOL_DUMP_VERSION_UNCHUNKED = 1;
+//! mempool.dat as checksummed chunks of transactions, in mempool order
+static const uint64_t MEMPOOL_DUMP_VERSION = 2;
+//! Roughly how many bytes of transactions go in a chunk of mempool.dat
+static const size_t MEMPOOL_DUMP_CHUNK_SIZE = 1'000'000;
 
-bool LoadMempool(const Config &config, CTxMemPool &pool) {
-    int64_t nExpiryTimeout =
+/**
+ * Version 2 of mempool.dat is a sequence of chunks (see WriteMempoolChunk).
+ * The payloads are transactions (MempoolDumpEntry) in mempool order, so that
+ * parents always come first, then an empty payload, then a last one with the
+ * fee deltas of the transactions which are not in the mempool.
+ */
+void WriteMempoolChunk(CAutoFile &file, const std::vector<uint8_t> &payload) {
+    file << payload;
+    file << Hash(payload.begin(), payload.end());
+}
+
+std::vector<uint8_t> ReadMempoolChunk(CAutoFile &file) {
+    std::vector<uint8_t> payload;
+    uint256 checksum;
+    file >> payload;
+    file >> checksum;
+    if (Hash(payload.begin(), payload.end()) != checksum) {
+        throw std::ios_base::failure("mempool chunk checksum mismatch");
+    }
+    return payload;
+}
+
+bool LoadMempoolEntries(const Config &config, CTxMemPool &pool,
+                        const std::vector<MempoolDumpEntry> &entries,
+                        MempoolLoadStats &stats) {
+    const int64_t nExpiryTimeout =
+        gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    const int64_t nNow = GetTime();
+
+    std::vector<CTransactionRef> txs;
+    std::vector<int64_t> acceptTimes;
+    txs.reserve(entries.size());
+    acceptTimes.reserve(entries.size());
+    for (const MempoolDumpEntry &entry : entries) {
+        const TxId &txid = entry.tx->GetId();
+        if (entry.nFeeDelta != Amount::zero()) {
+            pool.PrioritiseTransaction(txid, entry.nFeeDelta);
+        }
+        if (entry.nTime + nExpiryTimeout <= nNow) {
+            ++stats.expired;
+            continue;
+        }
+        // The recorded fee tells which transactions would not make it into
+        // the mempool anymore, sparing the lookup of their inputs.
+        Amount nModifiedFee = entry.nFee;
+        pool.ApplyDelta(txid, nModifiedFee);
+        const Amount mempoolRejectFee =
+            pool.GetMinFee(config.GetMaxMemPoolSize())
+                .GetFee(GetVirtualTransactionSize(entry.nSize,
+                                                  entry.nSigChecks));
+        if (nModifiedFee < ::minRelayTxFee.GetFee(entry.nSize) ||
+            (mempoolRejectFee > Amount::zero() &&
+             nModifiedFee < mempoolRejectFee)) {
+            ++stats.failed;
+            continue;
+        }
+        txs.push_back(entry.tx);
+        acceptTimes.push_back(entry.nTime);
+    }
+
+    std::vector<MempoolBatchAcceptResult> results;
+    {
+        LOCK(cs_main);
+        results = AcceptToMemoryPoolBatch(config, pool, txs,
+                                          false /* bypass_limits */,
+                                          Amount::zero() /* nAbsurdFee */,
+                                          acceptTimes);
+    }
+    for (size_t i = 0; i < txs.size(); ++i) {
+        if (results[i].accepted) {
+            ++stats.count;
+        } else if (pool.exists(txs[i]->GetId())) {
+            // mempool may contain the transaction already, e.g. from
+            // wallet(s) having loaded it while we were processing mempool
+            // transactions; consider these as valid, instead of failed, but
+            // mark them as 'already there'
+            ++stats.already_there;
+        } else {
+            ++stats.failed;
+        }
+    }
+
+    return !ShutdownRequested();
+}
+
+namespace {
+std::vector<MempoolDumpEntry> ReadMempoolEntries(CAutoFile &file) {
+    const std::vector<uint8_t> payload = ReadMempoolChunk(file);
+    VectorReader reader(SER_DISK, CLIENT_VERSION, payload, 0);
+    std::vector<MempoolDumpEntry> entries;
+    while (!reader.empty()) {
+        reader >> entries.emplace_back();
+    }
+    return entries;
+}
+
+/** Read version 1 of mempool.dat, accepting the transactions one by one. */
+bool LoadMempoolUnchunked(const Config &config, CTxMemPool &pool,
+                          CAutoFile &file, MempoolLoadStats &stats) {
+    const int64_t nExpiryTimeout =
         gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    const int64_t nNow = GetTime();
+
+    uint64_t num;
+    file >> num;
+    while (num--) {
+        CTransactionRef tx;
+        int64_t nTime;
+        int64_t nFeeDelta;
+        file >> tx;
+        file >> nTime;
+        file >> nFeeDelta;
+
+        Amount amountdelta = nFeeDelta * SATOSHI;
+        if (amountdelta != Amount::zero()) {
+            pool.PrioritiseTransaction(tx->GetId(), amountdelta);
+        }
+        CValidationState state;
+        if (nTime + nExpiryTimeout > nNow) {
+            LOCK(cs_main);
+            AcceptToMemoryPoolWithTime(
+                config, pool, state, tx, nullptr /* pfMissingInputs */,
+                nTime, false /* bypass_limits */,
+                Amount::zero() /* nAbsurdFee */, false /* test_accept */);
+            if (state.IsValid()) {
+                ++stats.count;
+            } else {
+                // mempool may contain the transaction already, e.g. from
+                // wallet(s) having loaded it while we were processing
+                // mempool transactions; consider these as valid, instead of
+                // failed, but mark them as 'already there'
+                if (pool.exists(tx->GetId())) {
+                    ++stats.already_there;
+                } else {
+                    ++stats.failed;
+                }
+            }
+        } else {
+            ++stats.expired;
+        }
+
+        if (ShutdownRequested()) {
+            return false;
+        }
+    }
+    std::map<TxId, Amount> mapDeltas;
+    file >> mapDeltas;
+
+    for (const auto &i : mapDeltas) {
+        pool.PrioritiseTransaction(i.first, i.second);
+    }
+    return true;
+}
+
+/**
+ * Read version 2 of mempool.dat. The next chunk is read and checked while
+ * the transactions of the current one are being accepted.
+ */
+bool LoadMempoolChunked(const Config &config, CTxMemPool &pool,
+                        CAutoFile &file, MempoolLoadStats &stats) {
+    auto ReadEntries = [&file] { return ReadMempoolEntries(file); };
+    std::future<std::vector<MempoolDumpEntry>> next =
+        std::async(std::launch::async, ReadEntries);
+    while (true) {
+        const std::vector<MempoolDumpEntry> entries = next.get();
+        if (entries.empty()) {
+            break;
+        }
+        next = std::async(std::launch::async, ReadEntries);
+
+        if (!LoadMempoolEntries(config, pool, entries, stats)) {
+            return false;
+        }
+    }
+
+    std::map<TxId, Amount> mapDeltas;
+    const std::vector<uint8_t> payload = ReadMempoolChunk(file);
+    VectorReader(SER_DISK, CLIENT_VERSION, payload, 0) >> mapDeltas;
+
+    for (const auto &i : mapDeltas) {
+        pool.PrioritiseTransaction(i.first, i.second);
+    }
+    return true;
+}
+} // namespace
+
+bool LoadMempool(const Config &config, CTxMemPool &pool) {
     FILE *filestr = fsbridge::fopen(GetDataDir() / "mempool.dat", "rb");
     CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
     if (file.IsNull()) {
@@ -5722,66 +6327,21 @@ bool LoadMempool(const Config &config, CTxMemPool &pool) {
         return false;
     }
 
-    int64_t count = 0;
-    int64_t expired = 0;
-    int64_t failed = 0;
-    int64_t already_there = 0;
-    int64_t nNow = GetTime();
+    MempoolLoadStats stats;
 
     try {
         uint64_t version;
         file >> version;
-        if (version != MEMPOOL_DUMP_VERSION) {
-            return false;
-        }
-
-        uint64_t num;
-        file >> num;
-        while (num--) {
-            CTransactionRef tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            Amount amountdelta = nFeeDelta * SATOSHI;
-            if (amountdelta != Amount::zero()) {
-                pool.PrioritiseTransaction(tx->GetId(), amountdelta);
-            }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
-                LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(
-                    config, pool, state, tx, nullptr /* pfMissingInputs */,
-                    nTime, false /* bypass_limits */,
-                    Amount::zero() /* nAbsurdFee */, false /* test_accept */);
-                if (state.IsValid()) {
-                    ++count;
-                } else {
-                    // mempool may contain the transaction already, e.g. from
-                    // wallet(s) having loaded it while we were processing
-                    // mempool transactions; consider these as valid, instead of
-                    // failed, but mark them as 'already there'
-                    if (pool.exists(tx->GetId())) {
-                        ++already_there;
-                    } else {
-                        ++failed;
-                    }
-                }
-            } else {
-                ++expired;
+        if (version == MEMPOOL_DUMP_VERSION_UNCHUNKED) {
+            if (!LoadMempoolUnchunked(config, pool, file, stats)) {
+                return false;
             }
-
-            if (ShutdownRequested()) {
+        } else if (version == MEMPOOL_DUMP_VERSION) {
+            if (!LoadMempoolChunked(config, pool, file, stats)) {
                 return false;
             }
-        }
-        std::map<TxId, Amount> mapDeltas;
-        file >> mapDeltas;
-
-        for (const auto &i : mapDeltas) {
-            pool.PrioritiseTransaction(i.first, i.second);
+        } else {
+            return false;
         }
     } catch (const std::exception &e) {
         LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing "
@@ -5792,7 +6352,7 @@ bool LoadMempool(const Config &config, CTxMemPool &pool) {
 
     LogPrintf("Imported mempool transactions from disk: %i succeeded, %i "
               "failed, %i expired, %i already there\n",
-              count, failed, expired, already_there);
+              stats.count, stats.failed, stats.expired, stats.already_there);
     return true;
 }
 
@@ -5800,7 +6360,7 @@ bool DumpMempool(const CTxMemPool &pool) {
     int64_t start = GetTimeMicros();
 
     std::map<uint256, Amount> mapDeltas;
-    std::vector<TxMempoolInfo> vinfo;
+    std::shared_ptr<const MempoolSnapshot> snapshot;
 
     static Mutex dump_mutex;
     LOCK(dump_mutex);
@@ -5811,7 +6371,7 @@ bool DumpMempool(const CTxMemPool &pool) {
             mapDeltas[i.first] = i.second;
         }
 
-        vinfo = pool.infoAll();
+        snapshot = pool.GetSnapshot();
     }
 
     int64_t mid = GetTimeMicros();
@@ -5827,15 +6387,32 @@ bool DumpMempool(const CTxMemPool &pool) {
         uint64_t version = MEMPOOL_DUMP_VERSION;
         file << version;
 
-        file << uint64_t(vinfo.size());
-        for (const auto &i : vinfo) {
-            file << *(i.tx);
-            file << int64_t(i.nTime);
-            file << i.nFeeDelta;
-            mapDeltas.erase(i.tx->GetId());
+        std::vector<uint8_t> payload;
+        for (const MempoolSnapshot::Entry &entry : snapshot->entries) {
+            const MempoolDumpEntry dumpEntry{entry.tx,
+                                             entry.time,
+                                             entry.modifiedFee - entry.fee,
+                                             entry.fee,
+                                             uint32_t(entry.txSize),
+                                             entry.sigChecks};
+            CVectorWriter(SER_DISK, CLIENT_VERSION, payload, payload.size(),
+                          dumpEntry);
+            mapDeltas.erase(entry.tx->GetId());
+            if (payload.size() >= MEMPOOL_DUMP_CHUNK_SIZE) {
+                WriteMempoolChunk(file, payload);
+                payload.clear();
+            }
+        }
+        if (!payload.empty()) {
+            WriteMempoolChunk(file, payload);
+            payload.clear();
         }
+        // The end of the transactions.
+        WriteMempoolChunk(file, payload);
+
+        CVectorWriter(SER_DISK, CLIENT_VERSION, payload, 0, mapDeltas);
+        WriteMempoolChunk(file, payload);
 
-        file << mapDeltas;
         if (!FileCommit(file.Get())) {
             throw std::runtime_error("FileCommit failed");
         }
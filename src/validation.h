@@ -16,6 +16,7 @@
 #include <chain.h>
 #include <coins.h>
 #include <consensus/consensus.h>
+#include <consensus/validation.h>
 #include <flatfile.h>
 #include <fs.h>
 #include <protocol.h> // For CMessageHeader::MessageMagic
@@ -38,6 +39,7 @@
 
 class arith_uint256;
 
+class CAutoFile;
 class CBlockIndex;
 class CBlockTreeDB;
 class CBlockUndo;
@@ -48,6 +50,7 @@ class CConnman;
 class CInv;
 class Config;
 class CScriptCheck;
+class SchnorrSignatureBatch;
 class CTxMemPool;
 class CTxUndo;
 class CValidationState;
@@ -98,9 +101,22 @@ static constexpr unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 static constexpr unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
 /** Maximum number of dedicated script-checking threads allowed */
-static constexpr int MAX_SCRIPTCHECK_THREADS = 15;
+static constexpr int MAX_SCRIPTCHECK_THREADS = 256;
 /** -par default (number of script-checking threads, 0 = auto) */
 static constexpr int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of dedicated block input fetching threads allowed */
+static constexpr int MAX_INPUTFETCH_THREADS = 64;
+/**
+ * -parinputfetch default (number of threads reading block inputs from the
+ * coins database ahead of ConnectBlock, 0 = disabled)
+ */
+static constexpr int DEFAULT_INPUTFETCH_THREADS = 4;
+/**
+ * -parmempoolinputs default (transactions with at least that many inputs have
+ * their scripts verified by the script-checking threads when they are accepted
+ * to the mempool, 0 = never)
+ */
+static constexpr int DEFAULT_MEMPOOL_PARALLEL_INPUTS = 16;
 /**
  * Number of blocks that can be requested at any given time from a single peer.
  */
@@ -212,6 +228,13 @@ extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+/** Size of the coins kept in the UTXO cache when it is flushed. */
+extern size_t nCoinCacheRetainUsage;
+/**
+ * Minimum number of inputs for the scripts of a transaction to be verified by
+ * the script-checking threads when it is accepted to the mempool (0 = never).
+ */
+extern size_t nMempoolParallelInputs;
 
 /**
  * A fee rate smaller than this is considered zero fee (for relaying, mining and
@@ -399,6 +422,10 @@ void UnloadBlockIndex();
 void StartScriptCheckWorkerThreads(int threads_num);
 /** Stop all of the script checking worker threads */
 void StopScriptCheckWorkerThreads();
+/** Run instances of block input fetching worker threads */
+void StartInputFetchWorkerThreads(int threads_num);
+/** Stop all of the block input fetching worker threads */
+void StopInputFetchWorkerThreads();
 
 /**
  * Check whether we are doing an initial block download (synchronizing from disk
@@ -475,6 +502,33 @@ AcceptToMemoryPoolWithTime(const Config &config, CTxMemPool &pool,
                            bool test_accept = false)
     EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+/** The outcome of AcceptToMemoryPoolBatch() for one transaction. */
+struct MempoolBatchAcceptResult {
+    //! Whether the transaction was added to the mempool
+    bool accepted{false};
+    //! Set when some inputs are unknown, as pfMissingInputs is
+    bool missingInputs{false};
+    CValidationState state;
+};
+
+/**
+ * (try to) add a batch of transactions to memory pool, in order, with a single
+ * acquisition of the mempool lock. The result is the same as calling
+ * AcceptToMemoryPool() on each transaction in turn, so a transaction may spend
+ * the outputs of one before it in the batch. Before that, the inputs of all
+ * the transactions are looked up in one pass, and the scripts of those that
+ * can be verified up front are, all together, by the script check threads, so
+ * that their signatures are found in the signature cache by the per
+ * transaction checks. If acceptTimes is not empty, it holds the time at which
+ * each transaction entered the mempool, rather than the current time.
+ */
+std::vector<MempoolBatchAcceptResult>
+AcceptToMemoryPoolBatch(const Config &config, CTxMemPool &pool,
+                        const std::vector<CTransactionRef> &txs,
+                        bool bypass_limits, const Amount nAbsurdFee,
+                        const std::vector<int64_t> &acceptTimes = {})
+    EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -639,6 +693,13 @@ public:
 
     bool operator()();
 
+    /**
+     * Like operator(), but Schnorr signatures which are not in the signature
+     * cache are added to batch instead of being verified, if the flags allow
+     * it. The check is then only successful if the batch verifies as well.
+     */
+    bool operator()(SchnorrSignatureBatch &batch);
+
     void swap(CScriptCheck &check) {
         context.swap(check.context);
         std::swap(nFlags, check.nFlags);
@@ -653,13 +714,33 @@ public:
     ScriptError GetScriptError() const { return error; }
 
     ScriptExecutionMetrics GetScriptExecutionMetrics() const { return metrics; }
+
+private:
+    bool Run(SchnorrSignatureBatch *batch);
+
+    friend bool CheckBatch(std::vector<CScriptCheck> &vChecks);
 };
 
+/**
+ * Run a batch of script checks for the script check queue (see checkqueue.h),
+ * verifying the Schnorr signatures of all of them at once.
+ */
+bool CheckBatch(std::vector<CScriptCheck> &vChecks);
+
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock &block, const FlatFilePos &pos,
                        const Consensus::Params &params);
 bool ReadBlockFromDisk(CBlock &block, const CBlockIndex *pindex,
                        const Consensus::Params &params);
+/**
+ * Read the block with the given hash at pos as it is serialized on disk, which
+ * is also how it is sent to peers, without deserializing it. Only the size
+ * recorded before it and its header are checked.
+ */
+bool ReadRawBlockFromDisk(std::vector<uint8_t> &block, const FlatFilePos &pos,
+                          const BlockHash &hash,
+                          const CMessageHeader::MessageMagic &diskMagic,
+                          uint64_t nMaxBlockSize);
 
 bool UndoReadFromDisk(CBlockUndo &blockundo, const CBlockIndex *pindex);
 
@@ -807,6 +888,60 @@ static const unsigned int REJECT_AGAINST_FINALIZED = 0x103;
 /** Get block file info entry for one block file */
 CBlockFileInfo *GetBlockFileInfo(size_t n);
 
+/**
+ * A mempool transaction as written to disk, along with what it took to get it
+ * into the mempool.
+ */
+struct MempoolDumpEntry {
+    CTransactionRef tx;
+    int64_t nTime;
+    Amount nFeeDelta;
+    Amount nFee;
+    uint32_t nSize;
+    int64_t nSigChecks;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(tx);
+        READWRITE(nTime);
+        READWRITE(nFeeDelta);
+        READWRITE(nFee);
+        READWRITE(nSize);
+        READWRITE(nSigChecks);
+    }
+};
+
+/** What became of the transactions read back from disk. */
+struct MempoolLoadStats {
+    int64_t count = 0;
+    int64_t expired = 0;
+    int64_t failed = 0;
+    int64_t already_there = 0;
+};
+
+/**
+ * Write a chunk of a mempool file: a length-prefixed payload followed by its
+ * double SHA256.
+ */
+void WriteMempoolChunk(CAutoFile &file, const std::vector<uint8_t> &payload);
+
+/**
+ * Read back a chunk written by WriteMempoolChunk(). Throws if the file ends
+ * or the payload does not match its checksum.
+ */
+std::vector<uint8_t> ReadMempoolChunk(CAutoFile &file);
+
+/**
+ * Add transactions read back from disk, parents first, to the mempool as a
+ * batch. Their fee deltas are restored whether they make it or not. Returns
+ * false if shutdown was requested.
+ */
+bool LoadMempoolEntries(const Config &config, CTxMemPool &pool,
+                        const std::vector<MempoolDumpEntry> &entries,
+                        MempoolLoadStats &stats);
+
 /** Dump the mempool to disk. */
 bool DumpMempool(const CTxMemPool &pool);
 
@@ -24,3 +24,7 @@ bool CZMQAbstractNotifier::NotifyTransaction(
 bool CZMQAbstractNotifier::NotifyDoubleSpend(const CTransaction & /*transaction*/) {
     return true;
 }
+
+bool CZMQAbstractNotifier::NotifyBlockTemplateLight(const std::string & /*json*/) {
+    return true;
+}
@@ -36,6 +36,7 @@ public:
     virtual bool NotifyBlock(const CBlockIndex *pindex);
     virtual bool NotifyTransaction(const CTransaction &transaction);
     virtual bool NotifyDoubleSpend(const CTransaction &transaction);
+    virtual bool NotifyBlockTemplateLight(const std::string &json);
 
 protected:
     void *psocket;
@@ -44,6 +44,8 @@ CZMQNotificationInterface *CZMQNotificationInterface::Create() {
         CZMQAbstractNotifier::Create<CZMQPublishHashDoubleSpendNotifier>;
     factories["pubrawds"] =
         CZMQAbstractNotifier::Create<CZMQPublishRawDoubleSpendNotifier>;
+    factories["pubgbtlight"] =
+        CZMQAbstractNotifier::Create<CZMQPublishBlockTemplateLightNotifier>;
 
     std::list<std::unique_ptr<CZMQAbstractNotifier>> notifiers;
     for (const auto &entry : factories) {
@@ -183,5 +185,10 @@ void CZMQNotificationInterface::TransactionDoubleSpent(const CTransactionRef &pt
     });
 }
 
+void CZMQNotificationInterface::NotifyBlockTemplateLight(const std::string &json) {
+    TryForEachAndRemoveFailed(notifiers, [&json](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyBlockTemplateLight(json);
+    });
+}
 
 CZMQNotificationInterface *g_zmq_notification_interface = nullptr;
@@ -11,6 +11,7 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <string>
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
@@ -23,6 +24,9 @@ public:
 
     static CZMQNotificationInterface *Create();
 
+    /** Publish a getblocktemplatelight result to the gbtlight subscribers. */
+    void NotifyBlockTemplateLight(const std::string &json);
+
 protected:
     bool Initialize();
     void Shutdown();
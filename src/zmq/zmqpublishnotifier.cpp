@@ -33,6 +33,7 @@ inline constexpr auto MSG_RAWBLOCK = "rawblock";
 inline constexpr auto MSG_RAWTX = "rawtx";
 inline constexpr auto MSG_HASHDS = "hashds";
 inline constexpr auto MSG_RAWDS = "rawds";
+inline constexpr auto MSG_GBTLIGHT = "gbtlight";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void *data, size_t size, ...) {
@@ -221,3 +222,8 @@ bool CZMQPublishRawDoubleSpendNotifier::NotifyDoubleSpend(const CTransaction &tr
     ss << transaction;
     return SendZmqMessage(MSG_RAWDS, &*ss.begin(), ss.size());
 }
+
+bool CZMQPublishBlockTemplateLightNotifier::NotifyBlockTemplateLight(const std::string &json) {
+    LogPrint(BCLog::ZMQ, "zmq: Publish gbtlight\n");
+    return SendZmqMessage(MSG_GBTLIGHT, json.data(), json.size());
+}
@@ -59,4 +59,9 @@ public:
     bool NotifyDoubleSpend(const CTransaction &transaction) override;
 };
 
+class CZMQPublishBlockTemplateLightNotifier : public CZMQAbstractPublishNotifier {
+public:
+    bool NotifyBlockTemplateLight(const std::string &json) override;
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
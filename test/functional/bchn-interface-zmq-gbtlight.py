@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 The Bitcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""
+Tests that getblocktemplatelight templates are published to -zmqpubgbtlight
+subscribers on a new tip and as mempool changes raise their fees.
+"""
+
+import json
+import struct
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal
+
+ADDRESS = "tcp://127.0.0.1:28333"
+
+
+class GBTLightZMQTest(BitcoinTestFramework):
+    def set_test_params(self):
+        # We need connected nodes for getblocktemplatelight to function (bitcoind node policy)
+        self.num_nodes = 2
+
+    def skip_test_if_missing_module(self):
+        self.skip_if_no_py3_zmq()
+        self.skip_if_no_bitcoind_zmq()
+        self.skip_if_no_wallet()
+
+    def setup_nodes(self):
+        import zmq
+
+        self.zmq_context = zmq.Context()
+        self.socket = self.zmq_context.socket(zmq.SUB)
+        self.socket.set(zmq.RCVTIMEO, 60000)
+        self.socket.setsockopt(zmq.SUBSCRIBE, b"gbtlight")
+        self.socket.connect(ADDRESS)
+        self.sequence = None
+
+        self.extra_args = [
+            ["-zmqpubgbtlight={}".format(ADDRESS), "-gbtpushfeethreshold=0.00000001"],
+            [],
+        ]
+        self.add_nodes(self.num_nodes, self.extra_args)
+        self.start_nodes()
+
+    def receive(self):
+        topic, body, seq = self.socket.recv_multipart()
+        assert_equal(topic, b"gbtlight")
+        seq = struct.unpack('<I', seq)[-1]
+        if self.sequence is not None:
+            # Sequence should be incremental.
+            assert_equal(seq, self.sequence + 1)
+        self.sequence = seq
+        return json.loads(body.decode())
+
+    def receive_for_tip(self, tip):
+        # Templates pushed for earlier tips may still be queued.
+        while True:
+            gbtl = self.receive()
+            if gbtl["previousblockhash"] == tip:
+                return gbtl
+
+    def run_test(self):
+        try:
+            self._zmq_test()
+        finally:
+            self.zmq_context.destroy(linger=None)
+
+    def _zmq_test(self):
+        node = self.nodes[0]
+
+        self.log.info("A template is published on a new tip")
+        tip = node.generate(1)[0]
+        self.sync_all()
+        gbtl = self.receive_for_tip(tip)
+        subsidy = gbtl["coinbasevalue"]
+        assert_equal(gbtl["merkle"], [])
+        # It is the template getblocktemplatelight returns, and its job is stored for submitblocklight.
+        assert_equal(gbtl["job_id"], node.getblocktemplatelight()["job_id"])
+
+        self.log.info("A template is published as mempool changes raise its fees")
+        txid = self.nodes[1].sendtoaddress(node.getnewaddress(), 1.0)
+        self.sync_all()
+        gbtl = self.receive()
+        assert_equal(gbtl["previousblockhash"], tip)
+        assert_equal(gbtl["merkle"], [txid])
+        # The coinbase value now includes the fee.
+        assert gbtl["coinbasevalue"] > subsidy
+
+
+if __name__ == '__main__':
+    GBTLightZMQTest().main()